@@ -0,0 +1,67 @@
+/*
+ * Compilation cache
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <acc/hash.h>
+
+/*
+ * The outputs of earlier compilations, kept in the directory named by the
+ * ACC_CACHE_DIR environment variable. They are found through a hash of the
+ * source, the options that make a difference to the output and the version
+ * of the compiler, so that compiling the same thing again only takes copying
+ * them. Once they take up more than ACC_CACHE_SIZE bytes (a number followed
+ * by an optional k, M or G, 1G by default), those used longest ago make way.
+ * Only available on Unix.
+ */
+
+void cache_init(void);
+/*
+ * Adds the hits and misses of this run to the statistics kept in the cache
+ */
+void cache_destroy(void);
+bool cache_enabled(void);
+
+/*
+ * The key for compiling the len bytes of source in src with the current
+ * options
+ */
+void cache_key(struct hash *key, const char *src, size_t len);
+
+/*
+ * Writes the outputs stored under key to the files in names, which holds n
+ * of them, NULL for those that weren't asked for. Returns whether there were
+ * any stored.
+ */
+bool cache_fetch(const struct hash *key, const char *names[], int n);
+/*
+ * Stores the outputs in the files in names under key
+ */
+void cache_store(const struct hash *key, const char *names[], int n);
+
+/*
+ * Writes the statistics kept in the cache to f
+ */
+void cache_report(FILE *f);
+
+#endif
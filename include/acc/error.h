@@ -21,6 +21,7 @@
 #define ERROR_H
 
 #include <setjmp.h>
+#include <stdbool.h>
 
 #include <acc/parsing/token.h>
 
@@ -46,7 +47,21 @@ enum errorty {
  */
 void report(enum errorty ty, struct token *tok, const char *frmt, ...);
 
-extern const char *currentfile;
+/*
+ * Gives up after a fatal error, as report() does for E_FATAL
+ */
+void fatal(void);
+
+/*
+ * Where fatal errors go outside of a translation unit, while the options are
+ * parsed; inside one they go to its own fatal_env
+ */
 extern jmp_buf fatal_env;
 
+/*
+ * Whether an error was reported outside of a translation unit; those inside
+ * one mark it as failed
+ */
+extern bool reported_error;
+
 #endif
@@ -0,0 +1,53 @@
+/*
+ * Hashing
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * A 128-bit hash of everything fed to it, for telling whether two inputs are
+ * the same without keeping them around. Not meant to hold up against anyone
+ * trying to make two inputs hash the same.
+ */
+struct hash {
+	uint64_t a, b;
+};
+
+#define HASH_HEXLEN 32
+
+void hash_init(struct hash *h);
+void hash_bytes(struct hash *h, const void *p, size_t len);
+/*
+ * Strings are fed along with their terminator, so that "ab" followed by "c"
+ * differs from "a" followed by "bc"
+ */
+void hash_str(struct hash *h, const char *str);
+void hash_int(struct hash *h, long v);
+
+bool hash_eq(const struct hash *l, const struct hash *r);
+/*
+ * Writes the hash as HASH_HEXLEN hexadecimal digits and a terminator
+ */
+void hash_hex(const struct hash *h, char *buf);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Incremental compilation
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCR_H
+#define INCR_H
+
+#include <stddef.h>
+
+#include <acc/target/emit.h>
+#include <acc/list.h>
+
+/*
+ * With -fincremental, the assembly of each function is kept in a database
+ * next to the output, under a hash of the source of the function, of the
+ * declarations before it (along with the signatures of the functions defined
+ * before it), and of the options. Functions found there again aren't
+ * optimized or compiled, but have their code spliced into the output, so
+ * that compiling after a change takes time in proportion to the functions
+ * it touches.
+ */
+struct incrdb;
+
+/*
+ * Reads the database at path, which is empty if there's none yet
+ */
+struct incrdb *incr_open(const char *path);
+/*
+ * Writes back the code looked up or added since incr_open(), and nothing
+ * else, so that the code of functions that are gone doesn't pile up
+ */
+void incr_close(struct incrdb *db);
+
+/*
+ * Sets codes[k] to the code kept for the k-th container in syms, or to NULL.
+ * decls holds where the declarations start in the len bytes of source in
+ * src, as parsefile() gives them.
+ */
+void incr_lookup(struct incrdb *db, const char *src, size_t len,
+	struct list *decls, struct list *syms, struct fncode **codes);
+/*
+ * Takes the code in codes that wasn't found by incr_lookup(), as compiled
+ * by emit_fncodes(), keeping that of functions for next time
+ */
+void incr_update(struct incrdb *db, struct list *syms, struct fncode **codes);
+
+#endif
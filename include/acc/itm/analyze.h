@@ -29,6 +29,7 @@
 extern const tagtype_t tt_used;
 extern const tagtype_t tt_endlife;
 extern const tagtype_t tt_phiable;
+extern const tagtype_t tt_loopdepth;
 
 /*
  * Analysis flags to pass to analyze()
@@ -45,7 +46,11 @@ enum analysis {
 	/*
 	 * Tags 'phiable' nodes as such
 	 */
-	A_PHIABLE = 0x4
+	A_PHIABLE = 0x4,
+	/*
+	 * Tags each block with the number of loops it is nested in
+	 */
+	A_LOOPDEPTH = 0x8
 };
 
 void analyze(struct itm_block *strt, enum analysis a);
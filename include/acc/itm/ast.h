@@ -89,6 +89,7 @@ struct itm_container {
 	char *id;
 	struct itm_block *block;
 	struct list *literals;
+	struct itm_literal *init;	// of an object, NULL if it's zero
 };
 
 struct itm_block {
@@ -149,6 +150,8 @@ struct itm_expr *itm_eval(struct itm_expr *e);
 struct itm_instr *itm_add(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_sub(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_mul(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
+// high half of the product, signed or unsigned depending on the type
+struct itm_instr *itm_mulh(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_imul(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_div(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_idiv(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
@@ -183,6 +186,8 @@ struct itm_instr *itm_alloca(struct itm_block *b, struct ctype *ty);
 struct itm_instr *itm_load(struct itm_block *b, struct itm_expr *l);
 struct itm_instr *itm_store(struct itm_block *b, struct itm_expr *l, struct itm_expr *r);
 struct itm_instr *itm_phi(struct itm_block *b, struct ctype *ty, struct list *dict);
+// c ? t : f, without branching
+struct itm_instr *itm_select(struct itm_block *b, struct itm_expr *c, struct itm_expr *t, struct itm_expr *f);
 
 struct itm_instr *itm_jmp(struct itm_block *b, struct itm_block *to);
 struct itm_instr *itm_split(struct itm_block *b, struct itm_expr *c, struct itm_block *t, struct itm_block *e);
@@ -192,4 +197,11 @@ struct itm_instr *itm_leave(struct itm_block *b);
 struct itm_instr *itm_mov(struct itm_block *b, struct itm_expr *e);
 struct itm_instr *itm_clobb(struct itm_block *b);
 
+/*
+ * Appends an instruction to b as made by the function id is the ITM_ID() of,
+ * but without any operands, for those reading instructions back in
+ */
+struct itm_instr *itm_append(struct itm_block *b, struct ctype *ty,
+	instr_id_t id, const char *operation, bool terminal);
+
 #endif
@@ -0,0 +1,49 @@
+/*
+ * Binary intermediate representation
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ITM_BIN_H
+#define ITM_BIN_H
+
+#include <stdio.h>
+
+#include <acc/itm/ast.h>
+#include <acc/list.h>
+
+/*
+ * A compact encoding of containers that can be read back in, unlike the
+ * text written by itm_container_to_string(). Expressions are referred to by
+ * dense indexes and names through a string table, so that the file is small
+ * and can be read straight from memory. Tags aren't kept, they are only
+ * analysis results.
+ */
+
+/*
+ * Writes the containers in containers, and those they refer to, to f
+ */
+void itm_write(FILE *f, struct list *containers);
+
+/*
+ * Reads the containers written by itm_write() from f, mapping it into memory
+ * where possible. Their types are made in the current translation unit,
+ * which must have its AST set up. The containers are the caller's, to be
+ * deleted with delete_itm_container(). Returns NULL if f doesn't hold any.
+ */
+struct list *itm_read(FILE *f);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Whole-program optimization
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ITM_LTO_H
+#define ITM_LTO_H
+
+#include <acc/itm/ast.h>
+#include <acc/list.h>
+
+/*
+ * Links the containers of several files into one module. units holds a list
+ * of containers per file, as parsefile() gives them. Every declaration of a
+ * symbol with external linkage, in whichever file, is resolved to the one
+ * definition of it, as are the declarations of a static symbol within its
+ * own file, and references to them are made to refer to that instead.
+ * Returns the list of the containers left, in the order they came in.
+ */
+struct list *lto_link(struct list *units);
+
+/*
+ * Optimizations across the containers of a linked module, done before each
+ * of them is optimized on its own:
+ *
+ * - Globals that are never stored to and never have their address taken
+ *   keep the value they start out with, zero, which their loads are replaced
+ *   with.
+ * - Containers that can't be reached from main() are removed, or, without a
+ *   main(), those that can't be reached from any symbol with external
+ *   linkage.
+ *
+ * Globals with external linkage are only known not to be touched elsewhere
+ * if the module has main(), which makes it a whole program.
+ */
+void lto_optimize(struct list *syms);
+
+#endif
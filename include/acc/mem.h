@@ -0,0 +1,82 @@
+/*
+ * Memory accounting
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+
+/*
+ * Allocation of the kinds of objects there are most of, counted by category
+ * for -fmem-report. Nothing is kept with the memory: the size of what is
+ * freed is given by the caller, so the memory is that of malloc() and
+ * without -fmem-report these are malloc() and free().
+ */
+enum memcat {
+	MEM_TOKENS,
+	MEM_TYPES,
+	MEM_SYMBOLS,
+	MEM_IR,
+	MEM_TAGS,
+	MEM_LISTS,
+	MEM_LOCATIONS,
+	NMEMCATS
+};
+
+/*
+ * Starts counting, if asked for; mem_finish() writes out the counts of the
+ * categories
+ */
+void mem_init(void);
+void mem_finish(void);
+
+void *mem_alloc(enum memcat cat, size_t size);
+void *mem_zalloc(enum memcat cat, size_t size);
+void mem_free(enum memcat cat, void *p, size_t size);
+/*
+ * Starts counting p, allocated elsewhere, of which size bytes are used; to
+ * be counted at its real size, it is cut down to those with -fmem-report
+ */
+void *mem_take(enum memcat cat, void *p, size_t size);
+/*
+ * A copy of str, of strlen(str) + 1 bytes
+ */
+char *mem_strdup(enum memcat cat, const char *str);
+
+/*
+ * What a thread allocated from one point on, for the phases of -fmem-report.
+ * Marks nest, so that the peak of one is the most the thread had allocated
+ * and not yet freed at any time between mem_mark() and mem_since(), less
+ * what it had at mem_mark().
+ */
+struct memmark {
+	long allocs;
+	long bytes;		// allocated
+	long live;		// allocated and not freed
+	long peak;
+};
+
+void mem_mark(struct memmark *m);
+/*
+ * Ends the mark m, which must be the last one made on the thread, and gives
+ * what was allocated since in use
+ */
+void mem_since(const struct memmark *m, struct memmark *use);
+
+#endif
@@ -55,9 +55,55 @@ bool option_warnings(void);
  * Indicates whether to emit IR ('-Sir')
  */
 bool option_emit_ir(void);
+/*
+ * Indicates whether to emit binary IR ('-Sbir')
+ */
+bool option_emit_bir(void);
 /*
  * Indicates whether to emit assembly ('-S')
  */
 bool option_emit_asm(void);
 
+/*
+ * Indicates whether to emit an object file ('-c')
+ */
+bool option_emit_obj(void);
+
+/*
+ * The number of threads to compile on ('-j')
+ */
+int option_jobs(void);
+
+/*
+ * Indicates whether to compile incrementally ('-fincremental')
+ */
+bool option_incremental(void);
+
+/*
+ * Indicates whether to compile all input files as one program ('-flto')
+ */
+bool option_lto(void);
+
+/*
+ * Indicates whether to report how long compilation takes ('-ftime-report')
+ */
+bool option_time_report(void);
+/*
+ * The file to write a trace of the compilation to, NULL if none
+ * ('-ftime-trace=<file>')
+ */
+const char *option_time_trace(void);
+
+/*
+ * Indicates whether to report memory usage ('-fmem-report')
+ */
+bool option_mem_report(void);
+
+/*
+ * Indicates whether to report optimization statistics ('-fstats'), and
+ * whether to do so as JSON ('-fstats=json')
+ */
+bool option_stats(void);
+bool option_stats_json(void);
+
 #endif
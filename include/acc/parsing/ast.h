@@ -174,6 +174,13 @@ struct operator {
 	const char *rep;
 };
 
+/*
+ * Sets up the primitive types, once before any translation unit
+ */
+void types_init(void);
+/*
+ * Declarations of the current translation unit
+ */
 void ast_init(void);
 void ast_destroy(void);
 
@@ -24,6 +24,21 @@
 
 #include <acc/parsing/ast.h>
 
-void parsefile(FILE *f, struct list *syms);
+/*
+ * Where an external declaration starts, and where the body of a function
+ * definition does
+ */
+struct declpos {
+	int line, column;
+	int bodyline, bodycolumn;	// 0 if not a function definition
+	struct itm_container *fn;	// the function defined, if any
+};
+
+/*
+ * Parses the external declarations in f, putting their containers in syms.
+ * Where they start is put in decls unless it's NULL, followed by where the
+ * file ends.
+ */
+void parsefile(FILE *f, struct list *syms, struct list *decls);
 
 #endif
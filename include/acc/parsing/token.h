@@ -87,5 +87,9 @@ int get_line(void);
  * Get current column number (starting at 1)
  */
 int get_column(void);
+/*
+ * Get where the next token starts, without advancing the stream
+ */
+void peekpos(FILE *f, int *line, int *column);
 
 #endif
@@ -0,0 +1,55 @@
+/*
+ * Optimization statistics
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <acc/tu.h>
+
+/*
+ * How often the optimizers and the code generator do what they do, counted
+ * per function of a translation unit, for -fstats. Without it the counters
+ * do nothing.
+ */
+enum stat {
+	ST_FOLDED,		// constants folded by o_cfld
+	ST_UNSPLIT,		// splits made jumps by o_uncsplit
+	ST_PRUNED,		// blocks removed by o_prune
+	ST_PROMOTED,		// allocas made phis by o_phiable
+	ST_MOVS,		// movs inserted to meet the restrictions of the cpu
+	ST_RESOLVED,		// register hints taken
+	ST_DROPPED,		// register hints given up in a conflict
+	ST_SPILLED,		// values spilled by the graph coloring allocator
+	ST_INSTRS,		// machine instructions emitted
+	NSTATS
+};
+
+/*
+ * Starts counting for u, to be written with its diagnostics, headed by name,
+ * on stats_report()
+ */
+void stats_open(struct tu *u, const char *name);
+void stats_report(struct tu *u);
+
+/*
+ * Adds n to stat of the function named fn, in the unit of the calling thread
+ */
+void stats_add(const char *fn, enum stat stat, long n);
+
+#endif
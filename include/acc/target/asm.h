@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <acc/itm/ast.h>
 #include <acc/itm/tag.h>
@@ -31,7 +32,7 @@ typedef void *asme_type_t;
 extern asme_type_t asme_reg;
 extern asme_type_t asme_imm;
 
-const tagtype_t tt_loc;
+extern const tagtype_t tt_loc;
 
 struct asme {
 	asme_type_t *type;
@@ -122,10 +123,38 @@ void loc_to_string(FILE *f, struct location *loc);
 struct archdes {
 	regid_t all_iregs;
 	regid_t saved_iregs;
+	regid_t byte_iregs; // those with an 8-bit form
 	regid_t all_fregs;
 	regid_t saved_fregs;
 };
 
+/*
+ * Stack frame bookkeeping. Offsets are relative to the frame pointer, and
+ * thus negative.
+ */
+int framealloc(struct itm_block *b, size_t size);
+int framesize(struct itm_block *b);
+
 void regalloc(struct itm_block *b, struct archdes rset);
+void regcolor(struct itm_block *b, struct archdes rset);
+
+/*
+ * Phi elimination. splitcrit() gives the edges out of conditional branches
+ * into blocks with phis a block of their own, and is to be called before
+ * register allocation. phicopies() returns the ordered copies to be emitted at
+ * the end of pred, right before it jumps to succ.
+ */
+struct pcopy {
+	bool swap; // exchange the contents of dst and src instead
+	int width; // the bytes exchanged, enough for every read of either
+	struct ctype *type;
+	struct location *dst;
+	struct location *src; // NULL if val isn't read from a location
+	struct itm_expr *val;
+};
+
+void splitcrit(struct itm_block *b);
+struct list *phicopies(struct itm_block *pred, struct itm_block *succ);
+void delete_phicopies(struct list *copies);
 
 #endif
@@ -0,0 +1,47 @@
+/*
+ * Buffered assembly output
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef ASMOUT_H
+#define ASMOUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Text output through a large private buffer, which is written out to the
+ * file with write(2) when it fills up and when the output is deleted. The
+ * file is flushed when the output is created, and mustn't be written to
+ * through stdio until it's deleted. Without a file, the buffer grows to hold
+ * everything written, which asmout_data() returns.
+ */
+struct asmout;
+
+struct asmout *new_asmout(FILE *f);
+void delete_asmout(struct asmout *o);
+const char *asmout_data(struct asmout *o, size_t *len);
+
+void asmout_mem(struct asmout *o, const char *s, size_t len);
+void asmout_str(struct asmout *o, const char *s);
+void asmout_chr(struct asmout *o, char c);
+void asmout_dec(struct asmout *o, int64_t value);
+void asmout_flush(struct asmout *o);
+
+#endif
@@ -21,6 +21,7 @@
 #define TARGET_CPU_H
 
 #include <acc/parsing/ast.h>
+#include <acc/hash.h>
 
 struct cpu {
 	const char *name;
@@ -51,6 +52,16 @@ void archoption(const char *opt);
  */
 void xarchoption(const char *opt);
 
+/*
+ * Feeds the target options that make a difference to the output to h (not to
+ * be implemented by platform implementations)
+ */
+void archhash(struct hash *h);
+/*
+ * Feeds the options set through xarchoption() to h
+ */
+void xarchhash(struct hash *h);
+
 /*
  * Gets type size for the given type
  */
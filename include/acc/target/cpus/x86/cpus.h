@@ -1,6 +1,8 @@
 #ifndef TARGET_X86_CPUS_H
 #define TARGET_X86_CPUS_H
 
+#include <stdbool.h>
+
 #include <acc/target/cpu.h>
 
 enum asmflavor {
@@ -10,6 +12,12 @@ enum asmflavor {
 
 enum asmflavor asmflavor(void);
 
+/*
+ * Whether floating point arithmetic is done using SSE2 instructions, which is
+ * the default on x86_64 and can be enabled with -msse2 from i686 upwards
+ */
+bool x86_sse2(void);
+
 extern const struct cpu cpu8086, cpui386, cpui686, cpux86_64;
 
 #endif
@@ -19,8 +19,35 @@
 #ifndef TARGET_EMIT_H
 #define TARGET_EMIT_H
 
+#include <stdint.h>
+
 #include <acc/list.h>
 
 void emit(FILE *f, struct list *containers);
+void emit_object(FILE *f, struct list *containers);
+
+/*
+ * The assembly of a function, as kept between compilations (see incr.h). It
+ * refers to the constants it loads by labels of its own, so that it can be
+ * put in between other code with other constants.
+ */
+struct fnconst {
+	uint64_t bits;
+	int size;
+};
+
+struct fncode {
+	char *text;
+	size_t len;
+	int nconsts;
+	struct fnconst *consts;
+};
+
+/*
+ * Emits assembly like emit(), but takes the code of the k-th container from
+ * codes[k] where it's set, rather than compiling it. Where it isn't, it's set
+ * to the code it's compiled to, to be freed by the caller.
+ */
+void emit_fncodes(FILE *f, struct list *containers, struct fncode **codes);
 
 #endif
@@ -0,0 +1,83 @@
+/*
+ * Relocatable object files
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <acc/target/asm.h>
+
+/*
+ * The contents of an object file as a backend assembles them: the bytes of
+ * each section, the symbols defined in and referred to from them and the
+ * relocations left for the linker. Symbols whose name starts with ".L" are
+ * local to the assembler, and are replaced by their section in relocations.
+ */
+struct objfile;
+struct objsym;
+
+enum objreloc {
+	OR_ABS32,	// zero extended on 64 bit cpus
+	OR_ABS32S,	// sign extended on 64 bit cpus
+	OR_ABS64,
+	OR_PC32,
+	OR_PLT32
+};
+
+struct objfile *new_objfile(void);
+void delete_objfile(struct objfile *o);
+
+/*
+ * Sections; anything added goes to the current one, which is .text
+ * initially. Nothing but zeroes goes to .bss.
+ */
+void obj_section(struct objfile *o, enum section sec);
+size_t obj_offset(struct objfile *o);
+void obj_bytes(struct objfile *o, const void *data, size_t size);
+void obj_int(struct objfile *o, uint64_t value, int size);
+void obj_zeroes(struct objfile *o, size_t size);
+void obj_align(struct objfile *o, size_t align);
+
+/*
+ * Symbols, created on first mention. obj_define() puts a symbol at the
+ * current offset.
+ */
+struct objsym *obj_symbol(struct objfile *o, const char *name);
+void obj_define(struct objfile *o, struct objsym *sym);
+void obj_global(struct objfile *o, struct objsym *sym);
+bool obj_defined(struct objsym *sym, enum section *sec, size_t *offset);
+
+/*
+ * Adds a relocation of the field of the given size at offset in the current
+ * section, to be filled in with sym + addend, minus the address of the field
+ * for pc relative ones.
+ */
+void obj_reloc(struct objfile *o, size_t offset, enum objreloc type,
+	struct objsym *sym, int64_t addend);
+
+/*
+ * Writes an ELF relocatable object for the current cpu
+ */
+void obj_write_elf(struct objfile *o, FILE *f);
+
+#endif
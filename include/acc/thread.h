@@ -0,0 +1,86 @@
+/*
+ * Threads
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <setjmp.h>
+
+/*
+ * Threads are used where there are POSIX threads and thread-local storage,
+ * which C99 has neither of. Elsewhere everything runs on one thread, and
+ * storage meant to have a copy per thread is static.
+ */
+#if defined(__unix__) && \
+    (defined(__GNUC__) || __STDC_VERSION__ >= 201112L)
+#define ACC_THREADS 1
+#endif
+
+/*
+ * Storage with a copy per thread, for state that is only needed while a
+ * thread works on something, like the instructions of the function being
+ * emitted.
+ */
+#if !defined(ACC_THREADS)
+#define THREAD_LOCAL
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+struct mutex;
+
+struct mutex *new_mutex(void);
+void delete_mutex(struct mutex *m);
+void mutex_lock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+/*
+ * A pool of threads working through numbered tasks. Each thread starts on a
+ * range of the tasks of its own, and steals from the end of the others' when
+ * it runs out, so that a few large tasks don't keep the rest waiting.
+ */
+struct pool;
+
+/*
+ * A pool of nthreads threads besides the one running it, or NULL if there
+ * are none to be had
+ */
+struct pool *new_pool(int nthreads);
+void delete_pool(struct pool *p);
+
+/*
+ * Calls fn(arg, k) for every k from 0 up to n, on the threads of p and the
+ * calling thread, and returns when all are done. The threads work in the
+ * translation unit of the caller. A fatal error in one of the tasks stops
+ * the others, and is passed on to the caller once they have. Runs the tasks
+ * in order on the calling thread if p is NULL.
+ */
+void pool_run(struct pool *p, int n, void (*fn)(void *arg, int k), void *arg);
+
+/*
+ * Fatal errors on the calling thread jump to env from now on, rather than
+ * to the fatal_env of its translation unit if env is NULL. Returns where
+ * they went before.
+ */
+jmp_buf *thread_catch(jmp_buf *env);
+jmp_buf *thread_catcher(void);
+
+#endif
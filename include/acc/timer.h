@@ -0,0 +1,55 @@
+/*
+ * Phase timing
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <acc/tu.h>
+
+/*
+ * How long the phases of compilation take, for -ftime-report and
+ * -ftime-trace, and what they allocate through mem.h, for -fmem-report.
+ * Phases nest in those started before them on the same thread, and add up
+ * per translation unit, so that the time of a phase done on several threads
+ * at once is the sum of them. Without any of these options the timers do
+ * nothing. Uses a monotonic clock on Unix, and processor time elsewhere.
+ */
+
+/*
+ * Starts timing, for the options given; writes the trace on timer_finish()
+ */
+void timer_init(void);
+void timer_finish(void);
+
+/*
+ * Starts timing the phases of u, to be written with its diagnostics, headed
+ * by name, on timer_report()
+ */
+void timer_open(struct tu *u, const char *name);
+void timer_report(struct tu *u);
+
+/*
+ * Times the phase name until the matching timer_stop(). If fn isn't NULL,
+ * the phase is done on the function named fn, and is reported along with it
+ * as well. name must outlive the unit.
+ */
+void timer_start(const char *name, const char *fn);
+void timer_stop(void);
+
+#endif
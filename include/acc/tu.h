@@ -0,0 +1,81 @@
+/*
+ * Translation units
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef TU_H
+#define TU_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+#include <acc/parsing/token.h>
+#include <acc/thread.h>
+#include <acc/list.h>
+
+/*
+ * Everything kept about the file being compiled. Each thread works on one
+ * unit at a time, which it makes current with tu_enter(); the tokenizer, the
+ * scopes of the parser and the error reporter find it through curtu(). The
+ * threads of its pool work in it too, on the functions in it.
+ */
+struct tu {
+	const char *file;	// NULL for stdin
+	jmp_buf fatal_env;
+	struct pool *pool;	// NULL to do everything on one thread
+
+	// tokenizer
+	int line, column;
+	char *linestr;
+	struct token buffer;
+	bool isbuffered;
+
+	// declarations
+	struct list *alltypes, *typescopes;
+	struct list *allsyms, *symscopes;
+
+	// diagnostics, kept until tu_flushdiag() if bufdiag is set
+	struct mutex *diaglock;
+	int ndiag;
+	bool failed;		// an error was reported, fatal or not
+	bool bufdiag;
+	char *diag;
+	size_t diaglen, diagcap;
+
+	// phase timing, NULL if it isn't timed
+	struct timetree *times;
+	// optimization statistics, NULL if they aren't counted
+	struct stats *stats;
+};
+
+void tu_init(struct tu *u, const char *file, bool bufdiag);
+void tu_destroy(struct tu *u);
+
+/*
+ * Makes u the unit of the calling thread, NULL for none
+ */
+void tu_enter(struct tu *u);
+struct tu *curtu(void);
+
+/*
+ * Writes a diagnostic to stderr, or to the buffer of u, in one piece
+ */
+void tu_diag(struct tu *u, const char *msg, size_t len);
+void tu_flushdiag(struct tu *u, FILE *f);
+
+#endif
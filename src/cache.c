@@ -0,0 +1,497 @@
+/*
+ * Compilation cache
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// for directories, file locks and utime(), where there are such
+#ifdef __unix__
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <acc/target/cpu.h>
+#include <acc/cache.h>
+#include <acc/options.h>
+#include <acc/thread.h>
+#include <acc/error.h>
+#include <acc/ext.h>
+
+void cache_key(struct hash *key, const char *src, size_t len)
+{
+	hash_init(key);
+	hash_str(key, "acc " ACC_VERSION);
+
+	hash_int(key, option_optimize());
+	hash_int(key, option_warnings());
+	hash_int(key, option_emit_ir());
+	hash_int(key, option_emit_bir());
+	hash_int(key, option_emit_asm());
+	hash_int(key, option_emit_obj());
+	for (int i = 0; i < EX_COUNT; ++i)
+		hash_int(key, isext(i));
+	archhash(key);
+
+	hash_bytes(key, src, len);
+}
+
+#ifdef __unix__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define DEFAULT_LIMIT (1024ull * 1024 * 1024)
+
+/*
+ * An entry starts with MAGIC, followed by each of the outputs as an eight-byte
+ * little-endian length and the bytes themselves. Outputs that weren't asked
+ * for have a length of ABSENT.
+ */
+#define MAGIC "acc\2"
+#define MAGICLEN 4
+#define ABSENT 0xffffffffffffffffull
+
+static char *dir;		// NULL without a cache
+static unsigned long long limit;
+
+// what this run adds to the statistics
+static struct mutex *lock;
+static long hits, misses;
+static long long added;		// less what was replaced
+static unsigned tmpcount;
+
+// a number of bytes, optionally followed by K, M or G, and nothing else
+static unsigned long long parsesize(const char *str)
+{
+	char *end;
+	int shift = 0;
+	errno = 0;
+	unsigned long long size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		shift += 10;
+		// fallthrough
+	case 'M':
+	case 'm':
+		shift += 10;
+		// fallthrough
+	case 'K':
+	case 'k':
+		shift += 10;
+		++end;
+	}
+
+	// strtoull skips spaces and negates after a minus sign
+	if (*str < '0' || *str > '9' || *end || errno == ERANGE ||
+	    size > ULLONG_MAX >> shift) {
+		report(E_OPTIONS, NULL, "invalid cache size: \"%s\"", str);
+		return DEFAULT_LIMIT;
+	}
+	return size << shift;
+}
+
+void cache_init(void)
+{
+	const char *env = getenv("ACC_CACHE_DIR");
+	if (!env || !*env)
+		return;
+
+	if (mkdir(env, 0777) && errno != EEXIST) {
+		report(E_OPTIONS, NULL, "can't make cache directory \"%s\": %s",
+			env, strerror(errno));
+		return;
+	}
+
+	dir = malloc(strlen(env) + 1);
+	strcpy(dir, env);
+	const char *size = getenv("ACC_CACHE_SIZE");
+	limit = size ? parsesize(size) : DEFAULT_LIMIT;
+	lock = new_mutex();
+}
+
+bool cache_enabled(void)
+{
+	return dir != NULL;
+}
+
+// dir/name, to be freed
+static char *cachepath(const char *name)
+{
+	char *path = malloc(strlen(dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static char *entrypath(const struct hash *key)
+{
+	char hex[HASH_HEXLEN + 1];
+	hash_hex(key, hex);
+	return cachepath(hex);
+}
+
+static bool getlen(FILE *f, unsigned long long *len)
+{
+	unsigned char bytes[8];
+	if (fread(bytes, 1, 8, f) != 8)
+		return false;
+	*len = 0;
+	for (int i = 7; i >= 0; --i)
+		*len = *len << 8 | bytes[i];
+	return true;
+}
+
+static void putlen(FILE *f, unsigned long long len)
+{
+	unsigned char bytes[8];
+	for (int i = 0; i < 8; ++i) {
+		bytes[i] = len & 0xff;
+		len >>= 8;
+	}
+	fwrite(bytes, 1, 8, f);
+}
+
+// copies len bytes from in to the file named name
+static bool copyout(FILE *in, unsigned long long len, const char *name)
+{
+	FILE *out = fopen(name, "wb");
+	if (!out)
+		return false;
+
+	char buf[BUFSIZ];
+	while (len) {
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+		if (fread(buf, 1, n, in) != n || fwrite(buf, 1, n, out) != n)
+			break;
+		len -= n;
+	}
+
+	return !fclose(out) && !len;
+}
+
+static bool fetch(FILE *e, const char *names[], int n)
+{
+	char magic[MAGICLEN];
+	if (fread(magic, 1, MAGICLEN, e) != MAGICLEN ||
+	    memcmp(magic, MAGIC, MAGICLEN))
+		return false;
+
+	for (int i = 0; i < n; ++i) {
+		unsigned long long len;
+		if (!getlen(e, &len) || (len == ABSENT) != !names[i])
+			return false;
+		if (names[i] && !copyout(e, len, names[i]))
+			return false;
+	}
+	return true;
+}
+
+bool cache_fetch(const struct hash *key, const char *names[], int n)
+{
+	char *path = entrypath(key);
+	FILE *e = fopen(path, "rb");
+	bool hit = e && fetch(e, names, n);
+	if (e)
+		fclose(e);
+
+	// to tell which entries are used least recently
+	if (hit)
+		utime(path, NULL);
+	free(path);
+
+	mutex_lock(lock);
+	if (hit)
+		++hits;
+	else
+		++misses;
+	mutex_unlock(lock);
+	return hit;
+}
+
+// appends the file named name to e
+static bool copyin(FILE *e, const char *name)
+{
+	FILE *in = fopen(name, "rb");
+	if (!in || fseek(in, 0, SEEK_END)) {
+		if (in)
+			fclose(in);
+		return false;
+	}
+	long len = ftell(in);
+	if (len < 0) {
+		fclose(in);
+		return false;
+	}
+	rewind(in);
+	putlen(e, len);
+
+	char buf[BUFSIZ];
+	size_t n;
+	while (len > 0 && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (fwrite(buf, 1, n, e) != n)
+			break;
+		len -= n;
+	}
+
+	fclose(in);
+	return !len;
+}
+
+void cache_store(const struct hash *key, const char *names[], int n)
+{
+	// written elsewhere first, so that no one finds half an entry
+	mutex_lock(lock);
+	unsigned count = tmpcount++;
+	mutex_unlock(lock);
+	char tmpname[64];
+	sprintf(tmpname, "tmp.%ld.%u", (long)getpid(), count);
+	char *tmp = cachepath(tmpname);
+
+	FILE *e = fopen(tmp, "wb");
+	if (!e) {
+		free(tmp);
+		return;
+	}
+
+	bool ok = fwrite(MAGIC, 1, MAGICLEN, e) == MAGICLEN;
+	for (int i = 0; i < n && ok; ++i) {
+		if (names[i])
+			ok = copyin(e, names[i]);
+		else
+			putlen(e, ABSENT);
+	}
+	// a full disk may only show here
+	long size = ftell(e);
+	ok = ok && size >= 0 && !ferror(e);
+	ok = !fclose(e) && ok;
+
+	// an entry stored before under the same key is replaced
+	char *path = entrypath(key);
+	struct stat sb;
+	long long replaced = stat(path, &sb) ? 0 : sb.st_size;
+	if (!ok || rename(tmp, path)) {
+		remove(tmp);
+	} else {
+		mutex_lock(lock);
+		added += size - replaced;
+		mutex_unlock(lock);
+	}
+
+	free(path);
+	free(tmp);
+}
+
+/*
+ * The statistics are kept in a file of their own, which is locked while it's
+ * read and written
+ */
+struct stats {
+	long hits, misses;
+	unsigned long long size;
+};
+
+static int openstats(struct stats *st, bool write)
+{
+	char *path = cachepath("stats");
+	int fd = open(path, write ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+	free(path);
+	memset(st, 0, sizeof(struct stats));
+	if (fd < 0)
+		return -1;
+
+	struct flock fl;
+	memset(&fl, 0, sizeof(struct flock));
+	fl.l_type = write ? F_WRLCK : F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(fd, F_SETLKW, &fl) && errno == EINTR)
+		;
+
+	char buf[256];
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	if (len > 0) {
+		buf[len] = '\0';
+		sscanf(buf, "hits %ld\nmisses %ld\nsize %llu\n",
+			&st->hits, &st->misses, &st->size);
+	}
+	return fd;
+}
+
+// closing the file lets go of the lock
+static void closestats(int fd, struct stats *st)
+{
+	char buf[256];
+	int len = sprintf(buf, "hits %ld\nmisses %ld\nsize %llu\n",
+		st->hits, st->misses, st->size);
+	if (!lseek(fd, 0, SEEK_SET) && write(fd, buf, len) == len)
+		ftruncate(fd, len);
+	close(fd);
+}
+
+struct entry {
+	char *path;
+	time_t used;
+	unsigned long long size;
+};
+
+static int cmpentry(const void *l, const void *r)
+{
+	const struct entry *le = l, *re = r;
+	return (le->used > re->used) - (le->used < re->used);
+}
+
+static bool isentry(const char *name)
+{
+	if (strlen(name) != HASH_HEXLEN)
+		return false;
+	for (; *name; ++name)
+		if (!strchr("0123456789abcdef", *name))
+			return false;
+	return true;
+}
+
+/*
+ * Removes the entries used longest ago until those left take up a bit less
+ * than the limit, so that not every store has to do this. Gives what they
+ * take up then.
+ */
+static unsigned long long evict(void)
+{
+	DIR *d = opendir(dir);
+	if (!d)
+		return 0;
+
+	struct entry *entries = NULL;
+	size_t n = 0, cap = 0;
+	unsigned long long total = 0;
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		struct stat sb;
+		if (!isentry(de->d_name))
+			continue;
+		char *path = cachepath(de->d_name);
+		if (stat(path, &sb)) {
+			free(path);
+			continue;
+		}
+
+		if (n == cap)
+			entries = realloc(entries,
+				(cap = cap ? cap * 2 : 64) * sizeof(struct entry));
+		entries[n].path = path;
+		entries[n].used = sb.st_mtime;
+		entries[n].size = sb.st_size;
+		total += sb.st_size;
+		++n;
+	}
+	closedir(d);
+
+	qsort(entries, n, sizeof(struct entry), &cmpentry);
+	for (size_t i = 0; i < n; ++i) {
+		if (total > limit / 10 * 9 && !remove(entries[i].path))
+			total -= entries[i].size;
+		free(entries[i].path);
+	}
+	free(entries);
+	return total;
+}
+
+void cache_destroy(void)
+{
+	if (!dir)
+		return;
+
+	if (hits || misses || added) {
+		struct stats st;
+		int fd = openstats(&st, true);
+		if (fd >= 0) {
+			st.hits += hits;
+			st.misses += misses;
+			if (added < 0 && (unsigned long long)-added > st.size)
+				st.size = 0;
+			else
+				st.size += added;
+			if (st.size > limit)
+				st.size = evict();
+			closestats(fd, &st);
+		}
+	}
+
+	delete_mutex(lock);
+	free(dir);
+	dir = NULL;
+}
+
+void cache_report(FILE *f)
+{
+	if (!dir) {
+		fprintf(f, "no cache (ACC_CACHE_DIR isn't set)\n");
+		return;
+	}
+
+	struct stats st;
+	int fd = openstats(&st, false);
+	if (fd >= 0)
+		close(fd);
+
+	long total = st.hits + st.misses;
+	fprintf(f, "cache directory          %s\n", dir);
+	fprintf(f, "hits                     %ld\n", st.hits);
+	fprintf(f, "misses                   %ld\n", st.misses);
+	fprintf(f, "hit rate                 %.1f%%\n",
+		total ? 100.0 * st.hits / total : 0.0);
+	fprintf(f, "size                     %llu kB\n", st.size / 1024);
+	fprintf(f, "limit                    %llu kB\n", limit / 1024);
+}
+
+#else
+
+void cache_init(void)
+{
+}
+
+void cache_destroy(void)
+{
+}
+
+bool cache_enabled(void)
+{
+	return false;
+}
+
+bool cache_fetch(const struct hash *key, const char *names[], int n)
+{
+	return false;
+}
+
+void cache_store(const struct hash *key, const char *names[], int n)
+{
+}
+
+void cache_report(FILE *f)
+{
+	fprintf(f, "the cache isn't available here\n");
+}
+
+#endif
@@ -24,12 +24,58 @@
 
 #include <acc/parsing/token.h>
 #include <acc/error.h>
+#include <acc/thread.h>
+#include <acc/tu.h>
 #include <acc/options.h>
 #include <acc/ext.h>
 #include <acc/term.h>
 
-const char *currentfile = NULL;
 jmp_buf fatal_env;
+bool reported_error = false;
+
+/*
+ * Diagnostics are put together before they are written out, so that those
+ * of threads working in the same translation unit don't get mixed up.
+ */
+struct diag {
+	char *buf;
+	size_t len, cap;
+};
+
+static void vdiag(struct diag *d, const char *frmt, va_list ap)
+{
+	va_list cp;
+	va_copy(cp, ap);
+	int len = vsnprintf(NULL, 0, frmt, cp);
+	va_end(cp);
+	if (len < 0)
+		return;
+
+	if (d->len + len + 1 > d->cap) {
+		d->cap = (d->len + len + 1) * 2;
+		d->buf = realloc(d->buf, d->cap);
+	}
+	vsnprintf(d->buf + d->len, len + 1, frmt, ap);
+	d->len += len;
+}
+
+static void diag(struct diag *d, const char *frmt, ...)
+{
+	va_list ap;
+	va_start(ap, frmt);
+	vdiag(d, frmt, ap);
+	va_end(ap);
+}
+
+void fatal(void)
+{
+	jmp_buf *env = thread_catcher();
+	if (env)
+		longjmp(*env, 1);
+
+	struct tu *u = curtu();
+	longjmp(u ? u->fatal_env : fatal_env, 1);
+}
 
 void report(enum errorty ty, struct token *tok, const char *frmt, ...)
 {
@@ -37,6 +83,9 @@ void report(enum errorty ty, struct token *tok, const char *frmt, ...)
 	if (!option_warnings() && (ty & E_WARNING))
 		return;
 
+	struct tu *u = curtu();
+	struct diag d = { 0 };
+
 	bool colors =
 #ifndef BUILDFOR_WINDOWS
 		isext(EX_DIAGNOSTICS_COLOR) || getenv("ACC_COLORS");
@@ -44,47 +93,58 @@ void report(enum errorty ty, struct token *tok, const char *frmt, ...)
 		false;
 #endif
 
-	fprintf(stderr, ANSI_BOLD(colors));
+	diag(&d, ANSI_BOLD(colors));
 
 	if (!(ty & E_HIDE_LOCATION))
-		fprintf(stderr, "%s:%d:%d: ", currentfile ?
-			currentfile : "<stdin>", get_line(), get_column());
+		diag(&d, "%s:%d:%d: ", u && u->file ?
+			u->file : "<stdin>", get_line(), get_column());
 	else
-		fprintf(stderr, "acc: ");
+		diag(&d, "acc: ");
 
 	if (ty & E_FATAL) {
-		fprintf(stderr, ANSI_RED(colors));
-		fprintf(stderr, "fatal error: ");
+		diag(&d, ANSI_RED(colors));
+		diag(&d, "fatal error: ");
 	} else if (ty & E_WARNING) {
-		fprintf(stderr, ANSI_MAGENTA(colors));
-		fprintf(stderr, "warning: ");
+		diag(&d, ANSI_MAGENTA(colors));
+		diag(&d, "warning: ");
 	} else {
-		fprintf(stderr, ANSI_RED(colors));
-		fprintf(stderr, "error: ");
+		diag(&d, ANSI_RED(colors));
+		diag(&d, "error: ");
 	}
 
-	fprintf(stderr, ANSI_RESET(colors));
+	diag(&d, ANSI_RESET(colors));
 
 	va_start(ap, frmt);
-	vfprintf(stderr, frmt, ap);
+	vdiag(&d, frmt, ap);
 	va_end(ap);
 
-	fprintf(stderr, "\n");
+	diag(&d, "\n");
 	if (!(ty & E_HIDE_TOKEN) && tok->linestr) {
-		fprintf(stderr, "%s\n", tok->linestr);
+		diag(&d, "%s\n", tok->linestr);
 		for (int i = 0; i < tok->column - 1; ++i) {
 			if (tok->linestr[i] == '\t')
-				fprintf(stderr, "\t");
+				diag(&d, "\t");
 			else
-				fprintf(stderr, " ");
+				diag(&d, " ");
 		}
-		fprintf(stderr, ANSI_BOLD(colors));
-		fprintf(stderr, ANSI_GREEN(colors));
-		fprintf(stderr, "^");
-		fprintf(stderr, ANSI_RESET(colors));
-		fprintf(stderr, "\n");
+		diag(&d, ANSI_BOLD(colors));
+		diag(&d, ANSI_GREEN(colors));
+		diag(&d, "^");
+		diag(&d, ANSI_RESET(colors));
+		diag(&d, "\n");
+	}
+
+	tu_diag(u, d.buf, d.len);
+	free(d.buf);
+
+	if (!(ty & E_WARNING) && u) {
+		mutex_lock(u->diaglock);
+		u->failed = true;
+		mutex_unlock(u->diaglock);
+	} else if (!(ty & E_WARNING)) {
+		reported_error = true;
 	}
 
 	if (ty & E_FATAL)
-		longjmp(fatal_env, 1);
+		fatal();
 }
@@ -0,0 +1,83 @@
+/*
+ * Hashing
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include <acc/hash.h>
+
+/*
+ * Two independent halves: FNV-1a, and a multiply-and-shift hash with
+ * the golden ratio, so that inputs colliding in one are unlikely to collide
+ * in the other
+ */
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+#define GOLDEN 0x9e3779b97f4a7c15ull
+
+void hash_init(struct hash *h)
+{
+	h->a = FNV_OFFSET;
+	h->b = GOLDEN;
+}
+
+void hash_bytes(struct hash *h, const void *p, size_t len)
+{
+	const unsigned char *bytes = p;
+	uint64_t a = h->a, b = h->b;
+	for (size_t i = 0; i < len; ++i) {
+		a = (a ^ bytes[i]) * FNV_PRIME;
+		b = (b + bytes[i] + 1) * GOLDEN;
+		b ^= b >> 29;
+	}
+	h->a = a;
+	h->b = b;
+}
+
+void hash_str(struct hash *h, const char *str)
+{
+	hash_bytes(h, str, strlen(str) + 1);
+}
+
+void hash_int(struct hash *h, long v)
+{
+	// byte by byte, so that the hash doesn't depend on the byte order
+	unsigned char bytes[sizeof(long)];
+	unsigned long u = v;
+	for (int i = 0; i < sizeof(long); ++i) {
+		bytes[i] = u & 0xff;
+		u >>= 8;
+	}
+	hash_bytes(h, bytes, sizeof(long));
+}
+
+bool hash_eq(const struct hash *l, const struct hash *r)
+{
+	return l->a == r->a && l->b == r->b;
+}
+
+void hash_hex(const struct hash *h, char *buf)
+{
+	static const char digits[] = "0123456789abcdef";
+	uint64_t halves[2] = { h->a, h->b };
+	for (int i = 0; i < HASH_HEXLEN; ++i) {
+		uint64_t half = halves[i / 16];
+		*buf++ = digits[(half >> (60 - (i % 16) * 4)) & 0xf];
+	}
+	*buf = '\0';
+}
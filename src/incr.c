@@ -0,0 +1,336 @@
+/*
+ * Incremental compilation
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <acc/parsing/file.h>
+#include <acc/incr.h>
+#include <acc/cache.h>
+#include <acc/hash.h>
+
+/*
+ * The database starts with MAGIC, followed by the entries: the two halves of
+ * the key, the length and the text of the code, and the number of constants
+ * and each of their bits and sizes, all numbers eight bytes little-endian.
+ * Databases of code with labels named differently start differently.
+ */
+#define MAGIC "accfdb\2\n"
+#define MAGICLEN 8
+
+struct fnentry {
+	struct hash key;
+	struct fncode *code;
+	bool keep;
+};
+
+// a function that was looked up
+struct fnkey {
+	struct itm_container *fn;
+	struct hash key;
+	bool found;
+};
+
+struct incrdb {
+	char *path;
+	struct fnentry *entries;	// sorted by key
+	size_t n;
+	struct fnentry *added;
+	size_t nadded, capadded;
+	struct fnkey *fns;
+	int nfns;
+};
+
+static void delete_fncode(struct fncode *code)
+{
+	free(code->text);
+	free(code->consts);
+	free(code);
+}
+
+static int cmpkey(const struct hash *l, const struct hash *r)
+{
+	if (l->a != r->a)
+		return l->a < r->a ? -1 : 1;
+	if (l->b != r->b)
+		return l->b < r->b ? -1 : 1;
+	return 0;
+}
+
+static int cmpentry(const void *l, const void *r)
+{
+	return cmpkey(&((const struct fnentry *)l)->key,
+		&((const struct fnentry *)r)->key);
+}
+
+static bool getnum(FILE *f, uint64_t *v)
+{
+	unsigned char bytes[8];
+	if (fread(bytes, 1, 8, f) != 8)
+		return false;
+	*v = 0;
+	for (int i = 7; i >= 0; --i)
+		*v = *v << 8 | bytes[i];
+	return true;
+}
+
+static void putnum(FILE *f, uint64_t v)
+{
+	unsigned char bytes[8];
+	for (int i = 0; i < 8; ++i) {
+		bytes[i] = v & 0xff;
+		v >>= 8;
+	}
+	fwrite(bytes, 1, 8, f);
+}
+
+static struct fncode *readcode(FILE *f)
+{
+	uint64_t len, nconsts;
+	if (!getnum(f, &len))
+		return NULL;
+
+	struct fncode *code = calloc(1, sizeof(struct fncode));
+	code->len = len;
+	code->text = malloc(len);
+	if (fread(code->text, 1, len, f) != len || !getnum(f, &nconsts))
+		goto fail;
+
+	code->nconsts = nconsts;
+	code->consts = malloc(nconsts * sizeof(struct fnconst));
+	for (int k = 0; k < code->nconsts; ++k) {
+		uint64_t size;
+		if (!getnum(f, &code->consts[k].bits) || !getnum(f, &size))
+			goto fail;
+		code->consts[k].size = size;
+	}
+	return code;
+
+fail:
+	delete_fncode(code);
+	return NULL;
+}
+
+static void writeentry(FILE *f, struct fnentry *e)
+{
+	putnum(f, e->key.a);
+	putnum(f, e->key.b);
+	putnum(f, e->code->len);
+	fwrite(e->code->text, 1, e->code->len, f);
+	putnum(f, e->code->nconsts);
+	for (int k = 0; k < e->code->nconsts; ++k) {
+		putnum(f, e->code->consts[k].bits);
+		putnum(f, e->code->consts[k].size);
+	}
+}
+
+struct incrdb *incr_open(const char *path)
+{
+	struct incrdb *db = calloc(1, sizeof(struct incrdb));
+	db->path = malloc(strlen(path) + 1);
+	strcpy(db->path, path);
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return db;
+
+	char magic[MAGICLEN];
+	size_t cap = 0;
+	if (fread(magic, 1, MAGICLEN, f) != MAGICLEN ||
+	    memcmp(magic, MAGIC, MAGICLEN)) {
+		fclose(f);
+		return db;
+	}
+
+	// whatever comes after an entry that's cut off is lost
+	struct fnentry e;
+	while (getnum(f, &e.key.a) && getnum(f, &e.key.b) &&
+	       (e.code = readcode(f))) {
+		if (db->n == cap)
+			db->entries = realloc(db->entries,
+				(cap = cap ? cap * 2 : 64) * sizeof(struct fnentry));
+		e.keep = false;
+		db->entries[db->n++] = e;
+	}
+	fclose(f);
+
+	qsort(db->entries, db->n, sizeof(struct fnentry), &cmpentry);
+	return db;
+}
+
+void incr_close(struct incrdb *db)
+{
+	// written elsewhere first, so that it's never found cut off
+	char tmp[strlen(db->path) + 5];
+	sprintf(tmp, "%s.tmp", db->path);
+	FILE *f = fopen(tmp, "wb");
+	if (f) {
+		fwrite(MAGIC, 1, MAGICLEN, f);
+		for (size_t i = 0; i < db->n; ++i)
+			if (db->entries[i].keep)
+				writeentry(f, &db->entries[i]);
+		for (size_t i = 0; i < db->nadded; ++i)
+			writeentry(f, &db->added[i]);
+		if (fclose(f) || rename(tmp, db->path))
+			remove(tmp);
+	}
+
+	for (size_t i = 0; i < db->n; ++i)
+		delete_fncode(db->entries[i].code);
+	for (size_t i = 0; i < db->nadded; ++i)
+		delete_fncode(db->added[i].code);
+	free(db->entries);
+	free(db->added);
+	free(db->fns);
+	free(db->path);
+	free(db);
+}
+
+/*
+ * The offsets of the positions given by the tokenizer, which counts columns
+ * in characters
+ */
+struct lines {
+	size_t *starts;
+	int n;
+	size_t len;
+};
+
+static void getlines(struct lines *l, const char *src, size_t len)
+{
+	int cap = 64;
+	l->starts = malloc(cap * sizeof(size_t));
+	l->starts[0] = 0;
+	l->n = 1;
+	l->len = len;
+	for (size_t i = 0; i < len; ++i) {
+		if (src[i] != '\n')
+			continue;
+		if (l->n == cap)
+			l->starts = realloc(l->starts,
+				(cap *= 2) * sizeof(size_t));
+		l->starts[l->n++] = i + 1;
+	}
+}
+
+static size_t offset(struct lines *l, int line, int column, size_t from)
+{
+	size_t off = l->len;
+	if (line >= 1 && line <= l->n && column >= 1)
+		off = l->starts[line - 1] + column - 1;
+	if (off > l->len)
+		off = l->len;
+	return off < from ? from : off;
+}
+
+static void hashrange(struct hash *h, const char *src, size_t from, size_t to)
+{
+	hash_int(h, to - from);
+	hash_bytes(h, src + from, to - from);
+}
+
+void incr_lookup(struct incrdb *db, const char *src, size_t len,
+	struct list *decls, struct list *syms, struct fncode **codes)
+{
+	struct lines l;
+	getlines(&l, src, len);
+
+	// everything functions can depend on besides their own source
+	struct hash deps;
+	cache_key(&deps, NULL, 0);
+
+	db->fns = malloc(list_length(decls) * sizeof(struct fnkey));
+	db->nfns = 0;
+	struct declpos *pos = NULL, *next = NULL;
+	size_t start = 0, end = 0;
+	it_t it = list_iterator(decls);
+	for (iterator_next(&it, (void **)&pos); pos; pos = next) {
+		if (!iterator_next(&it, (void **)&next))
+			next = NULL;
+		start = offset(&l, pos->line, pos->column, end);
+		end = next ? offset(&l, next->line, next->column, start) : len;
+
+		if (!pos->fn) {
+			hashrange(&deps, src, start, end);
+			continue;
+		}
+
+		struct fnkey *fk = &db->fns[db->nfns++];
+		fk->fn = pos->fn;
+		fk->key = deps;
+		fk->found = false;
+		hashrange(&fk->key, src, start, end);
+
+		size_t body = offset(&l, pos->bodyline, pos->bodycolumn, start);
+		hashrange(&deps, src, start, body < end ? body : end);
+	}
+	free(l.starts);
+
+	// functions come in syms in the order they are defined in
+	struct itm_container *c;
+	int k = 0, j = 0;
+	it = list_iterator(syms);
+	while (iterator_next(&it, (void **)&c)) {
+		codes[k] = NULL;
+		if (j < db->nfns && db->fns[j].fn == c) {
+			struct fnentry e = { db->fns[j].key };
+			struct fnentry *found = bsearch(&e, db->entries, db->n,
+				sizeof(struct fnentry), &cmpentry);
+			if (found) {
+				found->keep = true;
+				codes[k] = found->code;
+				db->fns[j].found = true;
+			}
+			++j;
+		}
+		++k;
+	}
+}
+
+void incr_update(struct incrdb *db, struct list *syms, struct fncode **codes)
+{
+	struct itm_container *c;
+	int k = 0, j = 0;
+	it_t it = list_iterator(syms);
+	while (iterator_next(&it, (void **)&c)) {
+		struct fnkey *fk = NULL;
+		if (j < db->nfns && db->fns[j].fn == c)
+			fk = &db->fns[j++];
+
+		if (fk && fk->found) {
+			++k;
+			continue;
+		}
+		if (!fk) {
+			delete_fncode(codes[k++]);
+			continue;
+		}
+
+		if (db->nadded == db->capadded)
+			db->added = realloc(db->added, (db->capadded =
+				db->capadded ? db->capadded * 2 : 64) *
+				sizeof(struct fnentry));
+		struct fnentry *e = &db->added[db->nadded++];
+		e->key = fk->key;
+		e->code = codes[k++];
+		e->keep = true;
+	}
+}
@@ -24,6 +24,7 @@
 #include <acc/itm/ast.h>
 #include <acc/itm/tag.h>
 #include <acc/parsing/ast.h>
+#include <acc/timer.h>
 
 static const char *const usedstr = "used";
 const tagtype_t tt_used = &usedstr;
@@ -31,25 +32,43 @@ static const char *const endlifestr = "endlife";
 const tagtype_t tt_endlife = &endlifestr;
 static const char *const phiablestr = "phiable";
 const tagtype_t tt_phiable = &phiablestr;
+static const char *const loopdepthstr = "loopdepth";
+const tagtype_t tt_loopdepth = &loopdepthstr;
 
 static void canalias(struct itm_expr *l, struct itm_expr *r);
 
 static void a_used(struct itm_instr *strt);
 static void a_lifetime(struct itm_instr *instr);
 static void a_phiable(struct itm_instr *instr);
+static void a_loopdepth(struct itm_block *strt);
 
 static bool lifetime(struct itm_instr *instr, struct itm_block *block, struct list *done);
 
 void analyze(struct itm_block *strt, enum analysis a)
 {
-	if ((a & A_USED) == A_USED)
+	if ((a & A_USED) == A_USED) {
+		timer_start("analyze A_USED", NULL);
 		a_used(strt->first);
+		timer_stop();
+	}
 
-	if ((a & A_LIFETIME) == A_LIFETIME)
+	if ((a & A_LIFETIME) == A_LIFETIME) {
+		timer_start("analyze A_LIFETIME", NULL);
 		a_lifetime(strt->first);
+		timer_stop();
+	}
 
-	if ((a & A_PHIABLE) == A_PHIABLE)
+	if ((a & A_PHIABLE) == A_PHIABLE) {
+		timer_start("analyze A_PHIABLE", NULL);
 		a_phiable(strt->first);
+		timer_stop();
+	}
+
+	if ((a & A_LOOPDEPTH) == A_LOOPDEPTH) {
+		timer_start("analyze A_LOOPDEPTH", NULL);
+		a_loopdepth(strt);
+		timer_stop();
+	}
 }
 
 static void a_used(struct itm_instr *i)
@@ -219,3 +238,66 @@ static void a_phiable(struct itm_instr *instr)
 	if (instr->next)
 		a_phiable(instr->next);
 }
+
+static struct itm_tag *loopdepthtag(struct itm_block *b)
+{
+	struct itm_tag *tag = itm_get_tag(&b->base, tt_loopdepth);
+	if (!tag) {
+		tag = new_itm_tag(tt_loopdepth, TO_INT);
+		itm_tag_expr(&b->base, tag);
+	}
+	return tag;
+}
+
+/*
+ * Adds the natural loop of the back edge tail -> head to body, by walking
+ * predecessors from the tail until the header is reached.
+ */
+static void loopbody(struct itm_block *head, struct itm_block *tail,
+	struct list *body)
+{
+	if (list_contains(body, tail))
+		return;
+
+	list_push_back(body, tail);
+	if (tail == head)
+		return;
+
+	struct itm_block *pb;
+	it_t it = list_iterator(tail->previous);
+	while (iterator_next(&it, (void **)&pb))
+		loopbody(head, pb, body);
+}
+
+/*
+ * The parser always lays out a loop header lexically before its body, so an
+ * edge to a block that doesn't come after the current block is a back edge.
+ */
+static void a_loopdepth(struct itm_block *strt)
+{
+	struct list *seen = new_list(NULL, 0);
+
+	for (struct itm_block *b = strt; b; b = b->lexnext)
+		itm_tag_seti(loopdepthtag(b), 0);
+
+	for (struct itm_block *b = strt; b; b = b->lexnext) {
+		list_push_back(seen, b);
+
+		struct list *body = new_list(NULL, 0);
+		struct itm_block *pb;
+		it_t it = list_iterator(b->previous);
+		while (iterator_next(&it, (void **)&pb))
+			if (pb == b || !list_contains(seen, pb))
+				loopbody(b, pb, body);
+
+		struct itm_block *lb;
+		it = list_iterator(body);
+		while (iterator_next(&it, (void **)&lb)) {
+			struct itm_tag *tag = loopdepthtag(lb);
+			itm_tag_seti(tag, itm_tag_geti(tag) + 1);
+		}
+		delete_list(body, NULL);
+	}
+
+	delete_list(seen, NULL);
+}
@@ -24,6 +24,7 @@
 
 #include <acc/itm/ast.h>
 #include <acc/error.h>
+#include <acc/mem.h>
 #include <acc/term.h>
 
 static void free_dummy(struct itm_expr *e);
@@ -32,7 +33,8 @@ int64_t itm_getsi(struct itm_literal *lit)
 {
 	uint64_t u = lit->value.i;
 	uint64_t sign = 1ul << (lit->base.type->size * 8 - 1);
-	if (!(u & sign))
+	// shifting newbits by 64 below would be undefined
+	if (!(u & sign) || lit->base.type->size >= 8)
 		return (int64_t)u;
 
 	uint64_t newbits = ~(uint64_t)0;
@@ -182,7 +184,7 @@ void itm_containere_to_string(FILE *f, struct itm_expr *e)
 	assert(e != NULL);
 
 	struct itm_container *b = (struct itm_container *)e;
-	e->to_string(f, e);
+	e->type->to_string(f, e->type);
 	fprintf(f, ANSI_BOLD(ITM_COLORS));
 	fprintf(f, " @%s", b->id);
 	fprintf(f, ANSI_RESET(ITM_COLORS));
@@ -225,23 +227,23 @@ struct itm_container *new_itm_container(enum itm_linkage linkage, char *id,
 	assert(id != NULL);
 	assert(ty != NULL);
 
-	struct itm_container *c = malloc(sizeof(struct itm_container));
+	struct itm_container *c = mem_alloc(MEM_IR, sizeof(struct itm_container));
 	c->base.tags = NULL;
 	c->base.etype = ITME_CONTAINER;
 	c->base.type = new_pointer(ty);
 	c->base.free = (void (*)(struct itm_expr *))&delete_itm_container;
 	c->base.to_string = &itm_containere_to_string;
 	c->block = NULL;
-	c->id = malloc((strlen(id) + 1) * sizeof(char));
-	sprintf(c->id, "%s", id);
+	c->id = mem_strdup(MEM_IR, id);
 	c->linkage = linkage;
 	c->literals = new_list(NULL, 0);
+	c->init = NULL;
 	return c;
 }
 
 void delete_itm_container(struct itm_container *c)
 {
-	free(c->id);
+	mem_free(MEM_IR, c->id, strlen(c->id) + 1);
 
 	struct itm_expr *lit;
 	it_t it = list_iterator(c->literals);
@@ -251,18 +253,28 @@ void delete_itm_container(struct itm_container *c)
 
 	if (c->block)
 		delete_itm_block(c->block);
-	free(c);
+	mem_free(MEM_IR, c, sizeof(struct itm_container));
 }
 
 // literal and block initializers/destructors
+static void free_literal(struct itm_expr *e)
+{
+	mem_free(MEM_IR, e, sizeof(struct itm_literal));
+}
+
+static void free_undef(struct itm_expr *e)
+{
+	mem_free(MEM_IR, e, sizeof(struct itm_expr));
+}
+
 struct itm_literal *new_itm_literal(struct itm_container *c, struct ctype *ty)
 {
 	assert(ty != NULL);
-	struct itm_literal *lit = malloc(sizeof(struct itm_literal));
+	struct itm_literal *lit = mem_alloc(MEM_IR, sizeof(struct itm_literal));
 	lit->base.tags = NULL;
 	lit->base.etype = ITME_LITERAL;
 	lit->base.type = ty;
-	lit->base.free = (void (*)(struct itm_expr *))&free;
+	lit->base.free = &free_literal;
 	lit->base.to_string = &itm_literal_to_string;
 	list_push_back(c->literals, lit);
 	return lit;
@@ -271,11 +283,11 @@ struct itm_literal *new_itm_literal(struct itm_container *c, struct ctype *ty)
 struct itm_expr *new_itm_undef(struct itm_container *c, struct ctype *ty)
 {
 	assert(ty != NULL);
-	struct itm_expr *lit = malloc(sizeof(struct itm_expr));
+	struct itm_expr *lit = mem_alloc(MEM_IR, sizeof(struct itm_expr));
 	lit->tags = NULL;
 	lit->etype = ITME_UNDEF;
 	lit->type = ty;
-	lit->free = (void (*)(struct itm_expr *))&free;
+	lit->free = &free_undef;
 	lit->to_string = &itm_undef_to_string;
 	list_push_back(c->literals, lit);
 	return lit;
@@ -289,12 +301,12 @@ bool itm_hasvalue(struct itm_expr *e, int val)
 		return false;
 
 	struct itm_literal *lit = (struct itm_literal *)e;
-	return (int)lit->value.i == val;
+	return itm_getsi(lit) == val;
 }
 
 struct itm_block *new_itm_block(struct itm_container *container)
 {
-	struct itm_block *res = malloc(sizeof(struct itm_block));
+	struct itm_block *res = mem_alloc(MEM_IR, sizeof(struct itm_block));
 	res->base.type = NULL;
 	res->base.etype = ITME_BLOCK;
 	res->base.tags = NULL;
@@ -336,7 +348,7 @@ void cleanup_instr(struct itm_instr *i)
 
 	if (i->next)
 		cleanup_instr(i->next);
-	free(i);
+	mem_free(MEM_IR, i, sizeof(struct itm_instr));
 }
 
 void delete_itm_block(struct itm_block *block)
@@ -348,7 +360,7 @@ void delete_itm_block(struct itm_block *block)
 		cleanup_instr(block->first);
 	delete_list(block->previous, NULL);
 	delete_list(block->next, NULL);
-	free(block);
+	mem_free(MEM_IR, block, sizeof(struct itm_block));
 }
 
 void itm_tag_expr(struct itm_expr *e, struct itm_tag *tag)
@@ -444,11 +456,15 @@ void itm_inserti(struct itm_instr *a, struct itm_instr *before)
 {
 	if (a->previous)
 		a->previous->next = a->next;
+	else if (a->block->first == a)
+		a->block->first = a->next;
 	if (a->next)
 		a->next->previous = a->previous;
 	if (a->block->last == a)
 		a->block->last = a->previous;
 
+	// a may come from another block
+	a->block = before->block;
 	if (before->previous)
 		before->previous->next = a;
 	else
@@ -466,8 +482,15 @@ bool itm_isconst(struct itm_expr *e)
 		return true;
 
 	struct itm_instr *i = (struct itm_instr *)e;
+	if (i->id == ITM_ID(itm_itof) || i->id == ITM_ID(itm_ftoi) ||
+	    i->id == ITM_ID(itm_fext) || i->id == ITM_ID(itm_ftrunc) ||
+	    i->id == ITM_ID(itm_sext) || i->id == ITM_ID(itm_zext) ||
+	    i->id == ITM_ID(itm_trunc))
+		return itm_isconst(list_head(i->operands));
+
 	if (i->id != ITM_ID(itm_add) && i->id != ITM_ID(itm_sub) &&
 	    i->id != ITM_ID(itm_mul) && i->id != ITM_ID(itm_div) &&
+	    i->id != ITM_ID(itm_mulh) &&
 	    i->id != ITM_ID(itm_rem) && i->id != ITM_ID(itm_xor) &&
 	    i->id != ITM_ID(itm_shl) && i->id != ITM_ID(itm_shr) &&
 	    i->id != ITM_ID(itm_sal) && i->id != ITM_ID(itm_sar) &&
@@ -481,6 +504,93 @@ bool itm_isconst(struct itm_expr *e)
 	       itm_isconst(list_last(i->operands));
 }
 
+static double litgetd(struct itm_literal *lit)
+{
+	if (lit->base.type == &cfloat)
+		return lit->value.f;
+	if (hastc(lit->base.type, TC_FLOATING))
+		return lit->value.d;
+	if (hastc(lit->base.type, TC_UNSIGNED))
+		return lit->value.i;
+	return itm_getsi(lit);
+}
+
+/*
+ * Floating point evaluation, done in double precision and rounded to the
+ * result type afterwards. Also evaluates the conversions from and to
+ * floating point types.
+ */
+static struct itm_expr *itm_evalf(struct itm_instr *i,
+	struct itm_literal *l, struct itm_literal *r)
+{
+	double ld = litgetd(l);
+	double rd = litgetd(r);
+	double resd;
+
+	if (i->id == ITM_ID(itm_itof) || i->id == ITM_ID(itm_fext) ||
+	    i->id == ITM_ID(itm_ftrunc) || i->id == ITM_ID(itm_ftoi))
+		resd = ld;
+	else if (i->id == ITM_ID(itm_add))
+		resd = ld + rd;
+	else if (i->id == ITM_ID(itm_sub))
+		resd = ld - rd;
+	else if (i->id == ITM_ID(itm_mul))
+		resd = ld * rd;
+	else if (i->id == ITM_ID(itm_div))
+		resd = ld / rd;
+	else if (i->id == ITM_ID(itm_cmpeq))
+		resd = ld == rd;
+	else if (i->id == ITM_ID(itm_cmpneq))
+		resd = ld != rd;
+	else if (i->id == ITM_ID(itm_cmpgt))
+		resd = ld > rd;
+	else if (i->id == ITM_ID(itm_cmpgte))
+		resd = ld >= rd;
+	else if (i->id == ITM_ID(itm_cmplt))
+		resd = ld < rd;
+	else if (i->id == ITM_ID(itm_cmplte))
+		resd = ld <= rd;
+	else
+		return &i->base;
+
+	struct ctype *ty = i->base.type;
+	struct itm_literal *res = new_itm_literal(i->block->container, ty);
+	if (ty == &cfloat) {
+		res->value.f = resd;
+	} else if (hastc(ty, TC_FLOATING)) {
+		res->value.d = resd;
+	} else {
+		int64_t resi = (int64_t)resd;
+		uint64_t mask = 1ul << (ty->size * 8 - 1);
+		mask |= mask - 1;
+		res->value.i = (uint64_t)resi & mask;
+	}
+	return &res->base;
+}
+
+// the high half of the product of two size byte numbers
+static uint64_t mulh(uint64_t l, uint64_t r, int size, bool sign)
+{
+	if (size < 8) {
+		if (sign)
+			return (uint64_t)((int64_t)l * (int64_t)r >> size * 8);
+		return l * r >> size * 8;
+	}
+
+	uint64_t ll = l & 0xffffffffu, lh = l >> 32;
+	uint64_t rl = r & 0xffffffffu, rh = r >> 32;
+	uint64_t mid = (ll * rl >> 32) + lh * rl;
+	uint64_t mid2 = (mid & 0xffffffffu) + ll * rh;
+	uint64_t res = lh * rh + (mid >> 32) + (mid2 >> 32);
+
+	// the signed product differs by the other operand for negative ones
+	if (sign && (int64_t)l < 0)
+		res -= r;
+	if (sign && (int64_t)r < 0)
+		res -= l;
+	return res;
+}
+
 struct itm_expr *itm_eval(struct itm_expr *e)
 {
 	assert(itm_isconst(e));
@@ -501,6 +611,10 @@ struct itm_expr *itm_eval(struct itm_expr *e)
 	struct itm_literal *l = (struct itm_literal *)itm_eval(first);
 	struct itm_literal *r = (struct itm_literal *)itm_eval(second);
 
+	if (hastc(l->base.type, TC_FLOATING) ||
+	    hastc(i->base.type, TC_FLOATING))
+		return itm_evalf(i, l, r);
+
 	uint64_t li = l->value.i;
 	uint64_t ri = r->value.i;
 	int64_t lis = itm_getsi(l);
@@ -510,21 +624,36 @@ struct itm_expr *itm_eval(struct itm_expr *e)
 		int64_t s;
 	} resi;
 
+	bool isdiv = i->id == ITM_ID(itm_div) || i->id == ITM_ID(itm_rem);
+	if (isdiv && ri == 0)
+		return &i->base;
+
 	// TODO: floating point emulation
-	if (i->id == ITM_ID(itm_add))
+	if (i->id == ITM_ID(itm_sext))
+		resi.s = lis;
+	else if (i->id == ITM_ID(itm_zext) || i->id == ITM_ID(itm_trunc))
+		resi.u = li;
+	else if (i->id == ITM_ID(itm_add))
 		resi.u = li + ri;
 	else if (i->id == ITM_ID(itm_sub))
 		resi.u = li - ri;
 	else if (i->id == ITM_ID(itm_mul))
 		resi.u = li * ri;
+	else if (i->id == ITM_ID(itm_mulh))
+		resi.u = hastc(l->base.type, TC_SIGNED) ?
+			mulh(lis, ris, l->base.type->size, true) :
+			mulh(li, ri, l->base.type->size, false);
+	else if (isdiv && hastc(l->base.type, TC_SIGNED) && ris == -1)
+		// avoid the overflow trap for the most negative number
+		resi.u = i->id == ITM_ID(itm_div) ? -li : 0;
 	else if (i->id == ITM_ID(itm_div) && hastc(l->base.type, TC_UNSIGNED))
 		resi.u = li / ri;
 	else if (i->id == ITM_ID(itm_div) && hastc(l->base.type, TC_SIGNED))
 		resi.s = lis / ris;
-	else if (i->id == ITM_ID(itm_sub))
-		resi.u = li - ri;
-	else if (i->id == ITM_ID(itm_rem))
-		resi.u = l->value.i % r->value.i;
+	else if (i->id == ITM_ID(itm_rem) && hastc(l->base.type, TC_UNSIGNED))
+		resi.u = li % ri;
+	else if (i->id == ITM_ID(itm_rem) && hastc(l->base.type, TC_SIGNED))
+		resi.s = lis % ris;
 	else if (i->id == ITM_ID(itm_xor))
 		resi.u = li ^ ri;
 	else if (i->id == ITM_ID(itm_and))
@@ -536,9 +665,9 @@ struct itm_expr *itm_eval(struct itm_expr *e)
 	else if (i->id == ITM_ID(itm_shr))
 		resi.u = li >> ri;
 	else if (i->id == ITM_ID(itm_sal))
-		resi.s = lis / (1l >> ri);
+		resi.u = li << ri;
 	else if (i->id == ITM_ID(itm_sar))
-		resi.s = lis * (1l >> ri);
+		resi.s = lis >> ri;
 	else if (i->id == ITM_ID(itm_cmpeq))
 		resi.u = li == ri;
 	else if (i->id == ITM_ID(itm_cmpneq))
@@ -583,7 +712,7 @@ enum opflags {
 static struct itm_instr *impl_op(struct itm_block *b, struct ctype *type, void (*id)(void),
 	const char *operation, enum opflags opflags)
 {
-	struct itm_instr *res = malloc(sizeof(struct itm_instr));
+	struct itm_instr *res = mem_alloc(MEM_IR, sizeof(struct itm_instr));
 
 	assert(type != NULL);
 	assert(b != NULL);
@@ -659,6 +788,12 @@ static struct itm_instr *impl_cast(struct itm_block *b, struct itm_expr *l, stru
 	return res;
 }
 
+struct itm_instr *itm_append(struct itm_block *b, struct ctype *ty,
+	instr_id_t id, const char *operation, bool terminal)
+{
+	return impl_op(b, ty, id, operation, terminal ? OF_TERMINAL : OF_NONE);
+}
+
 struct itm_instr *itm_add(struct itm_block *b, struct itm_expr *l, struct itm_expr *r)
 {
 	return impl_aop(b, l, r, ITM_ID(itm_add), "add");
@@ -674,6 +809,11 @@ struct itm_instr *itm_mul(struct itm_block *b, struct itm_expr *l, struct itm_ex
 	return impl_aop(b, l, r, ITM_ID(itm_mul), "mul");
 }
 
+struct itm_instr *itm_mulh(struct itm_block *b, struct itm_expr *l, struct itm_expr *r)
+{
+	return impl_aop(b, l, r, ITM_ID(itm_mulh), "mulh");
+}
+
 struct itm_instr *itm_imul(struct itm_block *b, struct itm_expr *l, struct itm_expr *r)
 {
 	return impl_aop(b, l, r, ITM_ID(itm_imul), "imul");
@@ -829,8 +969,10 @@ struct itm_instr *itm_deepptr(struct itm_block *b, struct itm_expr *l, struct it
 		deeptype = ((struct cpointer *)deeptype)->pointsto;
 		break;
 	case STRUCTURE:
+	case UNION:
 		j = ((struct itm_literal *)r)->value.i;
-		deeptype = get_list_item(((struct cstruct *)deeptype)->fields, j);
+		deeptype = ((struct field *)get_list_item(
+			((struct cstruct *)deeptype)->fields, j))->type;
 		break;
 	case ARRAY:
 		deeptype = ((struct carray *)deeptype)->elementtype;
@@ -890,6 +1032,18 @@ struct itm_instr *itm_phi(struct itm_block *b, struct ctype *ty, struct list *di
 	return res;
 }
 
+struct itm_instr *itm_select(struct itm_block *b, struct itm_expr *c, struct itm_expr *t, struct itm_expr *f)
+{
+	struct itm_instr *res;
+	res = impl_op(b, t->type, ITM_ID(itm_select), "select", OF_NONE);
+
+	list_push_back(res->operands, c);
+	list_push_back(res->operands, t);
+	list_push_back(res->operands, f);
+
+	return res;
+}
+
 struct itm_instr *itm_jmp(struct itm_block *b, struct itm_block *to)
 {
 	struct itm_instr *res;
@@ -0,0 +1,954 @@
+/*
+ * Binary intermediate representation
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// for mmap(), where there is such a thing
+#ifdef __unix__
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <acc/itm/bin.h>
+#include <acc/itm/ast.h>
+#include <acc/parsing/ast.h>
+#include <acc/error.h>
+#include <acc/hash.h>
+
+/*
+ * All numbers are unsigned LEB128 varints. A file is laid out as follows,
+ * types, strings, containers, literals, blocks and instructions each being
+ * referred to by their index in the order they come in:
+ *
+ * file     := MAGIC #strings #types #containers
+ *             string* type* fields* head* body*
+ * string   := length bytes		// with the terminating null
+ * type     := TY_PRIMITIVE primitive
+ *           | TY_POINTER type
+ *           | TY_QUALIFIED type qualifiers
+ *           | TY_FUNCTION type #params (type name)*
+ *           | (TY_STRUCT | TY_UNION) name size
+ * fields   := #fields (type name)*	// for each struct and union type
+ * head     := name linkage type	// the type it's a pointer to
+ * body     := #literals literal* init #blocks block* instr*
+ * literal  := LIT_VALUE type bits | LIT_UNDEF type
+ * block    := #previous index* #next index* #instrs
+ * instr    := opcode type typeoperand #operands operand*
+ * operand  := index << 2 | OP_LITERAL, OP_INSTR, OP_BLOCK or OP_CONTAINER
+ *
+ * Names are string indexes plus one, zero for none, and so are typeoperand a
+ * type index and init a literal index. Literals, blocks and instructions are numbered per container,
+ * and the blocks of a container that is only declared are left out.
+ */
+#define MAGIC "accir\0\2\n"
+#define MAGICLEN 8
+
+enum {
+	TY_PRIMITIVE,
+	TY_POINTER,
+	TY_QUALIFIED,
+	TY_FUNCTION,
+	TY_STRUCT,
+	TY_UNION
+};
+
+enum {
+	LIT_VALUE,
+	LIT_UNDEF
+};
+
+enum {
+	OP_LITERAL,
+	OP_INSTR,
+	OP_BLOCK,
+	OP_CONTAINER
+};
+
+static struct ctype *primitives[] = {
+	&cint, &cshort, &clong, &cuint, &cushort, &culong, &clonglong,
+	&culonglong, &cchar, &cuchar, &cfloat, &cdouble, &cvoid, &clongdouble,
+	&cbool
+};
+#define NPRIMITIVES (sizeof(primitives) / sizeof(struct ctype *))
+
+static const struct opcode {
+	instr_id_t id;
+	const char *operation;
+	bool terminal;
+} opcodes[] = {
+	{ ITM_ID(itm_add), "add", false },
+	{ ITM_ID(itm_sub), "sub", false },
+	{ ITM_ID(itm_mul), "mul", false },
+	{ ITM_ID(itm_mulh), "mulh", false },
+	{ ITM_ID(itm_imul), "imul", false },
+	{ ITM_ID(itm_div), "div", false },
+	{ ITM_ID(itm_idiv), "idiv", false },
+	{ ITM_ID(itm_rem), "rem", false },
+	{ ITM_ID(itm_shl), "shl", false },
+	{ ITM_ID(itm_shr), "shr", false },
+	{ ITM_ID(itm_sal), "sal", false },
+	{ ITM_ID(itm_sar), "sar", false },
+	{ ITM_ID(itm_or), "or", false },
+	{ ITM_ID(itm_and), "and", false },
+	{ ITM_ID(itm_xor), "xor", false },
+	{ ITM_ID(itm_cmpeq), "cmp eq", false },
+	{ ITM_ID(itm_cmpneq), "cmp neq", false },
+	{ ITM_ID(itm_cmpgt), "cmp gt", false },
+	{ ITM_ID(itm_cmpgte), "cmp gte", false },
+	{ ITM_ID(itm_cmplt), "cmp lt", false },
+	{ ITM_ID(itm_cmplte), "cmp lte", false },
+	{ ITM_ID(itm_bitcast), "bitcast", false },
+	{ ITM_ID(itm_trunc), "trunc", false },
+	{ ITM_ID(itm_ftrunc), "ftrunc", false },
+	{ ITM_ID(itm_zext), "zext", false },
+	{ ITM_ID(itm_sext), "sext", false },
+	{ ITM_ID(itm_fext), "fext", false },
+	{ ITM_ID(itm_itof), "itof", false },
+	{ ITM_ID(itm_ftoi), "ftoi", false },
+	{ ITM_ID(itm_getptr), "getptr", false },
+	{ ITM_ID(itm_deepptr), "deepptr", false },
+	{ ITM_ID(itm_alloca), "alloca", false },
+	{ ITM_ID(itm_load), "load", false },
+	{ ITM_ID(itm_store), "store", false },
+	{ ITM_ID(itm_phi), "phi", false },
+	{ ITM_ID(itm_select), "select", false },
+	{ ITM_ID(itm_jmp), "jmp", true },
+	{ ITM_ID(itm_split), "split", true },
+	{ ITM_ID(itm_ret), "ret", true },
+	{ ITM_ID(itm_leave), "leave", true },
+	{ ITM_ID(itm_mov), "mov", false },
+	{ ITM_ID(itm_clobb), "clobb", false }
+};
+#define NOPCODES (sizeof(opcodes) / sizeof(struct opcode))
+
+// float literals keep their value in value.f, other floating ones in value.d
+static bool isfloat(struct ctype *ty)
+{
+	return hastc(ty, TC_FLOATING) && ty->size == sizeof(float);
+}
+
+/*
+ * Writing
+ */
+
+struct buf {
+	unsigned char *data;
+	size_t len, cap;
+};
+
+static void putbytes(struct buf *b, const void *p, size_t len)
+{
+	if (b->len + len > b->cap) {
+		while (b->len + len > b->cap)
+			b->cap = b->cap ? b->cap * 2 : 256;
+		b->data = realloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->len, p, len);
+	b->len += len;
+}
+
+static void putvar(struct buf *b, uint64_t v)
+{
+	unsigned char bytes[10];
+	int n = 0;
+	do {
+		bytes[n] = v & 0x7f;
+		v >>= 7;
+		if (v)
+			bytes[n] |= 0x80;
+		++n;
+	} while (v);
+	putbytes(b, bytes, n);
+}
+
+/*
+ * An open-addressing table from pointers, or from strings if strings is set,
+ * to indexes
+ */
+struct table {
+	const void **keys;
+	int *vals;
+	size_t cap, n;
+	bool strings;
+};
+
+static size_t slot(struct table *t, const void *key)
+{
+	struct hash h;
+	hash_init(&h);
+	if (t->strings)
+		hash_str(&h, key);
+	else
+		hash_bytes(&h, &key, sizeof(key));
+
+	size_t k = h.a & (t->cap - 1);
+	while (t->keys[k] && (t->strings ? strcmp(t->keys[k], key) :
+	                      t->keys[k] != key))
+		k = (k + 1) & (t->cap - 1);
+	return k;
+}
+
+static int table_get(struct table *t, const void *key)
+{
+	if (!t->n)
+		return -1;
+	size_t k = slot(t, key);
+	return t->keys[k] ? t->vals[k] : -1;
+}
+
+static void table_put(struct table *t, const void *key, int val)
+{
+	if ((t->n + 1) * 2 > t->cap) {
+		struct table old = *t;
+		t->cap = t->cap ? t->cap * 2 : 64;
+		t->keys = calloc(t->cap, sizeof(void *));
+		t->vals = malloc(t->cap * sizeof(int));
+		t->n = 0;
+		for (size_t k = 0; k < old.cap; ++k)
+			if (old.keys[k])
+				table_put(t, old.keys[k], old.vals[k]);
+		free(old.keys);
+		free(old.vals);
+	}
+
+	size_t k = slot(t, key);
+	if (!t->keys[k])
+		++t->n;
+	t->keys[k] = key;
+	t->vals[k] = val;
+}
+
+static void table_clear(struct table *t)
+{
+	free(t->keys);
+	free(t->vals);
+	memset(t, 0, sizeof(struct table));
+}
+
+struct writer {
+	struct buf strings, types, fields, heads, bodies;
+	int nstrings, ntypes, nconts;
+	struct table strtab, typetab, conttab;
+	int *ptrof;			// the pointer type to each type, or -1
+	struct list *structs, *conts;	// in the order of their indexes
+
+	// numbering the expressions of the container being written
+	struct table exprs;
+	struct itm_expr **lits;
+	int nlits, caplits;
+};
+
+static int putname(struct writer *w, const char *str)
+{
+	if (!str)
+		return 0;
+	int k = table_get(&w->strtab, str);
+	if (k < 0) {
+		k = w->nstrings++;
+		table_put(&w->strtab, str, k);
+		size_t len = strlen(str) + 1;
+		putvar(&w->strings, len);
+		putbytes(&w->strings, str, len);
+	}
+	return k + 1;
+}
+
+static int newtype(struct writer *w, struct ctype *ty)
+{
+	int k = w->ntypes++;
+	table_put(&w->typetab, ty, k);
+	w->ptrof = realloc(w->ptrof, w->ntypes * sizeof(int));
+	w->ptrof[k] = -1;
+	return k;
+}
+
+static int puttype(struct writer *w, struct ctype *ty)
+{
+	int k = table_get(&w->typetab, ty);
+	if (k >= 0)
+		return k;
+
+	struct symbol *sym;
+	it_t it;
+	int sub;
+	switch (ty->type) {
+	case PRIMITIVE:
+		for (sub = 0; sub < NPRIMITIVES; ++sub)
+			if (primitives[sub] == ty)
+				break;
+		if (sub == NPRIMITIVES)
+			break;
+		putvar(&w->types, TY_PRIMITIVE);
+		putvar(&w->types, sub);
+		return newtype(w, ty);
+	case POINTER:
+		// pointers are made anew wherever they're needed
+		sub = puttype(w, ((struct cpointer *)ty)->pointsto);
+		if (w->ptrof[sub] >= 0) {
+			table_put(&w->typetab, ty, w->ptrof[sub]);
+			return w->ptrof[sub];
+		}
+		putvar(&w->types, TY_POINTER);
+		putvar(&w->types, sub);
+		k = newtype(w, ty);
+		w->ptrof[sub] = k;
+		return k;
+	case QUALIFIED:
+		sub = puttype(w, ((struct cqualified *)ty)->type);
+		putvar(&w->types, TY_QUALIFIED);
+		putvar(&w->types, sub);
+		putvar(&w->types, ((struct cqualified *)ty)->qualifiers);
+		return newtype(w, ty);
+	case FUNCTION:
+		sub = puttype(w, ((struct cfunction *)ty)->ret);
+		it = list_iterator(((struct cfunction *)ty)->parameters);
+		while (iterator_next(&it, (void **)&sym))
+			puttype(w, sym->type);
+
+		putvar(&w->types, TY_FUNCTION);
+		putvar(&w->types, sub);
+		putvar(&w->types,
+			list_length(((struct cfunction *)ty)->parameters));
+		it = list_iterator(((struct cfunction *)ty)->parameters);
+		while (iterator_next(&it, (void **)&sym)) {
+			putvar(&w->types, puttype(w, sym->type));
+			putvar(&w->types, putname(w, sym->id));
+		}
+		return newtype(w, ty);
+	case STRUCTURE:
+	case UNION:
+		// their fields come later, as they may point back to them
+		putvar(&w->types, ty->type == STRUCTURE ? TY_STRUCT : TY_UNION);
+		putvar(&w->types, putname(w, ty->name));
+		putvar(&w->types, ty->size);
+		list_push_back(w->structs, ty);
+		return newtype(w, ty);
+	default:
+		break;
+	}
+
+	report(E_INTERNAL, NULL, "can't write type to intermediate file");
+	return 0;
+}
+
+static void putfields(struct writer *w)
+{
+	// fields may bring in other structs, which are added to the end
+	struct cstruct *cs;
+	for (int k = 0; k < list_length(w->structs); ++k) {
+		cs = get_list_item(w->structs, k);
+		struct field *fi;
+		it_t it = list_iterator(cs->fields);
+		while (iterator_next(&it, (void **)&fi))
+			puttype(w, fi->type);
+
+		putvar(&w->fields, list_length(cs->fields));
+		it = list_iterator(cs->fields);
+		while (iterator_next(&it, (void **)&fi)) {
+			putvar(&w->fields, puttype(w, fi->type));
+			putvar(&w->fields, putname(w, fi->id));
+		}
+	}
+}
+
+static int putcont(struct writer *w, struct itm_container *c)
+{
+	int k = table_get(&w->conttab, c);
+	if (k < 0) {
+		k = w->nconts++;
+		table_put(&w->conttab, c, k);
+		list_push_back(w->conts, c);
+	}
+	return k;
+}
+
+static int putlit(struct writer *w, struct itm_expr *lit)
+{
+	int k = table_get(&w->exprs, lit);
+	if (k >= 0)
+		return k;
+
+	if (w->nlits == w->caplits)
+		w->lits = realloc(w->lits, (w->caplits =
+			w->caplits ? w->caplits * 2 : 64) *
+			sizeof(struct itm_expr *));
+	k = w->nlits;
+	w->lits[w->nlits++] = lit;
+	table_put(&w->exprs, lit, k);
+	return k;
+}
+
+static const struct opcode *getopcode(struct itm_instr *i)
+{
+	for (int k = 0; k < NOPCODES; ++k)
+		if (opcodes[k].id == i->id)
+			return &opcodes[k];
+
+	report(E_INTERNAL, NULL, "can't write %s to intermediate file",
+		i->operation);
+	return NULL;
+}
+
+static void putoperand(struct writer *w, struct buf *b, struct itm_expr *e)
+{
+	switch (e->etype) {
+	case ITME_LITERAL:
+	case ITME_UNDEF:
+		putvar(b, (uint64_t)putlit(w, e) << 2 | OP_LITERAL);
+		break;
+	case ITME_INSTRUCTION:
+		putvar(b, (uint64_t)table_get(&w->exprs, e) << 2 | OP_INSTR);
+		break;
+	case ITME_BLOCK:
+		putvar(b, (uint64_t)table_get(&w->exprs, e) << 2 | OP_BLOCK);
+		break;
+	case ITME_CONTAINER:
+		putvar(b, (uint64_t)putcont(w, (struct itm_container *)e) << 2 |
+			OP_CONTAINER);
+		break;
+	}
+}
+
+static void putlits(struct writer *w, struct buf *b)
+{
+	putvar(b, w->nlits);
+	for (int k = 0; k < w->nlits; ++k) {
+		struct itm_expr *e = w->lits[k];
+		if (e->etype == ITME_UNDEF) {
+			putvar(b, LIT_UNDEF);
+			putvar(b, puttype(w, e->type));
+			continue;
+		}
+
+		struct itm_literal *lit = (struct itm_literal *)e;
+		uint64_t bits = lit->value.i;
+		if (isfloat(e->type)) {
+			uint32_t fbits;
+			memcpy(&fbits, &lit->value.f, sizeof(fbits));
+			bits = fbits;
+		} else if (hastc(e->type, TC_FLOATING)) {
+			memcpy(&bits, &lit->value.d, sizeof(bits));
+		}
+		putvar(b, LIT_VALUE);
+		putvar(b, puttype(w, e->type));
+		putvar(b, bits);
+	}
+}
+
+static void putblocks(struct writer *w, struct buf *b, struct itm_block *first)
+{
+	struct itm_block *bl, *other;
+	it_t it;
+	for (bl = first; bl; bl = bl->lexnext) {
+		putvar(b, list_length(bl->previous));
+		it = list_iterator(bl->previous);
+		while (iterator_next(&it, (void **)&other))
+			putvar(b, table_get(&w->exprs, other));
+		putvar(b, list_length(bl->next));
+		it = list_iterator(bl->next);
+		while (iterator_next(&it, (void **)&other))
+			putvar(b, table_get(&w->exprs, other));
+
+		int n = 0;
+		for (struct itm_instr *i = bl->first; i; i = i->next)
+			++n;
+		putvar(b, n);
+	}
+}
+
+static void putbody(struct writer *w, struct itm_container *c)
+{
+	table_clear(&w->exprs);
+	w->nlits = 0;
+
+	// literals go first, but operands may bring in more of them
+	struct itm_expr *lit;
+	it_t it = list_iterator(c->literals);
+	while (iterator_next(&it, (void **)&lit))
+		putlit(w, lit);
+	int init = c->init ? putlit(w, &c->init->base) + 1 : 0;
+
+	int nblocks = 0, ninstrs = 0;
+	for (struct itm_block *b = c->block; b; b = b->lexnext) {
+		table_put(&w->exprs, b, nblocks++);
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			table_put(&w->exprs, i, ninstrs++);
+	}
+
+	struct buf instrs = { 0 };
+	for (struct itm_block *b = c->block; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			putvar(&instrs, getopcode(i) - opcodes);
+			putvar(&instrs, puttype(w, i->base.type));
+			putvar(&instrs, i->typeoperand ?
+				puttype(w, i->typeoperand) + 1 : 0);
+			putvar(&instrs, list_length(i->operands));
+
+			struct itm_expr *e;
+			it = list_iterator(i->operands);
+			while (iterator_next(&it, (void **)&e))
+				putoperand(w, &instrs, e);
+		}
+	}
+
+	putlits(w, &w->bodies);
+	putvar(&w->bodies, init);
+	putvar(&w->bodies, nblocks);
+	putblocks(w, &w->bodies, c->block);
+	putbytes(&w->bodies, instrs.data, instrs.len);
+	free(instrs.data);
+}
+
+void itm_write(FILE *f, struct list *containers)
+{
+	struct writer w;
+	memset(&w, 0, sizeof(struct writer));
+	w.strtab.strings = true;
+	w.structs = new_list(NULL, 0);
+	w.conts = new_list(NULL, 0);
+
+	struct itm_container *c;
+	it_t it = list_iterator(containers);
+	while (iterator_next(&it, (void **)&c))
+		putcont(&w, c);
+
+	// those referred to are added to the end
+	for (int k = 0; k < list_length(w.conts); ++k) {
+		c = get_list_item(w.conts, k);
+		putvar(&w.heads, putname(&w, c->id));
+		putvar(&w.heads, c->linkage);
+		putvar(&w.heads, puttype(&w,
+			((struct cpointer *)c->base.type)->pointsto));
+		putbody(&w, c);
+	}
+	putfields(&w);
+
+	struct buf head = { 0 };
+	putbytes(&head, MAGIC, MAGICLEN);
+	putvar(&head, w.nstrings);
+	putvar(&head, w.ntypes);
+	putvar(&head, w.nconts);
+	fwrite(head.data, 1, head.len, f);
+	fwrite(w.strings.data, 1, w.strings.len, f);
+	fwrite(w.types.data, 1, w.types.len, f);
+	fwrite(w.fields.data, 1, w.fields.len, f);
+	fwrite(w.heads.data, 1, w.heads.len, f);
+	fwrite(w.bodies.data, 1, w.bodies.len, f);
+
+	free(head.data);
+	free(w.strings.data);
+	free(w.types.data);
+	free(w.fields.data);
+	free(w.heads.data);
+	free(w.bodies.data);
+	table_clear(&w.strtab);
+	table_clear(&w.typetab);
+	table_clear(&w.conttab);
+	table_clear(&w.exprs);
+	free(w.ptrof);
+	free(w.lits);
+	delete_list(w.structs, NULL);
+	delete_list(w.conts, NULL);
+}
+
+/*
+ * Reading
+ */
+
+struct reader {
+	const unsigned char *p, *end;
+	bool bad;
+
+	const char **strings;
+	struct ctype **types;
+	uint64_t nstrings, ntypes, nconts;
+	struct itm_container **conts;
+};
+
+static uint64_t getvar(struct reader *r)
+{
+	uint64_t v = 0;
+	for (int shift = 0; r->p < r->end; shift += 7) {
+		unsigned char b = *r->p++;
+		if (shift < 64)
+			v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+	r->bad = true;
+	return 0;
+}
+
+// an index below n
+static uint64_t getindex(struct reader *r, uint64_t n)
+{
+	uint64_t k = getvar(r);
+	if (k >= n) {
+		r->bad = true;
+		return 0;
+	}
+	return k;
+}
+
+static struct ctype *gettype(struct reader *r)
+{
+	return r->ntypes ? r->types[getindex(r, r->ntypes)] : NULL;
+}
+
+static char *getname(struct reader *r)
+{
+	uint64_t k = getindex(r, r->nstrings + 1);
+	return k ? (char *)r->strings[k - 1] : NULL;
+}
+
+static bool getstrings(struct reader *r)
+{
+	r->strings = malloc((r->nstrings + 1) * sizeof(char *));
+	for (uint64_t k = 0; k < r->nstrings && !r->bad; ++k) {
+		uint64_t len = getvar(r);
+		if (!len || len > r->end - r->p || r->p[len - 1]) {
+			r->bad = true;
+			break;
+		}
+		r->strings[k] = (const char *)r->p;
+		r->p += len;
+	}
+	return !r->bad;
+}
+
+static struct ctype *readtype(struct reader *r, uint64_t k)
+{
+	// only types before it can be referred to
+	uint64_t ntypes = r->ntypes;
+	r->ntypes = k;
+
+	struct ctype *ty = NULL, *sub;
+	struct list *params;
+	uint64_t n;
+	switch (getvar(r)) {
+	case TY_PRIMITIVE:
+		ty = primitives[getindex(r, NPRIMITIVES)];
+		break;
+	case TY_POINTER:
+		if ((sub = gettype(r)))
+			ty = new_pointer(sub);
+		break;
+	case TY_QUALIFIED:
+		if ((sub = gettype(r)))
+			ty = new_qualified(sub, getvar(r));
+		break;
+	case TY_FUNCTION:
+		sub = gettype(r);
+		n = getvar(r);
+		params = new_list(NULL, 0);
+		for (uint64_t j = 0; j < n && !r->bad; ++j) {
+			struct ctype *pty = gettype(r);
+			char *id = getname(r);
+			if (pty)
+				list_push_back(params,
+					new_symbol(pty, id, SC_DEFAULT, false));
+		}
+		if (sub)
+			ty = new_function(sub, params);
+		delete_list(params, NULL);
+		break;
+	case TY_STRUCT:
+	case TY_UNION:
+		ty = new_struct(getname(r));
+		ty->size = getvar(r);
+		break;
+	}
+
+	r->ntypes = ntypes;
+	if (!ty)
+		r->bad = true;
+	return ty;
+}
+
+static bool gettypes(struct reader *r)
+{
+	r->types = malloc((r->ntypes + 1) * sizeof(struct ctype *));
+	for (uint64_t k = 0; k < r->ntypes && !r->bad; ++k)
+		r->types[k] = readtype(r, k);
+
+	for (uint64_t k = 0; k < r->ntypes && !r->bad; ++k) {
+		struct ctype *ty = r->types[k];
+		if (ty->type != STRUCTURE && ty->type != UNION)
+			continue;
+
+		uint64_t n = getvar(r);
+		for (uint64_t j = 0; j < n && !r->bad; ++j) {
+			struct ctype *fty = gettype(r);
+			char *id = getname(r);
+			if (!r->bad)
+				struct_add_field(ty, fty, id ? id : "");
+		}
+	}
+	return !r->bad;
+}
+
+static bool getheads(struct reader *r)
+{
+	r->conts = calloc(r->nconts + 1, sizeof(struct itm_container *));
+	for (uint64_t k = 0; k < r->nconts && !r->bad; ++k) {
+		char *id = getname(r);
+		uint64_t linkage = getindex(r, IL_EXTERN + 1);
+		struct ctype *ty = gettype(r);
+		if (!id || !ty) {
+			r->bad = true;
+			break;
+		}
+		r->conts[k] = new_itm_container(linkage, id, ty);
+	}
+	return !r->bad;
+}
+
+static void getlits(struct reader *r, struct itm_container *c,
+	struct itm_expr **lits, uint64_t n)
+{
+	for (uint64_t k = 0; k < n && !r->bad; ++k) {
+		uint64_t kind = getvar(r);
+		struct ctype *ty = gettype(r);
+		if (r->bad)
+			break;
+		if (kind == LIT_UNDEF) {
+			lits[k] = new_itm_undef(c, ty);
+			continue;
+		}
+
+		struct itm_literal *lit = new_itm_literal(c, ty);
+		uint64_t bits = getvar(r);
+		lit->value.i = 0;
+		if (isfloat(ty)) {
+			uint32_t fbits = bits;
+			memcpy(&lit->value.f, &fbits, sizeof(fbits));
+		} else if (hastc(ty, TC_FLOATING)) {
+			memcpy(&lit->value.d, &bits, sizeof(bits));
+		} else {
+			lit->value.i = bits;
+		}
+		lits[k] = &lit->base;
+	}
+}
+
+/*
+ * Reads the instructions of a container, numbering nblocks blocks and
+ * ninstrs instructions, of which each block has the number in counts. Done
+ * twice: once to make them, and once to give them their operands, which may
+ * refer to instructions further on.
+ */
+struct body {
+	struct itm_expr **lits;
+	struct itm_block **blocks;
+	struct itm_instr **instrs;
+	uint64_t nlits, nblocks, ninstrs;
+	uint64_t *counts;
+};
+
+static struct itm_expr *getoperand(struct reader *r, struct body *b)
+{
+	uint64_t v = getvar(r), k = v >> 2;
+	switch (v & 3) {
+	case OP_LITERAL:
+		if (k < b->nlits)
+			return b->lits[k];
+		break;
+	case OP_INSTR:
+		if (k < b->ninstrs)
+			return &b->instrs[k]->base;
+		break;
+	case OP_BLOCK:
+		if (k < b->nblocks)
+			return &b->blocks[k]->base;
+		break;
+	case OP_CONTAINER:
+		if (k < r->nconts)
+			return &r->conts[k]->base;
+		break;
+	}
+	r->bad = true;
+	return NULL;
+}
+
+static void getinstrs(struct reader *r, struct body *b, bool operands)
+{
+	uint64_t k = 0;
+	for (uint64_t j = 0; j < b->nblocks; ++j) {
+		for (uint64_t n = 0; n < b->counts[j] && !r->bad; ++n, ++k) {
+			const struct opcode *op = &opcodes[getindex(r, NOPCODES)];
+			struct ctype *ty = gettype(r);
+			uint64_t tyop = getindex(r, r->ntypes + 1);
+			uint64_t nops = getvar(r);
+			if (r->bad)
+				return;
+
+			struct itm_instr *i;
+			if (!operands) {
+				i = b->instrs[k] = itm_append(b->blocks[j], ty,
+					op->id, op->operation, op->terminal);
+				i->typeoperand = tyop ? r->types[tyop - 1] : NULL;
+			}
+
+			i = b->instrs[k];
+			for (uint64_t o = 0; o < nops && !r->bad; ++o) {
+				struct itm_expr *e = getoperand(r, b);
+				if (operands && e)
+					list_push_back(i->operands, e);
+			}
+		}
+	}
+}
+
+static void getblocklist(struct reader *r, struct body *b, struct list *l)
+{
+	uint64_t n = getvar(r);
+	for (uint64_t k = 0; k < n && !r->bad; ++k)
+		list_push_back(l, b->blocks[getindex(r, b->nblocks)]);
+}
+
+static void getbody(struct reader *r, struct itm_container *c)
+{
+	struct body b;
+	memset(&b, 0, sizeof(struct body));
+	b.nlits = getvar(r);
+	if (b.nlits > r->end - r->p) {
+		r->bad = true;
+		return;
+	}
+	b.lits = malloc((b.nlits + 1) * sizeof(struct itm_expr *));
+	getlits(r, c, b.lits, b.nlits);
+
+	uint64_t init = getindex(r, b.nlits + 1);
+	if (init && !r->bad && b.lits[init - 1]->etype == ITME_LITERAL)
+		c->init = (struct itm_literal *)b.lits[init - 1];
+	else if (init)
+		r->bad = true;
+
+	b.nblocks = getvar(r);
+	if (r->bad || b.nblocks > r->end - r->p) {
+		r->bad = true;
+		free(b.lits);
+		return;
+	}
+	b.blocks = malloc((b.nblocks + 1) * sizeof(struct itm_block *));
+	b.counts = malloc((b.nblocks + 1) * sizeof(uint64_t));
+	for (uint64_t k = 0; k < b.nblocks; ++k) {
+		b.blocks[k] = new_itm_block(c);
+		if (k)
+			itm_lex_progress(b.blocks[k - 1], b.blocks[k]);
+	}
+	if (b.nblocks)
+		c->block = b.blocks[0];
+
+	for (uint64_t k = 0; k < b.nblocks && !r->bad; ++k) {
+		getblocklist(r, &b, b.blocks[k]->previous);
+		getblocklist(r, &b, b.blocks[k]->next);
+		b.counts[k] = getvar(r);
+		b.ninstrs += b.counts[k];
+		if (b.counts[k] > r->end - r->p)
+			r->bad = true;
+	}
+
+	if (!r->bad) {
+		b.instrs = malloc((b.ninstrs + 1) * sizeof(struct itm_instr *));
+		const unsigned char *start = r->p;
+		getinstrs(r, &b, false);
+		r->p = start;
+		if (!r->bad)
+			getinstrs(r, &b, true);
+	}
+
+	free(b.lits);
+	free(b.blocks);
+	free(b.counts);
+	free(b.instrs);
+}
+
+static struct list *readmem(const unsigned char *data, size_t len)
+{
+	struct reader r;
+	memset(&r, 0, sizeof(struct reader));
+	r.p = data + MAGICLEN;
+	r.end = data + len;
+	if (len < MAGICLEN || memcmp(data, MAGIC, MAGICLEN))
+		return NULL;
+
+	r.nstrings = getvar(&r);
+	r.ntypes = getvar(&r);
+	r.nconts = getvar(&r);
+	// each of them takes at least a byte
+	if (r.nstrings + r.ntypes + r.nconts > len)
+		return NULL;
+
+	struct list *conts = NULL;
+	if (getstrings(&r) && gettypes(&r) && getheads(&r))
+		for (uint64_t k = 0; k < r.nconts && !r.bad; ++k)
+			getbody(&r, r.conts[k]);
+
+	if (!r.bad) {
+		conts = new_list(NULL, 0);
+		for (uint64_t k = 0; k < r.nconts; ++k)
+			list_push_back(conts, r.conts[k]);
+	} else if (r.conts) {
+		for (uint64_t k = 0; k < r.nconts; ++k)
+			if (r.conts[k])
+				delete_itm_container(r.conts[k]);
+	}
+
+	free(r.strings);
+	free(r.types);
+	free(r.conts);
+	return conts;
+}
+
+#ifdef __unix__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+struct list *itm_read(FILE *f)
+{
+#ifdef __unix__
+	struct stat st;
+	if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			fileno(f), 0);
+		if (data != MAP_FAILED) {
+			struct list *conts = readmem(data, st.st_size);
+			munmap(data, st.st_size);
+			return conts;
+		}
+	}
+#endif
+
+	// pipes and the like are read into memory
+	size_t cap = BUFSIZ, len = 0, n;
+	unsigned char *data = malloc(cap);
+	while ((n = fread(data + len, 1, cap - len, f)) > 0) {
+		len += n;
+		if (len == cap)
+			data = realloc(data, cap *= 2);
+	}
+	struct list *conts = readmem(data, len);
+	free(data);
+	return conts;
+}
@@ -0,0 +1,301 @@
+/*
+ * Whole-program optimization
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <acc/itm/lto.h>
+#include <acc/itm/ast.h>
+#include <acc/parsing/ast.h>
+#include <acc/error.h>
+
+/*
+ * What is known of a container, kept in an array sorted by the address of
+ * the container, so that it can be found from references to it
+ */
+struct csym {
+	struct itm_container *c;
+	int unit, order;
+	struct itm_container *to;	// what it's linked to
+	bool stored, escaped, live;
+};
+
+static int cmpaddr(const void *l, const void *r)
+{
+	uintptr_t la = (uintptr_t)((const struct csym *)l)->c;
+	uintptr_t ra = (uintptr_t)((const struct csym *)r)->c;
+	return (la > ra) - (la < ra);
+}
+
+static struct csym *findsym(struct csym *syms, int n, struct itm_expr *e)
+{
+	if (e->etype != ITME_CONTAINER)
+		return NULL;
+	struct csym key;
+	key.c = (struct itm_container *)e;
+	return bsearch(&key, syms, n, sizeof(struct csym), &cmpaddr);
+}
+
+// statics are only linked within their own file
+static int scope(const struct csym *s)
+{
+	return s->c->linkage == IL_STATIC ? s->unit : -1;
+}
+
+static int cmpname(const void *l, const void *r)
+{
+	const struct csym *ls = l, *rs = r;
+	int cmp = strcmp(ls->c->id, rs->c->id);
+	if (cmp)
+		return cmp;
+	if (scope(ls) != scope(rs))
+		return scope(ls) < scope(rs) ? -1 : 1;
+	return (ls->order > rs->order) - (ls->order < rs->order);
+}
+
+static bool isfunction(struct itm_container *c)
+{
+	struct cpointer *ty = (struct cpointer *)c->base.type;
+	return ty->pointsto->type == FUNCTION;
+}
+
+/*
+ * Picks what the declarations syms[0..n) of one symbol are linked to: its
+ * definition, or a tentative definition of it if it's an object
+ */
+static struct itm_container *resolve(struct csym *syms, int n)
+{
+	struct itm_container *def = NULL, *tentative = NULL;
+	for (int k = 0; k < n; ++k) {
+		struct itm_container *c = syms[k].c;
+		bool defines = c->block || c->init;
+		if (defines && def) {
+			report(E_ERROR | E_HIDE_TOKEN | E_HIDE_LOCATION, NULL,
+				"multiple definitions of \"%s\"", c->id);
+		} else if (defines) {
+			def = c;
+		} else if (!tentative && c->linkage != IL_EXTERN &&
+		           !isfunction(c)) {
+			tentative = c;
+		}
+	}
+
+	if (def)
+		return def;
+	return tentative ? tentative : syms[0].c;
+}
+
+// makes the references in c refer to what they're linked to
+static void relink(struct itm_container *c, struct csym *syms, int n)
+{
+	for (struct itm_block *b = c->block; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			struct itm_expr *e;
+			struct csym *s;
+			int k = 0;
+			it_t it = list_iterator(i->operands);
+			while (iterator_next(&it, (void **)&e)) {
+				if ((s = findsym(syms, n, e)) && s->to != s->c)
+					set_list_item(i->operands, k, s->to);
+				++k;
+			}
+		}
+	}
+}
+
+struct list *lto_link(struct list *units)
+{
+	int n = 0;
+	struct list *unit;
+	it_t it = list_iterator(units);
+	while (iterator_next(&it, (void **)&unit))
+		n += list_length(unit);
+
+	struct csym *syms = calloc(n + 1, sizeof(struct csym));
+	int k = 0, u = 0;
+	it = list_iterator(units);
+	while (iterator_next(&it, (void **)&unit)) {
+		struct itm_container *c;
+		it_t cit = list_iterator(unit);
+		while (iterator_next(&cit, (void **)&c)) {
+			syms[k].c = c;
+			syms[k].unit = u;
+			syms[k].order = k;
+			++k;
+		}
+		++u;
+	}
+
+	qsort(syms, n, sizeof(struct csym), &cmpname);
+	for (int first = 0, last; first < n; first = last) {
+		for (last = first + 1; last < n; ++last)
+			if (strcmp(syms[first].c->id, syms[last].c->id) ||
+			    scope(&syms[first]) != scope(&syms[last]))
+				break;
+
+		struct itm_container *to = resolve(&syms[first], last - first);
+		for (k = first; k < last; ++k)
+			syms[k].to = to;
+	}
+
+	qsort(syms, n, sizeof(struct csym), &cmpaddr);
+	struct list *linked = new_list(NULL, 0);
+	it = list_iterator(units);
+	while (iterator_next(&it, (void **)&unit)) {
+		struct itm_container *c;
+		it_t cit = list_iterator(unit);
+		while (iterator_next(&cit, (void **)&c)) {
+			if (findsym(syms, n, &c->base)->to != c)
+				continue;
+			relink(c, syms, n);
+			list_push_back(linked, c);
+		}
+	}
+
+	free(syms);
+	return linked;
+}
+
+// notes how the containers are used by the instructions of c
+static void scanuses(struct itm_container *c, struct csym *syms, int n)
+{
+	for (struct itm_block *b = c->block; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			struct itm_expr *e;
+			struct csym *s;
+			int k = 0;
+			it_t it = list_iterator(i->operands);
+			while (iterator_next(&it, (void **)&e)) {
+				if (!(s = findsym(syms, n, e)))
+					;
+				else if (i->id == ITM_ID(itm_load) && k == 0)
+					;
+				else if (i->id == ITM_ID(itm_store) && k == 1)
+					s->stored = true;
+				else
+					s->escaped = true;
+				++k;
+			}
+		}
+	}
+}
+
+static bool isconst(struct csym *s, bool whole)
+{
+	struct itm_container *c = s->c;
+	return !isfunction(c) && !s->stored && !s->escaped &&
+	       (c->linkage == IL_STATIC || (whole && c->linkage == IL_GLOBAL));
+}
+
+// the initial value of g, as a literal of c
+static struct itm_literal *initial(struct itm_container *c,
+	struct itm_container *g, struct ctype *ty)
+{
+	struct itm_literal *lit = new_itm_literal(c, ty);
+	lit->value.i = 0;
+	if (g->init)
+		lit->value = g->init->value;
+	else if (hastc(ty, TC_FLOATING) && ty->size == sizeof(float))
+		lit->value.f = 0.0f;
+	else if (hastc(ty, TC_FLOATING))
+		lit->value.d = 0.0;
+	return lit;
+}
+
+// replaces the loads of constant globals in c by their value
+static void propagate(struct itm_container *c, struct csym *syms, int n,
+	bool whole)
+{
+	for (struct itm_block *b = c->block; b; b = b->lexnext) {
+		struct itm_instr *next;
+		for (struct itm_instr *i = b->first; i; i = next) {
+			next = i->next;
+			struct csym *s;
+			if (i->id != ITM_ID(itm_load) ||
+			    !(s = findsym(syms, n, list_head(i->operands))) ||
+			    !isconst(s, whole))
+				continue;
+			// of which the value was given as another type
+			if (s->c->init && s->c->init->base.type != i->base.type)
+				continue;
+
+			itm_repli(i, &initial(c, s->c, i->base.type)->base);
+		}
+	}
+}
+
+static void marklive(struct csym *s, struct csym **stack, int *depth)
+{
+	if (s->live)
+		return;
+	s->live = true;
+	stack[(*depth)++] = s;
+}
+
+static void markrefs(struct csym *s, struct csym *syms, int n,
+	struct csym **stack, int *depth)
+{
+	for (struct itm_block *b = s->c->block; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			struct itm_expr *e;
+			struct csym *ref;
+			it_t it = list_iterator(i->operands);
+			while (iterator_next(&it, (void **)&e))
+				if ((ref = findsym(syms, n, e)))
+					marklive(ref, stack, depth);
+		}
+	}
+}
+
+void lto_optimize(struct list *conts)
+{
+	int n = list_length(conts), k = 0;
+	struct csym *syms = calloc(n + 1, sizeof(struct csym));
+	struct itm_container *c, *entry = NULL;
+	it_t it = list_iterator(conts);
+	while (iterator_next(&it, (void **)&c)) {
+		syms[k++].c = c;
+		if (c->block && c->linkage == IL_GLOBAL && !strcmp(c->id, "main"))
+			entry = c;
+	}
+	qsort(syms, n, sizeof(struct csym), &cmpaddr);
+
+	bool whole = entry != NULL;
+	for (k = 0; k < n; ++k)
+		scanuses(syms[k].c, syms, n);
+	for (k = 0; k < n; ++k)
+		propagate(syms[k].c, syms, n, whole);
+
+	struct csym **stack = malloc((n + 1) * sizeof(struct csym *));
+	int depth = 0;
+	for (k = 0; k < n; ++k)
+		if (whole ? syms[k].c == entry : syms[k].c->linkage == IL_GLOBAL)
+			marklive(&syms[k], stack, &depth);
+	while (depth)
+		markrefs(stack[--depth], syms, n, stack, &depth);
+	free(stack);
+
+	// they're left to the symbols that own them
+	for (k = 0; k < n; ++k)
+		if (!syms[k].live)
+			list_remove(conts, syms[k].c);
+	free(syms);
+}
@@ -24,16 +24,20 @@
 #include <acc/itm/analyze.h>
 #include <acc/itm/tag.h>
 #include <acc/options.h>
+#include <acc/timer.h>
+#include <acc/stats.h>
 #include <acc/list.h>
 
 /*
  * Replaces SSA alloca/load/store system with a phi node system where possible
+ * Returns the amount of promoted allocas
  */
-static void o_phiable(struct itm_instr *strt, struct list *dict);
+static int o_phiable(struct itm_instr *strt, struct list *dict);
 /*
  * Removes unused blocks
+ * Returns the amount of removed blocks
  */
-static void o_prune(struct itm_block *blk);
+static int o_prune(struct itm_block *blk);
 /*
  * Performs constant folding
  * Returns the amount of folded constants
@@ -44,26 +48,53 @@ static int o_cfld(struct itm_instr *i);
  * Returns the amount of removed splits
  */
 static int o_uncsplit(struct itm_block *b);
+/*
+ * Replaces multiplications of induction variables by a constant with
+ * induction variables of their own, which are stepped by an addition
+ */
+static void o_strred(struct itm_block *b);
 
 void optimize(struct itm_block *strt)
 {
 	if (option_optimize() == 0)
 		return;
 
+	const char *id = strt->container->id;
+	timer_start("optimize", id);
 	analyze(strt, A_PHIABLE);
+	timer_start("o_phiable", NULL);
 	struct list *dict = new_list(NULL, 0);
-	o_phiable(strt->first, dict);
+	stats_add(id, ST_PROMOTED, o_phiable(strt->first, dict));
 	delete_list(dict, NULL);
+	timer_stop();
 
+	// pruning takes phis down to a single value, which may fold again
 	while (true) {
-		int opts = 0;
-		opts += o_cfld(strt->first);
-		opts += o_uncsplit(strt);
-		if (opts == 0)
+		timer_start("o_cfld", NULL);
+		int folded = o_cfld(strt->first);
+		timer_stop();
+		timer_start("o_uncsplit", NULL);
+		int unsplit = o_uncsplit(strt);
+		timer_stop();
+		stats_add(id, ST_FOLDED, folded);
+		stats_add(id, ST_UNSPLIT, unsplit);
+		if (folded + unsplit == 0)
 			break;
+		timer_start("o_prune", NULL);
+		stats_add(id, ST_PRUNED, o_prune(strt->lexnext));
+		timer_stop();
 	}
 
-	o_prune(strt->lexnext);
+	timer_start("o_prune", NULL);
+	stats_add(id, ST_PRUNED, o_prune(strt->lexnext));
+	timer_stop();
+
+	if (option_optimize() >= 2) {
+		timer_start("o_strred", NULL);
+		o_strred(strt);
+		timer_stop();
+	}
+	timer_stop();
 }
 
 static struct itm_expr *traceload(struct itm_instr *ld, struct itm_instr *i,
@@ -121,7 +152,7 @@ static struct itm_expr *traceload(struct itm_instr *ld, struct itm_instr *i,
 	return &phi->base;
 }
 
-static void remphiables(struct itm_instr *strt)
+static int remphiables(struct itm_instr *strt)
 {
 	/*
 	 * Removes all stores to phiables, and then all allocas
@@ -152,17 +183,21 @@ static void remphiables(struct itm_instr *strt)
 		strt = nnxt;
 	}
 
+	int numrem = 0;
 	strt = first->first;
 	while (strt) {
 		struct itm_instr *nnxt = strt->next;
 		if (strt->id == ITM_ID(itm_alloca) &&
-		    itm_get_tag(&strt->base, tt_phiable))
+		    itm_get_tag(&strt->base, tt_phiable)) {
 			itm_remi(strt);
+			++numrem;
+		}
 		strt = nnxt;
 	}
+	return numrem;
 }
 
-static void o_phiable(struct itm_instr *strt, struct list *dict)
+static int o_phiable(struct itm_instr *strt, struct list *dict)
 {
 	struct itm_instr *nxt = strt->next;
 
@@ -171,11 +206,11 @@ static void o_phiable(struct itm_instr *strt, struct list *dict)
 		itm_replocc(&strt->base, traceload(strt, strt, dict), strt->block);
 
 	if (nxt)
-		o_phiable(nxt, dict);
+		return o_phiable(nxt, dict);
 	else if (strt->block->lexnext)
-		o_phiable(strt->block->lexnext->first, dict);
+		return o_phiable(strt->block->lexnext->first, dict);
 	else
-		remphiables(strt);
+		return remphiables(strt);
 }
 
 static void rmfromphi(struct itm_block *whichblk, struct itm_instr *phi)
@@ -198,15 +233,13 @@ static void rmfromphi(struct itm_block *whichblk, struct itm_instr *phi)
 		itm_repli(phi, list_last(phi->operands));
 }
 
-static void o_prune(struct itm_block *blk)
+static int o_prune(struct itm_block *blk)
 {
 	if (!blk)
-		return;
+		return 0;
 
-	if (blk->previous && list_length(blk->previous)) {
-		o_prune(blk->lexnext);
-		return;
-	}
+	if (blk->previous && list_length(blk->previous))
+		return o_prune(blk->lexnext);
 
 	struct itm_block *aft;
 	it_t it = list_iterator(blk->next);
@@ -227,8 +260,9 @@ static void o_prune(struct itm_block *blk)
 	if (nxt) {
 		nxt->lexprev = blk->lexprev;
 		delete_itm_block(blk);
-		o_prune(nxt);
+		return 1 + o_prune(nxt);
 	}
+	return 1;
 }
 
 
@@ -239,9 +273,10 @@ static int o_cfld(struct itm_instr *strt)
 	int numfold = 0;
 	if (itm_isconst(&strt->base)) {
 		struct itm_expr *repl = itm_eval(&strt->base);
-		if (repl != &strt->base)
+		if (repl != &strt->base) {
 			itm_repli(strt, repl);
-		numfold = 1;
+			numfold = 1;
+		}
 	}
 
 	if (nxt)
@@ -249,6 +284,7 @@ static int o_cfld(struct itm_instr *strt)
 
 	if (strt->block->lexnext)
 		return numfold + o_cfld(strt->block->lexnext->first);
+	return numfold;
 }
 
 static int o_uncsplit(struct itm_block *b)
@@ -276,8 +312,10 @@ static int o_uncsplit(struct itm_block *b)
 
 	struct itm_instr *phi = other->first;
 	while (phi && phi->id == ITM_ID(itm_phi)) {
+		// rmfromphi() may replace the phi
+		struct itm_instr *nxt = phi->next;
 		rmfromphi(b, phi);
-		phi = phi->next;
+		phi = nxt;
 	}
 
 	list_remove(b->next, other);
@@ -286,3 +324,124 @@ static int o_uncsplit(struct itm_block *b)
 
 	return 1 + o_uncsplit(b->lexnext);
 }
+
+static struct itm_literal *o_lit(struct itm_container *c, struct ctype *ty,
+	uint64_t v)
+{
+	struct itm_literal *lit = new_itm_literal(c, ty);
+	uint64_t mask = 1ul << (ty->size * 8 - 1);
+	lit->value.i = v & (mask | (mask - 1));
+	return lit;
+}
+
+/*
+ * Finds the step of the induction variable phi, which is stepped by adding
+ * or subtracting a literal along one of its two incoming edges.
+ */
+static struct itm_instr *getstep(struct itm_instr *phi, int *stepk,
+	uint64_t *step)
+{
+	if (list_length(phi->operands) != 4)
+		return NULL;
+
+	for (*stepk = 1; *stepk < 4; *stepk += 2) {
+		struct itm_expr *e = get_list_item(phi->operands, *stepk);
+		if (e->etype != ITME_INSTRUCTION)
+			continue;
+
+		struct itm_instr *i = (struct itm_instr *)e;
+		struct itm_expr *l = list_head(i->operands);
+		struct itm_expr *r = list_last(i->operands);
+		if (i->id == ITM_ID(itm_add) && r == &phi->base) {
+			r = l;
+			l = &phi->base;
+		} else if (i->id != ITM_ID(itm_add) && i->id != ITM_ID(itm_sub)) {
+			continue;
+		}
+
+		if (l == &phi->base && r->etype == ITME_LITERAL) {
+			*step = ((struct itm_literal *)r)->value.i;
+			return i;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * For i = phi * c, with phi stepped by next = phi + step, a new phi q is
+ * made with next = q + step * c, which starts out at the initial value of
+ * phi times c. Both phis take their values at the same time, so q equals
+ * phi * c wherever phi is available. Powers of two aren't worth it, those
+ * are a shift.
+ */
+static void strredi(struct itm_instr *i)
+{
+	if (i->id != ITM_ID(itm_mul) || !hastc(i->base.type, TC_INTEGRAL))
+		return;
+
+	struct itm_expr *l = list_head(i->operands);
+	struct itm_expr *r = list_last(i->operands);
+	if (l->etype == ITME_LITERAL) {
+		l = r;
+		r = list_head(i->operands);
+	}
+
+	if (l->etype != ITME_INSTRUCTION || r->etype != ITME_LITERAL ||
+	    l->type != i->base.type)
+		return;
+
+	struct itm_instr *phi = (struct itm_instr *)l;
+	uint64_t c = ((struct itm_literal *)r)->value.i;
+	int stepk;
+	uint64_t step;
+	struct itm_instr *next;
+	if (phi->id != ITM_ID(itm_phi) || !(c & (c - 1)) ||
+	    !(next = getstep(phi, &stepk, &step)))
+		return;
+
+	struct itm_container *cont = i->block->container;
+	int prek = stepk == 1 ? 2 : 0;
+	struct itm_block *pre = get_list_item(phi->operands, prek);
+	struct itm_block *latch = get_list_item(phi->operands, stepk - 1);
+	struct itm_expr *init = get_list_item(phi->operands, prek + 1);
+	if (pre == latch)
+		return;
+
+	if (init->etype == ITME_LITERAL) {
+		init = &o_lit(cont, i->base.type,
+			((struct itm_literal *)init)->value.i * c)->base;
+	} else if (init->etype == ITME_INSTRUCTION) {
+		struct itm_instr *jmp = pre->last;
+		struct itm_instr *m = itm_mul(pre, init, r);
+		itm_inserti(m, jmp);
+		init = &m->base;
+	}
+
+	struct list *dict = new_list(NULL, 0);
+	struct itm_instr *q = itm_phi(phi->block, i->base.type, dict);
+	delete_list(dict, NULL);
+
+	struct itm_literal *qstep = o_lit(cont, i->base.type, step * c);
+	struct itm_instr *qnext = next->id == ITM_ID(itm_add) ?
+		itm_add(next->block, &q->base, &qstep->base) :
+		itm_sub(next->block, &q->base, &qstep->base);
+	itm_inserti(qnext, next->next);
+
+	for (int k = 0; k < 4; k += 2) {
+		struct itm_block *from = get_list_item(phi->operands, k);
+		list_push_back(q->operands, from);
+		list_push_back(q->operands, from == pre ? init : &qnext->base);
+	}
+	itm_repli(i, &q->base);
+}
+
+static void o_strred(struct itm_block *b)
+{
+	for (; b; b = b->lexnext) {
+		struct itm_instr *nxt;
+		for (struct itm_instr *i = b->first; i; i = nxt) {
+			nxt = i->next;
+			strredi(i);
+		}
+	}
+}
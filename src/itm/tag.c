@@ -25,6 +25,7 @@
 #include <acc/itm/tag.h>
 #include <acc/itm/ast.h>
 #include <acc/list.h>
+#include <acc/mem.h>
 
 struct itm_tag {
 	tagtype_t type;
@@ -45,7 +46,7 @@ static void free_expr_list(void *data)
 
 struct itm_tag *new_itm_tag(tagtype_t type, enum itm_tag_object obj)
 {
-	struct itm_tag *tag = malloc(sizeof(struct itm_tag));
+	struct itm_tag *tag = mem_alloc(MEM_TAGS, sizeof(struct itm_tag));
 
 	assert(type != NULL);
 
@@ -21,6 +21,7 @@
 #include <assert.h>
 
 #include <acc/list.h>
+#include <acc/mem.h>
 
 struct node {
 	struct node *previous;
@@ -65,13 +66,13 @@ static void rmnode(struct list *restrict l, struct node *node)
 		node->previous->next = node->next;
 	if (node->next)
 		node->next->previous = node->previous;
-	free(node);
+	mem_free(MEM_LISTS, node, sizeof(struct node));
 	--l->length;
 }
 
 struct list *new_list(void *init[], int count)
 {
-	struct list *result = malloc(sizeof(struct list));
+	struct list *result = mem_alloc(MEM_LISTS, sizeof(struct list));
 
 	if (!init) {
 		result->head = NULL;
@@ -83,7 +84,7 @@ struct list *new_list(void *init[], int count)
 	struct node *prev = NULL;
 	struct node *head = NULL;
 	for (int i = 0; i < count; ++i) {
-		struct node *n = malloc(sizeof(struct node));
+		struct node *n = mem_alloc(MEM_LISTS, sizeof(struct node));
 		n->data = init[i];
 		n->next = NULL;
 		n->previous = prev;
@@ -110,7 +111,7 @@ struct list *clone_list(struct list *l)
 	void *item;
 	it_t it = list_iterator(l);
 	while (iterator_next(&it, &item)) {
-		struct node *n = malloc(sizeof(struct node));
+		struct node *n = mem_alloc(MEM_LISTS, sizeof(struct node));
 		n->data = item;
 		n->next = NULL;
 		n->previous = prev;
@@ -137,9 +138,9 @@ void delete_list(struct list *l, void (*destr)(void *))
 		if (destr)
 			destr(n->data);
 		next = n->next;
-		free(n);
+		mem_free(MEM_LISTS, n, sizeof(struct node));
 	}
-	free(l);
+	mem_free(MEM_LISTS, l, sizeof(struct list));
 }
 
 it_t list_iterator(struct list *l)
@@ -216,7 +217,7 @@ void list_push_back(struct list *l, void *restrict data)
 {
 	assert(l != NULL);
 
-	struct node *n = malloc(sizeof(struct node));
+	struct node *n = mem_alloc(MEM_LISTS, sizeof(struct node));
 	n->next = NULL;
 	n->previous = l->last;
 	n->data = data;
@@ -242,7 +243,7 @@ void list_push_front(struct list *l, void *restrict data)
 {
 	assert(l != NULL);
 
-	struct node *n = malloc(sizeof(struct node));
+	struct node *n = mem_alloc(MEM_LISTS, sizeof(struct node));
 	n->previous = NULL;
 	n->next = l->head;
 	n->data = data;
@@ -31,82 +31,460 @@
 #include <acc/target/emit.h>
 #include <acc/itm/analyze.h>
 #include <acc/itm/opt.h>
+#include <acc/itm/lto.h>
+#include <acc/itm/bin.h>
 #include <acc/itm/ast.h>
 #include <acc/parsing/file.h>
 #include <acc/parsing/token.h>
+#include <acc/parsing/ast.h>
 #include <acc/options.h>
 #include <acc/error.h>
+#include <acc/thread.h>
+#include <acc/cache.h>
+#include <acc/incr.h>
+#include <acc/timer.h>
+#include <acc/mem.h>
+#include <acc/stats.h>
+#include <acc/tu.h>
 
-static void opt_and_dump(struct list *syms)
+// the containers of files ending in ".bir" are read in with itm_read()
+static bool isbir(const char *file)
 {
-	char ofname[strlen(currentfile ? currentfile : "-") + 4];
-	sprintf(ofname, "%s.ir", currentfile ? currentfile : "-");
-	FILE *out;
-	if (option_emit_ir()) {
-		if (option_outfile())
-			out = fopen(option_outfile(), "wb");
-		else
-			out = fopen(ofname, "wb");
+	size_t len = file ? strlen(file) : 0;
+	return len > 4 && !strcmp(file + len - 4, ".bir");
+}
+
+static void readinput(FILE *f, struct list *syms, struct list *decls)
+{
+	if (!isbir(curtu()->file)) {
+		timer_start("parse", NULL);
+		parsefile(f, syms, decls);
+		timer_stop();
+		return;
 	}
 
-	struct itm_container *sym;
+	timer_start("read", NULL);
+	struct list *conts = itm_read(f);
+	timer_stop();
+	if (!conts)
+		report(E_FATAL | E_OPTIONS, NULL,
+			"invalid intermediate file: \"%s\"", curtu()->file);
+
+	while (list_length(conts))
+		list_push_back(syms, list_pop_front(conts));
+	delete_list(conts, NULL);
+}
+
+// no symbols own the containers read in, so they are deleted with the list
+static void deleteinput(struct list *syms)
+{
+	if (isbir(curtu()->file))
+		while (list_length(syms))
+			delete_itm_container(list_pop_front(syms));
+	delete_list(syms, NULL);
+}
+
+static void optimizeone(void *arg, int k)
+{
+	struct itm_container **conts = arg;
+	optimize(conts[k]->block);
+}
+
+// leaves out the containers with code in codes, if it isn't NULL
+static void opt_and_dump(struct list *syms, const char *irname,
+	const char *birname, struct fncode **codes)
+{
+	FILE *out;
+	if (irname)
+		out = fopen(irname, "wb");
+
+	struct itm_container *conts[list_length(syms) + 1], *sym;
+	int n = 0, k = 0;
 	it_t it = list_iterator(syms);
-	while (iterator_next(&it, (void **)&sym)) {
-		if (!sym->block)
-			continue;
+	while (iterator_next(&it, (void **)&sym))
+		if (sym->block && !(codes && codes[k++]))
+			conts[n++] = sym;
 
-		optimize(sym->block);
-		if (option_emit_ir())
-			itm_container_to_string(out, sym);
-	}
+	pool_run(curtu()->pool, n, &optimizeone, conts);
 
-	if (option_emit_ir())
+	if (irname) {
+		for (int k = 0; k < n; ++k)
+			itm_container_to_string(out, conts[k]);
+		fclose(out);
+	}
+	if (birname && (out = fopen(birname, "wb"))) {
+		itm_write(out, syms);
 		fclose(out);
+	}
 }
 
-static void compilefile(FILE *f)
+// the outputs of a compilation, the files they go to NULL if not asked for
+enum {
+	OUT_IR,
+	OUT_BIR,
+	OUT_CODE,
+	NOUTS
+};
+
+/*
+ * The outputs for the input file named file, irname, birname and codename
+ * having room for its name and five characters more
+ */
+static void getouts(const char *file, const char *outs[], char *irname,
+	char *birname, char *codename)
+{
+	outs[OUT_IR] = outs[OUT_BIR] = outs[OUT_CODE] = NULL;
+	bool obj = option_emit_obj() && !option_emit_asm();
+	if (option_emit_ir()) {
+		sprintf(irname, "%s.ir", file);
+		outs[OUT_IR] = option_outfile() ? option_outfile() : irname;
+	}
+	if (option_emit_bir()) {
+		sprintf(birname, "%s.bir", file);
+		outs[OUT_BIR] = option_outfile() ? option_outfile() : birname;
+	}
+	if (option_emit_asm() || obj) {
+		sprintf(codename, obj ? "%s.o" : "%s.s", file);
+		outs[OUT_CODE] = option_outfile() ? option_outfile() : codename;
+	}
+}
+
+// -fincremental only works on assembly from source, and not along with -Sir
+static bool incremental(const char *outs[])
+{
+	return option_incremental() && option_emit_asm() &&
+	       outs[OUT_CODE] && !outs[OUT_IR] && !outs[OUT_BIR] &&
+	       !isbir(curtu()->file);
+}
+
+static void compileincr(struct list *syms, struct list *decls,
+	const char *src, size_t len, const char *sname)
+{
+	char dbname[strlen(sname) + 5];
+	sprintf(dbname, "%s.fdb", sname);
+	struct incrdb *db = incr_open(dbname);
+
+	struct fncode *codes[list_length(syms) + 1];
+	incr_lookup(db, src, len, decls, syms, codes);
+	opt_and_dump(syms, NULL, NULL, codes);
+
+	FILE *s = fopen(sname, "wb");
+	emit_fncodes(s, syms, codes);
+	fclose(s);
+
+	incr_update(db, syms, codes);
+	incr_close(db);
+}
+
+static void writeout(struct list *syms, const char *outs[])
+{
+	opt_and_dump(syms, outs[OUT_IR], outs[OUT_BIR], NULL);
+
+	// -S takes precedence over -c
+	bool obj = option_emit_obj() && !option_emit_asm();
+	FILE *s = outs[OUT_CODE] ? fopen(outs[OUT_CODE], "wb") : tmpfile();
+	if (obj)
+		emit_object(s, syms);
+	else
+		emit(s, syms);
+	fclose(s);
+}
+
+/*
+ * Takes the len bytes of source in src if they are read beforehand, which
+ * they must be to compile incrementally. Returns whether it got through
+ * without fatal errors.
+ */
+static bool translate(FILE *f, const char *outs[], const char *src,
+	size_t len)
 {
 	struct list *syms = new_list(NULL, 0);
+	struct list *decls = src && incremental(outs) ?
+		new_list(NULL, 0) : NULL;
+	bool ok = false;
 
-	resettok();
 	ast_init();
 
-	if (setjmp(fatal_env))
+	if (setjmp(curtu()->fatal_env))
+		goto cleanup;
+
+	readinput(f, syms, decls);
+	if (decls) {
+		compileincr(syms, decls, src, len, outs[OUT_CODE]);
+		ok = true;
 		goto cleanup;
+	}
 
-	parsefile(f, syms);
-	opt_and_dump(syms);
+	writeout(syms, outs);
+	ok = true;
 
-	FILE *s;
-	if (option_emit_asm()) {
-		if (option_outfile()) {
-			s = fopen(option_outfile(), "wb");
-		} else {
-			char ofname[strlen(currentfile ? currentfile : "-") + 3];
-			sprintf(ofname, "%s.s", currentfile ? currentfile : "-");
-			s = fopen(ofname, "wb");
+cleanup:
+	if (decls)
+		delete_list(decls, &free);
+	deleteinput(syms);
+	ast_destroy();
+	return ok;
+}
+
+static char *readsource(FILE *f, size_t *len)
+{
+	size_t cap = BUFSIZ, n;
+	char *src = malloc(cap);
+	*len = 0;
+	while ((n = fread(src + *len, 1, cap - *len, f)) > 0) {
+		*len += n;
+		if (*len == cap)
+			src = realloc(src, cap *= 2);
+	}
+	return src;
+}
+
+/*
+ * Goes through the cache if there is one, and compiles incrementally with
+ * -fincremental. The outputs of compilations
+ * without diagnostics are stored, since those of the others wouldn't be
+ * given again on a hit.
+ */
+static void compilefile(FILE *f)
+{
+	const char *file = curtu()->file ? curtu()->file : "-";
+	char irname[strlen(file) + 5], birname[strlen(file) + 5];
+	char codename[strlen(file) + 5];
+	const char *outs[NOUTS];
+	getouts(file, outs, irname, birname, codename);
+
+	if (!cache_enabled() && !incremental(outs)) {
+		translate(f, outs, NULL, 0);
+		return;
+	}
+
+	size_t len;
+	char *src = readsource(f, &len);
+	struct hash key;
+	if (cache_enabled()) {
+		cache_key(&key, src, len);
+		if (cache_fetch(&key, outs, NOUTS)) {
+			free(src);
+			return;
 		}
+	}
+
+	// stdin can't be read twice
+	FILE *copy = NULL;
+	if (fseek(f, 0, SEEK_SET)) {
+		f = copy = tmpfile();
+		fwrite(src, 1, len, copy);
+		rewind(copy);
+	}
+
+	bool ok = translate(f, outs, src, len);
+	free(src);
+	if (ok && cache_enabled() && !curtu()->ndiag)
+		cache_store(&key, outs, NOUTS);
+	if (copy)
+		fclose(copy);
+}
+
+/*
+ * With -j, the input files are handed out to a number of threads, each
+ * compiling one file at a time in its own translation unit. Diagnostics are
+ * kept with the unit and written out in the order of the input files, as
+ * soon as the files before it are done. Threads left over when there are
+ * fewer files are shared out among them, to work on their functions.
+ */
+struct job {
+	const char *file;
+	struct tu tu;
+	bool done;
+};
+
+static struct job *jobs;
+static int njobs, nextreport, unitthreads;
+static struct mutex *joblock;
+static bool jobsfailed;
+
+static void runjob(void *arg, int k)
+{
+	struct job *j = &jobs[k];
+	tu_init(&j->tu, j->file, option_jobs() > 1);
+	if (unitthreads > 1)
+		j->tu.pool = new_pool(unitthreads - 1);
+	tu_enter(&j->tu);
+	timer_open(&j->tu, j->file ? j->file : "<stdin>");
+	stats_open(&j->tu, j->file ? j->file : "<stdin>");
+
+	// fatal errors end the unit, not the pool of files
+	jmp_buf *prev = thread_catch(NULL);
+
+	if (!j->file) {
+		compilefile(stdin);
 	} else {
-		s = tmpfile();
+		FILE *file = fopen(j->file, "rb");
+		if (file) {
+			compilefile(file);
+			fclose(file);
+		} else {
+			report(E_OPTIONS, NULL, "file not found: \"%s\"",
+				j->file);
+		}
 	}
-	emit(s, syms);
-	fclose(s);
 
-cleanup:
+	thread_catch(prev);
+	timer_report(&j->tu);
+	stats_report(&j->tu);
+	tu_enter(NULL);
+	delete_pool(j->tu.pool);
+
+	mutex_lock(joblock);
+	j->done = true;
+	while (nextreport < njobs && jobs[nextreport].done) {
+		jobsfailed = jobsfailed || jobs[nextreport].tu.failed;
+		tu_flushdiag(&jobs[nextreport].tu, stderr);
+		tu_destroy(&jobs[nextreport].tu);
+		++nextreport;
+	}
+	mutex_unlock(joblock);
+}
+
+// returns whether all files compiled without errors
+static bool compileall(void)
+{
+	njobs = list_length(option_input());
+	nextreport = 0;
+	jobsfailed = false;
+	jobs = calloc(njobs, sizeof(struct job));
+
+	char *file;
+	int k = 0;
+	it_t li = list_iterator(option_input());
+	while (iterator_next(&li, (void **)&file))
+		jobs[k++].file = strcmp(file, "-") ? file : NULL;
+
+	int nthreads = option_jobs() < njobs ? option_jobs() : njobs;
+	unitthreads = option_jobs() / nthreads;
+	joblock = new_mutex();
+
+	struct pool *p = new_pool(nthreads - 1);
+	pool_run(p, njobs, &runjob, NULL);
+	delete_pool(p);
+
+	delete_mutex(joblock);
+	free(jobs);
+	return !jobsfailed;
+}
+
+/*
+ * With -flto, the input files are each parsed in a translation unit of their
+ * own, and their containers are then linked into one module, which is
+ * optimized as a whole and written to one output. The units are kept until
+ * then, their symbols owning the containers.
+ */
+static bool parseunit(struct tu *u, struct list *syms)
+{
+	FILE *f = u->file ? fopen(u->file, "rb") : stdin;
+	if (!f) {
+		report(E_OPTIONS, NULL, "file not found: \"%s\"", u->file);
+		return false;
+	}
+
+	if (setjmp(u->fatal_env)) {
+		if (f != stdin)
+			fclose(f);
+		return false;
+	}
+
+	readinput(f, syms, NULL);
+	if (f != stdin)
+		fclose(f);
+	return true;
+}
+
+static void compilemodule(struct list *modules)
+{
+	char irname[6], birname[6], codename[6];
+	const char *outs[NOUTS];
+	getouts("a", outs, irname, birname, codename);
+
+	timer_start("lto_link", NULL);
+	struct list *syms = lto_link(modules);
+	timer_stop();
+	if (setjmp(curtu()->fatal_env)) {
+		delete_list(syms, NULL);
+		return;
+	}
+
+	timer_start("lto_optimize", NULL);
+	lto_optimize(syms);
+	timer_stop();
+	writeout(syms, outs);
 	delete_list(syms, NULL);
-	ast_destroy();
+}
+
+// returns whether all files compiled without errors
+static bool compilewhole(void)
+{
+	int n = list_length(option_input()), k = 0;
+	struct tu *units = calloc(n, sizeof(struct tu));
+	struct list *modules = new_list(NULL, 0);
+	bool ok = true;
+
+	char *file;
+	it_t it = list_iterator(option_input());
+	while (iterator_next(&it, (void **)&file)) {
+		struct tu *u = &units[k++];
+		tu_init(u, strcmp(file, "-") ? file : NULL, false);
+		tu_enter(u);
+		ast_init();
+		timer_open(u, file);
+
+		struct list *syms = new_list(NULL, 0);
+		list_push_back(modules, syms);
+		ok = parseunit(u, syms) && ok;
+		timer_report(u);
+	}
+
+	struct tu whole;
+	tu_init(&whole, NULL, false);
+	whole.pool = new_pool(option_jobs() - 1);
+	tu_enter(&whole);
+	timer_open(&whole, "-flto module");
+	stats_open(&whole, "-flto module");
+	if (ok)
+		compilemodule(modules);
+	timer_report(&whole);
+	stats_report(&whole);
+	tu_enter(NULL);
+	delete_pool(whole.pool);
+	ok = ok && !whole.failed;
+	tu_destroy(&whole);
+
+	for (k = 0; k < n; ++k) {
+		ok = ok && !units[k].failed;
+		tu_enter(&units[k]);
+		deleteinput(list_pop_front(modules));
+		ast_destroy();
+		tu_enter(NULL);
+		tu_destroy(&units[k]);
+	}
+	delete_list(modules, NULL);
+	free(units);
+	return ok;
 }
 
 #ifndef NDEBUG
 static void segvcatcher(int signo)
 {
+	struct tu *u = curtu();
+	if (u)
+		tu_flushdiag(u, stderr);
+
 	fprintf(stderr, "\n"
 	                "\t\\|/ ____ \\|/\n"
 	                "\t\"@'/ .. \\`@\"\n"
                         "\t/_| \\__/ |_\\\n"
 	                "\t   \\__U_/\n\n");
 	fprintf(stderr, "Oops! Received SIGSEGV during compilation!\n");
-	fprintf(stderr, "\tFile:\t%s\n", currentfile ? currentfile : "<stdin>");
+	fprintf(stderr, "\tFile:\t%s\n", u && u->file ? u->file : "<stdin>");
 	fprintf(stderr, "\tLine:\t%d\n", get_line());
 	fprintf(stderr, "\tColumn:\t%d\n\n", get_column());
 
@@ -138,26 +516,17 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	cache_init();
 	options_init(argc, argv);
+	types_init();
+	mem_init();
+	timer_init();
 
-	it_t li = list_iterator(option_input());
-	while (iterator_next(&li, (void **)&currentfile)) {
-		FILE *file;
-
-		if (!strcmp(currentfile, "-")) {
-			currentfile = NULL;
-			compilefile(stdin);
-			continue;
-		}
-
-		file = fopen(currentfile, "rb");
-		if (!file)
-			report(E_OPTIONS, NULL, "file not found: \"%s\"", currentfile);
-
-		compilefile(file);
-		fclose(file);
-	}
+	bool ok = option_lto() ? compilewhole() : compileall();
 
+	timer_finish();
+	mem_finish();
+	cache_destroy();
 	options_destroy();
-	return EXIT_SUCCESS;
+	return ok && !reported_error ? EXIT_SUCCESS : EXIT_FAILURE;
 }
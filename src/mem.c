@@ -0,0 +1,200 @@
+/*
+ * Memory accounting
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <acc/mem.h>
+#include <acc/options.h>
+#include <acc/thread.h>
+
+static const char *catnames[NMEMCATS] = {
+	"tokens",
+	"types",
+	"symbols",
+	"IR",
+	"tags",
+	"list nodes",
+	"locations"
+};
+
+struct catuse {
+	long allocs, bytes, live, peak;
+};
+
+/*
+ * Every thread counts on its own, so that allocating takes no lock; the
+ * counts are added up at the end, the peaks being those of the threads
+ * added up too
+ */
+struct memthread {
+	struct catuse cats[NMEMCATS];
+	long live, peak;
+	struct memthread *next;
+};
+
+static bool enabled = false;
+static struct mutex *lock;	// for threads
+static struct memthread *threads;
+static THREAD_LOCAL struct memthread *mine;
+
+// of the thread, for marks
+static THREAD_LOCAL long tallocs, tbytes, tlive, tpeak;
+
+void mem_init(void)
+{
+	enabled = option_mem_report();
+	if (!enabled)
+		return;
+
+	lock = new_mutex();
+	threads = NULL;
+}
+
+// the threads are done by now
+void mem_finish(void)
+{
+	if (!enabled)
+		return;
+
+	struct catuse cats[NMEMCATS];
+	long live = 0, peak = 0;
+	memset(cats, 0, sizeof(cats));
+	while (threads) {
+		struct memthread *t = threads;
+		for (int k = 0; k < NMEMCATS; ++k) {
+			cats[k].allocs += t->cats[k].allocs;
+			cats[k].bytes += t->cats[k].bytes;
+			cats[k].live += t->cats[k].live;
+			cats[k].peak += t->cats[k].peak;
+		}
+		live += t->live;
+		peak += t->peak;
+		threads = t->next;
+		free(t);
+	}
+
+	fprintf(stderr, "memory by category:\n");
+	fprintf(stderr, "  %-16s %10s %14s %10s %10s\n", "category", "allocs",
+		"allocated KB", "live KB", "peak KB");
+	for (int k = 0; k < NMEMCATS; ++k)
+		fprintf(stderr, "  %-16s %10ld %14.1f %10.1f %10.1f\n",
+			catnames[k], cats[k].allocs, cats[k].bytes / 1024.0,
+			cats[k].live / 1024.0, cats[k].peak / 1024.0);
+	fprintf(stderr, "  %-16s %10s %14s %10.1f %10.1f\n", "total", "", "",
+		live / 1024.0, peak / 1024.0);
+
+	delete_mutex(lock);
+	enabled = false;
+}
+
+static struct memthread *jointhreads(void)
+{
+	mine = calloc(1, sizeof(struct memthread));
+	mutex_lock(lock);
+	mine->next = threads;
+	threads = mine;
+	mutex_unlock(lock);
+	return mine;
+}
+
+static void count(enum memcat cat, long size, bool alloc)
+{
+	struct memthread *t = mine ? mine : jointhreads();
+	struct catuse *c = &t->cats[cat];
+	if (alloc) {
+		++c->allocs;
+		c->bytes += size;
+	}
+	c->live += size;
+	if (c->live > c->peak)
+		c->peak = c->live;
+	t->live += size;
+	if (t->live > t->peak)
+		t->peak = t->live;
+
+	if (alloc) {
+		++tallocs;
+		tbytes += size;
+	}
+	tlive += size;
+	if (tlive > tpeak)
+		tpeak = tlive;
+}
+
+void *mem_alloc(enum memcat cat, size_t size)
+{
+	if (enabled)
+		count(cat, size, true);
+	return malloc(size);
+}
+
+void *mem_zalloc(enum memcat cat, size_t size)
+{
+	if (enabled)
+		count(cat, size, true);
+	return calloc(1, size);
+}
+
+void mem_free(enum memcat cat, void *p, size_t size)
+{
+	if (enabled && p)
+		count(cat, -(long)size, false);
+	free(p);
+}
+
+void *mem_take(enum memcat cat, void *p, size_t size)
+{
+	if (!enabled)
+		return p;
+
+	count(cat, size, true);
+	return realloc(p, size);
+}
+
+char *mem_strdup(enum memcat cat, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = mem_alloc(cat, len);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void mem_mark(struct memmark *m)
+{
+	m->allocs = tallocs;
+	m->bytes = tbytes;
+	m->live = tlive;
+	m->peak = tpeak;
+	tpeak = tlive;
+}
+
+void mem_since(const struct memmark *m, struct memmark *use)
+{
+	use->allocs = tallocs - m->allocs;
+	use->bytes = tbytes - m->bytes;
+	use->live = tlive - m->live;
+	use->peak = tpeak - m->live;
+
+	// the peak of the outer mark takes in this one's
+	if (m->peak > tpeak)
+		tpeak = m->peak;
+}
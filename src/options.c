@@ -21,6 +21,7 @@
 
 #include <acc/target/cpu.h>
 #include <acc/options.h>
+#include <acc/cache.h>
 #include <acc/error.h>
 #include <acc/ext.h>
 
@@ -29,7 +30,17 @@ static struct list *input;
 static int optimize = 0;
 static bool warnings = true;
 static bool emit_ir = false;
+static bool emit_bir = false;
 static bool emit_asm = false;
+static bool emit_obj = false;
+static int jobs = 1;
+static bool incremental = false;
+static bool lto = false;
+static bool time_report = false;
+static char *time_trace = NULL;
+static bool mem_report = false;
+static bool stats = false;
+static bool stats_json = false;
 
 static char *help[] = {
 "Usage: acc [options] file...\n\
@@ -38,13 +49,36 @@ Options:\n\
   --help={extensions|target|warnings|optimizers}\n\
                            Display subject-specific help\n\
   --version                Display version information and exit\n\
+  --cache-stats            Display the statistics of the compilation cache in\n\
+                           ACC_CACHE_DIR and exit\n\
   -std=<standard>          Interpret input files as being <standard>\n\
   -v                       Output verbose information\n\
   -Sir                     Parse only, and dump intermediate output\n\
+  -Sbir                    Parse only, and dump intermediate output in a binary\n\
+                           form, which is read back in for input files ending\n\
+                           in .bir\n\
   -S                       Parse and compile, but do not assemble or link, and\n\
                            dump assembly\n\
   -c                       Parse, compile and assemble, but do not link\n\
   -o <file>                Output to <file>\n\
+  -j <n>                   Compile on up to <n> threads, working on several\n\
+                           input files or on the functions in them at once\n\
+  -fincremental            With -S, keep the assembly of each function next to\n\
+                           the output, and only compile the functions that\n\
+                           changed the next time\n\
+  -flto                    Compile all input files into one module, optimized\n\
+                           as a whole, to a single output (a.s or a.o by\n\
+                           default)\n\
+  -ftime-report            Display how long each phase of compilation takes,\n\
+                           per file and per function\n\
+  -ftime-trace=<file>      Write when each phase of compilation is done to\n\
+                           <file>, as Chrome trace events\n\
+  -fmem-report             Display how much memory each phase of compilation\n\
+                           allocates, per file and per function, and how much\n\
+                           is allocated of each kind of object\n\
+  -fstats                  Display how often each optimization applies, and\n\
+                           what code is generated, per file and per function\n\
+  -fstats=json             Like -fstats, as one line of JSON for each file\n\
 \n\
 Switches starting with -f, -m, -O and -W indicate extensions, target-specific\n\
  options, optimizations and warnings respectively. Information about them can be\n\
@@ -84,7 +118,10 @@ Report bugs at:\n\
 
 "  -masm=att, -masm=gas     Sets the x86 assembler dialect to AT&T/GAS syntax\n\
   -masm=nasm               Sets the x86 assembler dialect to NASM syntax\n\
-  -masm=intel, -masm=masm  Sets the x86 assembler dialect to MASM syntax\n"
+  -masm=intel, -masm=masm  Sets the x86 assembler dialect to MASM syntax\n\
+  -mcpu=<cpu>              Generates code for <cpu>\n\
+  -msse2, -mno-sse2        Enables/disables SSE2 floating point arithmetic,\n\
+                           enabled by default on x86_64 (requires i686)\n"
 };
 
 enum cversion {
@@ -142,10 +179,22 @@ void options_init(int argc, char *argv[])
 		} else if (!strcmp(arg, "--version")) {
 			fprintf(stderr, "acc " ACC_VERSION "\n");
 			exit(EXIT_SUCCESS);
+		} else if (!strcmp(arg, "--cache-stats")) {
+			cache_report(stderr);
+			exit(EXIT_SUCCESS);
 		}  else if (!strcmp(arg, "-o")) {
 			if (++i >= argc)
 				report(E_OPTIONS, NULL, "expected output file name");
 			outfile = argv[i];
+		} else if (!strncmp(arg, "-j", 2)) {
+			char *n = arg[2] ? &arg[2] : argv[++i];
+			if (i >= argc)
+				report(E_OPTIONS | E_FATAL, NULL,
+					"expected number of jobs");
+			jobs = atoi(n);
+			if (jobs < 1)
+				report(E_OPTIONS | E_FATAL, NULL,
+					"invalid number of jobs: %s", n);
 		} else if (!strcmp(arg, "-w")) {
 			warnings = false;
 		} else if (!strcmp(arg, "-O0")) {
@@ -164,8 +213,26 @@ void options_init(int argc, char *argv[])
 			setcversion(C99);
 		} else if (!strcmp(arg, "-Sir")) {
 			emit_ir = true;
+		} else if (!strcmp(arg, "-Sbir")) {
+			emit_bir = true;
 		} else if (!strcmp(arg, "-S")) {
 			emit_asm = true;
+		} else if (!strcmp(arg, "-c")) {
+			emit_obj = true;
+		} else if (!strcmp(arg, "-fincremental")) {
+			incremental = true;
+		} else if (!strcmp(arg, "-flto")) {
+			lto = true;
+		} else if (!strcmp(arg, "-ftime-report")) {
+			time_report = true;
+		} else if (!strncmp(arg, "-ftime-trace=", 13)) {
+			time_trace = &arg[13];
+		} else if (!strcmp(arg, "-fmem-report")) {
+			mem_report = true;
+		} else if (!strcmp(arg, "-fstats")) {
+			stats = true;
+		} else if (!strcmp(arg, "-fstats=json")) {
+			stats = stats_json = true;
 		} else if (arg[0] == '-' && arg[1] == 'f') {
 			enableext(&arg[2]);
 		} else if (arg[0] == '-' && arg[1] == 'm') {
@@ -212,7 +279,57 @@ bool option_emit_ir(void)
 	return emit_ir;
 }
 
+bool option_emit_bir(void)
+{
+	return emit_bir;
+}
+
 bool option_emit_asm(void)
 {
 	return emit_asm;
 }
+
+bool option_emit_obj(void)
+{
+	return emit_obj;
+}
+
+int option_jobs(void)
+{
+	return jobs;
+}
+
+bool option_incremental(void)
+{
+	return incremental;
+}
+
+bool option_lto(void)
+{
+	return lto;
+}
+
+bool option_time_report(void)
+{
+	return time_report;
+}
+
+const char *option_time_trace(void)
+{
+	return time_trace;
+}
+
+bool option_mem_report(void)
+{
+	return mem_report;
+}
+
+bool option_stats(void)
+{
+	return stats;
+}
+
+bool option_stats_json(void)
+{
+	return stats_json;
+}
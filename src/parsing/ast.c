@@ -26,23 +26,21 @@
 #include <acc/itm/ast.h>
 #include <acc/parsing/ast.h>
 #include <acc/ext.h>
+#include <acc/mem.h>
 #include <acc/term.h>
+#include <acc/tu.h>
 
 struct ctype cint, cshort, clong, cuint, cushort, culong,
 	clonglong, culonglong, cchar, cuchar,
 	cfloat, cdouble, cvoid, clongdouble, cbool;
 
-static struct list *alltypes;
-static struct list *typescopes;
-static struct list *allsyms;
-static struct list *symscopes;
-
 static void delete_symbol(void *sym);
 
 static void registerty(struct ctype *t)
 {
-	list_push_back(alltypes, t);
-	struct list *topscope = list_last(typescopes);
+	struct tu *u = curtu();
+	list_push_back(u->alltypes, t);
+	struct list *topscope = list_last(u->typescopes);
 	list_push_back(topscope, t);
 }
 
@@ -77,6 +75,10 @@ static void initprimitive(struct ctype *p, const char *name)
 	p->name = name;
 	p->to_string = &primitive_to_string;
 	p->compare = &primitive_compare;
+}
+
+static void registerprimitive(struct ctype *p)
+{
 	if ((p != &cbool || isext(EX_BOOL)) &&
 	    (p != &clonglong || isext(EX_LONG_LONG)) &&
 	    (p != &culonglong || isext(EX_LONG_LONG)) &&
@@ -111,14 +113,8 @@ enum typeclass gettc(struct ctype *ty)
 	return TC_COMPOSITE;
 }
 
-void ast_init(void)
+void types_init(void)
 {
-	alltypes = new_list(NULL, 0);
-	typescopes = new_list(NULL, 0);
-	allsyms = new_list(NULL, 0);
-	symscopes = new_list(NULL, 0);
-
-	enter_scope();
 	initprimitive(&cbool, "_Bool");
 	initprimitive(&cint, "int");
 	initprimitive(&cshort, "short");
@@ -134,6 +130,32 @@ void ast_init(void)
 	initprimitive(&clonglong, "long long");
 	initprimitive(&culonglong, "unsigned long long");
 	initprimitive(&clongdouble, "long double");
+}
+
+void ast_init(void)
+{
+	struct tu *u = curtu();
+	u->alltypes = new_list(NULL, 0);
+	u->typescopes = new_list(NULL, 0);
+	u->allsyms = new_list(NULL, 0);
+	u->symscopes = new_list(NULL, 0);
+
+	enter_scope();
+	registerprimitive(&cbool);
+	registerprimitive(&cint);
+	registerprimitive(&cshort);
+	registerprimitive(&cchar);
+	registerprimitive(&clong);
+	registerprimitive(&cuint);
+	registerprimitive(&cushort);
+	registerprimitive(&cuchar);
+	registerprimitive(&culong);
+	registerprimitive(&cfloat);
+	registerprimitive(&cdouble);
+	registerprimitive(&cvoid);
+	registerprimitive(&clonglong);
+	registerprimitive(&culonglong);
+	registerprimitive(&clongdouble);
 	enter_scope();
 }
 
@@ -145,24 +167,27 @@ static void destroy_type(void * ty)
 
 void ast_destroy(void)
 {
+	struct tu *u = curtu();
 	leave_scope();
 	leave_scope();
-	delete_list(alltypes, &destroy_type);
-	delete_list(typescopes, NULL);
-	delete_list(symscopes, NULL);
-	delete_list(allsyms, &delete_symbol);
+	delete_list(u->alltypes, &destroy_type);
+	delete_list(u->typescopes, NULL);
+	delete_list(u->symscopes, NULL);
+	delete_list(u->allsyms, &delete_symbol);
 }
 
 void enter_scope(void)
 {
-	list_push_back(typescopes, new_list(NULL, 0));
-	list_push_back(symscopes, new_list(NULL, 0));
+	struct tu *u = curtu();
+	list_push_back(u->typescopes, new_list(NULL, 0));
+	list_push_back(u->symscopes, new_list(NULL, 0));
 }
 
 void leave_scope(void)
 {
-	struct list * typescope = list_pop_back(typescopes);
-	struct list * symscope = list_pop_back(symscopes);
+	struct tu *u = curtu();
+	struct list * typescope = list_pop_back(u->typescopes);
+	struct list * symscope = list_pop_back(u->symscopes);
 	delete_list(typescope, NULL);
 	delete_list(symscope, NULL);
 }
@@ -196,10 +221,15 @@ static enum typecomp pointer_compare(struct ctype *l, struct ctype *r)
 	return TC_EXPLICIT;
 }
 
+static void free_pointer(struct ctype *ty)
+{
+	mem_free(MEM_TYPES, ty, sizeof(struct cpointer));
+}
+
 struct ctype *new_pointer(struct ctype *base)
 {
-	struct cpointer *ty = malloc(sizeof(struct cpointer));
-	ty->base.free = (void (*)(struct ctype *))&free;
+	struct cpointer *ty = mem_alloc(MEM_TYPES, sizeof(struct cpointer));
+	ty->base.free = &free_pointer;
 	ty->base.type = POINTER;
 	ty->base.size = gettypesize((struct ctype *)ty);
 	ty->base.name = NULL;
@@ -230,21 +260,21 @@ static enum typecomp struct_compare(struct ctype *l, struct ctype *r)
 static void free_struct(struct ctype *t)
 {
 	struct cstruct *cs = (struct cstruct *)t;
-	free((void *)t->name);
+	if (t->name)
+		mem_free(MEM_TYPES, (void *)t->name, strlen(t->name) + 1);
 	delete_list(cs->fields, NULL);
-	free(t);
+	mem_free(MEM_TYPES, t, sizeof(struct cstruct));
 }
 
 struct ctype *new_struct(char *id)
 {
-	struct cstruct *ty = malloc(sizeof(struct cpointer));
+	struct cstruct *ty = mem_alloc(MEM_TYPES, sizeof(struct cstruct));
 	ty->base.free = &free_struct;
 	ty->base.type = STRUCTURE;
 	ty->base.size = gettypesize((struct ctype *)ty);
-	if (id) {
-		ty->base.name = calloc(strlen(id) + 1, sizeof(char));
-		sprintf((char *)ty->base.name, "%s", id);
-	} else
+	if (id)
+		ty->base.name = mem_strdup(MEM_TYPES, id);
+	else
 		ty->base.name = NULL;
 	ty->base.to_string = &struct_to_string;
 	ty->base.compare = &struct_compare;
@@ -256,10 +286,8 @@ struct ctype *new_struct(char *id)
 void struct_add_field(struct ctype *type, struct ctype *ty, char *id)
 {
 	struct cstruct *cs = (struct cstruct *)type;
-	size_t strl = strlen(id) + 1;
-	struct field * fi = malloc(sizeof(struct field));
-	fi->id = calloc(strl, sizeof(char));
-	sprintf(fi->id, "%s", id);
+	struct field * fi = mem_alloc(MEM_TYPES, sizeof(struct field));
+	fi->id = mem_strdup(MEM_TYPES, id);
 	fi->type = ty;
 	list_push_back(cs->fields, fi);
 }
@@ -307,10 +335,15 @@ static enum typecomp qualified_compare(struct ctype *l, struct ctype *r)
 	return cq->type->compare(cq->type, r);
 }
 
+static void free_qualified(struct ctype *ty)
+{
+	mem_free(MEM_TYPES, ty, sizeof(struct cqualified));
+}
+
 struct ctype * new_qualified(struct ctype *base, enum qualifier q)
 {
-	struct cqualified *ty = malloc(sizeof(struct cqualified));
-	ty->base.free = (void (*)(struct ctype *))&free;
+	struct cqualified *ty = mem_alloc(MEM_TYPES, sizeof(struct cqualified));
+	ty->base.free = &free_qualified;
 	ty->base.type = QUALIFIED;
 	ty->base.size = base->size;
 	ty->base.name = NULL;
@@ -326,7 +359,7 @@ static void free_function(struct ctype *ty)
 {
 	struct cfunction *f = (struct cfunction *)ty;
 	delete_list(f->parameters, NULL);
-	free(f);
+	mem_free(MEM_TYPES, f, sizeof(struct cfunction));
 }
 
 static void function_to_string(FILE *f, struct ctype *ty)
@@ -355,7 +388,7 @@ static enum typecomp function_compare(struct ctype *l, struct ctype *r)
 
 struct ctype *new_function(struct ctype *ret, struct list *params)
 {
-	struct cfunction *ty = malloc(sizeof(struct cfunction));
+	struct cfunction *ty = mem_alloc(MEM_TYPES, sizeof(struct cfunction));
 	ty->base.free = &free_function;
 	ty->base.type = FUNCTION;
 	ty->base.size = -1;
@@ -370,8 +403,9 @@ struct ctype *new_function(struct ctype *ret, struct list *params)
 
 struct symbol *get_symbol(char *id)
 {
+	struct tu *u = curtu();
 	struct list *l;
-	it_t revit = list_rev_iterator(symscopes);
+	it_t revit = list_rev_iterator(u->symscopes);
 	while (rev_iterator_next(&revit, (void **)&l)) {
 		struct symbol *sym;
 		it_t it = list_iterator(l);
@@ -393,8 +427,9 @@ struct enumerator *get_enumerator(char *id)
 
 struct cstruct *get_struct(char *name)
 {
+	struct tu *u = curtu();
 	struct list *l;
-	it_t revit = list_rev_iterator(typescopes);
+	it_t revit = list_rev_iterator(u->typescopes);
 	while (rev_iterator_next(&revit, (void **)&l)) {
 		struct ctype *sym;
 		it_t it = list_iterator(l);
@@ -410,8 +445,9 @@ struct cstruct *get_struct(char *name)
 
 struct cstruct *get_union(char *name)
 {
+	struct tu *u = curtu();
 	struct list *l;
-	it_t revit = list_rev_iterator(typescopes);
+	it_t revit = list_rev_iterator(u->typescopes);
 	while (rev_iterator_next(&revit, (void **)&l)) {
 		struct ctype *sym;
 		it_t it = list_iterator(l);
@@ -428,25 +464,25 @@ struct cstruct *get_union(char *name)
 struct symbol *new_symbol(struct ctype *type, char *id,
 	enum storageclass sc, bool reg)
 {
-	struct symbol *sym = malloc(sizeof(struct symbol));
+	struct symbol *sym = mem_alloc(MEM_SYMBOLS, sizeof(struct symbol));
 	sym->value = NULL;
 	sym->type = type;
 	if (id) {
-		sym->id = malloc((strlen(id) + 1) * sizeof(char));
-		sprintf(sym->id, "%s", id);
+		sym->id = mem_strdup(MEM_SYMBOLS, id);
 	} else {
 		sym->id = NULL;
 	}
 	sym->storage = sc;
 	if (reg)
 		registersym(sym);
-	list_push_back(allsyms, sym);
+	list_push_back(curtu()->allsyms, sym);
 	return sym;
 }
 
 void registersym(struct symbol *sym)
 {
-	struct list *syms = list_last(symscopes);
+	struct tu *u = curtu();
+	struct list *syms = list_last(u->symscopes);
 	list_push_back(syms, sym);
 }
 
@@ -454,16 +490,17 @@ static void delete_symbol(void *ptr)
 {
 	struct symbol *sym = ptr;
 	if (sym->id)
-		free(sym->id);
+		mem_free(MEM_SYMBOLS, sym->id, strlen(sym->id) + 1);
 	if (sym->value && sym->value->etype == ITME_CONTAINER)
 		delete_itm_container((struct itm_container *)sym->value);
-	free(sym);
+	mem_free(MEM_SYMBOLS, sym, sizeof(struct symbol));
 }
 
 struct ctype *get_typedef(char *id)
 {
+	struct tu *u = curtu();
 	struct list *l;
-	it_t revit = list_rev_iterator(symscopes);
+	it_t revit = list_rev_iterator(u->symscopes);
 	while (rev_iterator_next(&revit, (void **)&l)) {
 		struct symbol *sym;
 		it_t it = list_iterator(l);
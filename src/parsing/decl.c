@@ -53,6 +53,7 @@ static struct symbol *parsedeclarator(FILE *f, enum declflags flags,
 static struct symbol *parseddeclarator(FILE *f, enum declflags flags,
 	struct ctype *ty, enum storageclass sc);
 static struct ctype *parseddend(FILE *f, struct ctype *ty);
+static void parseinit(FILE *f, struct symbol *sym);
 static struct ctype *parseparamlist(FILE *f, struct ctype *ty);
 static struct ctype *parsearray(FILE *f, struct ctype *ty);
 
@@ -86,18 +87,24 @@ bool parsedecl(FILE *f, enum declflags flags, struct list *syms, struct itm_bloc
 			assert(sym != NULL);
 			sym->value = (struct itm_expr *)itm_alloca(*b, sym->type);
 		} else if (sym->id) {
-			// TODO: not just IL_GLOBAL
-			sym->value = &new_itm_container(IL_GLOBAL, sym->id,
+			enum itm_linkage l = IL_GLOBAL;
+			if (sc == SC_STATIC)
+				l = IL_STATIC;
+			else if (sc == SC_EXTERN)
+				l = IL_EXTERN;
+			sym->value = &new_itm_container(l, sym->id,
 				sym->type)->base;
 		}
 
-		if ((flags & DF_INIT) && chkt(f, "=") &&
+		if ((flags & DF_INIT) && b && chkt(f, "=") &&
 		    sc != SC_EXTERN && sc != SC_TYPEDEF) {
-			// TODO: this only works for locals
 			struct expr e = parseexpr(f, EF_INIT | EF_FINISH_SEMICOLON |
 				EF_EXPECT_RVALUE, b, sym->type);
 			e = cast(e, sym->type, *b);
 			itm_store(*b, e.itm, sym->value);
+		} else if ((flags & DF_INIT) && sym->value && chkt(f, "=") &&
+		           sc != SC_EXTERN && sc != SC_TYPEDEF) {
+			parseinit(f, sym);
 		}
 		if ((flags & DF_BITFIELD) && chkt(f, ":")) {
 			// TODO: parse bitfield
@@ -127,6 +134,63 @@ bool parsedecl(FILE *f, enum declflags flags, struct list *syms, struct itm_bloc
 	return true;
 }
 
+// the value of lit converted to ty, made in c
+static struct itm_literal *convlit(struct itm_container *c,
+	struct itm_literal *lit, struct ctype *ty)
+{
+	struct ctype *from = lit->base.type;
+	if (from == ty)
+		return lit;
+
+	double d;
+	uint64_t u;
+	if (hastc(from, TC_FLOATING)) {
+		d = from->size == sizeof(float) ? lit->value.f : lit->value.d;
+		u = hastc(ty, TC_UNSIGNED) ? (uint64_t)d : (uint64_t)(int64_t)d;
+	} else if (hastc(from, TC_UNSIGNED) || hastc(from, TC_POINTER)) {
+		u = lit->value.i;
+		d = u;
+	} else {
+		u = itm_getsi(lit);
+		d = (int64_t)u;
+	}
+
+	struct itm_literal *res = new_itm_literal(c, ty);
+	res->value.i = 0;
+	if (hastc(ty, TC_FLOATING) && ty->size == sizeof(float))
+		res->value.f = d;
+	else if (hastc(ty, TC_FLOATING))
+		res->value.d = d;
+	else if (ty == &cbool)
+		res->value.i = hastc(from, TC_FLOATING) ? d != 0 : u != 0;
+	else if (ty->size < sizeof(uint64_t))
+		res->value.i = u & ~(~(uint64_t)0 << ty->size * 8);
+	else
+		res->value.i = u;
+	return res;
+}
+
+/*
+ * Parses the initializer of a global into a block of its own, of which only
+ * the value is kept: it must be a constant
+ */
+static void parseinit(FILE *f, struct symbol *sym)
+{
+	struct itm_container *c = (struct itm_container *)sym->value;
+	struct itm_block *first = new_itm_block(c), *b = first;
+	struct expr e = parseexpr(f, EF_INIT | EF_FINISH_SEMICOLON |
+		EF_EXPECT_RVALUE, &b, sym->type);
+
+	if (e.itm && e.itm->etype == ITME_LITERAL) {
+		cast(e, sym->type, b);
+		c->init = convlit(c, (struct itm_literal *)e.itm, sym->type);
+	} else if (e.itm) {
+		report(E_PARSER | E_HIDE_TOKEN, NULL,
+			"initializer of \"%s\" is not a constant", sym->id);
+	}
+	delete_itm_block(first);
+}
+
 static bool parsestorage(FILE *f, enum storageclass *sc,
 	const char *mod, enum storageclass set)
 {
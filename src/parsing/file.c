@@ -38,7 +38,8 @@ static void addparams(struct cfunction *fun)
 		registersym(sym);
 }
 
-static void processdecls(FILE *f, struct list *decls, struct list *syms)
+static void processdecls(FILE *f, struct list *decls, struct list *syms,
+	struct declpos *pos)
 {
 	struct symbol *sym;
 	it_t it = list_iterator(decls);
@@ -53,16 +54,24 @@ static void processdecls(FILE *f, struct list *decls, struct list *syms)
 		return;
 
 
+	if (pos) {
+		pos->bodyline = tok.line;
+		pos->bodycolumn = tok.column;
+	}
 	ungettok(&tok, f);
 	freetok(&tok);
 
 	struct symbol *sf = list_head(decls);
 	struct cfunction *cf = (struct cfunction *)sf->type;
-	// TODO: retrieve correct linkage, not just IL_GLOBAL
 	struct symbol *last = list_last(decls);
 	struct itm_container *cont = (struct itm_container *)last->value;
+	// a definition of an extern function defines it here after all
+	if (cont->linkage == IL_EXTERN)
+		cont->linkage = IL_GLOBAL;
 	struct itm_block *block = new_itm_block(cont);
 	cont->block = block;
+	if (pos)
+		pos->fn = cont;
 
 	enter_scope();
 	addparams(cf);
@@ -73,12 +82,21 @@ static void processdecls(FILE *f, struct list *decls, struct list *syms)
 		itm_leave(block);
 }
 
-void parsefile(FILE *f, struct list *syms)
+void parsefile(FILE *f, struct list *syms, struct list *decls)
 {
 	struct list * declsyms;
-	while (!chktt(f, T_EOF) &&
-	      parsedecl(f, DF_GLOBAL, (declsyms = new_list(NULL, 0)), NULL)) {
-		processdecls(f, declsyms, syms);
+	for (;;) {
+		struct declpos *pos = NULL;
+		if (decls) {
+			pos = calloc(1, sizeof(struct declpos));
+			peekpos(f, &pos->line, &pos->column);
+			list_push_back(decls, pos);
+		}
+
+		if (chktt(f, T_EOF) ||
+		    !parsedecl(f, DF_GLOBAL, (declsyms = new_list(NULL, 0)), NULL))
+			break;
+		processdecls(f, declsyms, syms, pos);
 		delete_list(declsyms, NULL);
 	}
 }
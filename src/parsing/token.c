@@ -24,7 +24,8 @@
  * The standard interface provides buffered access to tokens, although this is
  * abstracted away through an interface that seems unbuffered. The variable
  * "isbuffered" indicates whether the next token is already buffered or not. If
- * this is so, the next token is stored in the global variable "buffer". Using
+ * this is so, the next token is stored in "buffer". Both are kept with the rest
+ * of the tokenizer state in the current translation unit (see curtu()). Using
  * readtok() immediately is not preferred. It is more performance efficient to
  * make certain input is buffered first (call validatebuf()) and then read from
  * "buffer". To then advance the token for the next function, set "isbuffered"
@@ -39,6 +40,8 @@
 #include <acc/parsing/token.h>
 #include <acc/error.h>
 #include <acc/ext.h>
+#include <acc/mem.h>
+#include <acc/tu.h>
 
 /* string stream */
 typedef struct {
@@ -82,21 +85,16 @@ static bool readch(FILE *f, SFILE *t, char terminator);
 
 static struct token clonetok(struct token *tok);
 
-static int line = 1;
-static int column = 1;
-static char *linestr = NULL;
-
-static struct token buffer = { 0 };
-static bool isbuffered = false;
-
 int get_line(void)
 {
-	return line;
+	struct tu *u = curtu();
+	return u ? u->line : 0;
 }
 
 int get_column(void)
 {
-	return column;
+	struct tu *u = curtu();
+	return u ? u->column : 0;
 }
 
 /*
@@ -154,8 +152,9 @@ static void ssunputc(SFILE *ss)
 
 static void readline(FILE *f)
 {
-	if (linestr)
-		free(linestr);
+	struct tu *u = curtu();
+	if (u->linestr)
+		free(u->linestr);
 
 	SFILE *sf = ssopen();
 
@@ -166,9 +165,9 @@ static void readline(FILE *f)
 	}
 	ungetc(nxt, f);
 
-	linestr = ssclose(sf);
+	u->linestr = ssclose(sf);
 	for (; i > 0; --i)
-		ungetc(linestr[i - 1], f);
+		ungetc(u->linestr[i - 1], f);
 }
 
 /*
@@ -177,14 +176,15 @@ static void readline(FILE *f)
  */
 static struct lchar fgetlc(FILE *f)
 {
+	struct tu *u = curtu();
 	struct lchar res;
 	res.chars[0] = res.ch = fgetc(f);
-	++column;
+	++u->column;
 	if (res.chars[0] != '?') {
 		if (res.chars[0] == '\n') {
 			readline(f);
-			++line;
-			column = 1;
+			++u->line;
+			u->column = 1;
 		}
 		res.len = 1;
 		return res;
@@ -195,7 +195,7 @@ static struct lchar fgetlc(FILE *f)
 		res.len = 1;
 		return res;
 	}
-	column += 2;
+	u->column += 2;
 	res.chars[2] = fgetc(f);
 	switch (res.chars[2]) {
 	case '=':
@@ -237,7 +237,7 @@ static struct lchar fgetlc(FILE *f)
 	case '?':
 		ungetc('?', f);
 		ungetc('?', f);
-		column -= 2;
+		u->column -= 2;
 		res.ch = '?';
 		res.len = 1;
 		return res;
@@ -245,20 +245,21 @@ static struct lchar fgetlc(FILE *f)
 	report(E_TOKENIZER, NULL, "invalid trigraph sequence: \"\?\?%c\"", res.chars[2]);
 	ungetc(res.chars[2], f);
 	ungetc(res.chars[1], f);
-	column -= 2;
+	u->column -= 2;
 	res.len = 1;
 	return res;
 }
 
 static void ungetlc(struct lchar *lc, FILE *f)
 {
+	struct tu *u = curtu();
 	for (int i = lc->len - 1; i >= 0; --i) {
 		int c = lc->chars[i];
 		if (c == '\n') {
-			--line;
-			column = 1;
+			--u->line;
+			u->column = 1;
 		} else {
-			--column;
+			--u->column;
 		}
 		ungetc(c, f);
 	}
@@ -652,14 +653,15 @@ static bool chkstr(FILE *f, SFILE *t, enum tokenty *tt)
 
 static struct token readtok(FILE *f)
 {
-	if (!linestr)
+	struct tu *u = curtu();
+	if (!u->linestr)
 		readline(f);
 
 	skipf(f);
 
 	struct token res;
-	res.line = line;
-	res.column = column;
+	res.line = u->line;
+	res.column = u->column;
 	res.linestr = NULL;
 
 	SFILE *t = ssopen();
@@ -687,132 +689,144 @@ static struct token readtok(FILE *f)
 	report(E_TOKENIZER, NULL, "character out of place: '%c'", fgetc(f));
 
 ret:
+	t->buf = mem_take(MEM_TOKENS, t->buf, t->count + 1);
 	res.lexeme = ssclose(t);
-	res.linestr = malloc((strlen(linestr) + 1) * sizeof(char));
-	sprintf(res.linestr, "%s", linestr);
+	res.linestr = mem_strdup(MEM_TOKENS, u->linestr);
 eofret:
 	return res;
 }
 
 static void rewritetok(struct token *t, FILE *f)
 {
+	struct tu *u = curtu();
 	size_t len = strlen(t->lexeme);
 	for (int i = len - 1; i >= 0; --i)
 		ungetc(t->lexeme[i], f);
 
-	column = t->column;
-	line = t->line;
+	u->column = t->column;
+	u->line = t->line;
 }
 
 void ungettok(struct token *t, FILE *f)
 {
-	if (isbuffered) {
-		rewritetok(&buffer, f);
-		freetok(&buffer);
-		buffer = clonetok(t);
+	struct tu *u = curtu();
+	if (u->isbuffered) {
+		rewritetok(&u->buffer, f);
+		freetok(&u->buffer);
+		u->buffer = clonetok(t);
 	} else {
-		buffer = clonetok(t);
-		isbuffered = true;
+		u->buffer = clonetok(t);
+		u->isbuffered = true;
 	}
 }
 
 void freetok(struct token *t)
 {
 	if (t->lexeme)
-		free(t->lexeme);
+		mem_free(MEM_TOKENS, t->lexeme, strlen(t->lexeme) + 1);
 	if (t->linestr)
-		free(t->linestr);
+		mem_free(MEM_TOKENS, t->linestr, strlen(t->linestr) + 1);
 }
 
 static void validatebuf(FILE *f)
 {
-	if (isbuffered)
+	struct tu *u = curtu();
+	if (u->isbuffered)
 		return;
 
-	buffer = readtok(f);
-	isbuffered = true;
+	u->buffer = readtok(f);
+	u->isbuffered = true;
 }
 
 void resettok(void)
 {
-	line = 1;
-	column = 1;
-	isbuffered = false;
-	if (linestr)
-		free(linestr);
-	linestr = NULL;
+	struct tu *u = curtu();
+	u->line = 1;
+	u->column = 1;
+	u->isbuffered = false;
+	if (u->linestr)
+		free(u->linestr);
+	u->linestr = NULL;
 }
 
 static struct token clonetok(struct token *tok)
 {
 	struct token res = *tok;
-	if (tok->lexeme) {
-		res.lexeme = malloc((strlen(tok->lexeme) + 1) * sizeof(char));
-		sprintf(res.lexeme, "%s", tok->lexeme);
-	} else {
+	if (tok->lexeme)
+		res.lexeme = mem_strdup(MEM_TOKENS, tok->lexeme);
+	else
 		res.lexeme = NULL;
-	}
-	if (tok->linestr) {
-		res.linestr = malloc((strlen(tok->linestr) + 1) * sizeof(char));
-		sprintf(res.linestr, "%s", tok->linestr);
-	} else {
+	if (tok->linestr)
+		res.linestr = mem_strdup(MEM_TOKENS, tok->linestr);
+	else
 		res.linestr = NULL;
-	}
 	return res;
 }
 
 struct token gettok(FILE *f)
 {
+	struct tu *u = curtu();
 	validatebuf(f);
-	struct token res = clonetok(&buffer);
-	freetok(&buffer);
-	isbuffered = false;
+	struct token res = clonetok(&u->buffer);
+	freetok(&u->buffer);
+	u->isbuffered = false;
 	return res;
 }
 
 bool chkt(FILE *f, const char *t)
 {
+	struct tu *u = curtu();
 	validatebuf(f);
 
-	if (buffer.type == T_EOF) {
+	if (u->buffer.type == T_EOF) {
 		report(E_FATAL | E_HIDE_TOKEN, NULL,
 		       "unexpected end-of-file");
 	}
 
-	if (strcmp(t, buffer.lexeme))
+	if (strcmp(t, u->buffer.lexeme))
 		return false;
 
-	freetok(&buffer);
-	isbuffered = false;
+	freetok(&u->buffer);
+	u->isbuffered = false;
 	return true;
 }
 
 bool chktt(FILE *f, enum tokenty tt)
 {
+	struct tu *u = curtu();
 	validatebuf(f);
 
-	if (buffer.type != tt) {
-		if (buffer.type == T_EOF) {
+	if (u->buffer.type != tt) {
+		if (u->buffer.type == T_EOF) {
 			report(E_FATAL | E_HIDE_TOKEN, NULL,
 				"unexpected end-of-file");
 		}
 		return false;
 	}
 
-	if (buffer.type == T_EOF) {
+	if (u->buffer.type == T_EOF) {
 		resettok();
 		return true;
 	}
 
-	freetok(&buffer);
-	isbuffered = false;
+	freetok(&u->buffer);
+	u->isbuffered = false;
 	return true;
 }
 
+void peekpos(FILE *f, int *line, int *column)
+{
+	struct tu *u = curtu();
+	validatebuf(f);
+	*line = u->buffer.line;
+	*column = u->buffer.column;
+}
+
 bool chktp(FILE *f, const char *t, struct token *nxt)
 {
+	struct tu *u = curtu();
 	validatebuf(f);
-	*nxt = clonetok(&buffer);
+	*nxt = clonetok(&u->buffer);
 	bool res = chkt(f, t);
 	if (!res)
 		freetok(nxt);
@@ -821,8 +835,9 @@ bool chktp(FILE *f, const char *t, struct token *nxt)
 
 bool chkttp(FILE *f, enum tokenty tt, struct token *nxt)
 {
+	struct tu *u = curtu();
 	validatebuf(f);
-	*nxt = clonetok(&buffer);
+	*nxt = clonetok(&u->buffer);
 	bool res = chktt(f, tt);
 	if (!res)
 		freetok(nxt);
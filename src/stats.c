@@ -0,0 +1,225 @@
+/*
+ * Optimization statistics
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <acc/stats.h>
+#include <acc/options.h>
+#include <acc/thread.h>
+
+// the keys of the JSON output, and the columns of the table
+static const char *statnames[NSTATS] = {
+	"constants_folded",
+	"splits_removed",
+	"blocks_pruned",
+	"allocas_promoted",
+	"movs_inserted",
+	"hints_resolved",
+	"hints_dropped",
+	"registers_spilled",
+	"instructions"
+};
+
+static const char *statcols[NSTATS] = {
+	"folded",
+	"unsplit",
+	"pruned",
+	"promoted",
+	"movs",
+	"resolved",
+	"dropped",
+	"spilled",
+	"instrs"
+};
+
+// in the order first counted
+struct fnstats {
+	char *name;
+	long counts[NSTATS];
+	struct fnstats *next;
+};
+
+struct stats {
+	char *name;
+	struct mutex *lock;
+	struct fnstats *first, *last;
+};
+
+static char *copystr(const char *str)
+{
+	char *copy = malloc(strlen(str) + 1);
+	strcpy(copy, str);
+	return copy;
+}
+
+void stats_open(struct tu *u, const char *name)
+{
+	if (!option_stats())
+		return;
+
+	struct stats *s = calloc(1, sizeof(struct stats));
+	s->name = copystr(name);
+	s->lock = new_mutex();
+	u->stats = s;
+}
+
+void stats_add(const char *fn, enum stat stat, long n)
+{
+	struct tu *u = curtu();
+	struct stats *s = u ? u->stats : NULL;
+	if (!s || !n)
+		return;
+
+	mutex_lock(s->lock);
+	struct fnstats *f;
+	for (f = s->first; f; f = f->next)
+		if (!strcmp(f->name, fn))
+			break;
+
+	if (!f) {
+		f = calloc(1, sizeof(struct fnstats));
+		f->name = copystr(fn);
+		if (s->last)
+			s->last->next = f;
+		else
+			s->first = f;
+		s->last = f;
+	}
+	f->counts[stat] += n;
+	mutex_unlock(s->lock);
+}
+
+/*
+ * Reporting
+ */
+
+struct out {
+	char *data;
+	size_t len, cap;
+};
+
+static void outf(struct out *o, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char line[256];
+	int len = vsprintf(line, fmt, ap);
+	va_end(ap);
+
+	if (o->len + len > o->cap)
+		o->data = realloc(o->data, o->cap = (o->len + len) * 2);
+	memcpy(o->data + o->len, line, len);
+	o->len += len;
+}
+
+static void outjson(struct out *o, const char *str)
+{
+	outf(o, "\"");
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\')
+			outf(o, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			outf(o, "\\u%04x", (unsigned char)*str);
+		else
+			outf(o, "%c", *str);
+	}
+	outf(o, "\"");
+}
+
+static void outcounts(struct out *o, const long *counts)
+{
+	outf(o, "{");
+	for (int k = 0; k < NSTATS; ++k)
+		outf(o, "%s\"%s\":%ld", k ? "," : "", statnames[k], counts[k]);
+	outf(o, "}");
+}
+
+// one line for each unit, so that the output of several is JSON Lines
+static void putjson(struct out *o, struct stats *s, const long *total)
+{
+	outf(o, "{\"file\":");
+	outjson(o, s->name);
+	outf(o, ",\"total\":");
+	outcounts(o, total);
+	outf(o, ",\"functions\":[");
+	for (struct fnstats *f = s->first; f; f = f->next) {
+		outf(o, "%s{\"name\":", f == s->first ? "" : ",");
+		outjson(o, f->name);
+		outf(o, ",\"stats\":");
+		outcounts(o, f->counts);
+		outf(o, "}");
+	}
+	outf(o, "]}\n");
+}
+
+static void putrow(struct out *o, const char *name, const long *counts)
+{
+	outf(o, "  %-24.200s", name);
+	for (int k = 0; k < NSTATS; ++k)
+		outf(o, " %8ld", counts[k]);
+	outf(o, "\n");
+}
+
+static void puttable(struct out *o, struct stats *s, const long *total)
+{
+	outf(o, "statistics for %.200s:\n", s->name);
+	outf(o, "  %-24s", "function");
+	for (int k = 0; k < NSTATS; ++k)
+		outf(o, " %8s", statcols[k]);
+	outf(o, "\n");
+	for (struct fnstats *f = s->first; f; f = f->next)
+		putrow(o, f->name, f->counts);
+	putrow(o, "total", total);
+}
+
+void stats_report(struct tu *u)
+{
+	struct stats *s = u->stats;
+	if (!s)
+		return;
+
+	long total[NSTATS] = { 0 };
+	for (struct fnstats *f = s->first; f; f = f->next)
+		for (int k = 0; k < NSTATS; ++k)
+			total[k] += f->counts[k];
+
+	// units of which nothing was compiled, like those linked with -flto
+	struct out o = { 0 };
+	if (s->first && option_stats_json())
+		putjson(&o, s, total);
+	else if (s->first)
+		puttable(&o, s, total);
+	if (o.len)
+		tu_diag(u, o.data, o.len);
+	free(o.data);
+
+	struct fnstats *f = s->first, *next;
+	for (; f; f = next) {
+		next = f->next;
+		free(f->name);
+		free(f);
+	}
+	delete_mutex(s->lock);
+	free(s->name);
+	free(s);
+	u->stats = NULL;
+}
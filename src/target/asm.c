@@ -27,6 +27,9 @@
 #include <acc/target/cpu.h>
 #include <acc/itm/analyze.h>
 #include <acc/options.h>
+#include <acc/mem.h>
+#include <acc/timer.h>
+#include <acc/stats.h>
 
 asme_type_t asme_reg;
 asme_type_t asme_imm;
@@ -35,6 +38,8 @@ static const char *const locstr = "loc";
 const tagtype_t tt_loc = &locstr;
 static const char *const lochintstr = "lochint";
 static const tagtype_t tt_lochint = &lochintstr;
+static const char *const framestr = "frame";
+static const tagtype_t tt_frame = &framestr;
 
 static inline void loc_init(struct location *loc, enum locty type,
 	size_t size, void *ex)
@@ -46,7 +51,7 @@ static inline void loc_init(struct location *loc, enum locty type,
 
 struct location *new_loc_reg(size_t size, regid_t rid)
 {
-	struct loc_reg *loc = malloc(sizeof(struct loc_reg));
+	struct loc_reg *loc = mem_alloc(MEM_LOCATIONS, sizeof(struct loc_reg));
 	loc_init(&loc->base, LT_REG, size, loc);
 	loc->rid = rid;
 	return &loc->base;
@@ -54,7 +59,7 @@ struct location *new_loc_reg(size_t size, regid_t rid)
 
 struct location *new_loc_lmem(size_t size, int offset)
 {
-	struct loc_mem *loc = malloc(sizeof(struct loc_mem));
+	struct loc_mem *loc = mem_alloc(MEM_LOCATIONS, sizeof(struct loc_mem));
 	loc_init(&loc->base, LT_LMEM, size, loc);
 	loc->offset = offset;
 	return &loc->base;
@@ -62,7 +67,7 @@ struct location *new_loc_lmem(size_t size, int offset)
 
 struct location *new_loc_pmem(size_t size, int offset)
 {
-	struct loc_mem *loc = malloc(sizeof(struct loc_mem));
+	struct loc_mem *loc = mem_alloc(MEM_LOCATIONS, sizeof(struct loc_mem));
 	loc_init(&loc->base, LT_PMEM, size, loc);
 	loc->offset = offset;
 	return &loc->base;
@@ -70,7 +75,8 @@ struct location *new_loc_pmem(size_t size, int offset)
 
 struct location *new_loc_multiple(size_t size, struct list *locs)
 {
-	struct loc_multiple *loc = malloc(sizeof(struct loc_multiple));
+	struct loc_multiple *loc = mem_alloc(MEM_LOCATIONS,
+		sizeof(struct loc_multiple));
 	loc_init(&loc->base, LT_MULTIPLE, size, loc);
 	loc->locs = clone_list(locs);
 	return &loc->base;
@@ -78,11 +84,15 @@ struct location *new_loc_multiple(size_t size, struct list *locs)
 
 void delete_loc(struct location *loc)
 {
+	size_t size = sizeof(struct loc_reg);
 	if (loc->type == LT_MULTIPLE) {
 		struct loc_multiple *ext = loc->extended;
 		delete_list(ext->locs, (void (*)(void *))&delete_loc);
+		size = sizeof(struct loc_multiple);
+	} else if (loc->type != LT_REG) {
+		size = sizeof(struct loc_mem);
 	}
-	free(loc);
+	mem_free(MEM_LOCATIONS, loc, size);
 }
 
 void loc_to_string(FILE *f, struct location *loc)
@@ -107,6 +117,10 @@ void loc_to_string(FILE *f, struct location *loc)
 			rid &= ~(1ul << i);
 		}
 		break;
+	case LT_LMEM:
+		mem = loc->extended;
+		fprintf(f, "fp%+d", mem->offset);
+		break;
 	}
 }
 
@@ -228,6 +242,44 @@ void delete_asm_imm(struct asmimm *imm)
 		free(imm->label);
 }
 
+static struct itm_tag *frametag(struct itm_block *b)
+{
+	while (b->lexprev)
+		b = b->lexprev;
+
+	struct itm_tag *tag = itm_get_tag(&b->base, tt_frame);
+	if (!tag) {
+		tag = new_itm_tag(tt_frame, TO_INT);
+		itm_tag_expr(&b->base, tag);
+	}
+	return tag;
+}
+
+/*
+ * Reserves size bytes in the frame of the function b is part of, aligned to
+ * the size rounded up to a power of two (but no more than 16 bytes).
+ */
+int framealloc(struct itm_block *b, size_t size)
+{
+	assert(b != NULL);
+
+	size_t align = 1;
+	while (align < size && align < 16)
+		align *= 2;
+
+	struct itm_tag *tag = frametag(b);
+	int frame = itm_tag_geti(tag) + size;
+	frame = (frame + align - 1) / align * align;
+	itm_tag_seti(tag, frame);
+	return -frame;
+}
+
+int framesize(struct itm_block *b)
+{
+	assert(b != NULL);
+	return itm_tag_geti(frametag(b));
+}
+
 /*
  * These are register allocation functions, used to assign a valid register to
  * each intermediate instruction.
@@ -255,16 +307,39 @@ static void regasn(struct itm_block *b, struct archdes ades,
 
 /*
  * The only exported register allocation functions, calling in sequence the
- * three basic components.
+ * three basic components. From -O2 upwards the graph coloring allocator in
+ * regcolor.c is used instead.
  */
+static bool needscolor(struct itm_block *b)
+{
+	for (; b; b = b->lexnext)
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			if (i->id == ITM_ID(itm_phi) || i->id == ITM_ID(itm_clobb))
+				return true;
+	return false;
+}
+
 void regalloc(struct itm_block *b, struct archdes ades)
 {
+	/*
+	 * The hint-based allocator doesn't know values can live across loops,
+	 * nor that clobbered registers can't hold values that live past them.
+	 */
+	if (option_optimize() >= 2 || needscolor(b)) {
+		regcolor(b, ades);
+		return;
+	}
+
 	struct list *overlapdict = new_list(NULL, 0);
+	timer_start("overlap", NULL);
 	getovlps(b, ades, overlapdict);
+	timer_stop();
 #ifndef NDEBUG
 	ovldump(overlapdict);
 #endif
+	timer_start("assign", NULL);
 	regasn(b, ades, overlapdict);
+	timer_stop();
 
 	it_t it = list_iterator(overlapdict);
 	struct list *li;
@@ -299,7 +374,7 @@ static void ovldump(struct list *overlapdict)
 
 
 static void rgetovlps(struct itm_instr *i, struct archdes ades, int *h,
-	struct list *alive, struct list *overlapdicth);
+	struct list *alive, struct list *overlapdicth, struct list *visited);
 static void killinstrs(struct itm_instr *i, struct list *alive);
 
 static void getovlps(struct itm_block *b, struct archdes ades,
@@ -311,7 +386,9 @@ static void getovlps(struct itm_block *b, struct archdes ades,
 
 	int h = 0;
 	struct list *alive = new_list(NULL, 0);
-	rgetovlps(b->first, ades, &h, alive, overlapdict);
+	struct list *visited = new_list(NULL, 0);
+	rgetovlps(b->first, ades, &h, alive, overlapdict, visited);
+	delete_list(visited, NULL);
 	delete_list(alive, NULL);
 }
 
@@ -330,14 +407,15 @@ static void killinstrs(struct itm_instr *i, struct list *alive)
 }
 
 static void rgetovlps(struct itm_instr *i, struct archdes ades, int *h,
-	struct list *alive, struct list *overlapdict)
+	struct list *alive, struct list *overlapdict, struct list *visited)
 {
 	assert(h != NULL);
 	assert(i != NULL);
 
-	if (i->base.type != &cvoid && i->id != ITM_ID(itm_alloca)) {
-		killinstrs(i, alive);
+	// values may die at void instructions too, like the condition of a split
+	killinstrs(i, alive);
 
+	if (i->base.type != &cvoid && i->id != ITM_ID(itm_alloca)) {
 		struct list *initoverl = new_list(NULL, 0);
 
 		struct itm_instr *other;
@@ -355,13 +433,18 @@ static void rgetovlps(struct itm_instr *i, struct archdes ades, int *h,
 	}
 
 	if (i->next) {
-		rgetovlps(i->next, ades, h, alive, overlapdict);
+		rgetovlps(i->next, ades, h, alive, overlapdict, visited);
 	} else {
+		// each block is walked once, or loops would never end
 		struct itm_block *nxt;
 		it_t bit = list_iterator(i->block->next);
 		while (iterator_next(&bit, (void **)&nxt)) {
+			if (list_contains(visited, nxt) || !nxt->first)
+				continue;
+			list_push_back(visited, nxt);
 			struct list *nalive = clone_list(alive);
-			rgetovlps(nxt->first, ades, h, nalive, overlapdict);
+			rgetovlps(nxt->first, ades, h, nalive, overlapdict,
+				visited);
 			delete_list(nalive, NULL);
 		}
 	}
@@ -411,23 +494,28 @@ static void regasn(struct itm_block *b, struct archdes ades,
 static void resolvconfls(struct itm_block *b, struct archdes ades,
 	struct list *overlapdict)
 {
-	for (struct itm_instr *i = b->first; i; i = i->next) {
-		struct itm_instr *win = resolvconfl(i, ades, overlapdict);
-		if (!win)
-			continue;
+	const char *id = b->container->id;
+	int numres = 0;
+	struct list *ovl;
+	for (; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			if (!dict_get(overlapdict, i, (void **)&ovl))
+				continue;
 
-		struct itm_tag *loct = itm_get_tag(&win->base, tt_lochint);
-		struct location *loc = copy_loc(itm_tag_get_user_ptr(loct));
-		struct itm_tag *nloct = new_itm_tag(tt_loc, TO_USER_PTR);
-		itm_tag_set_user_ptr(nloct, loc, (void (*)(FILE *, void *))&loc_to_string);
-		itm_untag_expr(&win->base, tt_lochint);
-		itm_tag_expr(&win->base, nloct);
-	}
+			struct itm_instr *win = resolvconfl(i, ades, overlapdict);
+			if (!win)
+				continue;
 
-	struct itm_block *nxt;
-	it_t it = list_iterator(b->next);
-	while (iterator_next(&it, (void **)&nxt))
-		resolvconfls(nxt, ades, overlapdict);
+			++numres;
+			struct itm_tag *loct = itm_get_tag(&win->base, tt_lochint);
+			struct location *loc = copy_loc(itm_tag_get_user_ptr(loct));
+			struct itm_tag *nloct = new_itm_tag(tt_loc, TO_USER_PTR);
+			itm_tag_set_user_ptr(nloct, loc, (void (*)(FILE *, void *))&loc_to_string);
+			itm_untag_expr(&win->base, tt_lochint);
+			itm_tag_expr(&win->base, nloct);
+		}
+	}
+	stats_add(id, ST_RESOLVED, numres);
 }
 
 static struct itm_instr *resolvconfl(struct itm_instr *i, struct archdes ades,
@@ -466,6 +554,7 @@ static struct itm_instr *resolvconfl(struct itm_instr *i, struct archdes ades,
 		}
 
 		itm_untag_expr(&ovli->base, tt_lochint);
+		stats_add(i->block->container->id, ST_DROPPED, 1);
 	}
 
 	return winner;
@@ -474,15 +563,12 @@ static struct itm_instr *resolvconfl(struct itm_instr *i, struct archdes ades,
 static void induceregs(struct itm_block *b, struct archdes ades,
 	struct list *overlapdict)
 {
-	for (struct itm_instr *i = b->first; i; i = i->next) {
-		inducereg(i, ades, overlapdict);
-		deducereg(i, ades, overlapdict);
+	for (; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			inducereg(i, ades, overlapdict);
+			deducereg(i, ades, overlapdict);
+		}
 	}
-
-	struct itm_block *nxt;
-	it_t it = list_iterator(b->next);
-	while (iterator_next(&it, (void **)&nxt))
-		induceregs(nxt, ades, overlapdict);
 }
 
 static void inducereg(struct itm_instr *i, struct archdes ades,
@@ -547,14 +633,13 @@ static void deducereg(struct itm_instr *i, struct archdes ades,
 static void asnrems(struct itm_block *b, struct archdes ades,
 	struct list *overlapdict)
 {
-	for (struct itm_instr *i = b->first; i; i = i->next)
-		if (i->base.type != &cvoid)
-			asnrem(i, ades, overlapdict);
-
-	struct itm_block *nxt;
-	it_t it = list_iterator(b->next);
-	while (iterator_next(&it, (void **)&nxt))
-		asnrems(nxt, ades, overlapdict);
+	struct list *ovl;
+	for (; b; b = b->lexnext)
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			// unreachable instructions have no overlap information
+			if (i->base.type != &cvoid &&
+			    dict_get(overlapdict, i, (void **)&ovl))
+				asnrem(i, ades, overlapdict);
 }
 
 // returns 0 if unsuccessful
@@ -566,8 +651,8 @@ static regid_t rgetreg(struct itm_instr *i, struct archdes ades,
 
 	regid_t try;
 	for (int i = 0; i < sizeof(regid_t) * 8; ++i) {
-		if (av & (1u << i)) {
-			try = 1u << i;
+		if (av & (1ul << i)) {
+			try = 1ul << i;
 			break;
 		}
 	}
@@ -606,9 +691,16 @@ static void asnrem(struct itm_instr *i, struct archdes ades,
 	if (itm_get_tag(&i->base, tt_loc))
 		return;
 
-	regid_t try = getreg(i, ades, overlapdict, ades.all_iregs & ~ades.saved_iregs);
+	regid_t all = ades.all_iregs;
+	regid_t saved = ades.saved_iregs;
+	if (hastc(i->base.type, TC_FLOATING)) {
+		all = ades.all_fregs;
+		saved = ades.saved_fregs;
+	}
+
+	regid_t try = getreg(i, ades, overlapdict, all & ~saved);
 	if (!try)
-		try = getreg(i, ades, overlapdict, ades.saved_iregs);
+		try = getreg(i, ades, overlapdict, saved);
 
 	struct loc_reg *reg = new_loc_reg(i->base.type->size, try)->extended;
 	struct itm_tag *regt = new_itm_tag(tt_loc, TO_USER_PTR);
@@ -0,0 +1,161 @@
+/*
+ * Buffered assembly output
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+// for write(2) and fileno(), where there are such
+#ifdef __unix__
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+#include <acc/target/asmout.h>
+#include <acc/error.h>
+
+#define ASMOUT_BUFSIZE (64 * 1024)
+
+struct asmout {
+	FILE *f;		// NULL to keep everything in buf
+	int fd;
+	size_t len, cap;
+	char *buf;
+};
+
+struct asmout *new_asmout(FILE *f)
+{
+	struct asmout *o = malloc(sizeof(struct asmout));
+	o->f = f;
+	o->fd = -1;
+	o->len = 0;
+	o->cap = f ? ASMOUT_BUFSIZE : 256;
+	o->buf = malloc(o->cap);
+#ifdef __unix__
+	if (f) {
+		fflush(f);
+		o->fd = fileno(f);
+	}
+#endif
+	return o;
+}
+
+void delete_asmout(struct asmout *o)
+{
+	asmout_flush(o);
+	free(o->buf);
+	free(o);
+}
+
+const char *asmout_data(struct asmout *o, size_t *len)
+{
+	*len = o->len;
+	return o->buf;
+}
+
+// makes room for len more bytes, or fails if there's a file to write to
+static bool asmout_grow(struct asmout *o, size_t len)
+{
+	if (o->f)
+		return false;
+
+	while (o->len + len > o->cap)
+		o->cap *= 2;
+	o->buf = realloc(o->buf, o->cap);
+	return true;
+}
+
+static void asmout_write(struct asmout *o, const char *p, size_t left)
+{
+	// streams without a file descriptor fall back on stdio
+	if (o->fd < 0) {
+		if (fwrite(p, 1, left, o->f) != left)
+			report(E_INTERNAL, NULL, "can't write output: %s",
+				strerror(errno));
+		return;
+	}
+
+#ifdef __unix__
+	while (left) {
+		ssize_t n = write(o->fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			report(E_INTERNAL, NULL, "can't write output: %s",
+				strerror(errno));
+		p += n;
+		left -= n;
+	}
+#endif
+}
+
+void asmout_flush(struct asmout *o)
+{
+	if (!o->f)
+		return;
+
+	size_t len = o->len;
+	o->len = 0;
+	asmout_write(o, o->buf, len);
+}
+
+void asmout_mem(struct asmout *o, const char *s, size_t len)
+{
+	if (o->len + len > o->cap && !asmout_grow(o, len))
+		asmout_flush(o);
+	if (len > o->cap) {
+		asmout_write(o, s, len);
+		return;
+	}
+
+	memcpy(o->buf + o->len, s, len);
+	o->len += len;
+}
+
+void asmout_str(struct asmout *o, const char *s)
+{
+	asmout_mem(o, s, strlen(s));
+}
+
+void asmout_chr(struct asmout *o, char c)
+{
+	if (o->len == o->cap && !asmout_grow(o, 1))
+		asmout_flush(o);
+	o->buf[o->len++] = c;
+}
+
+void asmout_dec(struct asmout *o, int64_t value)
+{
+	char digits[24];
+	char *p = digits + sizeof(digits);
+	// negated unsigned, so INT64_MIN is fine
+	uint64_t v = value < 0 ? -(uint64_t)value : value;
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	if (value < 0)
+		*--p = '-';
+	asmout_mem(o, p, digits + sizeof(digits) - p);
+}
@@ -34,12 +34,21 @@ const struct cpu *cpus[] = {
 };
 
 static enum asmflavor flavor = AF_ATT;
+static bool sse2set = false;
+static bool sse2 = false;
 
 enum asmflavor asmflavor(void)
 {
 	return flavor;
 }
 
+bool x86_sse2(void)
+{
+	if (getcpu()->offset < cpui686.offset)
+		return false;
+	return sse2set ? sse2 : getcpu() == &cpux86_64;
+}
+
 void xarchoption(const char *opt)
 {
 	if (!strcmp(opt, "asm=nasm") || !strcmp(opt, "asm=intel")) {
@@ -48,14 +57,39 @@ void xarchoption(const char *opt)
 	} else if (!strcmp(opt, "asm=gas") || !strcmp(opt, "asm=att")) {
 		flavor = AF_ATT;
 		return;
+	} else if (!strcmp(opt, "sse2")) {
+		sse2set = sse2 = true;
+		return;
+	} else if (!strcmp(opt, "no-sse2")) {
+		sse2set = true;
+		sse2 = false;
+		return;
 	}
 
 	report(E_OPTIONS | E_FATAL, NULL,
 		"invalid option for architecture: '-m%s'", opt);
 }
 
+void xarchhash(struct hash *h)
+{
+	hash_int(h, flavor);
+	hash_int(h, x86_sse2());
+}
+
 int gettypesize(struct ctype *ty)
 {
+	// unsigned types are as large as their signed counterparts
+	if (ty == &cuchar)
+		ty = &cchar;
+	else if (ty == &cushort)
+		ty = &cshort;
+	else if (ty == &cuint)
+		ty = &cint;
+	else if (ty == &culong)
+		ty = &clong;
+	else if (ty == &culonglong)
+		ty = &clonglong;
+
 	if (ty == &cbool)
 		return 1;
 	if (ty == &cfloat)
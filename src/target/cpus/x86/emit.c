@@ -18,10 +18,9 @@
  */
 
 /*
- * TODO: Floating point instructions
+ * TODO: x87 floating point for cpus without sse2
  * TODO: Unsigned arithmetic
  * TODO: Function calls and their restrictions
- * TODO: Non-register location support
  * TODO: Multiple register location support
  */
 
@@ -30,6 +29,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include <ctype.h>
 #include <assert.h>
 
@@ -37,10 +37,17 @@
 #include <acc/target/emit.h>
 #include <acc/target/cpu.h>
 #include <acc/target/asm.h>
+#include <acc/target/obj.h>
+#include <acc/target/asmout.h>
 #include <acc/itm/ast.h>
 #include <acc/itm/analyze.h>
 #include <acc/parsing/ast.h>
 #include <acc/options.h>
+#include <acc/thread.h>
+#include <acc/error.h>
+#include <acc/tu.h>
+#include <acc/timer.h>
+#include <acc/stats.h>
 
 asme_type_t asme_x86ea;
 
@@ -52,6 +59,23 @@ struct x86ea {
 	int mult;
 };
 
+/*
+ * Storage for operands that aren't registers, filled in by x86_getasme()
+ * and cleaned up by x86_putasme().
+ */
+struct x86opnd {
+	struct asmimm imm;
+	struct asmimm disp;
+	struct x86ea ea;
+};
+
+/*
+ * The name of each register is stored right behind its at&t prefix, so both
+ * spellings are there without formatting.
+ */
+#define X86_REG(size, name, parent, ch1, ch2, id) \
+	NEW_REG(size, "%" name + 1, parent, ch1, ch2, id)
+
 static const struct asmreg ah, bh, ch, dh;
 static const struct asmreg al, bl, cl, dl, spl, bpl, sil, dil,
 	r8b, r9b, r10b, r11b, r12b, r13b, r14b, r15b;
@@ -62,127 +86,158 @@ static const struct asmreg eax, ebx, ecx, edx, esp, ebp, esi, edi,
 static const struct asmreg rax, rbx, rcx, rdx, rsp, rbp, rsi, rdi,
 	r8, r9, r10, r11, r12, r13, r14, r15;
 
-static const struct asmreg ah = NEW_REG(1, "ah", &ax, NULL, NULL, 0);
-static const struct asmreg bh = NEW_REG(1, "bh", &bx, NULL, NULL, 1);
-static const struct asmreg ch = NEW_REG(1, "ch", &cx, NULL, NULL, 2);
-static const struct asmreg dh = NEW_REG(1, "dh", &dx, NULL, NULL, 3);
-static const struct asmreg al = NEW_REG(1, "al", &ax, NULL, NULL, 0);
-static const struct asmreg bl = NEW_REG(1, "bl", &bx, NULL, NULL, 1);
-static const struct asmreg cl = NEW_REG(1, "cl", &cx, NULL, NULL, 2);
-static const struct asmreg dl = NEW_REG(1, "dl", &dx, NULL, NULL, 3);
-static const struct asmreg spl = NEW_REG(1, "spl", &sp, NULL, NULL, 0);
-static const struct asmreg bpl = NEW_REG(1, "bpl", &bp, NULL, NULL, 0);
-static const struct asmreg sil = NEW_REG(1, "sil", &si, NULL, NULL, 4);
-static const struct asmreg dil = NEW_REG(1, "dil", &di, NULL, NULL, 5);
-static const struct asmreg r8b = NEW_REG(1, "r8b", &r8w, NULL, NULL, 6);
-static const struct asmreg r9b = NEW_REG(1, "r9b", &r9w, NULL, NULL, 7);
-static const struct asmreg r10b = NEW_REG(1, "r10b", &r10w, NULL, NULL, 8);
-static const struct asmreg r11b = NEW_REG(1, "r11b", &r11w, NULL, NULL, 9);
-static const struct asmreg r12b = NEW_REG(1, "r12b", &r12w, NULL, NULL, 10);
-static const struct asmreg r13b = NEW_REG(1, "r13b", &r13w, NULL, NULL, 11);
-static const struct asmreg r14b = NEW_REG(1, "r14b", &r14w, NULL, NULL, 12);
-static const struct asmreg r15b = NEW_REG(1, "r15b", &r15w, NULL, NULL, 13);
-
-static const struct asmreg ax = NEW_REG(2, "ax", &eax, &al, &ah, 0);
-static const struct asmreg bx = NEW_REG(2, "bx", &ebx, &bl, &bh, 1);
-static const struct asmreg cx = NEW_REG(2, "cx", &ecx, &cl, &ch, 2);
-static const struct asmreg dx = NEW_REG(2, "dx", &edx, &dl, &dh, 3);
-static const struct asmreg sp = NEW_REG(2, "sp", &esp, &spl, NULL, 0);
-static const struct asmreg bp = NEW_REG(2, "bp", &ebp, &bpl, NULL, 0);
-static const struct asmreg si = NEW_REG(2, "si", &esi, &sil, NULL, 4);
-static const struct asmreg di = NEW_REG(2, "di", &edi, &dil, NULL, 5);
-static const struct asmreg r8w = NEW_REG(2, "r8w", &r8d, &r8b, NULL, 6);
-static const struct asmreg r9w = NEW_REG(2, "r9w", &r9d, &r9b, NULL, 7);
-static const struct asmreg r10w = NEW_REG(2, "r10w", &r10d, &r10b, NULL, 8);
-static const struct asmreg r11w = NEW_REG(2, "r11w", &r11d, &r11b, NULL, 9);
-static const struct asmreg r12w = NEW_REG(2, "r12w", &r12d, &r12b, NULL, 10);
-static const struct asmreg r13w = NEW_REG(2, "r13w", &r13d, &r13b, NULL, 11);
-static const struct asmreg r14w = NEW_REG(2, "r14w", &r14d, &r14b, NULL, 12);
-static const struct asmreg r15w = NEW_REG(2, "r15w", &r15d, &r15b, NULL, 13);
-
-static const struct asmreg eax = NEW_REG(4, "eax", &rax, &ax, NULL, 0);
-static const struct asmreg ebx = NEW_REG(4, "ebx", &rbx, &bx, NULL, 1);
-static const struct asmreg ecx = NEW_REG(4, "ecx", &rcx, &cx, NULL, 2);
-static const struct asmreg edx = NEW_REG(4, "edx", &rdx, &dx, NULL, 3);
-static const struct asmreg esp = NEW_REG(4, "esp", &rsp, &sp, NULL, 0);
-static const struct asmreg ebp = NEW_REG(4, "ebp", &rbp, &bp, NULL, 0);
-static const struct asmreg esi = NEW_REG(4, "esi", &rsi, &si, NULL, 4);
-static const struct asmreg edi = NEW_REG(4, "edi", &rdi, &di, NULL, 5);
-static const struct asmreg r8d = NEW_REG(4, "r8d", &r8, &r8w, NULL, 6);
-static const struct asmreg r9d = NEW_REG(4, "r9d", &r9, &r9w, NULL, 7);
-static const struct asmreg r10d = NEW_REG(4, "r10d", &r10, &r10w, NULL, 8);
-static const struct asmreg r11d = NEW_REG(4, "r11d", &r11, &r11w, NULL, 9);
-static const struct asmreg r12d = NEW_REG(4, "r12d", &r12, &r12w, NULL, 10);
-static const struct asmreg r13d = NEW_REG(4, "r13d", &r13, &r13w, NULL, 11);
-static const struct asmreg r14d = NEW_REG(4, "r14d", &r14, &r14w, NULL, 12);
-static const struct asmreg r15d = NEW_REG(4, "r15d", &r15, &r15w, NULL, 13);
-
-static const struct asmreg rax = NEW_REG(8, "rax", NULL, &eax, NULL, 0);
-static const struct asmreg rbx = NEW_REG(8, "rbx", NULL, &ebx, NULL, 1);
-static const struct asmreg rcx = NEW_REG(8, "rcx", NULL, &ecx, NULL, 2);
-static const struct asmreg rdx = NEW_REG(8, "rdx", NULL, &edx, NULL, 3);
-static const struct asmreg rsp = NEW_REG(8, "rsp", NULL, &esp, NULL, 0);
-static const struct asmreg rbp = NEW_REG(8, "rbp", NULL, &ebp, NULL, 0);
-static const struct asmreg rsi = NEW_REG(8, "rsi", NULL, &esi, NULL, 4);
-static const struct asmreg rdi = NEW_REG(8, "rdi", NULL, &edi, NULL, 5);
-static const struct asmreg r8 = NEW_REG(8, "r8", NULL, &r8d, NULL, 6);
-static const struct asmreg r9 = NEW_REG(8, "r9", NULL, &r9d, NULL, 7);
-static const struct asmreg r10 = NEW_REG(8, "r10", NULL, &r10d, NULL, 8);
-static const struct asmreg r11 = NEW_REG(8, "r11", NULL, &r11d, NULL, 9);
-static const struct asmreg r12 = NEW_REG(8, "r12", NULL, &r12d, NULL, 10);
-static const struct asmreg r13 = NEW_REG(8, "r13", NULL, &r13d, NULL, 11);
-static const struct asmreg r14 = NEW_REG(8, "r14", NULL, &r14d, NULL, 12);
-static const struct asmreg r15 = NEW_REG(8, "r15", NULL, &r15d, NULL, 13);
-
-static const struct asmreg eflag = NEW_REG(0, "e", NULL, NULL, NULL, 14);
-static const struct asmreg neflag = NEW_REG(0, "ne", NULL, NULL, NULL, 15);
-static const struct asmreg gflag = NEW_REG(0, "g", NULL, NULL, NULL, 16);
-static const struct asmreg geflag = NEW_REG(0, "ge", NULL, NULL, NULL, 17);
-static const struct asmreg lflag = NEW_REG(0, "l", NULL, NULL, NULL, 18);
-static const struct asmreg leflag = NEW_REG(0, "le", NULL, NULL, NULL, 19);
-static const struct asmreg aflag = NEW_REG(0, "a", NULL, NULL, NULL, 20);
-static const struct asmreg aeflag = NEW_REG(0, "ae", NULL, NULL, NULL, 21);
-static const struct asmreg bflag = NEW_REG(0, "b", NULL, NULL, NULL, 22);
-static const struct asmreg beflag = NEW_REG(0, "be", NULL, NULL, NULL, 23);
-
-// list of available registers per platform
+static const struct asmreg ah = X86_REG(1, "ah", &ax, NULL, NULL, 0);
+static const struct asmreg bh = X86_REG(1, "bh", &bx, NULL, NULL, 1);
+static const struct asmreg ch = X86_REG(1, "ch", &cx, NULL, NULL, 2);
+static const struct asmreg dh = X86_REG(1, "dh", &dx, NULL, NULL, 3);
+static const struct asmreg al = X86_REG(1, "al", &ax, NULL, NULL, 0);
+static const struct asmreg bl = X86_REG(1, "bl", &bx, NULL, NULL, 1);
+static const struct asmreg cl = X86_REG(1, "cl", &cx, NULL, NULL, 2);
+static const struct asmreg dl = X86_REG(1, "dl", &dx, NULL, NULL, 3);
+static const struct asmreg spl = X86_REG(1, "spl", &sp, NULL, NULL, 0);
+static const struct asmreg bpl = X86_REG(1, "bpl", &bp, NULL, NULL, 0);
+static const struct asmreg sil = X86_REG(1, "sil", &si, NULL, NULL, 4);
+static const struct asmreg dil = X86_REG(1, "dil", &di, NULL, NULL, 5);
+static const struct asmreg r8b = X86_REG(1, "r8b", &r8w, NULL, NULL, 6);
+static const struct asmreg r9b = X86_REG(1, "r9b", &r9w, NULL, NULL, 7);
+static const struct asmreg r10b = X86_REG(1, "r10b", &r10w, NULL, NULL, 8);
+static const struct asmreg r11b = X86_REG(1, "r11b", &r11w, NULL, NULL, 9);
+static const struct asmreg r12b = X86_REG(1, "r12b", &r12w, NULL, NULL, 10);
+static const struct asmreg r13b = X86_REG(1, "r13b", &r13w, NULL, NULL, 11);
+static const struct asmreg r14b = X86_REG(1, "r14b", &r14w, NULL, NULL, 12);
+static const struct asmreg r15b = X86_REG(1, "r15b", &r15w, NULL, NULL, 13);
+
+static const struct asmreg ax = X86_REG(2, "ax", &eax, &al, &ah, 0);
+static const struct asmreg bx = X86_REG(2, "bx", &ebx, &bl, &bh, 1);
+static const struct asmreg cx = X86_REG(2, "cx", &ecx, &cl, &ch, 2);
+static const struct asmreg dx = X86_REG(2, "dx", &edx, &dl, &dh, 3);
+static const struct asmreg sp = X86_REG(2, "sp", &esp, &spl, NULL, 0);
+static const struct asmreg bp = X86_REG(2, "bp", &ebp, &bpl, NULL, 0);
+static const struct asmreg si = X86_REG(2, "si", &esi, &sil, NULL, 4);
+static const struct asmreg di = X86_REG(2, "di", &edi, &dil, NULL, 5);
+static const struct asmreg r8w = X86_REG(2, "r8w", &r8d, &r8b, NULL, 6);
+static const struct asmreg r9w = X86_REG(2, "r9w", &r9d, &r9b, NULL, 7);
+static const struct asmreg r10w = X86_REG(2, "r10w", &r10d, &r10b, NULL, 8);
+static const struct asmreg r11w = X86_REG(2, "r11w", &r11d, &r11b, NULL, 9);
+static const struct asmreg r12w = X86_REG(2, "r12w", &r12d, &r12b, NULL, 10);
+static const struct asmreg r13w = X86_REG(2, "r13w", &r13d, &r13b, NULL, 11);
+static const struct asmreg r14w = X86_REG(2, "r14w", &r14d, &r14b, NULL, 12);
+static const struct asmreg r15w = X86_REG(2, "r15w", &r15d, &r15b, NULL, 13);
+
+static const struct asmreg eax = X86_REG(4, "eax", &rax, &ax, NULL, 0);
+static const struct asmreg ebx = X86_REG(4, "ebx", &rbx, &bx, NULL, 1);
+static const struct asmreg ecx = X86_REG(4, "ecx", &rcx, &cx, NULL, 2);
+static const struct asmreg edx = X86_REG(4, "edx", &rdx, &dx, NULL, 3);
+static const struct asmreg esp = X86_REG(4, "esp", &rsp, &sp, NULL, 0);
+static const struct asmreg ebp = X86_REG(4, "ebp", &rbp, &bp, NULL, 0);
+static const struct asmreg esi = X86_REG(4, "esi", &rsi, &si, NULL, 4);
+static const struct asmreg edi = X86_REG(4, "edi", &rdi, &di, NULL, 5);
+static const struct asmreg r8d = X86_REG(4, "r8d", &r8, &r8w, NULL, 6);
+static const struct asmreg r9d = X86_REG(4, "r9d", &r9, &r9w, NULL, 7);
+static const struct asmreg r10d = X86_REG(4, "r10d", &r10, &r10w, NULL, 8);
+static const struct asmreg r11d = X86_REG(4, "r11d", &r11, &r11w, NULL, 9);
+static const struct asmreg r12d = X86_REG(4, "r12d", &r12, &r12w, NULL, 10);
+static const struct asmreg r13d = X86_REG(4, "r13d", &r13, &r13w, NULL, 11);
+static const struct asmreg r14d = X86_REG(4, "r14d", &r14, &r14w, NULL, 12);
+static const struct asmreg r15d = X86_REG(4, "r15d", &r15, &r15w, NULL, 13);
+
+static const struct asmreg rax = X86_REG(8, "rax", NULL, &eax, NULL, 0);
+static const struct asmreg rbx = X86_REG(8, "rbx", NULL, &ebx, NULL, 1);
+static const struct asmreg rcx = X86_REG(8, "rcx", NULL, &ecx, NULL, 2);
+static const struct asmreg rdx = X86_REG(8, "rdx", NULL, &edx, NULL, 3);
+static const struct asmreg rsp = X86_REG(8, "rsp", NULL, &esp, NULL, 0);
+static const struct asmreg rbp = X86_REG(8, "rbp", NULL, &ebp, NULL, 0);
+static const struct asmreg rsi = X86_REG(8, "rsi", NULL, &esi, NULL, 4);
+static const struct asmreg rdi = X86_REG(8, "rdi", NULL, &edi, NULL, 5);
+static const struct asmreg r8 = X86_REG(8, "r8", NULL, &r8d, NULL, 6);
+static const struct asmreg r9 = X86_REG(8, "r9", NULL, &r9d, NULL, 7);
+static const struct asmreg r10 = X86_REG(8, "r10", NULL, &r10d, NULL, 8);
+static const struct asmreg r11 = X86_REG(8, "r11", NULL, &r11d, NULL, 9);
+static const struct asmreg r12 = X86_REG(8, "r12", NULL, &r12d, NULL, 10);
+static const struct asmreg r13 = X86_REG(8, "r13", NULL, &r13d, NULL, 11);
+static const struct asmreg r14 = X86_REG(8, "r14", NULL, &r14d, NULL, 12);
+static const struct asmreg r15 = X86_REG(8, "r15", NULL, &r15d, NULL, 13);
+
+static const struct asmreg eflag = X86_REG(0, "e", NULL, NULL, NULL, 14);
+static const struct asmreg neflag = X86_REG(0, "ne", NULL, NULL, NULL, 15);
+static const struct asmreg gflag = X86_REG(0, "g", NULL, NULL, NULL, 16);
+static const struct asmreg geflag = X86_REG(0, "ge", NULL, NULL, NULL, 17);
+static const struct asmreg lflag = X86_REG(0, "l", NULL, NULL, NULL, 18);
+static const struct asmreg leflag = X86_REG(0, "le", NULL, NULL, NULL, 19);
+static const struct asmreg aflag = X86_REG(0, "a", NULL, NULL, NULL, 20);
+static const struct asmreg aeflag = X86_REG(0, "ae", NULL, NULL, NULL, 21);
+static const struct asmreg bflag = X86_REG(0, "b", NULL, NULL, NULL, 22);
+static const struct asmreg beflag = X86_REG(0, "be", NULL, NULL, NULL, 23);
+
+// the size of the xmm registers is 16, though they hold single floats and doubles
+static const struct asmreg xmm0 = X86_REG(16, "xmm0", NULL, NULL, NULL, 24);
+static const struct asmreg xmm1 = X86_REG(16, "xmm1", NULL, NULL, NULL, 25);
+static const struct asmreg xmm2 = X86_REG(16, "xmm2", NULL, NULL, NULL, 26);
+static const struct asmreg xmm3 = X86_REG(16, "xmm3", NULL, NULL, NULL, 27);
+static const struct asmreg xmm4 = X86_REG(16, "xmm4", NULL, NULL, NULL, 28);
+static const struct asmreg xmm5 = X86_REG(16, "xmm5", NULL, NULL, NULL, 29);
+static const struct asmreg xmm6 = X86_REG(16, "xmm6", NULL, NULL, NULL, 30);
+static const struct asmreg xmm7 = X86_REG(16, "xmm7", NULL, NULL, NULL, 31);
+static const struct asmreg xmm8 = X86_REG(16, "xmm8", NULL, NULL, NULL, 32);
+static const struct asmreg xmm9 = X86_REG(16, "xmm9", NULL, NULL, NULL, 33);
+static const struct asmreg xmm10 = X86_REG(16, "xmm10", NULL, NULL, NULL, 34);
+static const struct asmreg xmm11 = X86_REG(16, "xmm11", NULL, NULL, NULL, 35);
+static const struct asmreg xmm12 = X86_REG(16, "xmm12", NULL, NULL, NULL, 36);
+static const struct asmreg xmm13 = X86_REG(16, "xmm13", NULL, NULL, NULL, 37);
+static const struct asmreg xmm14 = X86_REG(16, "xmm14", NULL, NULL, NULL, 38);
+static const struct asmreg xmm15 = X86_REG(16, "xmm15", NULL, NULL, NULL, 39);
+
+// only used for rip-relative addressing on x86_64
+static const struct asmreg rip = X86_REG(8, "rip", NULL, NULL, NULL, 40);
+
+// list of available registers per platform, x86_getreg takes the first match
+// so the low byte registers come before the high ones
 static const struct asmreg *regav8086[] = {
-	&ah, &al, &bh, &bl, &ch, &cl, &dh, &dl,
+	&al, &ah, &bl, &bh, &cl, &ch, &dl, &dh,
 	&spl, &bpl, &sil, &dil,
 	&ax, &bx, &cx, &dx, &sp, &bp, &si, &di,
 	&eflag, &neflag, &gflag, &geflag, &lflag, &leflag,
+	&aflag, &aeflag, &bflag, &beflag,
 	NULL
 };
 
 static const struct asmreg *regavi386[] = {
-	&ah, &al, &bh, &bl, &ch, &cl, &dh, &dl,
+	&al, &ah, &bl, &bh, &cl, &ch, &dl, &dh,
 	&spl, &bpl, &sil, &dil,
 	&ax, &bx, &cx, &dx, &sp, &bp, &si, &di,
 	&eax, &ebx, &edx, &ecx, &esp, &ebp, &esi, &edi,
 	&eflag, &neflag, &gflag, &geflag, &lflag, &leflag,
+	&aflag, &aeflag, &bflag, &beflag,
 	NULL
 };
 
 static const struct asmreg *regavi686[] = {
-	&ah, &al, &bh, &bl, &ch, &cl, &dh, &dl,
+	&al, &ah, &bl, &bh, &cl, &ch, &dl, &dh,
 	&spl, &bpl, &sil, &dil,
 	&ax, &bx, &cx, &dx, &sp, &bp, &si, &di,
 	&eax, &ebx, &edx, &ecx, &esp, &ebp, &esi, &edi,
+	&xmm0, &xmm1, &xmm2, &xmm3, &xmm4, &xmm5, &xmm6, &xmm7,
 	&eflag, &neflag, &gflag, &geflag, &lflag, &leflag,
+	&aflag, &aeflag, &bflag, &beflag,
 	NULL
 };
 
 static const struct asmreg *regavamd64[] = {
-	&ah, &al, &bh, &bl, &ch, &cl, &dh, &dl,
+	&al, &ah, &bl, &bh, &cl, &ch, &dl, &dh,
 	&spl, &bpl, &sil, &dil,
 	&ax, &bx, &cx, &dx, &sp, &bp, &si, &di,
 	&eax, &ebx, &edx, &ecx, &esp, &ebp, &esi, &edi,
 
-	&r8b, &r9b, &r10b, &r11b, &r12b, &r14b, &r15b,
-	&r8w, &r9w, &r10w, &r11w, &r12w, &r14w, &r15w,
-	&r8d, &r9d, &r10d, &r11d, &r12d, &r14d, &r15d,
-	&r8, &r9, &r10, &r11, &r12, &r14, &r15,
+	&rax, &rbx, &rdx, &rcx, &rsp, &rbp, &rsi, &rdi,
+
+	&r8b, &r9b, &r10b, &r11b, &r12b, &r13b, &r14b, &r15b,
+	&r8w, &r9w, &r10w, &r11w, &r12w, &r13w, &r14w, &r15w,
+	&r8d, &r9d, &r10d, &r11d, &r12d, &r13d, &r14d, &r15d,
+	&r8, &r9, &r10, &r11, &r12, &r13, &r14, &r15,
+	&xmm0, &xmm1, &xmm2, &xmm3, &xmm4, &xmm5, &xmm6, &xmm7,
+	&xmm8, &xmm9, &xmm10, &xmm11, &xmm12, &xmm13, &xmm14, &xmm15,
 	&eflag, &neflag, &gflag, &geflag, &lflag, &leflag,
+	&aflag, &aeflag, &bflag, &beflag,
 	NULL
 };
 
@@ -190,12 +245,70 @@ static const struct asmreg **regav[] = {
 	&regav8086[0], &regavi386[0], &regavi686[0], &regavamd64[0]
 };
 
+/*
+ * Latencies of the instructions multiplications by constants are built from,
+ * per platform, see x86_lowermul(). lea means lea with a scaled index, which
+ * 16 bit addressing doesn't have. branch is the cost of a mispredicted branch,
+ * see x86_ifconvert(), and cmov is zero where there is no such instruction.
+ */
+struct x86costs {
+	int add, shift, lea, imul, cmov, branch;
+};
+
+static const struct x86costs x86costs[] = {
+	{ 3, 2, 1000, 120, 0, 16 },	// 8086
+	{ 2, 3, 2, 12, 0, 8 },		// i386
+	{ 1, 1, 1, 4, 2, 20 },		// i686
+	{ 1, 1, 1, 3, 1, 16 }		// x86_64
+};
+
+/*
+ * Tuning of the emitted code per platform. Loop tops are aligned to 1 << p2
+ * bytes, if that takes at most skip bytes of padding executed when falling
+ * into them: the 8086 fetches words, the i386 dwords, later cpus decode 16
+ * byte lines. incdec tells whether inc and dec are preferred over adding
+ * one, which they aren't where updating only part of the flags stalls.
+ */
+struct x86tune {
+	int p2, skip;
+	bool incdec;
+};
+
+static const struct x86tune x86tunings[] = {
+	{ 1, 1, true },		// 8086
+	{ 2, 3, true },		// i386
+	{ 4, 7, true },		// i686
+	{ 4, 10, false }	// x86_64
+};
+
+/*
+ * Latencies in cycles per platform, of simple arithmetic, of loading an
+ * operand from memory, of integer multiplication and of sse addition,
+ * multiplication and division, and how many instructions are issued each
+ * cycle. The 8086 and i386 execute one instruction at a time, there's no
+ * latency to hide, so their code isn't scheduled.
+ */
+struct x86lat {
+	int alu, load, imul, fadd, fmul, fdiv, issue;
+};
+
+static const struct x86lat x86lats[] = {
+	{ 3, 8, 120, 0, 0, 0, 0 },	// 8086
+	{ 2, 4, 12, 0, 0, 0, 0 },	// i386
+	{ 1, 3, 4, 3, 5, 18, 3 },	// i686
+	{ 1, 4, 3, 4, 4, 13, 4 }	// x86_64
+};
+
 /*
  * to string functionality
  */
 static void emit_label(FILE *f, struct asmimm *imm);
 static void emit_i(FILE *f, const char *instr, int numops, ...);
+static void emit_fi(FILE *f, const char *instr, int numops, ...);
 static void emit_sdi(FILE *f, const char *instr, struct asme *src, struct asme *dest);
+static void emit_sdfi(FILE *f, const char *instr, struct asme *src, struct asme *dest);
+static void emit_align(FILE *f, int align);
+static void emit_p2align(FILE *f, int p2, int skip);
 static void emit_global(FILE *f, struct asmimm *imm);
 static void emit_extern(FILE *f, struct asmimm *imm);
 static void emit_section(FILE *f, enum section sec);
@@ -204,121 +317,367 @@ static void emit_short(FILE *f, size_t cnt, ...);
 static void emit_long(FILE *f, size_t cnt, ...);
 static void emit_quad(FILE *f, size_t cnt, ...);
 
-void asmregtostr(FILE *f, struct asme *e)
+// assembly text goes through this rather than stdio
+static THREAD_LOCAL struct asmout *x86_out;
+
+static const char *const x86sizes[] = {
+	[1] = "byte", [2] = "word", [4] = "dword", [8] = "qword"
+};
+
+static const char x86suffixes[] = {
+	[1] = 'b', [2] = 'w', [4] = 'l', [8] = 'q', [10] = 't'
+};
+
+static void x86_outreg(struct asmout *o, const struct asmreg *r)
 {
-	struct asmreg *r = (struct asmreg *)e;
-	if (asmflavor() == AF_ATT)
-		fprintf(f, "%%");
-	fprintf(f, "%s", r->name);
+	asmout_str(o, asmflavor() == AF_ATT ? r->name - 1 : r->name);
 }
 
-static void write_intel_size(FILE *f, int size)
+static void x86_outimm(struct asmout *o, struct asmimm *imm, bool attprefix)
 {
-	switch (size) {
-	case 1:
-		fprintf(f, "byte");
-		break;
-	case 2:
-		fprintf(f, "word");
-		break;
-	case 4:
-		fprintf(f, "dword");
-		break;
-	case 8:
-		fprintf(f, "qword");
-		break;
+	if (imm->op) {
+		asmout_chr(o, '(');
+		x86_outimm(o, imm->l, attprefix);
+		asmout_chr(o, ' ');
+		asmout_str(o, imm->op);
+		asmout_chr(o, ' ');
+		x86_outimm(o, imm->r, attprefix);
+		asmout_chr(o, ')');
+		return;
+	}
+
+	if (imm->label) {
+		asmout_str(o, imm->label);
+		return;
+	}
+
+	if (attprefix && asmflavor() == AF_ATT) {
+		asmout_chr(o, '$');
+	} else if (attprefix) {
+		if (imm->base.size <= 8 && x86sizes[imm->base.size])
+			asmout_str(o, x86sizes[imm->base.size]);
+		asmout_chr(o, ' ');
 	}
+	asmout_dec(o, imm->value);
 }
 
-static void asmimmtostrpfix(FILE *f, struct asmimm *imm, bool attprefix)
+static void x86_outea(struct asmout *o, struct x86ea *ea)
 {
-	if (imm->op) {
-		fprintf(f, "(");
-		asmimmtostrpfix(f, imm->l, attprefix);
-		fprintf(f, " %s ", imm->op);
-		asmimmtostrpfix(f, imm->r, attprefix);
-		fprintf(f, ")");
-	} else if (imm->label) {
-		fprintf(f, "%s", imm->label);
-	} else if (attprefix) {
-		if (asmflavor() == AF_ATT) {
-			fprintf(f, "$%ld", imm->value);
-		} else {
-			write_intel_size(f, imm->base.size);
-			fprintf(f, " %ld", imm->value);
+	if (asmflavor() == AF_ATT) {
+		if (ea->displacement && (ea->basereg || ea->offset))
+			x86_outimm(o, ea->displacement, false);
+		asmout_chr(o, '(');
+		if (ea->displacement && !(ea->basereg || ea->offset))
+			x86_outimm(o, ea->displacement, true);
+		if (ea->basereg)
+			x86_outreg(o, ea->basereg);
+		if (ea->offset) {
+			asmout_mem(o, ", ", 2);
+			x86_outreg(o, ea->offset);
+		}
+		if (ea->mult > 1) {
+			asmout_mem(o, ", ", 2);
+			asmout_dec(o, ea->mult);
+		}
+		asmout_chr(o, ')');
+		return;
+	}
+
+	if (ea->base.size <= 8 && x86sizes[ea->base.size])
+		asmout_str(o, x86sizes[ea->base.size]);
+	asmout_mem(o, " [", 2);
+	if (ea->basereg == &rip) {
+		asmout_mem(o, "rel ", 4);
+		x86_outimm(o, ea->displacement, true);
+		asmout_chr(o, ']');
+		return;
+	}
+	if (ea->basereg) {
+		x86_outreg(o, ea->basereg);
+		if (ea->displacement || ea->offset)
+			asmout_mem(o, " + ", 3);
+	}
+	if (ea->displacement) {
+		x86_outimm(o, ea->displacement, true);
+		if (ea->offset)
+			asmout_mem(o, " + ", 3);
+	}
+	if (ea->offset) {
+		x86_outreg(o, ea->offset);
+		if (ea->mult > 1) {
+			asmout_mem(o, " * ", 3);
+			asmout_dec(o, ea->mult);
 		}
-	} else {
-		fprintf(f, "%ld", imm->value);
 	}
+	asmout_chr(o, ']');
+}
+
+static void x86_outopnd(struct asmout *o, struct asme *e)
+{
+	if (e->type == &asme_reg)
+		x86_outreg(o, (struct asmreg *)e);
+	else if (e->type == &asme_imm)
+		x86_outimm(o, (struct asmimm *)e, true);
+	else
+		x86_outea(o, (struct x86ea *)e);
+}
+
+// through stdio, for the operands' to_string
+static void x86_tostr(FILE *f, struct asme *e, bool attprefix)
+{
+	struct asmout *o = new_asmout(f);
+	if (e->type == &asme_imm)
+		x86_outimm(o, (struct asmimm *)e, attprefix);
+	else
+		x86_outopnd(o, e);
+	delete_asmout(o);
+}
+
+void asmregtostr(FILE *f, struct asme *e)
+{
+	x86_tostr(f, e, true);
 }
 
 void asmimmtostr(FILE *f, struct asme *imm)
 {
-	asmimmtostrpfix(f, (struct asmimm *)imm, true);
+	x86_tostr(f, imm, true);
 }
 
 void asmimmtostrd(FILE *f, struct asme *imm)
 {
-	asmimmtostrpfix(f, (struct asmimm *)imm, false);
+	x86_tostr(f, imm, false);
+}
+
+
+/*
+ * Machine instructions
+ *
+ * The code of a function is collected as a list of machine instructions,
+ * which the peephole optimizer works on before they're written out, see
+ * x86_peephole(). Their operands are copies of those they were emitted with,
+ * in the order they are written in.
+ */
+enum x86mikind {
+	MI_INSTR,
+	MI_LABEL,
+	MI_ALIGN
+};
+
+struct x86mi {
+	enum x86mikind kind;
+	char mnem[16];
+	bool suffix;
+	int nops;
+	struct asme *ops[3];	// the label of labels
+	int p2, skip;		// of alignments
+	// where it's assembled to, with '-c'
+	size_t addr;
+	int len;
+	bool far;		// of jumps; target is the label jumped to
+	struct x86mi *target;
+	struct x86mi *prev, *next;
+};
+
+// the code of the function being emitted, if any
+static THREAD_LOCAL struct x86mi *x86_mifirst, *x86_milast;
+static THREAD_LOCAL bool x86_micollect;
+// the object file assembled to, with '-c'
+static THREAD_LOCAL struct objfile *x86_obj;
+
+static struct asme *x86_copyasme(struct asme *e)
+{
+	if (e->type == &asme_imm) {
+		struct asmimm *imm = malloc(sizeof(struct asmimm));
+		*imm = *(struct asmimm *)e;
+		if (imm->label) {
+			imm->label = malloc(strlen(imm->label) + 1);
+			strcpy(imm->label, ((struct asmimm *)e)->label);
+		}
+		if (imm->l)
+			imm->l = (struct asmimm *)x86_copyasme(&imm->l->base);
+		if (imm->r)
+			imm->r = (struct asmimm *)x86_copyasme(&imm->r->base);
+		return &imm->base;
+	}
+
+	if (e->type == &asme_x86ea) {
+		struct x86ea *ea = malloc(sizeof(struct x86ea));
+		*ea = *(struct x86ea *)e;
+		if (ea->displacement)
+			ea->displacement = (struct asmimm *)
+				x86_copyasme(&ea->displacement->base);
+		return &ea->base;
+	}
+
+	// registers are never freed
+	return e;
+}
+
+static void x86_freeasme(struct asme *e)
+{
+	if (e->type == &asme_imm) {
+		struct asmimm *imm = (struct asmimm *)e;
+		if (imm->l)
+			x86_freeasme(&imm->l->base);
+		if (imm->r)
+			x86_freeasme(&imm->r->base);
+		delete_asm_imm(imm);
+		free(imm);
+	} else if (e->type == &asme_x86ea) {
+		struct x86ea *ea = (struct x86ea *)e;
+		if (ea->displacement)
+			x86_freeasme(&ea->displacement->base);
+		free(ea);
+	}
+}
+
+static struct x86mi *new_x86mi(enum x86mikind kind)
+{
+	struct x86mi *mi = calloc(1, sizeof(struct x86mi));
+	mi->kind = kind;
+	return mi;
+}
+
+static void delete_x86mi(struct x86mi *mi)
+{
+	for (int k = 0; k < mi->nops; ++k)
+		x86_freeasme(mi->ops[k]);
+	free(mi);
 }
 
+static void x86_miappend(struct x86mi *mi)
+{
+	mi->prev = x86_milast;
+	if (x86_milast)
+		x86_milast->next = mi;
+	else
+		x86_mifirst = mi;
+	x86_milast = mi;
+}
+
+static void x86_miremove(struct x86mi *mi)
+{
+	if (mi->prev)
+		mi->prev->next = mi->next;
+	else
+		x86_mifirst = mi->next;
+	if (mi->next)
+		mi->next->prev = mi->prev;
+	else
+		x86_milast = mi->prev;
+	delete_x86mi(mi);
+}
+
+static void x86_miwrite(struct asmout *o, struct x86mi *mi);
+static void x86_objwrite(struct x86mi *mi);
+
+static void x86_misubmit(FILE *f, struct x86mi *mi)
+{
+	if (x86_micollect) {
+		x86_miappend(mi);
+		return;
+	}
+
+	if (x86_obj)
+		x86_objwrite(mi);
+	else
+		x86_miwrite(x86_out, mi);
+	delete_x86mi(mi);
+}
 
 static void emit_label(FILE *f, struct asmimm *imm)
 {
 	assert(imm != NULL);
 	assert(imm->label != NULL);
 
-	fprintf(f, "%s:\n", imm->label);
+	struct x86mi *mi = new_x86mi(MI_LABEL);
+	mi->nops = 1;
+	mi->ops[0] = x86_copyasme(&imm->base);
+	x86_misubmit(f, mi);
 }
 
-static void emit_i(FILE *f, const char *instr, int numops, ...)
+static void emit_vi(FILE *f, const char *instr, bool suffix, int numops,
+	va_list ap)
 {
-	va_list ap;
-	bool reqsuf = 0;
-	struct asme **ops = malloc(sizeof(struct asme *) * numops);
+	assert(numops <= 3 && strlen(instr) < sizeof(((struct x86mi *)0)->mnem));
 
-	va_start(ap, numops);
+	struct x86mi *mi = new_x86mi(MI_INSTR);
+	strcpy(mi->mnem, instr);
+	mi->suffix = suffix;
+	mi->nops = numops;
 	for (int i = 0; i < numops; ++i) {
 		struct asme *e = va_arg(ap, struct asme *);
 		assert(e != NULL);
-		ops[i] = e;
-		reqsuf |= (e->type != &asme_imm);
+		mi->ops[i] = x86_copyasme(e);
 	}
+	x86_misubmit(f, mi);
+}
 
-	fprintf(f, "\t%s", instr);
-	if (asmflavor() == AF_ATT && reqsuf) {
-		switch (ops[0]->size) {
-		case 1:
-			fprintf(f, "b");
-			break;
-		case 2:
-			fprintf(f, "w");
-			break;
-		case 4:
-			fprintf(f, "l");
-			break;
-		case 8:
-			fprintf(f, "q");
-			break;
-		case 10:
-			fprintf(f, "t");
-			break;
+static void x86_miwrite(struct asmout *o, struct x86mi *mi)
+{
+	bool att = asmflavor() == AF_ATT;
+	if (mi->kind == MI_LABEL) {
+		asmout_str(o, ((struct asmimm *)mi->ops[0])->label);
+		asmout_mem(o, ":\n", 2);
+		return;
+	}
+
+	if (mi->kind == MI_ALIGN) {
+		if (att) {
+			asmout_mem(o, "\t.p2align\t", 10);
+			asmout_dec(o, mi->p2);
+			asmout_mem(o, ",,", 2);
+			asmout_dec(o, mi->skip);
+		} else {
+			asmout_mem(o, "\talign\t", 7);
+			asmout_dec(o, 1 << mi->p2);
 		}
+		asmout_chr(o, '\n');
+		return;
 	}
 
+	bool reqsuf = 0;
+	int numops = mi->nops;
+	struct asme **ops = mi->ops;
+	for (int i = 0; i < numops; ++i)
+		reqsuf |= (ops[i]->type != &asme_imm);
+
+	asmout_chr(o, '\t');
+	asmout_str(o, mi->mnem);
+	if (att && reqsuf && mi->suffix && ops[0]->size <= 10 &&
+	    x86suffixes[ops[0]->size])
+		asmout_chr(o, x86suffixes[ops[0]->size]);
+
 	if (numops)
-		fprintf(f, " ");
+		asmout_chr(o, ' ');
 
 	for (int i = 0; i < numops; ++i) {
-		ops[i]->to_string(f, ops[i]);
+		x86_outopnd(o, ops[i]);
 		if (i != numops - 1)
-			fprintf(f, ", ");
+			asmout_mem(o, ", ", 2);
 	}
 
-	fprintf(f, "\n");
+	asmout_chr(o, '\n');
+}
+
+static void emit_i(FILE *f, const char *instr, int numops, ...)
+{
+	va_list ap;
+	va_start(ap, numops);
+	emit_vi(f, instr, true, numops, ap);
+	va_end(ap);
+}
 
+/*
+ * Emits an instruction whose mnemonic already implies the operand size, so
+ * never gets a suffix (sse instructions, movzx/movsx...)
+ */
+static void emit_fi(FILE *f, const char *instr, int numops, ...)
+{
+	va_list ap;
+	va_start(ap, numops);
+	emit_vi(f, instr, false, numops, ap);
 	va_end(ap);
-	free(ops);
 }
 
 static void emit_sdi(FILE *f, const char *instr,
@@ -330,15 +689,33 @@ static void emit_sdi(FILE *f, const char *instr,
 		emit_i(f, instr, 2, dest, src);
 }
 
+static void emit_sdfi(FILE *f, const char *instr,
+	struct asme *dest, struct asme *src)
+{
+	if (asmflavor() == AF_ATT)
+		emit_fi(f, instr, 2, src, dest);
+	else
+		emit_fi(f, instr, 2, dest, src);
+}
+
+// a directive with one argument
+static void x86_outdir(const char *dir, const char *arg)
+{
+	asmout_str(x86_out, dir);
+	asmout_str(x86_out, arg);
+	asmout_chr(x86_out, '\n');
+}
+
 static void emit_global(FILE *f, struct asmimm *imm)
 {
 	assert(imm != NULL);
 	assert(imm->label != NULL);
 
-	if (asmflavor() == AF_ATT)
-		fprintf(f, "\t.globl\t%s\n", imm->label);
+	if (x86_obj)
+		obj_global(x86_obj, obj_symbol(x86_obj, imm->label));
 	else
-		fprintf(f, "global\t%s\n", imm->label);
+		x86_outdir(asmflavor() == AF_ATT ? "\t.globl\t" : "global\t",
+			imm->label);
 }
 
 static void emit_extern(FILE *f, struct asmimm *imm)
@@ -346,51 +723,89 @@ static void emit_extern(FILE *f, struct asmimm *imm)
 	assert(imm != NULL);
 	assert(imm->label != NULL);
 
-	if (asmflavor() == AF_ATT)
+	if (x86_obj || asmflavor() == AF_ATT)
 		return;
 
-	fprintf(f, "extern\t%s\n", imm->label);
+	x86_outdir("extern\t", imm->label);
 }
 
 static void emit_sect(FILE *f, enum section sec)
 {
 	assert(sec != SECTION_INVALID);
 
-	if (asmflavor() == AF_ATT) {
-		fprintf(f, "\t");
-		if (sec == SECTION_RODATA)
-			fprintf(f, ".");
+	if (x86_obj) {
+		obj_section(x86_obj, sec);
+		return;
+	}
+
+	static const char *const names[] = {
+		[SECTION_TEXT] = ".text",
+		[SECTION_DATA] = ".data",
+		[SECTION_RODATA] = ".rodata",
+		[SECTION_BSS] = ".bss"
+	};
+
+	// gas knows .text, .data and .bss as directives of their own
+	if (asmflavor() != AF_ATT)
+		x86_outdir("section\t", names[sec]);
+	else if (sec == SECTION_RODATA)
+		x86_outdir("\t.section\t", names[sec]);
+	else
+		x86_outdir("\t", names[sec]);
+}
+
+static void emit_align(FILE *f, int align)
+{
+	if (x86_obj) {
+		obj_align(x86_obj, align);
+		return;
 	}
 
-	if (asmflavor() != AF_ATT || sec == SECTION_RODATA)
-		fprintf(f, "section\t");
+	asmout_str(x86_out, asmflavor() == AF_ATT ? "\t.align\t" : "\talign\t");
+	asmout_dec(x86_out, align);
+	asmout_chr(x86_out, '\n');
+}
 
-	switch (sec) {
-	case SECTION_TEXT:
-		fprintf(f, ".text");
-		break;
-	case SECTION_DATA:
-		fprintf(f, ".data");
-		break;
-	case SECTION_RODATA:
-		fprintf(f, ".rodata");
-		break;
-	case SECTION_BSS:
-		fprintf(f, ".bss");
-		break;
+static void emit_p2align(FILE *f, int p2, int skip)
+{
+	struct x86mi *mi = new_x86mi(MI_ALIGN);
+	mi->p2 = p2;
+	mi->skip = skip;
+	x86_misubmit(f, mi);
+}
+
+// a number, or the address of a label
+static void x86_objdata(const char *val, int size)
+{
+	char *end;
+	uint64_t v = strtoull(val, &end, 0);
+	if (*end) {
+		obj_reloc(x86_obj, obj_offset(x86_obj),
+			size == 8 ? OR_ABS64 : OR_ABS32,
+			obj_symbol(x86_obj, val), 0);
+		v = 0;
 	}
-	fprintf(f, "\n");
+	obj_int(x86_obj, v, size);
 }
 
-static void emit_reslike(FILE *f, const char *dir, size_t cnt, va_list ap)
+static void emit_reslike(FILE *f, const char *dir, int size, size_t cnt,
+	va_list ap)
 {
-	fprintf(f, "\t%s\t", dir);
+	if (x86_obj) {
+		for (int i = 0; i < cnt; ++i)
+			x86_objdata(va_arg(ap, char *), size);
+		return;
+	}
+
+	asmout_chr(x86_out, '\t');
+	asmout_str(x86_out, dir);
+	asmout_chr(x86_out, '\t');
 	for (int i = 0; i < cnt; ++i) {
-		fprintf(f, "%s", va_arg(ap, char *));
+		asmout_str(x86_out, va_arg(ap, char *));
 		if (i != cnt - 1)
-			fprintf(f, ", ");
+			asmout_mem(x86_out, ", ", 2);
 	}
-	fprintf(f, "\n");
+	asmout_chr(x86_out, '\n');
 }
 
 static void emit_byte(FILE *f, size_t cnt, ...)
@@ -398,9 +813,9 @@ static void emit_byte(FILE *f, size_t cnt, ...)
 	va_list ap;
 	va_start(ap, cnt);
 	if (asmflavor() == AF_ATT)
-		emit_reslike(f, ".byte", cnt, ap);
+		emit_reslike(f, ".byte", 1, cnt, ap);
 	else
-		emit_reslike(f, "db", cnt, ap);
+		emit_reslike(f, "db", 1, cnt, ap);
 	va_end(ap);
 }
 
@@ -409,9 +824,9 @@ static void emit_short(FILE *f, size_t cnt, ...)
 	va_list ap;
 	va_start(ap, cnt);
 	if (asmflavor() == AF_ATT)
-		emit_reslike(f, ".short", cnt, ap);
+		emit_reslike(f, ".short", 2, cnt, ap);
 	else
-		emit_reslike(f, "dw", cnt, ap);
+		emit_reslike(f, "dw", 2, cnt, ap);
 	va_end(ap);
 }
 
@@ -420,9 +835,9 @@ static void emit_long(FILE *f, size_t cnt, ...)
 	va_list ap;
 	va_start(ap, cnt);
 	if (asmflavor() == AF_ATT)
-		emit_reslike(f, ".long", cnt, ap);
+		emit_reslike(f, ".long", 4, cnt, ap);
 	else
-		emit_reslike(f, "dd", cnt, ap);
+		emit_reslike(f, "dd", 4, cnt, ap);
 	va_end(ap);
 }
 
@@ -431,9 +846,9 @@ static void emit_quad(FILE *f, size_t cnt, ...)
 	va_list ap;
 	va_start(ap, cnt);
 	if (asmflavor() == AF_ATT)
-		emit_reslike(f, ".quad", cnt, ap);
+		emit_reslike(f, ".quad", 8, cnt, ap);
 	else
-		emit_reslike(f, "dq", cnt, ap);
+		emit_reslike(f, "dq", 8, cnt, ap);
 	va_end(ap);
 }
 
@@ -451,7 +866,15 @@ static struct asmimm *x86_getcontlbl(struct itm_container *c,
 	struct list *cldict);
 static void x86_emit_container(FILE *f, struct itm_container *sym,
 	struct list *cldict);
+static void x86_ifconvert(struct itm_block *b);
+static void x86_keepflags(struct itm_block *b);
 static void x86_restrict(struct itm_block *b);
+static void x86_restrictimm(struct itm_instr *i);
+static void x86_emit_prologue(FILE *f, struct itm_block *b);
+static void x86_emit_epilogue(FILE *f, struct itm_block *b);
+static void x86_peephole(void);
+static void x86_schedule(void);
+static void x86_assemble(void);
 
 static void new_x86_ea(struct x86ea *res, int size,
 	const struct asmreg *base,
@@ -479,95 +902,384 @@ static void delete_x86_ea(struct x86ea *ea)
 
 static void x86eatostr(FILE *f, struct asme *e)
 {
-	struct x86ea *ea = (struct x86ea *)e;
-	if (asmflavor() == AF_ATT) {
-		if (ea->displacement && (ea->basereg || ea->offset))
-			ea->displacement->base.to_string_d(
-				f, (struct asme *)ea->displacement);
-		fprintf(f, "(");
-		if (ea->displacement && !(ea->basereg || ea->offset))
-			ea->displacement->base.to_string(
-				f, (struct asme *)ea->displacement);
-		if (ea->basereg)
-			ea->basereg->base.to_string(
-				f, (struct asme *)ea->basereg);
-		if (ea->offset) {
-			fprintf(f, ", ");
-			ea->offset->base.to_string(
-				f, (struct asme *)ea->offset);
-		}
-		if (ea->mult > 1)
-			fprintf(f, ", %d", ea->mult);
-		fprintf(f, ")");
-		return;
-	}
+	x86_tostr(f, e, true);
+}
 
-	switch (ea->base.size) {
-	case 1:
-		fprintf(f, "byte");
-		break;
-	case 2:
-		fprintf(f, "word");
-		break;
-	case 4:
-		fprintf(f, "dword");
-		break;
-	case 8:
-		fprintf(f, "qword");
-		break;
-	}
-	fprintf(f, " [");
-	if (ea->basereg) {
-		ea->basereg->base.to_string(f, (struct asme *)ea->basereg);
-		if (ea->displacement || ea->offset)
-			fprintf(f, " + ");
-	}
-	if (ea->displacement) {
-		ea->displacement->base.to_string(
-			f, (struct asme *)ea->displacement);
-		if (ea->offset)
-			fprintf(f, " + ");
-	}
-	if (ea->offset) {
-		ea->offset->base.to_string(f, (struct asme *)ea->offset);
-		if (ea->mult > 1)
-			fprintf(f, " * %d", ea->mult);
-	}
-	fprintf(f, "]");
+/*
+ * Floating point literals can't be immediate operands, so they are loaded
+ * from a pool of constants, which is emitted to .rodata after all containers.
+ * Containers compiled on different threads have a pool of their own, which
+ * are merged once they are done (see x86_mergeconsts()).
+ */
+struct x86const {
+	uint64_t bits;
+	int size;
+	struct asmimm lbl;
+};
+
+static THREAD_LOCAL struct list *cpool;
+
+static struct x86const *x86_poolconst(struct list *pool, uint64_t bits,
+	int size)
+{
+	struct x86const *c;
+	it_t it = list_iterator(pool);
+	while (iterator_next(&it, (void **)&c))
+		if (c->bits == bits && c->size == size)
+			return c;
+
+	c = malloc(sizeof(struct x86const));
+	c->bits = bits;
+	c->size = size;
+	char lblid[4 + sizeof(int) * 3]; // size estimate
+	sprintf(lblid, ".LC%d", list_length(pool));
+	new_asm_label(&c->lbl, lblid);
+	list_push_back(pool, c);
+	return c;
 }
 
-void emit(FILE *f, struct list *containers)
+static struct asmimm *x86_getconst(struct itm_literal *lit)
 {
-	struct list *cldict = new_list(NULL, 0);
+	int size = lit->base.type->size;
+	uint64_t bits = lit->value.i;
+	if (size < 8)
+		bits &= (1ul << (size * 8)) - 1;
 
-	struct itm_container *cont;
-	it_t it = list_iterator(containers);
-	while (iterator_next(&it, (void **)&cont))
-		x86_getcontlbl(cont, cldict);
+	return &x86_poolconst(cpool, bits, size)->lbl;
+}
 
-	it = list_iterator(containers);
-	while (iterator_next(&it, (void **)&cont))
-		x86_emit_container(f, cont, cldict);
+static void x86_emit_cpool(FILE *f)
+{
+	if (!list_length(cpool))
+		return;
 
-	while (list_length(cldict)) {
-		struct asmimm *lbl = list_pop_back(cldict);
-		delete_asm_imm(lbl);
-		free(lbl);
-		list_pop_back(cldict);
+	emit_sect(f, SECTION_RODATA);
+
+	struct x86const *c;
+	it_t it = list_iterator(cpool);
+	while (iterator_next(&it, (void **)&c)) {
+		char val[sizeof(uint64_t) * 3]; // size estimate
+		sprintf(val, "%lu", (unsigned long)c->bits);
+		emit_align(f, c->size);
+		emit_label(f, &c->lbl);
+		if (c->size == 4)
+			emit_long(f, 1, val);
+		else
+			emit_quad(f, 1, val);
 	}
+}
 
-	delete_list(cldict, NULL);
+static void x86_delete_const(void *c)
+{
+	delete_asm_imm(&((struct x86const *)c)->lbl);
+	free(c);
 }
 
-static void x86_archdes(struct archdes *ades)
+/*
+ * The containers are compiled to machine instructions on the thread pool of
+ * the translation unit, each on its own, and then written out in the order
+ * they appear in, so the output doesn't depend on how many threads there
+ * are. Assembly text is written out in parallel as well, to a buffer per
+ * container.
+ *
+ * With emit_fncodes(), the text is written with the labels of the unit's own
+ * constants, and is then spliced in with those of the merged pool, for code
+ * kept from before and new code alike.
+ */
+struct x86unit {
+	struct itm_container *c;
+	struct list *cldict;
+	struct x86mi *first, *last;
+	struct list *cpool;
+	struct x86const **consts;	// what cpool's are merged into
+	struct asmout *out;
+	struct fncode **code;		// with emit_fncodes()
+};
+
+// whether the code of u is kept from before
+static bool x86_kept(struct x86unit *u)
 {
-	memset(ades, 0, sizeof(struct archdes));
-	int offs = getcpu()->offset;
+	return u->code && *u->code;
+}
 
-	if (offs < cpux86_64.offset) {
+static void x86_compile_unit(void *arg, int k)
+{
+	struct x86unit *u = (struct x86unit *)arg + k;
+	if (x86_kept(u))
+		return;
+
+	// anything left behind by a fatal error is lost
+	x86_mifirst = x86_milast = NULL;
+	cpool = u->cpool = new_list(NULL, 0);
+	timer_start("emit", u->c->id);
+	x86_emit_container(NULL, u->c, u->cldict);
+	timer_stop();
+	u->first = x86_mifirst;
+	u->last = x86_milast;
+	x86_mifirst = x86_milast = NULL;
+	cpool = NULL;
+}
+
+// in the order the containers first use them, as if there were one pool
+static void x86_mergeconsts(struct x86unit *u)
+{
+	if (x86_kept(u)) {
+		struct fncode *code = *u->code;
+		u->consts = malloc(code->nconsts * sizeof(struct x86const *));
+		for (int k = 0; k < code->nconsts; ++k)
+			u->consts[k] = x86_poolconst(cpool,
+				code->consts[k].bits, code->consts[k].size);
+		return;
+	}
+
+	u->consts = malloc(list_length(u->cpool) * sizeof(struct x86const *));
+
+	struct x86const *c;
+	int k = 0;
+	it_t it = list_iterator(u->cpool);
+	while (iterator_next(&it, (void **)&c))
+		u->consts[k++] = x86_poolconst(cpool, c->bits, c->size);
+}
+
+static void x86_relabel(struct asme *e, struct x86unit *u)
+{
+	if (e->type == &asme_x86ea) {
+		struct x86ea *ea = (struct x86ea *)e;
+		if (ea->displacement)
+			x86_relabel(&ea->displacement->base, u);
+		return;
+	}
+
+	if (e->type != &asme_imm)
+		return;
+
+	struct asmimm *imm = (struct asmimm *)e;
+	if (imm->l)
+		x86_relabel(&imm->l->base, u);
+	if (imm->r)
+		x86_relabel(&imm->r->base, u);
+	// no identifier starts with a dot, and block labels have a digit there
+	if (!imm->label || strncmp(imm->label, ".LC", 3))
+		return;
+
+	const char *to = u->consts[atoi(imm->label + 3)]->lbl.label;
+	if (strcmp(imm->label, to)) {
+		free(imm->label);
+		imm->label = malloc(strlen(to) + 1);
+		strcpy(imm->label, to);
+	}
+}
+
+// the instructions of u, relabeled once its constants are merged
+static void x86_takeunit(struct x86unit *u, bool relabel)
+{
+	x86_mifirst = u->first;
+	x86_milast = u->last;
+	for (struct x86mi *mi = x86_mifirst; relabel && mi; mi = mi->next)
+		for (int k = 0; k < mi->nops; ++k)
+			x86_relabel(mi->ops[k], u);
+
+	if (u->c->linkage == IL_GLOBAL)
+		emit_global(NULL, x86_getcontlbl(u->c, u->cldict));
+}
+
+static struct fncode *x86_tocode(struct x86unit *u)
+{
+	struct fncode *code = malloc(sizeof(struct fncode));
+	const char *text = asmout_data(u->out, &code->len);
+	code->text = malloc(code->len);
+	memcpy(code->text, text, code->len);
+
+	code->nconsts = list_length(u->cpool);
+	code->consts = malloc(code->nconsts * sizeof(struct fnconst));
+	struct x86const *c;
+	int k = 0;
+	it_t it = list_iterator(u->cpool);
+	while (iterator_next(&it, (void **)&c)) {
+		code->consts[k].bits = c->bits;
+		code->consts[k++].size = c->size;
+	}
+	return code;
+}
+
+static void x86_write_unit(void *arg, int k)
+{
+	struct x86unit *u = (struct x86unit *)arg + k;
+	if (x86_kept(u))
+		return;
+
+	struct asmout *prev = x86_out;
+	x86_out = u->out = new_asmout(NULL);
+
+	x86_takeunit(u, !u->code);
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next)
+		x86_miwrite(x86_out, mi);
+	asmout_chr(x86_out, '\n');
+	while (x86_mifirst)
+		x86_miremove(x86_mifirst);
+
+	if (u->code) {
+		*u->code = x86_tocode(u);
+		delete_asmout(u->out);
+		u->out = NULL;
+	}
+
+	x86_out = prev;
+}
+
+// the next reference to a constant from p on, NULL if there are none
+static const char *x86_findlc(const char *p, const char *end)
+{
+	while (end - p > 3) {
+		const char *dot = memchr(p, '.', end - p - 3);
+		if (!dot)
+			return NULL;
+		if (dot[1] == 'L' && dot[2] == 'C' &&
+		    isdigit((unsigned char)dot[3]))
+			return dot;
+		p = dot + 1;
+	}
+	return NULL;
+}
+
+// the code of u, with the labels of the merged constants
+static void x86_splice(struct asmout *o, struct x86unit *u)
+{
+	struct fncode *code = *u->code;
+	const char *p = code->text, *end = p + code->len, *lc;
+	while ((lc = x86_findlc(p, end))) {
+		asmout_mem(o, p, lc - p);
+		char *after;
+		long k = strtol(lc + 3, &after, 10);
+		asmout_str(o, u->consts[k]->lbl.label);
+		p = after;
+	}
+	asmout_mem(o, p, end - p);
+}
+
+static void x86_emit_units(FILE *f, struct list *containers,
+	struct fncode **codes)
+{
+	if (!x86_obj)
+		x86_out = new_asmout(f);
+
+	// looked up only from here on, by all threads
+	struct list *cldict = new_list(NULL, 0);
+	struct itm_container *cont;
+	it_t it = list_iterator(containers);
+	while (iterator_next(&it, (void **)&cont))
+		x86_getcontlbl(cont, cldict);
+
+	int n = list_length(containers), k = 0;
+	struct x86unit *units = calloc(n, sizeof(struct x86unit));
+	it = list_iterator(containers);
+	while (iterator_next(&it, (void **)&cont)) {
+		units[k].c = cont;
+		units[k].code = codes ? &codes[k] : NULL;
+		units[k++].cldict = cldict;
+	}
+
+	pool_run(curtu()->pool, n, &x86_compile_unit, units);
+
+	timer_start("output", NULL);
+	cpool = new_list(NULL, 0);
+	for (k = 0; k < n; ++k)
+		x86_mergeconsts(&units[k]);
+
+	if (x86_obj) {
+		for (k = 0; k < n; ++k) {
+			x86_takeunit(&units[k], true);
+			x86_assemble();
+			while (x86_mifirst)
+				x86_miremove(x86_mifirst);
+		}
+	} else {
+		pool_run(curtu()->pool, n, &x86_write_unit, units);
+		for (k = 0; k < n; ++k) {
+			if (codes) {
+				x86_splice(x86_out, &units[k]);
+				continue;
+			}
+
+			size_t len;
+			const char *data = asmout_data(units[k].out, &len);
+			asmout_mem(x86_out, data, len);
+			delete_asmout(units[k].out);
+		}
+	}
+
+	for (k = 0; k < n; ++k) {
+		if (units[k].cpool)
+			delete_list(units[k].cpool, &x86_delete_const);
+		free(units[k].consts);
+	}
+	free(units);
+
+	x86_emit_cpool(f);
+	delete_list(cpool, &x86_delete_const);
+	cpool = NULL;
+
+	// no executable stack, like obj_write_elf() says
+	if (x86_out && asmflavor() == AF_ATT)
+		x86_outdir("\t.section\t", ".note.GNU-stack,\"\",@progbits");
+	else if (x86_out)
+		x86_outdir("section\t",
+			".note.GNU-stack noalloc noexec nowrite progbits");
+	timer_stop();
+
+	while (list_length(cldict)) {
+		struct asmimm *lbl = list_pop_back(cldict);
+		delete_asm_imm(lbl);
+		free(lbl);
+		list_pop_back(cldict);
+	}
+
+	delete_list(cldict, NULL);
+
+	if (x86_out) {
+		delete_asmout(x86_out);
+		x86_out = NULL;
+	}
+}
+
+void emit(FILE *f, struct list *containers)
+{
+	x86_emit_units(f, containers, NULL);
+}
+
+void emit_fncodes(FILE *f, struct list *containers, struct fncode **codes)
+{
+	assert(!x86_obj);
+	x86_emit_units(f, containers, codes);
+}
+
+void emit_object(FILE *f, struct list *containers)
+{
+	if (getcpu()->bits == 16)
+		report(E_OPTIONS | E_FATAL, NULL,
+			"no object files for %s, use '-S'", getcpu()->name);
+
+	x86_obj = new_objfile();
+	x86_emit_units(f, containers, NULL);
+	obj_write_elf(x86_obj, f);
+	delete_objfile(x86_obj);
+	x86_obj = NULL;
+}
+
+static void x86_archdes(struct archdes *ades)
+{
+	memset(ades, 0, sizeof(struct archdes));
+	int offs = getcpu()->offset;
+
+	if (offs < cpux86_64.offset) {
 		ades->all_iregs =
 			eax.id | ebx.id | ecx.id | edx.id | edi.id | esi.id;
-		ades->saved_iregs = ades->all_iregs & ~(eax.id | edx.id);
+		ades->saved_iregs = ebx.id | esi.id | edi.id;
+		ades->byte_iregs = eax.id | ebx.id | ecx.id | edx.id;
+		// xmm7 is kept free as scratch register
+		if (x86_sse2())
+			ades->all_fregs = xmm0.id | xmm1.id | xmm2.id |
+				xmm3.id | xmm4.id | xmm5.id | xmm6.id;
 		return;
 	}
 
@@ -576,14 +1288,34 @@ static void x86_archdes(struct archdes *ades)
 		r8.id | r9.id | r10.id | r11.id | r12.id | r13.id | r14.id;
 	ades->saved_iregs =
 		rbx.id | r12.id | r13.id | r14.id | r15.id;
+	ades->byte_iregs = ades->all_iregs;
+	// xmm15 is kept free as scratch register
+	if (x86_sse2())
+		ades->all_fregs =
+			xmm0.id | xmm1.id | xmm2.id | xmm3.id | xmm4.id |
+			xmm5.id | xmm6.id | xmm7.id | xmm8.id | xmm9.id |
+			xmm10.id | xmm11.id | xmm12.id | xmm13.id | xmm14.id;
+}
+
+// scratch register for floating point operations, see x86_archdes()
+static const struct asmreg *x86_fscratch(void)
+{
+	return getcpu()->offset < cpux86_64.offset ? &xmm7 : &xmm15;
+}
+
+static bool x86_isshift(struct itm_instr *i)
+{
+	return i->id == ITM_ID(itm_shl) || i->id == ITM_ID(itm_shr) ||
+	       i->id == ITM_ID(itm_sal) || i->id == ITM_ID(itm_sar);
 }
 
 static bool x86_isarith(struct itm_instr *i)
 {
 	return i->id == ITM_ID(itm_add) || i->id == ITM_ID(itm_sub) ||
 	       i->id == ITM_ID(itm_mul) || i->id == ITM_ID(itm_div) ||
+	       i->id == ITM_ID(itm_rem) || i->id == ITM_ID(itm_mulh) ||
 	       i->id == ITM_ID(itm_xor) || i->id == ITM_ID(itm_and) ||
-	       i->id == ITM_ID(itm_or);
+	       i->id == ITM_ID(itm_or) || x86_isshift(i);
 }
 
 static bool x86_issymm(struct itm_instr *i)
@@ -594,6 +1326,7 @@ static bool x86_issymm(struct itm_instr *i)
 }
 
 static void x86_emit_block(FILE *f, struct itm_block *b, struct list *bldict);
+static void x86_select(struct itm_block *b);
 
 /*
  * emit() cleans up the mess left by getcontlbl()
@@ -612,29 +1345,253 @@ static struct asmimm *x86_getcontlbl(struct itm_container *c,
 	return lbl;
 }
 
+/*
+ * Block layout
+ *
+ * Blocks are placed so that the likelier successor of each block follows it,
+ * which saves the jump there. The edges are weighed by a static estimate of
+ * how often they are taken: ten times per loop they are nested in, and for
+ * splits, staying in a loop and not returning are the likelier outcomes.
+ * Edges are then taken from heaviest to lightest, joining chains of blocks
+ * where the edge goes from the end of one to the start of another. The body
+ * of a while loop ends up before its condition this way, so that only one
+ * conditional jump is taken per iteration.
+ */
+struct x86edge {
+	int from, to, weight;
+};
+
+static int x86_blockidx(struct itm_block **bs, int n, struct itm_block *b)
+{
+	for (int k = 0; k < n; ++k)
+		if (bs[k] == b)
+			return k;
+	assert(false);
+	return -1;
+}
+
+static int x86_freq(struct itm_block *b)
+{
+	struct itm_tag *tag = itm_get_tag(&b->base, tt_loopdepth);
+	int depth = tag ? itm_tag_geti(tag) : 0;
+	int freq = 1;
+	for (int k = 0; k < depth && k < 4; ++k)
+		freq *= 10;
+	return freq;
+}
+
+static bool x86_returns(struct itm_block *b)
+{
+	return b->last && (b->last->id == ITM_ID(itm_ret) ||
+	                   b->last->id == ITM_ID(itm_leave));
+}
+
+// the likelihood of a split going to the block at index to, out of 16
+static int x86_splitprob(struct itm_block **bs, int from, int to, int other)
+{
+	int din = x86_freq(bs[to]) - x86_freq(bs[from]);
+	int dother = x86_freq(bs[other]) - x86_freq(bs[from]);
+
+	// back edges and loop exits
+	if ((to <= from) != (other <= from))
+		return to <= from ? 14 : 2;
+	if ((din < 0) != (dother < 0))
+		return din < 0 ? 2 : 14;
+	if (x86_returns(bs[to]) != x86_returns(bs[other]))
+		return x86_returns(bs[to]) ? 5 : 11;
+	return 8;
+}
+
+static int x86_cmpedge(const void *a, const void *b)
+{
+	const struct x86edge *ea = a, *eb = b;
+	if (ea->weight != eb->weight)
+		return eb->weight - ea->weight;
+	if (ea->from != eb->from)
+		return ea->from - eb->from;
+	return ea->to - eb->to;
+}
+
+static void x86_layout(struct itm_block *strt)
+{
+	if (option_optimize() < 1)
+		return;
+
+	int n = 0;
+	for (struct itm_block *b = strt; b; b = b->lexnext)
+		++n;
+
+	struct itm_block **bs = malloc(n * sizeof(struct itm_block *));
+	struct x86edge *edges = malloc(2 * n * sizeof(struct x86edge));
+	int *chain = malloc(n * sizeof(int));	// the first block of each chain
+	int *after = malloc(n * sizeof(int));	// the block placed after each
+	int nedges = 0;
+
+	int k = 0;
+	for (struct itm_block *b = strt; b; b = b->lexnext, ++k) {
+		bs[k] = b;
+		chain[k] = k;
+		after[k] = -1;
+	}
+
+	for (k = 0; k < n; ++k) {
+		struct itm_instr *i = bs[k]->last;
+		int freq = x86_freq(bs[k]);
+		if (i && i->id == ITM_ID(itm_jmp)) {
+			int to = x86_blockidx(bs, n, list_head(i->operands));
+			edges[nedges++] = (struct x86edge){ k, to, freq * 16 };
+		} else if (i && i->id == ITM_ID(itm_split)) {
+			int t = x86_blockidx(bs, n, get_list_item(i->operands, 1));
+			int f = x86_blockidx(bs, n, list_last(i->operands));
+			int p = x86_splitprob(bs, k, t, f);
+			edges[nedges++] = (struct x86edge){ k, t, freq * p };
+			edges[nedges++] = (struct x86edge){ k, f, freq * (16 - p) };
+		}
+	}
+	qsort(edges, nedges, sizeof(struct x86edge), &x86_cmpedge);
+
+	for (int e = 0; e < nedges; ++e) {
+		int from = edges[e].from, to = edges[e].to;
+		// the entry block stays first
+		if (to == 0 || after[from] >= 0 || chain[to] != to ||
+		    chain[from] == to)
+			continue;
+
+		int head = chain[from];
+		after[from] = to;
+		for (int j = to; j >= 0; j = after[j])
+			chain[j] = head;
+	}
+
+	/*
+	 * The chain of the entry block comes first, the others follow by how
+	 * often they run, so that the hot ones stay together.
+	 */
+	struct itm_block *prev = NULL;
+	bool *placed = calloc(n, sizeof(bool));
+	for (int best = 0; best >= 0; ) {
+		placed[best] = true;
+		for (int j = best; j >= 0; j = after[j]) {
+			bs[j]->lexprev = prev;
+			if (prev)
+				prev->lexnext = bs[j];
+			prev = bs[j];
+		}
+
+		best = -1;
+		for (k = 0; k < n; ++k)
+			if (chain[k] == k && !placed[k] && (best < 0 ||
+			    x86_freq(bs[k]) > x86_freq(bs[best])))
+				best = k;
+	}
+	prev->lexnext = NULL;
+
+	free(placed);
+	free(after);
+	free(chain);
+	free(edges);
+	free(bs);
+}
+
+// whether b is jumped to from a block in the same loop placed after it
+static bool x86_looptop(struct itm_block *b)
+{
+	if (!b->lexprev || x86_freq(b) == 1)
+		return false;
+
+	for (struct itm_block *l = b; l; l = l->lexnext)
+		if (list_contains(b->previous, l) && x86_freq(l) >= x86_freq(b))
+			return true;
+	return false;
+}
+
+static int x86_nmovs(struct itm_block *b)
+{
+	int n = 0;
+	for (; b; b = b->lexnext)
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			if (i->id == ITM_ID(itm_mov))
+				++n;
+	return n;
+}
+
+static int x86_ninstrs(void)
+{
+	int n = 0;
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next)
+		if (mi->kind == MI_INSTR)
+			++n;
+	return n;
+}
+
+// to the list of machine instructions, which is left to the caller
 static void x86_emit_container(FILE *f, struct itm_container *c,
 	struct list *cldict)
 {
+	timer_start("lower", NULL);
+	x86_ifconvert(c->block);
+	splitcrit(c->block);
+	x86_keepflags(c->block);
+	timer_stop();
+	timer_start("x86_restrict", NULL);
+	int movs = option_stats() ? x86_nmovs(c->block) : 0;
 	x86_restrict(c->block);
+	if (option_stats())
+		stats_add(c->id, ST_MOVS, x86_nmovs(c->block) - movs);
+	timer_stop();
 
 	struct archdes des;
 	x86_archdes(&des);
+	timer_start("regalloc", NULL);
 	regalloc(c->block, des);
+	timer_stop();
+	timer_start("x86_select", NULL);
+	x86_select(c->block);
+	timer_stop();
+	timer_start("x86_layout", NULL);
+	x86_layout(c->block);
+	timer_stop();
 
 	//itm_container_to_string(f, c);
 	//return;
 
 	struct asmimm *lbl = x86_getcontlbl(c, cldict);
 
-	if (c->linkage == IL_GLOBAL)
-		emit_global(f, lbl);
+	timer_start("instructions", NULL);
+	x86_micollect = true;
 	emit_label(f, lbl);
+	x86_emit_prologue(f, c->block);
 
 	struct list *dict = new_list(NULL, 0);
 	x86_emit_block(f, c->block, dict);
 	delete_list(dict, NULL);
+	x86_micollect = false;
+	timer_stop();
+
+	if (option_optimize() >= 1) {
+		timer_start("x86_peephole", NULL);
+		x86_peephole();
+		timer_stop();
+	}
+	if (option_optimize() >= 2) {
+		timer_start("x86_schedule", NULL);
+		x86_schedule();
+		timer_stop();
+	}
+
+	if (option_stats())
+		stats_add(c->id, ST_INSTRS, x86_ninstrs());
+}
+
+// integer literals that don't fit a sign extended 32 bit immediate
+static bool x86_isimm64(struct itm_expr *e)
+{
+	if (e->etype != ITME_LITERAL || hastc(e->type, TC_FLOATING) ||
+	    e->type->size != 8)
+		return false;
 
-	fprintf(f, "\n");
+	int64_t v = itm_getsi((struct itm_literal *)e);
+	return v < INT32_MIN || v > INT32_MAX;
 }
 
 static void x86_restrictarith(struct itm_instr *i)
@@ -642,6 +1599,13 @@ static void x86_restrictarith(struct itm_instr *i)
 	if (!x86_isarith(i))
 		return;
 
+	struct itm_expr *last = list_last(i->operands);
+	if (x86_isimm64(last)) {
+		struct itm_instr *mov = itm_mov(i->block, last);
+		itm_inserti(mov, i);
+		set_list_item(i->operands, 1, mov);
+	}
+
 	if (x86_issymm(i))
 		return;
 
@@ -654,24 +1618,25 @@ static void x86_restrictarith(struct itm_instr *i)
 	set_list_item(i->operands, 0, mov);
 }
 
-static void x86_restrictmul(struct itm_instr *i)
+// shifts by a variable amount take it in cl, rcx is clobbered
+static void x86_restrictshift(struct itm_instr *i)
 {
-	if (i->id != ITM_ID(itm_mul))
+	if (!x86_isshift(i))
 		return;
 
-	struct itm_expr *l = list_head(i->operands);
-	if (!hastc(l->type, TC_UNSIGNED))
+	struct itm_expr *r = list_last(i->operands);
+	if (r->etype != ITME_INSTRUCTION)
 		return;
 
-	struct location *actloc = new_loc_reg(i->base.type->size, rax.id);
-	struct itm_instr *mov = itm_mov(i->block, l);
+	struct location *actloc = new_loc_reg(r->type->size, rcx.id);
+	struct itm_instr *mov = itm_mov(i->block, r);
 	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
 	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
 	itm_tag_expr(&mov->base, loc);
 	itm_inserti(mov, i);
-	set_list_item(i->operands, 0, mov);
+	set_list_item(i->operands, 1, mov);
 
-	actloc = new_loc_reg(i->base.type->size, rdx.id);
+	actloc = new_loc_reg(i->base.type->size, rcx.id);
 	struct itm_instr *clobb = itm_clobb(i->block);
 	loc = new_itm_tag(tt_loc, TO_USER_PTR);
 	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
@@ -679,246 +1644,3929 @@ static void x86_restrictmul(struct itm_instr *i)
 	itm_inserti(clobb, i->next);
 }
 
-static void x86_restrictcmp(struct itm_instr *i)
+static bool x86_isaddr(struct itm_instr *i)
 {
-	regid_t reg;
+	return i->id == ITM_ID(itm_getptr) || i->id == ITM_ID(itm_deepptr);
+}
 
-	if (i->id == ITM_ID(itm_cmpeq))
-		reg = eflag.id;
-	else if (i->id == ITM_ID(itm_cmpneq))
-		reg = neflag.id;
-	else if (i->id == ITM_ID(itm_cmpgt))
-		reg = gflag.id;
-	else if (i->id == ITM_ID(itm_cmpgte))
-		reg = geflag.id;
-	else if (i->id == ITM_ID(itm_cmplt))
-		reg = lflag.id;
-	else if (i->id == ITM_ID(itm_cmplte))
-		reg = leflag.id;
-	else
-		return;
+static bool x86_isfield(struct itm_instr *i)
+{
+	struct itm_expr *p = list_head(i->operands);
+	struct ctype *ty = ((struct cpointer *)p->type)->pointsto;
+	return i->id == ITM_ID(itm_deepptr) &&
+	       (ty->type == STRUCTURE || ty->type == UNION);
+}
 
-	struct itm_instr *mov = itm_mov(i->block, &i->base);
-	itm_inserti(mov, i->next);
-	itm_replocc(&i->base, &mov->base, i->block);
-	// set mov operand again for it has been replaced with the mov itself
-	set_list_item(mov->operands, 0, &i->base);
+// the number of bytes a getptr or deepptr steps by per index
+static int x86_elemsize(struct itm_instr *i)
+{
+	struct itm_expr *p = list_head(i->operands);
+	struct ctype *ty = ((struct cpointer *)p->type)->pointsto;
+	if (i->id == ITM_ID(itm_deepptr) && ty->type == ARRAY)
+		ty = ((struct carray *)ty)->elementtype;
+	// arithmetic on void pointers steps by bytes, like gcc does
+	return ty->size > 0 ? ty->size : 1;
+}
 
-	struct location *actloc = new_loc_reg(i->base.type->size, reg);
-	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
-	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
-	itm_tag_expr(&i->base, loc);
+static bool x86_isscale(int size)
+{
+	if (getcpu()->offset < cpui386.offset)
+		return size == 1;
+	return size == 1 || size == 2 || size == 4 || size == 8;
 }
 
-static void x86_restrictret(struct itm_instr *i)
+/*
+ * Indices of getptr and deepptr are extended to the size of a pointer, so
+ * they may serve as the index register of an address. Element sizes that
+ * aren't a valid scale are multiplied in beforehand, and the pointer is then
+ * indexed as a pointer to char.
+ */
+static void x86_restrictptr(struct itm_instr *i)
 {
-	if (i->id != ITM_ID(itm_ret))
+	if (!x86_isaddr(i) || x86_isfield(i))
 		return;
 
-	if (hastc(i->base.type, TC_POINTER) ||
-	    hastc(i->base.type, TC_INTEGRAL)) {
-		struct itm_instr *mov = itm_mov(i->block, list_head(i->operands));
-		struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
-		struct location *actloc = new_loc_reg(i->base.type->size, rax.id);
-		itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
-		itm_tag_expr(&mov->base, loc);
-		itm_inserti(mov, i);
-		set_list_item(i->operands, 0, mov);
+	struct itm_expr *idx = get_list_item(i->operands, 1);
+	if (idx->etype == ITME_LITERAL)
+		return;
+
+	int psize = getcpu()->bits / 8;
+	if (idx->type->size < psize) {
+		bool uns = hastc(idx->type, TC_UNSIGNED);
+		struct ctype *ty;
+		switch (psize) {
+		case 2:
+			ty = uns ? &cushort : &cshort;
+			break;
+		case 4:
+			ty = uns ? &cuint : &cint;
+			break;
+		default:
+			ty = uns ? &culonglong : &clonglong;
+			break;
+		}
+		struct itm_instr *ext = uns ? itm_zext(i->block, idx, ty) :
+			itm_sext(i->block, idx, ty);
+		itm_inserti(ext, i);
+		idx = &ext->base;
+		set_list_item(i->operands, 1, idx);
 	}
+
+	int size = x86_elemsize(i);
+	if (x86_isscale(size))
+		return;
+
+	struct itm_literal *lit = new_itm_literal(i->block->container,
+		idx->type);
+	lit->value.i = size;
+	struct itm_instr *mul = itm_mul(i->block, idx, &lit->base);
+	itm_inserti(mul, i);
+	struct itm_instr *cast = itm_bitcast(i->block, list_head(i->operands),
+		new_pointer(&cchar));
+	itm_inserti(cast, i);
+	set_list_item(i->operands, 0, cast);
+	set_list_item(i->operands, 1, mul);
 }
 
-static void x86_restrict(struct itm_block *b)
+static bool x86_isfloat(struct itm_expr *e)
 {
-	struct itm_instr *i = b->first;
-	while (i) {
-		x86_restrictmul(i);
-		x86_restrictret(i);
-		x86_restrictarith(i);
-		x86_restrictcmp(i);
-		i = i->next;
-	}
-
-	if (b->lexnext)
-		x86_restrict(b->lexnext);
+	return hastc(e->type, TC_FLOATING);
 }
 
+static void x86_pin(struct itm_expr *e, regid_t rid)
+{
+	struct location *actloc = new_loc_reg(e->type->size, rid);
+	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
+	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
+	itm_tag_expr(e, loc);
+}
 
-static struct itm_instr *x86_emiti(FILE *f, struct itm_instr *i,
-	struct list *bldict);
+static void x86_clobber(struct itm_instr *before, regid_t rid, int size)
+{
+	struct itm_instr *clobb = itm_clobb(before->block);
+	struct location *actloc = new_loc_reg(size, rid);
+	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
+	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
+	itm_tag_expr(&clobb->base, loc);
+	itm_inserti(clobb, before);
+}
 
 /*
- * x86_emit_block cleans up the mess left by getblocklbl
+ * div and idiv divide rdx:rax by their operand, leaving the quotient in rax
+ * and the remainder in rdx, the one operand mul and imul leave the high half
+ * of the product in rdx. The left operand is moved into rax, and the result
+ * is copied out of its register right away, so that pinned registers are only
+ * live for a single instruction. The sign extension of the dividend
+ * overwrites rdx, which a clobber keeps the divisor out of.
  */
-static struct asmimm *x86_getblocklbl(struct itm_block *b, struct list *bldict)
+static void x86_restrictdiv(struct itm_instr *i)
 {
-	struct asmimm *lbl;
+	bool isdiv = i->id == ITM_ID(itm_div) || i->id == ITM_ID(itm_rem);
+	if ((!isdiv && i->id != ITM_ID(itm_mulh)) || x86_isfloat(&i->base))
+		return;
 
-	if (!dict_get(bldict, b, (void **)&lbl)) {
-		lbl = malloc(sizeof(struct asmimm));
-		char lblid[3 + sizeof(int) * 3]; // size estimate
-		sprintf(lblid, ".L%d", list_length(bldict) / 2);
-		new_asm_label(lbl, lblid);
-		dict_push_back(bldict, b, lbl);
-	}
+	int size = i->base.type->size;
+	struct itm_instr *rmov = itm_mov(i->block, list_last(i->operands));
+	itm_inserti(rmov, i);
+	set_list_item(i->operands, 1, &rmov->base);
+
+	struct itm_instr *lmov = itm_mov(i->block, list_head(i->operands));
+	x86_pin(&lmov->base, rax.id);
+	itm_inserti(lmov, i);
+	set_list_item(i->operands, 0, &lmov->base);
+
+	if (isdiv)
+		x86_clobber(i, rdx.id, size);
+
+	bool indx = i->id != ITM_ID(itm_div);
+	struct itm_instr *res = itm_mov(i->block, &i->base);
+	itm_inserti(res, i->next);
+	itm_replocc(&i->base, &res->base, i->block);
+	set_list_item(res->operands, 0, &i->base);
+	x86_pin(&i->base, indx ? rdx.id : rax.id);
+	x86_clobber(res->next, indx ? rax.id : rdx.id, size);
+}
 
-	return lbl;
+/*
+ * Division by constants
+ *
+ * Divisions and remainders by integer literals are turned into multiplications
+ * by a magic number, taking the high half of the product. This follows
+ * Granlund and Montgomery, "Division by Invariant Integers using
+ * Multiplication", with magic numbers as computed in Hacker's Delight.
+ * Divisions by powers of two become shifts.
+ */
+struct x86magic {
+	uint64_t m;
+	int s;
+	bool add;	// m doesn't fit, and the dividend is to be added again
+};
+
+static uint64_t x86_mask(int bits)
+{
+	return bits >= 64 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
 }
 
-static void x86_emit_block(FILE *f, struct itm_block *b, struct list *bldict)
+// unsigned division of a bits bit number by d, which isn't a power of two
+static struct x86magic x86_magicu(uint64_t d, int bits)
 {
-	struct asmimm *lbl = x86_getblocklbl(b, bldict);
+	uint64_t mask = x86_mask(bits), top = (uint64_t)1 << (bits - 1);
+	struct x86magic mag = { 0, 0, false };
+
+	uint64_t nc = (mask - ((mask - d + 1) & mask) % d) & mask;
+	uint64_t q1 = top / nc, r1 = top - q1 * nc;
+	uint64_t q2 = (top - 1) / d, r2 = (top - 1) - q2 * d;
+	uint64_t delta;
+	int p = bits - 1;
+	do {
+		++p;
+		if (r1 >= nc - r1) {
+			q1 = (2 * q1 + 1) & mask;
+			r1 = (2 * r1 - nc) & mask;
+		} else {
+			q1 = (2 * q1) & mask;
+			r1 = (2 * r1) & mask;
+		}
+		if (r2 + 1 >= d - r2) {
+			if (q2 >= top - 1)
+				mag.add = true;
+			q2 = (2 * q2 + 1) & mask;
+			r2 = (2 * r2 + 1 - d) & mask;
+		} else {
+			if (q2 >= top)
+				mag.add = true;
+			q2 = (2 * q2) & mask;
+			r2 = (2 * r2 + 1) & mask;
+		}
+		delta = d - 1 - r2;
+	} while (p < 2 * bits && (q1 < delta || (q1 == delta && r1 == 0)));
 
-	emit_label(f, lbl);
+	mag.m = (q2 + 1) & mask;
+	mag.s = p - bits;
+	return mag;
+}
 
+// signed division by d, whose absolute value isn't a power of two
+static struct x86magic x86_magics(int64_t d, int bits)
+{
+	uint64_t mask = x86_mask(bits), top = (uint64_t)1 << (bits - 1);
+	struct x86magic mag = { 0, 0, false };
+
+	uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+	uint64_t t = top + (d < 0);
+	uint64_t anc = t - 1 - t % ad;
+	uint64_t q1 = top / anc, r1 = top - q1 * anc;
+	uint64_t q2 = top / ad, r2 = top - q2 * ad;
+	uint64_t delta;
+	int p = bits - 1;
+	do {
+		++p;
+		q1 = (2 * q1) & mask;
+		r1 = (2 * r1) & mask;
+		if (r1 >= anc) {
+			++q1;
+			r1 -= anc;
+		}
+		q2 = (2 * q2) & mask;
+		r2 = (2 * r2) & mask;
+		if (r2 >= ad) {
+			++q2;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	mag.m = (q2 + 1) & mask;
+	if (d < 0)
+		mag.m = -mag.m & mask;
+	mag.s = p - bits;
+	return mag;
+}
 
-	for (struct itm_instr *i = b->first; i; i = x86_emiti(f, i, bldict))
-		;
+// log2(v) if v is a power of two, -1 otherwise
+static int x86_log2(uint64_t v)
+{
+	if (!v || (v & (v - 1)))
+		return -1;
 
-	if (b->lexnext)
-		x86_emit_block(f, b->lexnext, bldict);
+	int res = 0;
+	while (v >>= 1)
+		++res;
+	return res;
+}
+
+static struct itm_expr *x86_tylit(struct itm_block *b, struct ctype *ty,
+	uint64_t v)
+{
+	struct itm_literal *lit = new_itm_literal(b->container, ty);
+	lit->value.i = v & x86_mask(ty->size * 8);
+	return &lit->base;
+}
+
+static struct itm_expr *x86_lit(struct itm_instr *i, uint64_t v)
+{
+	return x86_tylit(i->block, i->base.type, v);
+}
+
+// inserts the new instruction n before i
+static struct itm_expr *x86_ins(struct itm_instr *i, struct itm_instr *n)
+{
+	itm_inserti(n, i);
+	return &n->base;
+}
+
+static struct itm_expr *x86_divu(struct itm_instr *i, struct itm_expr *n,
+	uint64_t d)
+{
+	struct itm_block *b = i->block;
+	int k = x86_log2(d);
+	if (k >= 0)
+		return k ? x86_ins(i, itm_shr(b, n, x86_lit(i, k))) : n;
+
+	struct x86magic mag = x86_magicu(d, i->base.type->size * 8);
+	struct itm_expr *q = x86_ins(i, itm_mulh(b, n, x86_lit(i, mag.m)));
+	if (mag.add) {
+		// q = (((n - q) >> 1) + q) >> (s - 1)
+		struct itm_expr *t = x86_ins(i, itm_sub(b, n, q));
+		t = x86_ins(i, itm_shr(b, t, x86_lit(i, 1)));
+		q = x86_ins(i, itm_add(b, t, q));
+		--mag.s;
+	}
+	if (mag.s)
+		q = x86_ins(i, itm_shr(b, q, x86_lit(i, mag.s)));
+	return q;
+}
+
+static struct itm_expr *x86_divs(struct itm_instr *i, struct itm_expr *n,
+	int64_t d)
+{
+	struct itm_block *b = i->block;
+	int bits = i->base.type->size * 8;
+	int k = x86_log2(d < 0 ? -(uint64_t)d & x86_mask(bits) : (uint64_t)d);
+	struct itm_expr *q = n;
+
+	if (k > 0) {
+		// negative dividends are rounded towards zero by adding d - 1
+		struct itm_expr *bias = n;
+		if (k > 1)
+			bias = x86_ins(i, itm_sar(b, n, x86_lit(i, k - 1)));
+		bias = x86_ins(i, itm_shr(b, bias, x86_lit(i, bits - k)));
+		q = x86_ins(i, itm_add(b, n, bias));
+		q = x86_ins(i, itm_sar(b, q, x86_lit(i, k)));
+	} else if (k < 0) {
+		struct x86magic mag = x86_magics(d, bits);
+		bool neg = mag.m >> (bits - 1);
+		q = x86_ins(i, itm_mulh(b, n, x86_lit(i, mag.m)));
+		if (d > 0 && neg)
+			q = x86_ins(i, itm_add(b, q, n));
+		else if (d < 0 && !neg)
+			q = x86_ins(i, itm_sub(b, q, n));
+		if (mag.s)
+			q = x86_ins(i, itm_sar(b, q, x86_lit(i, mag.s)));
+		// add one to negative quotients
+		struct itm_expr *t = x86_ins(i,
+			itm_shr(b, q, x86_lit(i, bits - 1)));
+		return x86_ins(i, itm_add(b, q, t));
+	}
+
+	if (d < 0)
+		q = x86_ins(i, itm_sub(b, x86_lit(i, 0), q));
+	return q;
+}
+
+static void x86_lowerdiv(struct itm_instr *i)
+{
+	bool isrem = i->id == ITM_ID(itm_rem);
+	if (i->id != ITM_ID(itm_div) && !isrem)
+		return;
+
+	struct itm_expr *n = list_head(i->operands);
+	struct itm_expr *r = list_last(i->operands);
+	int size = i->base.type->size;
+	if (r->etype != ITME_LITERAL || x86_isfloat(&i->base) ||
+	    (size != 4 && (size != 8 || getcpu()->bits != 64)))
+		return;
+
+	struct itm_literal *lit = (struct itm_literal *)r;
+	uint64_t d = lit->value.i & x86_mask(size * 8);
+	// division by zero is left to the hardware
+	if (!d)
+		return;
+
+	struct itm_expr *res;
+	bool sign = hastc(i->base.type, TC_SIGNED);
+	if (isrem && !sign && x86_log2(d) >= 0) {
+		res = x86_ins(i, itm_and(i->block, n, x86_lit(i, d - 1)));
+	} else {
+		res = sign ? x86_divs(i, n, itm_getsi(lit)) : x86_divu(i, n, d);
+		if (isrem) {
+			struct itm_expr *t = x86_ins(i, itm_mul(i->block, res,
+				x86_lit(i, d)));
+			res = x86_ins(i, itm_sub(i->block, n, t));
+		}
+	}
+	itm_repli(i, res);
+}
+
+static struct itm_expr *x86_flit(struct itm_block *b, struct ctype *ty,
+	double v)
+{
+	struct itm_literal *lit = new_itm_literal(b->container, ty);
+	if (ty->size == 4)
+		lit->value.f = v;
+	else
+		lit->value.d = v;
+	return &lit->base;
+}
+
+/*
+ * Unsigned conversions
+ *
+ * The conversions between integers and floating point values only know
+ * signed integers. Narrower unsigned integers are extended first, see
+ * x86_restrictfp(), which leaves those as wide as a register.
+ *
+ * Such an integer x with its top bit set is converted as (x >> 1 | x & 1)
+ * times two, the bit shifted out kept so that the half rounds like x would.
+ * There is no cmov for floating point values, so the factor is selected from
+ * the bits of 2.0 and 1.0. A 32-bit integer converted to a double isn't
+ * rounded at all, that is converted as (x ^ 2^31) + 2^31 instead.
+ *
+ * A floating point value f of at least 2^(n - 1) is converted less that, and
+ * the top bit set again in the result.
+ */
+static void x86_lowerconv(struct itm_instr *i)
+{
+	bool isitof = i->id == ITM_ID(itm_itof);
+	if ((!isitof && i->id != ITM_ID(itm_ftoi)) || !x86_sse2())
+		return;
+
+	struct itm_block *b = i->block;
+	struct itm_expr *l = list_head(i->operands);
+	struct ctype *ity = isitof ? l->type : i->base.type;
+	struct ctype *fty = isitof ? i->base.type : l->type;
+	int bits = getcpu()->bits;
+	if (!hastc(ity, TC_UNSIGNED) || ity->size * 8 != bits)
+		return;
+
+	uint64_t top = (uint64_t)1 << (bits - 1);
+	struct itm_expr *res;
+	if (!isitof) {
+		struct itm_expr *k = x86_flit(b, fty, top);
+		struct itm_expr *d = x86_ins(i, itm_sub(b, l, k));
+		struct itm_expr *hi = x86_ins(i, itm_ftoi(b, d, ity));
+		hi = x86_ins(i, itm_xor(b, hi, x86_tylit(b, ity, top)));
+		struct itm_expr *lo = x86_ins(i, itm_ftoi(b, l, ity));
+		struct itm_expr *big = x86_ins(i, itm_cmpgte(b, l, k));
+		res = x86_ins(i, itm_select(b, big, hi, lo));
+	} else if (fty->size * 8 > bits) {
+		struct itm_expr *t = x86_ins(i,
+			itm_xor(b, l, x86_tylit(b, ity, top)));
+		t = x86_ins(i, itm_itof(b, t, fty));
+		res = x86_ins(i, itm_add(b, t, x86_flit(b, fty, top)));
+	} else {
+		struct itm_expr *h = x86_ins(i,
+			itm_shr(b, l, x86_tylit(b, ity, 1)));
+		struct itm_expr *odd = x86_ins(i,
+			itm_and(b, l, x86_tylit(b, ity, 1)));
+		h = x86_ins(i, itm_or(b, h, odd));
+
+		// the literals are as wide as the result
+		struct ctype *bty = fty->size == 4 ? &cuint : &culonglong;
+		uint64_t two = fty->size == 4 ? 0x40000000 : 0x4000000000000000;
+		uint64_t one = fty->size == 4 ? 0x3f800000 : 0x3ff0000000000000;
+
+		struct ctype *sty = bits == 64 ? &clonglong : &cint;
+		struct itm_expr *s = x86_ins(i, itm_bitcast(b, l, sty));
+		struct itm_expr *neg = x86_ins(i,
+			itm_cmplt(b, s, x86_tylit(b, sty, 0)));
+		h = x86_ins(i, itm_select(b, neg, h, l));
+		struct itm_expr *f = x86_ins(i, itm_select(b, neg,
+			x86_tylit(b, bty, two), x86_tylit(b, bty, one)));
+		h = x86_ins(i, itm_itof(b, h, fty));
+		f = x86_ins(i, itm_bitcast(b, f, fty));
+		res = x86_ins(i, itm_mul(b, h, f));
+	}
+	itm_repli(i, res);
+}
+
+/*
+ * Multiplication by constants
+ *
+ * A multiplication by an integer literal is built from shifts, additions and
+ * subtractions instead if that is cheaper than imul on the target cpu, see
+ * x86costs. An addition of a value shifted left by one to three bits is
+ * emitted as a single lea, so y * 3, y * 5 and y * 9 are a lea each, as is
+ * x + y * 2, 4 or 8. Sequences are searched up to a depth of three steps.
+ */
+enum x86mulop {
+	MO_NONE,	// x itself
+	MO_SHL,		// y << k
+	MO_ADDY,	// y + (y << k)
+	MO_ADDX,	// x + (y << k)
+	MO_SUBY		// (y << k) - y
+};
+
+struct x86mulstep {
+	enum x86mulop op;
+	int k;
+	uint64_t c;	// y = x * c
+};
+
+#define X86_MULDEPTH 3
+
+// the cost of x + (y << k)
+static int x86_addcost(int k)
+{
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	return k <= 3 ? cs->lea : cs->shift + cs->add;
+}
+
+static int x86_mulcost(uint64_t c, int depth, struct x86mulstep *st);
+
+static void x86_mulstep(uint64_t c, int depth, struct x86mulstep *st,
+	int *best, enum x86mulop op, int k, uint64_t sub, int cost)
+{
+	struct x86mulstep tmp;
+	if (cost >= *best)
+		return;
+
+	cost += x86_mulcost(sub, depth - 1, &tmp);
+	if (cost < *best) {
+		*best = cost;
+		st->op = op;
+		st->k = k;
+		st->c = sub;
+	}
+}
+
+static int x86_mulcost(uint64_t c, int depth, struct x86mulstep *st)
+{
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	int best = INT_MAX / 2;
+	st->op = MO_NONE;
+	if (c == 1)
+		return 0;
+	if (!depth || !c)
+		return best;
+
+	int tz = 0;
+	while (!(c & (1ull << tz)))
+		++tz;
+	if (tz)
+		x86_mulstep(c, depth, st, &best, MO_SHL, tz, c >> tz, cs->shift);
+
+	for (int k = 1; k <= 3; ++k) {
+		uint64_t s = 1ull << k;
+		if (c % (s + 1) == 0)
+			x86_mulstep(c, depth, st, &best, MO_ADDY, k, c / (s + 1),
+				x86_addcost(k));
+		if ((c - 1) % s == 0)
+			x86_mulstep(c, depth, st, &best, MO_ADDX, k, (c - 1) / s,
+				x86_addcost(k));
+	}
+
+	// 2^k + 1 and 2^k - 1 take a shift and an addition
+	int k = x86_log2(c - 1);
+	if (k > 3)
+		x86_mulstep(c, depth, st, &best, MO_ADDX, k, 1, x86_addcost(k));
+	k = x86_log2(c + 1);
+	if (k > 0)
+		x86_mulstep(c, depth, st, &best, MO_SUBY, k, 1,
+			cs->shift + cs->add);
+	return best;
+}
+
+static struct itm_expr *x86_mulseq(struct itm_instr *i, struct itm_expr *x,
+	uint64_t c, int depth)
+{
+	struct itm_block *b = i->block;
+	struct x86mulstep st;
+	x86_mulcost(c, depth, &st);
+	if (st.op == MO_NONE)
+		return x;
+
+	struct itm_expr *y = x86_mulseq(i, x, st.c, depth - 1);
+	struct itm_expr *t = x86_ins(i, itm_shl(b, y, x86_lit(i, st.k)));
+	switch (st.op) {
+	case MO_ADDY:
+		return x86_ins(i, itm_add(b, y, t));
+	case MO_ADDX:
+		return x86_ins(i, itm_add(b, x, t));
+	case MO_SUBY:
+		return x86_ins(i, itm_sub(b, t, y));
+	default:
+		return t;
+	}
+}
+
+static void x86_lowermul(struct itm_instr *i)
+{
+	if (i->id != ITM_ID(itm_mul) || x86_isfloat(&i->base))
+		return;
+
+	struct itm_expr *x = list_head(i->operands);
+	struct itm_expr *r = list_last(i->operands);
+	if (x->etype == ITME_LITERAL) {
+		struct itm_expr *tmp = x;
+		x = r;
+		r = tmp;
+	}
+
+	int size = i->base.type->size;
+	if (r->etype != ITME_LITERAL || x->etype == ITME_LITERAL ||
+	    (size != 4 && (size != 8 || getcpu()->bits != 64)))
+		return;
+
+	uint64_t mask = x86_mask(size * 8);
+	uint64_t c = ((struct itm_literal *)r)->value.i & mask;
+	if (c <= 1) {
+		itm_repli(i, c ? x : x86_lit(i, 0));
+		return;
+	}
+
+	// negative factors may be cheaper to multiply by their negation
+	struct x86mulstep st;
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	int cost = x86_mulcost(c, X86_MULDEPTH, &st);
+	int ncost = x86_mulcost(-c & mask, X86_MULDEPTH, &st) + cs->add;
+	if (cost >= cs->imul && ncost >= cs->imul)
+		return;
+
+	struct itm_expr *res;
+	if (ncost < cost) {
+		res = x86_mulseq(i, x, -c & mask, X86_MULDEPTH);
+		res = x86_ins(i, itm_sub(i->block, x86_lit(i, 0), res));
+	} else {
+		res = x86_mulseq(i, x, c, X86_MULDEPTH);
+	}
+	itm_repli(i, res);
+}
+
+static bool x86_iscmp(struct itm_instr *i)
+{
+	return i->id == ITM_ID(itm_cmpeq) || i->id == ITM_ID(itm_cmpneq) ||
+	       i->id == ITM_ID(itm_cmpgt) || i->id == ITM_ID(itm_cmpgte) ||
+	       i->id == ITM_ID(itm_cmplt) || i->id == ITM_ID(itm_cmplte);
+}
+
+static bool x86_iscast(struct itm_instr *i)
+{
+	return i->id == ITM_ID(itm_sext) || i->id == ITM_ID(itm_zext) ||
+	       i->id == ITM_ID(itm_trunc) || i->id == ITM_ID(itm_bitcast) ||
+	       i->id == ITM_ID(itm_itof) || i->id == ITM_ID(itm_ftoi) ||
+	       i->id == ITM_ID(itm_fext) || i->id == ITM_ID(itm_ftrunc);
+}
+
+/*
+ * If-conversion
+ *
+ * A split whose arms do nothing but compute the operands of the phis where
+ * they join again is flattened: the arms are executed unconditionally, and
+ * the phis become selects. Pairs of constants are taken out of the flags by
+ * setcc, anything else requires cmov. That pays if it costs less than half a
+ * mispredicted branch, which is what a data dependent branch costs on average.
+ */
+static bool x86_hasuses(struct itm_instr *i, struct itm_instr *except)
+{
+	struct itm_block *b = i->block;
+	while (b->lexprev)
+		b = b->lexprev;
+
+	for (; b; b = b->lexnext) {
+		for (struct itm_instr *u = b->first; u; u = u->next) {
+			if (u == except)
+				continue;
+
+			struct itm_expr *e;
+			it_t it = list_iterator(u->operands);
+			while (iterator_next(&it, (void **)&e))
+				if (e == &i->base)
+					return true;
+		}
+	}
+	return false;
+}
+
+// the cost of executing i unconditionally, -1 if it may trap or has effects
+static int x86_speccost(struct itm_instr *i)
+{
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	int cost;
+	if (i->id == ITM_ID(itm_div) || i->id == ITM_ID(itm_rem))
+		return -1;
+	else if (i->id == ITM_ID(itm_mul) || i->id == ITM_ID(itm_mulh))
+		cost = cs->imul;
+	else if (x86_isarith(i) || x86_isaddr(i) ||
+	         i->id == ITM_ID(itm_sext) || i->id == ITM_ID(itm_zext) ||
+	         i->id == ITM_ID(itm_trunc))
+		cost = cs->add;
+	else if (x86_iscmp(i))
+		cost = 2 * cs->add; // and a setcc
+	else if (i->id == ITM_ID(itm_select))
+		cost = cs->cmov ? cs->cmov : cs->add;
+	else
+		return -1;
+
+	struct itm_expr *l = list_head(i->operands);
+	if (hastc(i->base.type, TC_FLOATING) || hastc(l->type, TC_FLOATING))
+		return -1;
+	return cost;
+}
+
+// the block an arm jumps to, if it does nothing else
+static struct itm_block *x86_armjoin(struct itm_block *arm)
+{
+	if (list_length(arm->previous) != 1 || arm->last->id != ITM_ID(itm_jmp))
+		return NULL;
+	return list_head(arm->last->operands);
+}
+
+static int x86_armcost(struct itm_block *arm)
+{
+	int cost = 0;
+	for (struct itm_instr *i = arm->first; i != arm->last; i = i->next) {
+		int c = x86_speccost(i);
+		if (c < 0)
+			return -1;
+		cost += c;
+	}
+	return cost;
+}
+
+/*
+ * The operand of phi along the edge from pred; literals, which needn't have
+ * the type of the phi, get it, since the phi is replaced by them.
+ */
+static struct itm_expr *x86_phiop(struct itm_instr *phi, struct itm_block *pred)
+{
+	for (int k = 0; k < list_length(phi->operands); k += 2) {
+		if (get_list_item(phi->operands, k) != pred)
+			continue;
+
+		struct itm_expr *e = get_list_item(phi->operands, k + 1);
+		if (e->etype == ITME_LITERAL && e->type != phi->base.type &&
+		    !hastc(e->type, TC_FLOATING))
+			e = x86_tylit(phi->block, phi->base.type,
+				((struct itm_literal *)e)->value.i);
+		return e;
+	}
+	assert(false);
+	return NULL;
+}
+
+enum x86selkind {
+	SK_SAME,	// both edges agree
+	SK_SETCC,	// arithmetic on a setcc, for pairs of constants
+	SK_BOOL,	// a setcc anded or ored with another boolean
+	SK_CMOV,
+	SK_NONE
+};
+
+/*
+ * Decides how a phi which takes t along the true and f along the false edge
+ * is replaced, and adds what that costs to *cost.
+ */
+static enum x86selkind x86_selkind(struct ctype *ty, struct itm_expr *t,
+	struct itm_expr *f, int *cost)
+{
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	if (t == f || t->etype == ITME_UNDEF || f->etype == ITME_UNDEF)
+		return SK_SAME;
+	if (!hastc(ty, TC_INTEGRAL) && !hastc(ty, TC_POINTER))
+		return SK_NONE;
+
+	bool tlit = t->etype == ITME_LITERAL;
+	bool flit = f->etype == ITME_LITERAL;
+	int setcost = -1;
+	if (tlit && flit && (ty == &cbool || ty->size > 1)) {
+		uint64_t mask = x86_mask(ty->size * 8);
+		uint64_t tv = ((struct itm_literal *)t)->value.i & mask;
+		uint64_t fv = ((struct itm_literal *)f)->value.i & mask;
+		uint64_t d = (tv - fv) & mask;
+
+		// the setcc and its zero extension
+		setcost = (ty->size > 1 ? 2 : 1) * cs->add;
+		if (d == 1 || d == mask)
+			setcost += (d == 1 ? fv : tv) ? cs->add : 0;
+		else if (x86_log2(d) >= 0)
+			setcost += cs->shift + (fv ? cs->add : 0);
+		else
+			setcost += 2 * cs->add + (fv ? cs->add : 0);
+	} else if (ty == &cbool && (tlit || flit)) {
+		setcost = 2 * cs->add;
+	}
+
+	int cmovcost = -1;
+	if (cs->cmov && ty->size >= 2 && ty->size <= getcpu()->bits / 8)
+		cmovcost = cs->cmov + (tlit + flit) * cs->add;
+
+	if (cmovcost >= 0 && (setcost < 0 || cmovcost < setcost)) {
+		*cost += cmovcost;
+		return SK_CMOV;
+	}
+	if (setcost < 0)
+		return SK_NONE;
+
+	*cost += setcost;
+	return tlit && flit ? SK_SETCC : SK_BOOL;
+}
+
+// whether a phi of constants is computed from the negation of c
+static bool x86_negsetcc(struct ctype *ty, struct itm_expr *t,
+	struct itm_expr *f)
+{
+	uint64_t mask = x86_mask(ty->size * 8);
+	uint64_t tv = ((struct itm_literal *)t)->value.i;
+	uint64_t fv = ((struct itm_literal *)f)->value.i;
+	return ((tv - fv) & mask) == mask;
+}
+
+// whether c ? t : f for booleans is computed from the negation of c
+static bool x86_negbool(struct itm_expr *t, struct itm_expr *f)
+{
+	if (t->etype == ITME_LITERAL)
+		return itm_hasvalue(t, 0);
+	return itm_hasvalue(f, 1);
+}
+
+// the setcc of c, of the negation of c if neg
+static struct itm_expr *x86_setcc(struct itm_instr *before,
+	struct itm_expr *c, bool neg, struct itm_expr **cache)
+{
+	if (!cache[neg]) {
+		struct itm_expr *one = x86_tylit(before->block, &cbool, 1);
+		struct itm_expr *zero = x86_tylit(before->block, &cbool, 0);
+		cache[neg] = x86_ins(before, neg ?
+			itm_select(before->block, c, zero, one) :
+			itm_select(before->block, c, one, zero));
+	}
+	return cache[neg];
+}
+
+// computes the phi of constants t and f from a setcc, before before
+static struct itm_expr *x86_setccseq(struct itm_instr *before,
+	struct itm_expr *b, struct ctype *ty, uint64_t tv, uint64_t fv)
+{
+	struct itm_block *bl = before->block;
+	uint64_t mask = x86_mask(ty->size * 8);
+	uint64_t d = (tv - fv) & mask;
+	struct itm_expr *z = b;
+	if (ty->size > 1)
+		z = x86_ins(before, itm_zext(bl, b, ty));
+
+	// b is already negated if d is -1
+	int k = x86_log2(d);
+	if (d == mask) {
+		fv = tv;
+	} else if (k > 0) {
+		z = x86_ins(before, itm_shl(bl, z, x86_tylit(bl, ty, k)));
+	} else if (k < 0) {
+		z = x86_ins(before, itm_sub(bl, x86_tylit(bl, ty, 0), z));
+		z = x86_ins(before, itm_and(bl, z, x86_tylit(bl, ty, d)));
+	}
+
+	if (fv & mask)
+		z = x86_ins(before, itm_add(bl, z, x86_tylit(bl, ty, fv)));
+	return z;
+}
+
+static void x86_hoist(struct itm_block *arm, struct itm_instr *before)
+{
+	struct itm_instr *next;
+	for (struct itm_instr *i = arm->first; i != arm->last; i = next) {
+		next = i->next;
+		itm_inserti(i, before);
+	}
+}
+
+static void x86_delblock(struct itm_block *b)
+{
+	b->lexprev->lexnext = b->lexnext;
+	if (b->lexnext)
+		b->lexnext->lexprev = b->lexprev;
+	b->lexnext = NULL;
+	delete_itm_block(b);
+}
+
+static void x86_repblock(struct list *l, struct itm_block *from,
+	struct itm_block *to)
+{
+	for (int k = 0; k < list_length(l); ++k)
+		if (get_list_item(l, k) == from)
+			set_list_item(l, k, to);
+}
+
+// appends join, the single successor of b, to b
+static void x86_merge(struct itm_block *b, struct itm_block *join)
+{
+	itm_remi(b->last);
+	for (struct itm_instr *i = join->first; i; i = i->next)
+		i->block = b;
+	if (b->last)
+		b->last->next = join->first;
+	else
+		b->first = join->first;
+	join->first->previous = b->last;
+	b->last = join->last;
+	join->first = join->last = NULL;
+
+	struct itm_block *succ;
+	it_t it = list_iterator(join->next);
+	while (iterator_next(&it, (void **)&succ)) {
+		x86_repblock(succ->previous, join, b);
+		for (struct itm_instr *i = succ->first;
+		     i && i->id == ITM_ID(itm_phi); i = i->next)
+			x86_repblock(i->operands, join, b);
+	}
+
+	while (list_length(b->next))
+		list_pop_back(b->next);
+	it = list_iterator(join->next);
+	while (iterator_next(&it, (void **)&succ))
+		list_push_back(b->next, succ);
+
+	x86_delblock(join);
+}
+
+static bool x86_ifconvertb(struct itm_block *b)
+{
+	const struct x86costs *cs = &x86costs[getcpu()->offset];
+	struct itm_instr *split = b->last;
+	if (!split || split->id != ITM_ID(itm_split))
+		return false;
+
+	struct itm_expr *c = list_head(split->operands);
+	struct itm_block *tb = get_list_item(split->operands, 1);
+	struct itm_block *fb = list_last(split->operands);
+	struct itm_block *tj = x86_armjoin(tb);
+	struct itm_block *fj = x86_armjoin(fb);
+
+	// the arms, of which a triangle has one, and the edges into join
+	struct itm_block *join, *tedge = b, *fedge = b;
+	if (tb == fb || c->etype != ITME_INSTRUCTION) {
+		return false;
+	} else if (tj && tj == fj) {
+		join = tj;
+		tedge = tb;
+		fedge = fb;
+	} else if (tj == fb) {
+		join = fb;
+		tedge = tb;
+		fb = NULL;
+	} else if (fj == tb) {
+		join = tb;
+		fedge = fb;
+		tb = NULL;
+	} else {
+		return false;
+	}
+
+	if (join == b || list_length(join->previous) != 2)
+		return false;
+
+	// the comparison is moved past the arms, so that its flags survive
+	struct itm_instr *ci = (struct itm_instr *)c;
+	bool iscmp = x86_iscmp(ci);
+	if (iscmp && (ci->block != b || x86_hasuses(ci, split)))
+		return false;
+
+	int cost = 0;
+	int tcost = tb ? x86_armcost(tb) : 0;
+	int fcost = fb ? x86_armcost(fb) : 0;
+	if (tcost < 0 || fcost < 0)
+		return false;
+	cost += tcost + fcost;
+
+	for (struct itm_instr *p = join->first;
+	     p && p->id == ITM_ID(itm_phi); p = p->next) {
+		struct itm_expr *t = x86_phiop(p, tedge);
+		struct itm_expr *f = x86_phiop(p, fedge);
+		if (x86_selkind(p->base.type, t, f, &cost) == SK_NONE)
+			return false;
+	}
+
+	if (cost > cs->branch / 2)
+		return false;
+
+	if (tb)
+		x86_hoist(tb, split);
+	if (fb)
+		x86_hoist(fb, split);
+	if (iscmp)
+		itm_inserti(ci, split);
+
+	/*
+	 * All selects read the flags, so they come first, and the arithmetic
+	 * on their results afterwards.
+	 */
+	struct itm_instr *p, *next;
+	struct itm_expr *setcc[2] = { NULL, NULL };
+	struct list *sels = new_list(NULL, 0);
+	int dummy = 0;
+	for (p = join->first; p && p->id == ITM_ID(itm_phi); p = p->next) {
+		struct itm_expr *t = x86_phiop(p, tedge);
+		struct itm_expr *f = x86_phiop(p, fedge);
+		switch (x86_selkind(p->base.type, t, f, &dummy)) {
+		case SK_CMOV:
+			dict_push_back(sels, p,
+				x86_ins(split, itm_select(b, c, t, f)));
+			break;
+		case SK_SETCC:
+			x86_setcc(split, c, x86_negsetcc(p->base.type, t, f), setcc);
+			break;
+		case SK_BOOL:
+			x86_setcc(split, c, x86_negbool(t, f), setcc);
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (p = join->first; p && p->id == ITM_ID(itm_phi); p = next) {
+		next = p->next;
+		struct itm_expr *t = x86_phiop(p, tedge);
+		struct itm_expr *f = x86_phiop(p, fedge);
+		struct ctype *ty = p->base.type;
+		struct itm_expr *e = NULL;
+		bool neg;
+		switch (x86_selkind(ty, t, f, &dummy)) {
+		case SK_SAME:
+			e = t->etype == ITME_UNDEF ? f : t;
+			break;
+		case SK_CMOV:
+			dict_get(sels, p, (void **)&e);
+			break;
+		case SK_SETCC:
+			neg = x86_negsetcc(ty, t, f);
+			e = x86_setccseq(split, setcc[neg], ty,
+				((struct itm_literal *)t)->value.i,
+				((struct itm_literal *)f)->value.i);
+			break;
+		case SK_BOOL:
+			/*
+			 * c ? 1 : x is c | x and c ? x : 0 is c & x, and likewise
+			 * with the negation of c for the others
+			 */
+			neg = x86_negbool(t, f);
+			struct itm_expr *lit = t->etype == ITME_LITERAL ? t : f;
+			struct itm_expr *x = lit == t ? f : t;
+			e = x86_ins(split, itm_hasvalue(lit, 1) ?
+				itm_or(b, setcc[neg], x) : itm_and(b, setcc[neg], x));
+			break;
+		default:
+			assert(false);
+		}
+		itm_repli(p, e);
+	}
+	delete_list(sels, NULL);
+
+	// the arms are gone, and join becomes part of b
+	itm_jmp(b, join);
+	itm_remi(split);
+	if (tb)
+		x86_delblock(tb);
+	if (fb)
+		x86_delblock(fb);
+
+	while (list_length(join->previous))
+		list_pop_back(join->previous);
+	list_push_back(join->previous, b);
+	while (list_length(b->next))
+		list_pop_back(b->next);
+	list_push_back(b->next, join);
+	x86_merge(b, join);
+	return true;
+}
+
+static void x86_ifconvert(struct itm_block *b)
+{
+	if (option_optimize() < 1 || getcpu()->offset < cpui386.offset)
+		return;
+
+	// nested diamonds become convertible once the inner ones are
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (struct itm_block *bl = b; bl; bl = bl->lexnext)
+			while (x86_ifconvertb(bl))
+				changed = true;
+	}
+}
+
+// whether the result of i is only used as the condition of splits and selects
+static bool x86_flagsonly(struct itm_instr *i)
+{
+	struct itm_block *b = i->block;
+	while (b->lexprev)
+		b = b->lexprev;
+
+	for (; b; b = b->lexnext) {
+		for (struct itm_instr *u = b->first; u; u = u->next) {
+			if (u->id == ITM_ID(itm_split) || u->id == ITM_ID(itm_select)) {
+				struct itm_expr *e;
+				it_t it = list_iterator(u->operands);
+				iterator_next(&it, (void **)&e);
+				while (iterator_next(&it, (void **)&e))
+					if (e == &i->base)
+						return false;
+				continue;
+			}
+			if (list_contains(u->operands, &i->base))
+				return false;
+		}
+	}
+	return true;
+}
+
+// selects of booleans are setccs, see x86_emit_select()
+static bool x86_issetcc(struct itm_instr *i)
+{
+	struct itm_expr *t = get_list_item(i->operands, 1);
+	struct itm_expr *f = list_last(i->operands);
+	return i->base.type->size == 1 &&
+	       t->etype == ITME_LITERAL && f->etype == ITME_LITERAL &&
+	       ((itm_hasvalue(t, 1) && itm_hasvalue(f, 0)) ||
+	        (itm_hasvalue(t, 0) && itm_hasvalue(f, 1)));
+}
+
+// replaces the conditions of splits and selects which are a by b
+static void x86_replflags(struct itm_block *b, struct itm_expr *a,
+	struct itm_expr *e)
+{
+	while (b->lexprev)
+		b = b->lexprev;
+
+	for (; b; b = b->lexnext)
+		for (struct itm_instr *u = b->first; u; u = u->next)
+			if ((u->id == ITM_ID(itm_split) ||
+			     u->id == ITM_ID(itm_select)) &&
+			    list_head(u->operands) == a)
+				set_list_item(u->operands, 0, e);
+}
+
+/*
+ * Flags liveness
+ *
+ * The flags a comparison leaves behind are read by the splits and selects
+ * using it, and so they have to survive until there. Only instructions which
+ * are emitted as moves are known to leave them alone. A comparison is emitted
+ * again before users the flags don't reach, which is cheaper than keeping its
+ * result in a register and testing that.
+ */
+static bool x86_keepsflags(struct itm_instr *i)
+{
+	return i->id == ITM_ID(itm_mov) || i->id == ITM_ID(itm_select) ||
+	       i->id == ITM_ID(itm_load) || i->id == ITM_ID(itm_store) ||
+	       i->id == ITM_ID(itm_sext) || i->id == ITM_ID(itm_zext) ||
+	       i->id == ITM_ID(itm_trunc) || i->id == ITM_ID(itm_alloca);
+}
+
+// whether the flags set by c are still there at u
+static bool x86_flagsreach(struct itm_instr *c, struct itm_instr *u)
+{
+	if (c->block != u->block)
+		return false;
+
+	for (struct itm_instr *i = c->next; i != u; i = i->next)
+		if (!i || !x86_keepsflags(i))
+			return false;
+	return true;
+}
+
+static struct itm_instr *x86_recmp(struct itm_instr *c, struct itm_instr *before)
+{
+	static const struct {
+		instr_id_t id;
+		struct itm_instr *(*build)(struct itm_block *b,
+			struct itm_expr *l, struct itm_expr *r);
+	} cmps[] = {
+		{ ITM_ID(itm_cmpeq), &itm_cmpeq },
+		{ ITM_ID(itm_cmpneq), &itm_cmpneq },
+		{ ITM_ID(itm_cmpgt), &itm_cmpgt },
+		{ ITM_ID(itm_cmpgte), &itm_cmpgte },
+		{ ITM_ID(itm_cmplt), &itm_cmplt },
+		{ ITM_ID(itm_cmplte), &itm_cmplte }
+	};
+
+	for (int k = 0; k < sizeof(cmps) / sizeof(*cmps); ++k) {
+		if (cmps[k].id != c->id)
+			continue;
+		struct itm_instr *n = cmps[k].build(before->block,
+			list_head(c->operands), list_last(c->operands));
+		itm_inserti(n, before);
+		return n;
+	}
+
+	assert(false);
+	return NULL;
+}
+
+static void x86_keepflags(struct itm_block *b)
+{
+	// the comparisons emitted again, each with its latest copy
+	struct list *again = new_list(NULL, 0);
+	for (struct itm_block *bl = b; bl; bl = bl->lexnext) {
+		for (struct itm_instr *u = bl->first; u; u = u->next) {
+			if (u->id != ITM_ID(itm_split) && u->id != ITM_ID(itm_select))
+				continue;
+
+			struct itm_instr *c = list_head(u->operands);
+			if (c->base.etype != ITME_INSTRUCTION || !x86_iscmp(c) ||
+			    x86_flagsreach(c, u))
+				continue;
+
+			struct itm_instr *n = NULL;
+			int k = 0;
+			while (k < list_length(again) && get_list_item(again, k) != c)
+				k += 2;
+			if (k < list_length(again))
+				n = get_list_item(again, k + 1);
+
+			if (!n || !x86_flagsreach(n, u)) {
+				n = x86_recmp(c, u);
+				if (k < list_length(again))
+					set_list_item(again, k + 1, n);
+				else
+					dict_push_back(again, c, n);
+			}
+			set_list_item(u->operands, 0, n);
+		}
+	}
+
+	for (int k = 0; k < list_length(again); k += 2) {
+		struct itm_instr *c = get_list_item(again, k);
+		if (!x86_hasuses(c, NULL))
+			itm_remi(c);
+	}
+	delete_list(again, NULL);
+}
+
+// cmov takes its operands from registers or memory
+static void x86_restrictselect(struct itm_instr *i)
+{
+	if (i->id != ITM_ID(itm_select) || x86_issetcc(i))
+		return;
+
+	for (int k = 1; k < 3; ++k) {
+		struct itm_expr *e = get_list_item(i->operands, k);
+		if (e->etype != ITME_LITERAL)
+			continue;
+		struct itm_instr *mov = itm_mov(i->block, e);
+		itm_inserti(mov, i);
+		set_list_item(i->operands, k, mov);
+	}
+}
+
+static void x86_restrictcmp(struct itm_instr *i)
+{
+	regid_t reg;
+
+	if (!x86_iscmp(i))
+		return;
+
+	/*
+	 * ucomiss/ucomisd set the flags like an unsigned comparison would; lt and
+	 * lte have their operands swapped by x86_emit_fcmp() so that an unordered
+	 * result compares false. An unordered result sets the zero flag as well,
+	 * which x86_emit_fcmp() clears again for eq and neq.
+	 */
+	struct ctype *ty = ((struct itm_expr *)list_head(i->operands))->type;
+	bool isunsigned = hastc(ty, TC_UNSIGNED) || hastc(ty, TC_POINTER);
+	bool isfloat = hastc(ty, TC_FLOATING);
+
+	if (i->id == ITM_ID(itm_cmpeq))
+		reg = eflag.id;
+	else if (i->id == ITM_ID(itm_cmpneq))
+		reg = neflag.id;
+	else if (i->id == ITM_ID(itm_cmpgt))
+		reg = (isfloat || isunsigned) ? aflag.id : gflag.id;
+	else if (i->id == ITM_ID(itm_cmpgte))
+		reg = (isfloat || isunsigned) ? aeflag.id : geflag.id;
+	else if (i->id == ITM_ID(itm_cmplt))
+		reg = isfloat ? aflag.id : isunsigned ? bflag.id : lflag.id;
+	else
+		reg = isfloat ? aeflag.id : isunsigned ? beflag.id : leflag.id;
+
+	/*
+	 * Values that aren't only branched on or selected by are materialized
+	 * by a setcc right away, while the flags are still there. The splits
+	 * and selects keep reading the flags, see x86_keepflags().
+	 */
+	if (!x86_flagsonly(i)) {
+		struct itm_block *b = i->block;
+		struct itm_instr *set;
+		set = itm_select(b, &i->base, x86_lit(i, 1), x86_lit(i, 0));
+		itm_inserti(set, i->next);
+		itm_replocc(&i->base, &set->base, b);
+		x86_replflags(b, &set->base, &i->base);
+	}
+
+	struct location *actloc = new_loc_reg(i->base.type->size, reg);
+	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
+	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
+	itm_tag_expr(&i->base, loc);
+}
+
+static void x86_restrictret(struct itm_instr *i)
+{
+	if (i->id != ITM_ID(itm_ret))
+		return;
+
+	// the ret itself is of type void, the value decides the register
+	struct ctype *ty = ((struct itm_expr *)list_head(i->operands))->type;
+	regid_t reg;
+	if (hastc(ty, TC_POINTER) || hastc(ty, TC_INTEGRAL))
+		reg = rax.id;
+	else if (hastc(ty, TC_FLOATING))
+		reg = xmm0.id;
+	else
+		return;
+
+	struct itm_instr *mov = itm_mov(i->block, list_head(i->operands));
+	struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
+	struct location *actloc = new_loc_reg(ty->size, reg);
+	itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
+	itm_tag_expr(&mov->base, loc);
+	itm_inserti(mov, i);
+	set_list_item(i->operands, 0, mov);
+}
+
+/*
+ * SSE instructions can't take immediate operands, and neither can any of the
+ * conversions. Floating point literals are moved into a register first, which
+ * loads them from the constant pool.
+ */
+static void x86_restrictfp(struct itm_instr *i)
+{
+	if (!x86_sse2() && hastc(i->base.type, TC_FLOATING))
+		report(E_FATAL | E_OPTIONS, NULL,
+			"floating point code generation requires -msse2");
+
+	if (i->id == ITM_ID(itm_mov) || i->id == ITM_ID(itm_phi))
+		return;
+
+	struct itm_expr *e;
+	int k = 0;
+	it_t it = list_iterator(i->operands);
+	while (iterator_next(&it, (void **)&e)) {
+		if (e->etype != ITME_INSTRUCTION && e->etype != ITME_BLOCK &&
+		    (x86_isfloat(e) || x86_iscast(i))) {
+			struct itm_instr *mov = itm_mov(i->block, e);
+			itm_inserti(mov, i);
+			set_list_item(i->operands, k, mov);
+		}
+		++k;
+	}
+
+	if (i->id != ITM_ID(itm_itof))
+		return;
+
+	/*
+	 * cvtsi2ss/cvtsi2sd only convert signed 32 and 64-bit integers, so
+	 * smaller integers are sign extended and unsigned ones are zero extended
+	 * to 64 bits where that is possible, see x86_lowerconv() for the others.
+	 */
+	struct itm_expr *l = list_head(i->operands);
+	struct itm_instr *ext = NULL;
+	if (l->type->size < cint.size)
+		ext = hastc(l->type, TC_UNSIGNED) ?
+			itm_zext(i->block, l, &cint) : itm_sext(i->block, l, &cint);
+	else if (hastc(l->type, TC_UNSIGNED) && l->type->size == 4 &&
+	         getcpu()->offset >= cpux86_64.offset)
+		ext = itm_zext(i->block, l, &culonglong);
+
+	if (ext) {
+		itm_inserti(ext, i);
+		set_list_item(i->operands, 0, ext);
+	}
+}
+
+/*
+ * Allocas are given a slot in the frame, and are addressed relative to the
+ * frame pointer by loads, stores, getptrs and deepptrs. Any other use takes
+ * the address into a register by an itm_mov of its own, which the allocator
+ * may rematerialize.
+ */
+static void x86_restrictalloca(struct itm_instr *i)
+{
+	if (i->id == ITM_ID(itm_alloca)) {
+		struct location *actloc = new_loc_lmem(i->typeoperand->size,
+			framealloc(i->block, i->typeoperand->size));
+		struct itm_tag *loc = new_itm_tag(tt_loc, TO_USER_PTR);
+		itm_tag_set_user_ptr(loc, actloc, (void (*)(FILE *, void *))&loc_to_string);
+		itm_tag_expr(&i->base, loc);
+		return;
+	}
+
+	if (i->id == ITM_ID(itm_mov) || i->id == ITM_ID(itm_phi))
+		return;
+
+	struct itm_expr *e;
+	int k = 0;
+	it_t it = list_iterator(i->operands);
+	while (iterator_next(&it, (void **)&e)) {
+		bool isaddr = (i->id == ITM_ID(itm_load) && k == 0) ||
+		              (i->id == ITM_ID(itm_store) && k == 1) ||
+		              (x86_isaddr(i) && k == 0);
+		if (!isaddr && e->etype == ITME_INSTRUCTION &&
+		    ((struct itm_instr *)e)->id == ITM_ID(itm_alloca)) {
+			struct itm_instr *mov = itm_mov(i->block, e);
+			itm_inserti(mov, i);
+			set_list_item(i->operands, k, mov);
+		}
+		++k;
+	}
+}
+
+static void x86_restrict(struct itm_block *b)
+{
+	// these insert instructions of their own, which are restricted below
+	struct itm_instr *next;
+	for (struct itm_instr *i = b->first; i; i = next) {
+		next = i->next;
+		x86_restrictptr(i);
+		x86_lowerdiv(i);
+		x86_lowerconv(i);
+	}
+	// including the multiplications inserted above
+	for (struct itm_instr *i = b->first; i; i = next) {
+		next = i->next;
+		x86_lowermul(i);
+	}
+
+	struct itm_instr *i = b->first;
+	while (i) {
+		x86_restrictalloca(i);
+		x86_restrictfp(i);
+		x86_restrictshift(i);
+		x86_restrictdiv(i);
+		x86_restrictret(i);
+		x86_restrictarith(i);
+		x86_restrictselect(i);
+		x86_restrictcmp(i);
+		x86_restrictimm(i);
+		i = i->next;
+	}
+
+	if (b->lexnext)
+		x86_restrict(b->lexnext);
+}
+
+
+static void x86_emiti(FILE *f, struct itm_instr *i, struct list *bldict);
+
+/*
+ * x86_emit_block cleans up the mess left by getblocklbl
+ */
+static struct asmimm *x86_getblocklbl(struct itm_block *b, struct list *bldict)
+{
+	struct asmimm *lbl;
+
+	if (!dict_get(bldict, b, (void **)&lbl)) {
+		/*
+		 * Named after the function as well, to be unique in the unit.
+		 * The number comes first, so that no name makes it look like
+		 * the label of a constant.
+		 */
+		const char *fn = b->container->id;
+		lbl = malloc(sizeof(struct asmimm));
+		char *lblid = malloc(4 + sizeof(int) * 3 + strlen(fn));
+		sprintf(lblid, ".L%d_%s", list_length(bldict) / 2, fn);
+		new_asm_label(lbl, lblid);
+		free(lblid);
+		dict_push_back(bldict, b, lbl);
+	}
+
+	return lbl;
+}
+
+static void x86_emit_block(FILE *f, struct itm_block *b, struct list *bldict)
+{
+	struct asmimm *lbl = x86_getblocklbl(b, bldict);
+
+	if (option_optimize() >= 1 && x86_looptop(b)) {
+		const struct x86tune *t = &x86tunings[getcpu()->offset];
+		emit_p2align(f, t->p2, t->skip);
+	}
+	emit_label(f, lbl);
+
+
+	for (struct itm_instr *i = b->first; i; i = i->next)
+		x86_emiti(f, i, bldict);
+
+	if (b->lexnext)
+		x86_emit_block(f, b->lexnext, bldict);
+
+	delete_asm_imm(lbl);
+	free(lbl);
+	list_pop_back(bldict);
+	list_pop_back(bldict);
+}
+
+static struct asme *x86_getloce(struct x86opnd *o, struct location *loc,
+	int size);
+static struct asme *x86_getasme(struct x86opnd *o, struct itm_expr *e);
+
+static struct asme *x86_getmem(struct x86opnd *o, struct itm_expr *ptr,
+	int size);
+
+/*
+ * Instruction selection
+ *
+ * Every instruction is matched against the patterns in x86pats, by its
+ * operation, the type of its result and the classes of its first two operands.
+ * The cheapest matching pattern is chosen, and emitted by the function the
+ * pattern names. A load that immediately precedes its only user may be folded
+ * into it, if the pattern matched for the user takes a memory operand there.
+ * Getptrs and deepptrs whose users all take them as an address are folded
+ * into those addresses. Folded instructions aren't emitted themselves.
+ */
+enum x86opc {
+	OC_NONE = 0x1,		// no operand
+	OC_REG = 0x2,		// general purpose register
+	OC_XMM = 0x4,		// sse register
+	OC_FLAG = 0x8,		// condition flag
+	OC_SLOT = 0x10,		// value that lives in a frame slot
+	OC_MEM = 0x20,		// load that may be folded
+	OC_FRAME = 0x40,	// address of a frame slot
+	OC_IMM = 0x80,		// integer literal that fits in 32 bits
+	OC_IMM64 = 0x100,	// any other integer literal
+	OC_ZERO = 0x200,
+	OC_ONE = 0x400,
+	OC_FLIT = 0x800,	// floating point literal
+	OC_UNDEF = 0x1000,
+	OC_BLOCK = 0x2000,
+	OC_ADDR = 0x4000,	// address that is folded into its users
+	OC_SCALE = 0x8000,	// shift that may be folded into a lea
+	OC_ANY = 0xffff
+};
+
+enum x86pty {
+	PT_VOID = 0x1,
+	PT_INT = 0x2,
+	PT_FLOAT = 0x4,
+	PT_ANY = 0x7
+};
+
+struct x86pat {
+	instr_id_t id;
+	enum x86pty ty;
+	int l, r;
+	int cost;
+	const char *mnem;
+	// NULL for instructions that don't emit any code
+	void (*emit)(FILE *f, struct itm_instr *i, const struct x86pat *p,
+		struct list *bldict);
+};
+
+static const char *const patternstr = "pattern";
+static const tagtype_t tt_pattern = &patternstr;
+static const char *const foldedstr = "folded";
+static const tagtype_t tt_folded = &foldedstr;
+static const char *const usesstr = "uses";
+static const tagtype_t tt_uses = &usesstr;
+
+static bool x86_isfolded(struct itm_expr *e)
+{
+	return e->etype == ITME_INSTRUCTION && itm_get_tag(e, tt_folded);
+}
+
+static const struct x86pat *x86_getpat(struct itm_instr *i)
+{
+	struct itm_tag *tag = itm_get_tag(&i->base, tt_pattern);
+	assert(tag != NULL);
+	return itm_tag_get_user_ptr(tag);
+}
+
+static struct location *x86_getloc(struct itm_expr *e)
+{
+	struct itm_tag *tag = itm_get_tag(e, tt_loc);
+	return tag ? itm_tag_get_user_ptr(tag) : NULL;
+}
+
+static const struct asmreg *x86_getreg(regid_t rid, int size)
+{
+	const struct asmreg **av = regav[getcpu()->offset];
+	for (int i = 0; av[i]; ++i) {
+		const struct asmreg *reg = av[i];
+		// !reg->base.size is for flags, xmm registers hold any size
+		if (reg->id == rid && (reg->base.size == size ||
+		    !reg->base.size || reg->base.size == 16))
+			return reg;
+	}
+
+	assert(false);
+	return NULL;
+}
+
+// the frame pointer, which isn't part of regav since it's never allocated
+static const struct asmreg *x86_fp(void)
+{
+	switch (getcpu()->bits) {
+	case 16:
+		return &bp;
+	case 32:
+		return &ebp;
+	default:
+		return &rbp;
+	}
+}
+
+static const struct asmreg *x86_sp(void)
+{
+	switch (getcpu()->bits) {
+	case 16:
+		return &sp;
+	case 32:
+		return &esp;
+	default:
+		return &rsp;
+	}
+}
+
+/*
+ * Peephole optimization
+ *
+ * Cleans up the machine instructions of a function where the code emitted for
+ * one ir instruction meets that of the next: copies of a register to itself,
+ * spill slots reloaded right after being stored, jumps to jumps and code that
+ * can't be reached. Zeroing and incrementing registers are rewritten the way
+ * the cpu is tuned for, and stores to spill slots never read are dropped.
+ */
+
+static bool x86_sameasme(struct asme *a, struct asme *b)
+{
+	if (a->type != b->type || a->size != b->size)
+		return false;
+
+	if (a->type == &asme_imm) {
+		struct asmimm *ia = (struct asmimm *)a, *ib = (struct asmimm *)b;
+		if (ia->value != ib->value || ia->op != ib->op ||
+		    !ia->label != !ib->label || !ia->l != !ib->l ||
+		    !ia->r != !ib->r)
+			return false;
+		if (ia->label && strcmp(ia->label, ib->label))
+			return false;
+		return (!ia->l || x86_sameasme(&ia->l->base, &ib->l->base)) &&
+		       (!ia->r || x86_sameasme(&ia->r->base, &ib->r->base));
+	}
+
+	if (a->type == &asme_x86ea) {
+		struct x86ea *ea = (struct x86ea *)a, *eb = (struct x86ea *)b;
+		if (ea->basereg != eb->basereg || ea->offset != eb->offset ||
+		    ea->mult != eb->mult ||
+		    !ea->displacement != !eb->displacement)
+			return false;
+		return !ea->displacement || x86_sameasme(
+			&ea->displacement->base, &eb->displacement->base);
+	}
+
+	return a == b;
+}
+
+// an integer immediate, not a label
+static bool x86_isconst(struct asme *e, long value)
+{
+	if (e->type != &asme_imm)
+		return false;
+
+	struct asmimm *imm = (struct asmimm *)e;
+	return !imm->label && !imm->op && imm->value == value;
+}
+
+// the label an operand refers to, if any
+static const char *x86_opnlabel(struct asme *e)
+{
+	if (e->type == &asme_x86ea) {
+		struct asmimm *disp = ((struct x86ea *)e)->displacement;
+		return disp ? disp->label : NULL;
+	}
+
+	return e->type == &asme_imm ? ((struct asmimm *)e)->label : NULL;
+}
+
+// whether the address of operand e is computed from register r
+static bool x86_addrof(struct asme *e, struct asme *r)
+{
+	if (e->type != &asme_x86ea || r->type != &asme_reg)
+		return false;
+
+	regid_t id = ((struct asmreg *)r)->id;
+	struct x86ea *ea = (struct x86ea *)e;
+	return (ea->basereg && ea->basereg->id == id) ||
+	       (ea->offset && ea->offset->id == id);
+}
+
+static bool x86_isinstr(struct x86mi *mi, const char *mnem, int nops)
+{
+	return mi && mi->kind == MI_INSTR && mi->nops == nops &&
+	       !strcmp(mi->mnem, mnem);
+}
+
+static struct asme *x86_midst(struct x86mi *mi)
+{
+	return mi->ops[asmflavor() == AF_ATT ? mi->nops - 1 : 0];
+}
+
+static struct asme *x86_misrc(struct x86mi *mi)
+{
+	return mi->ops[asmflavor() == AF_ATT ? 0 : mi->nops - 1];
+}
+
+static void x86_setsrc(struct x86mi *mi, struct asme *e)
+{
+	int k = asmflavor() == AF_ATT ? 0 : mi->nops - 1;
+	x86_freeasme(mi->ops[k]);
+	mi->ops[k] = x86_copyasme(e);
+}
+
+// the condition code an instruction reads the flags for, if any
+static const char *x86_micc(struct x86mi *mi)
+{
+	if (mi->kind != MI_INSTR)
+		return NULL;
+	if (mi->mnem[0] == 'j' && strcmp(mi->mnem, "jmp"))
+		return mi->mnem + 1;
+	if (!strncmp(mi->mnem, "set", 3))
+		return mi->mnem + 3;
+	if (!strncmp(mi->mnem, "cmov", 4))
+		return mi->mnem + 4;
+	return NULL;
+}
+
+// a jump to a label, conditional or not
+static const char *x86_mitarget(struct x86mi *mi)
+{
+	if (mi->kind != MI_INSTR || mi->mnem[0] != 'j' || mi->nops != 1)
+		return NULL;
+	return x86_opnlabel(mi->ops[0]);
+}
+
+static bool x86_isterm(struct x86mi *mi)
+{
+	return x86_isinstr(mi, "jmp", 1) || x86_isinstr(mi, "ret", 0);
+}
+
+/*
+ * Tests whether the flags as they are before mi are read, or only their carry
+ * if carry is set. No value lives in the flags across blocks, so they're dead
+ * at labels and jumps.
+ */
+static bool x86_flagsread(struct x86mi *mi, bool carry)
+{
+	static const char *const setters[] = {
+		"add", "sub", "and", "or", "xor", "cmp", "test", "neg",
+		"comiss", "comisd", "ucomiss", "ucomisd"
+	};
+
+	for (; mi; mi = mi->next) {
+		if (mi->kind == MI_LABEL)
+			return false;
+		if (mi->kind != MI_INSTR)
+			continue;
+
+		const char *cc = x86_micc(mi);
+		if (cc)
+			return !carry || strpbrk(cc, "abc");
+		if (!strcmp(mi->mnem, "adc") || !strcmp(mi->mnem, "sbb"))
+			return true;
+		if (x86_isterm(mi) || !strcmp(mi->mnem, "call"))
+			return false;
+
+		for (int k = 0; k < sizeof(setters) / sizeof(*setters); ++k)
+			if (!strcmp(mi->mnem, setters[k]))
+				return false;
+		// inc and dec leave the carry alone
+		if (!carry && (!strcmp(mi->mnem, "inc") ||
+		    !strcmp(mi->mnem, "dec")))
+			return false;
+	}
+
+	return false;
+}
+
+/*
+ * Removes copies of a register to itself, and reloads of a value that's still
+ * in a register. Copies between 32 bit registers in 64 bit mode clear the upper
+ * half, so they stay.
+ */
+static bool x86_peepmov(struct x86mi *mi)
+{
+	static const char *const movs[] = {
+		"mov", "movaps", "movapd", "movss", "movsd"
+	};
+
+	bool zext = getcpu()->bits == 64;
+	for (int k = 0; k < sizeof(movs) / sizeof(*movs); ++k) {
+		if (!x86_isinstr(mi, movs[k], 2))
+			continue;
+
+		struct asme *d = x86_midst(mi), *s = x86_misrc(mi);
+		if (d->type == &asme_reg && d == s &&
+		    (k != 0 || !zext || d->size != 4)) {
+			x86_miremove(mi);
+			return true;
+		}
+	}
+
+	struct x86mi *p = mi->prev;
+	if (!x86_isinstr(mi, "mov", 2) || !x86_isinstr(p, "mov", 2))
+		return false;
+
+	struct asme *pd = x86_midst(p), *ps = x86_misrc(p);
+	struct asme *d = x86_midst(mi), *s = x86_misrc(mi);
+	zext &= d->size == 4;
+
+	// stored, then loaded again
+	if (pd->type == &asme_x86ea && ps->type == &asme_reg &&
+	    x86_sameasme(s, pd) && d->type == &asme_reg) {
+		if (d != ps) {
+			x86_setsrc(mi, ps);
+		} else if (!zext) {
+			x86_miremove(mi);
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	if (ps->type != &asme_x86ea || pd->type != &asme_reg ||
+	    x86_addrof(ps, pd))
+		return false;
+
+	// loaded, then stored back
+	if (x86_sameasme(d, ps) && s == pd) {
+		x86_miremove(mi);
+		return true;
+	}
+
+	// loaded twice
+	if (x86_sameasme(s, ps) && d->type == &asme_reg) {
+		if (d == pd)
+			x86_miremove(mi);
+		else
+			x86_setsrc(mi, pd);
+		return true;
+	}
+
+	return false;
+}
+
+// zeroes registers with xor, adds one with inc or the other way around
+static bool x86_peeparith(struct x86mi *mi)
+{
+	if (x86_isinstr(mi, "mov", 2) && x86_midst(mi)->type == &asme_reg &&
+	    x86_isconst(x86_misrc(mi), 0) && !x86_flagsread(mi->next, false)) {
+		strcpy(mi->mnem, "xor");
+		x86_setsrc(mi, x86_midst(mi));
+		return true;
+	}
+
+	bool incdec = x86tunings[getcpu()->offset].incdec;
+	if (incdec && (x86_isinstr(mi, "add", 2) || x86_isinstr(mi, "sub", 2))) {
+		struct asme *s = x86_misrc(mi);
+		bool add = mi->mnem[0] == 'a';
+		bool inc;
+		if (x86_isconst(s, 1))
+			inc = add;
+		else if (x86_isconst(s, -1))
+			inc = !add;
+		else
+			return false;
+
+		if (x86_flagsread(mi->next, true))
+			return false;
+
+		strcpy(mi->mnem, inc ? "inc" : "dec");
+		x86_freeasme(s);
+		mi->ops[0] = x86_midst(mi);
+		mi->nops = 1;
+		return true;
+	}
+
+	if (!incdec && (x86_isinstr(mi, "inc", 1) || x86_isinstr(mi, "dec", 1))) {
+		if (x86_flagsread(mi->next, true))
+			return false;
+
+		struct asmimm one;
+		new_asm_imm(&one, mi->ops[0]->size, 1);
+		strcpy(mi->mnem, mi->mnem[0] == 'i' ? "add" : "sub");
+		mi->ops[1] = mi->ops[0];
+		mi->ops[asmflavor() == AF_ATT ? 0 : 1] = x86_copyasme(&one.base);
+		mi->nops = 2;
+		delete_asm_imm(&one);
+		return true;
+	}
+
+	return false;
+}
+
+static struct x86mi *x86_milabel(const char *label)
+{
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next)
+		if (mi->kind == MI_LABEL &&
+		    !strcmp(((struct asmimm *)mi->ops[0])->label, label))
+			return mi;
+	return NULL;
+}
+
+// the instruction run after falling through to mi
+static struct x86mi *x86_minext(struct x86mi *mi)
+{
+	while (mi && mi->kind != MI_INSTR)
+		mi = mi->next;
+	return mi;
+}
+
+// whether label comes between mi and the next instruction
+static bool x86_fallsto(struct x86mi *mi, const char *label)
+{
+	for (mi = mi->next; mi && mi->kind != MI_INSTR; mi = mi->next)
+		if (mi->kind == MI_LABEL &&
+		    !strcmp(((struct asmimm *)mi->ops[0])->label, label))
+			return true;
+	return false;
+}
+
+static void x86_settarget(struct x86mi *mi, const char *label)
+{
+	struct asmimm *imm = (struct asmimm *)mi->ops[0];
+	char *copy = malloc(strlen(label) + 1);
+	strcpy(copy, label);
+	free(imm->label);
+	imm->label = copy;
+}
+
+static bool x86_invcc(struct x86mi *mi)
+{
+	static const char *const ccs[][2] = {
+		{ "e", "ne" }, { "g", "le" }, { "ge", "l" },
+		{ "a", "be" }, { "ae", "b" }
+	};
+
+	const char *cc = x86_micc(mi);
+	for (int k = 0; k < sizeof(ccs) / sizeof(*ccs); ++k) {
+		for (int j = 0; j < 2; ++j) {
+			if (strcmp(cc, ccs[k][j]))
+				continue;
+			sprintf(mi->mnem, "j%s", ccs[k][!j]);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Jumps to jumps go straight to where those lead, jumps to the next
+ * instruction go, and a conditional jump over a jump becomes the inverse
+ * jump to where that one leads.
+ */
+static bool x86_peepjmp(struct x86mi *mi)
+{
+	const char *target = x86_mitarget(mi);
+	if (!target)
+		return false;
+
+	// follow a few jumps, in case they go round in circles
+	const char *final = target;
+	int hops;
+	for (hops = 0; hops < 8; ++hops) {
+		struct x86mi *l = x86_milabel(final);
+		struct x86mi *n = l ? x86_minext(l) : NULL;
+		if (!n || !x86_isinstr(n, "jmp", 1) || !x86_mitarget(n))
+			break;
+		final = x86_mitarget(n);
+	}
+	if (hops < 8 && strcmp(final, target)) {
+		x86_settarget(mi, final);
+		return true;
+	}
+
+	if (x86_fallsto(mi, target)) {
+		if (strcmp(mi->mnem, "jmp"))
+			return false;
+		x86_miremove(mi);
+		return true;
+	}
+
+	struct x86mi *n = mi->next;
+	if (x86_micc(mi) && x86_isinstr(n, "jmp", 1) && x86_mitarget(n) &&
+	    x86_fallsto(n, target)) {
+		if (!x86_invcc(mi))
+			return false;
+
+		x86_settarget(mi, x86_mitarget(n));
+		x86_miremove(n);
+		return true;
+	}
+
+	return false;
+}
+
+static bool x86_labelused(const char *label)
+{
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next) {
+		if (mi->kind != MI_INSTR)
+			continue;
+		for (int k = 0; k < mi->nops; ++k) {
+			const char *l = x86_opnlabel(mi->ops[k]);
+			if (l && !strcmp(l, label))
+				return true;
+		}
+	}
+	return false;
+}
+
+// drops code that can't be reached, and labels nothing jumps to
+static bool x86_peepdead(struct x86mi *mi)
+{
+	if (x86_isterm(mi) && mi->next && mi->next->kind == MI_INSTR) {
+		x86_miremove(mi->next);
+		return true;
+	}
+
+	if (mi->kind != MI_LABEL || mi == x86_mifirst ||
+	    x86_labelused(((struct asmimm *)mi->ops[0])->label))
+		return false;
+
+	// the alignment was for the loop starting here
+	if (mi->prev->kind == MI_ALIGN)
+		x86_miremove(mi->prev);
+	x86_miremove(mi);
+	return true;
+}
+
+/*
+ * Removes stores to spill slots that are never read. Only slots addressed
+ * off the frame pointer by a constant are considered, and only as long as
+ * no address into the frame is taken.
+ */
+static void x86_deadstores(void)
+{
+	const struct asmreg *fp = x86_fp(), *sp = x86_sp();
+	struct x86mi *mi;
+
+	for (mi = x86_mifirst; mi; mi = mi->next) {
+		if (mi->kind != MI_INSTR)
+			continue;
+
+		for (int k = 0; k < mi->nops; ++k) {
+			struct asme *e = mi->ops[k];
+			if (e == &fp->base && strcmp(mi->mnem, "push") &&
+			    strcmp(mi->mnem, "pop") && (mi->nops != 2 ||
+			    (mi->ops[!k] != &sp->base)))
+				return;
+			if (e->type != &asme_x86ea)
+				continue;
+
+			struct x86ea *ea = (struct x86ea *)e;
+			if (ea->basereg == sp || ea->offset == fp ||
+			    ea->offset == sp)
+				return;
+			if (ea->basereg == fp && (!strcmp(mi->mnem, "lea") ||
+			    ea->offset || (ea->displacement &&
+			    x86_opnlabel(&ea->displacement->base))))
+				return;
+		}
+	}
+
+	for (mi = x86_mifirst; mi; ) {
+		struct x86mi *next = mi->next;
+		if (mi->kind != MI_INSTR || mi->nops != 2 ||
+		    (strcmp(mi->mnem, "mov") && strcmp(mi->mnem, "movss") &&
+		     strcmp(mi->mnem, "movsd")))
+			goto next;
+
+		struct asme *d = x86_midst(mi);
+		if (d->type != &asme_x86ea || ((struct x86ea *)d)->basereg != fp)
+			goto next;
+
+		struct x86ea *st = (struct x86ea *)d;
+		long lo = st->displacement ? st->displacement->value : 0;
+		long hi = lo + d->size;
+		bool read = false;
+		for (struct x86mi *r = x86_mifirst; r && !read; r = r->next) {
+			if (r->kind != MI_INSTR)
+				continue;
+			for (int k = 0; k < r->nops; ++k) {
+				struct x86ea *ea = (struct x86ea *)r->ops[k];
+				if (&ea->base == d || ea->base.type != &asme_x86ea ||
+				    ea->basereg != fp)
+					continue;
+				long l = ea->displacement ?
+					ea->displacement->value : 0;
+				if (l < hi && lo < l + ea->base.size)
+					read = true;
+			}
+		}
+
+		if (!read)
+			x86_miremove(mi);
+next:
+		mi = next;
+	}
+}
+
+static void x86_peephole(void)
+{
+	bool changed;
+	do {
+		changed = false;
+		for (struct x86mi *mi = x86_mifirst; mi; ) {
+			/*
+			 * The rules remove at most mi, its neighbours, and
+			 * look back one instruction, so going back two to
+			 * continue is safe and catches what they enabled.
+			 */
+			struct x86mi *back = mi->prev ? mi->prev->prev : NULL;
+			if (x86_peepmov(mi) || x86_peeparith(mi) ||
+			    x86_peepjmp(mi) || x86_peepdead(mi)) {
+				changed = true;
+				mi = back ? back : x86_mifirst;
+			} else {
+				mi = mi->next;
+			}
+		}
+	} while (changed);
+
+	x86_deadstores();
+}
+
+/*
+ * Instruction scheduling
+ *
+ * Reorders the instructions between labels, jumps and anything else that
+ * isn't understood, so that those waiting for a result are issued after
+ * independent work instead of stalling. A list scheduler issues, cycle by
+ * cycle, the ready instruction heading the longest chain of latencies.
+ * Registers are allocated by then, so the order of the accesses to each
+ * register, to the flags and to memory that may overlap is kept. That pays
+ * on in-order pipelines; out-of-order cores reorder the code themselves, and
+ * run it about as fast either way.
+ */
+
+enum x86latkind {
+	XL_ALU,
+	XL_IMUL,
+	XL_FADD,
+	XL_FMUL,
+	XL_FDIV
+};
+
+#define XS_RMW		1	// the destination is read as well
+#define XS_NODST	2	// the destination is only read
+#define XS_SETFL	4	// sets the flags
+#define XS_USEFL	8	// reads the flags
+#define XS_PREFIX	16	// followed by a condition code
+
+struct x86sched {
+	const char *mnem;
+	enum x86latkind lat;
+	int flags;
+};
+
+static const struct x86sched x86scheds[] = {
+	{ "mov", XL_ALU, 0 },
+	{ "movabs", XL_ALU, 0 },
+	{ "movzx", XL_ALU, 0 },
+	{ "movsx", XL_ALU, 0 },
+	{ "movsxd", XL_ALU, 0 },
+	// movzbl and the like
+	{ "movz", XL_ALU, 0 },
+	{ "movs", XL_ALU, 0 },
+	{ "movd", XL_ALU, 0 },
+	{ "movq", XL_ALU, 0 },
+	{ "movaps", XL_ALU, 0 },
+	{ "movapd", XL_ALU, 0 },
+	{ "movss", XL_ALU, XS_RMW },
+	{ "movsd", XL_ALU, XS_RMW },
+	{ "lea", XL_ALU, 0 },
+
+	{ "add", XL_ALU, XS_RMW | XS_SETFL },
+	{ "sub", XL_ALU, XS_RMW | XS_SETFL },
+	{ "and", XL_ALU, XS_RMW | XS_SETFL },
+	{ "or", XL_ALU, XS_RMW | XS_SETFL },
+	{ "xor", XL_ALU, XS_RMW | XS_SETFL },
+	{ "adc", XL_ALU, XS_RMW | XS_SETFL | XS_USEFL },
+	{ "sbb", XL_ALU, XS_RMW | XS_SETFL | XS_USEFL },
+	{ "neg", XL_ALU, XS_RMW | XS_SETFL },
+	{ "inc", XL_ALU, XS_RMW | XS_SETFL },
+	{ "dec", XL_ALU, XS_RMW | XS_SETFL },
+	{ "shl", XL_ALU, XS_RMW | XS_SETFL },
+	{ "shr", XL_ALU, XS_RMW | XS_SETFL },
+	{ "sar", XL_ALU, XS_RMW | XS_SETFL },
+	{ "sal", XL_ALU, XS_RMW | XS_SETFL },
+	{ "imul", XL_IMUL, XS_RMW | XS_SETFL },
+	{ "cmp", XL_ALU, XS_NODST | XS_SETFL },
+	{ "test", XL_ALU, XS_NODST | XS_SETFL },
+	{ "set", XL_ALU, XS_RMW | XS_USEFL | XS_PREFIX },
+	{ "cmov", XL_ALU, XS_RMW | XS_USEFL | XS_PREFIX },
+
+	{ "addss", XL_FADD, XS_RMW },
+	{ "addsd", XL_FADD, XS_RMW },
+	{ "subss", XL_FADD, XS_RMW },
+	{ "subsd", XL_FADD, XS_RMW },
+	{ "mulss", XL_FMUL, XS_RMW },
+	{ "mulsd", XL_FMUL, XS_RMW },
+	{ "divss", XL_FDIV, XS_RMW },
+	{ "divsd", XL_FDIV, XS_RMW },
+	{ "xorps", XL_ALU, XS_RMW },
+	{ "xorpd", XL_ALU, XS_RMW },
+	{ "cvtss2sd", XL_FADD, XS_RMW },
+	{ "cvtsd2ss", XL_FADD, XS_RMW },
+	{ "cvtsi2ss", XL_FADD, XS_RMW },
+	{ "cvtsi2sd", XL_FADD, XS_RMW },
+	{ "cvttss2si", XL_FADD, 0 },
+	{ "cvttsd2si", XL_FADD, 0 },
+	{ "ucomiss", XL_FADD, XS_NODST | XS_SETFL },
+	{ "ucomisd", XL_FADD, XS_NODST | XS_SETFL },
+	{ "comiss", XL_FADD, XS_NODST | XS_SETFL },
+	{ "comisd", XL_FADD, XS_NODST | XS_SETFL }
+};
+
+static const struct x86sched *x86_findsched(const char *mnem, size_t len)
+{
+	for (int k = 0; k < sizeof(x86scheds) / sizeof(*x86scheds); ++k) {
+		const struct x86sched *s = &x86scheds[k];
+		size_t n = strlen(s->mnem);
+		if (!strncmp(mnem, s->mnem, n) &&
+		    (n == len || (s->flags & XS_PREFIX)))
+			return s;
+	}
+	return NULL;
+}
+
+/*
+ * How an instruction is scheduled, or NULL if it isn't. At&t spells out the
+ * operand sizes of shifts, extensions and conversions from integers.
+ */
+static const struct x86sched *x86_schedinfo(struct x86mi *mi)
+{
+	if (mi->kind != MI_INSTR)
+		return NULL;
+
+	size_t len = strlen(mi->mnem);
+	const struct x86sched *s = x86_findsched(mi->mnem, len);
+	for (int k = 1; !s && asmflavor() == AF_ATT && k <= 2 && k < len; ++k)
+		if (strchr("bwlq", mi->mnem[len - k]))
+			s = x86_findsched(mi->mnem, len - k);
+	return s;
+}
+
+struct x86node {
+	struct x86mi *mi;
+	regid_t uses, defs;
+	bool rdfl, wrfl;
+	struct asme *mem;
+	bool rdmem, wrmem;
+	int lat, height, cycle;
+	bool done;
+};
+
+// the most instructions scheduled at once
+#define X86_SCHEDWIN 64
+
+/*
+ * Fills in what mi reads and writes, and how long it takes. Fails for
+ * instructions that aren't scheduled, like one operand imul using edx:eax.
+ */
+static bool x86_schednode(struct x86node *n, struct x86mi *mi,
+	const struct x86lat *lat)
+{
+	const struct x86sched *s = x86_schedinfo(mi);
+	if (!s || (s->lat == XL_IMUL && mi->nops == 1))
+		return false;
+
+	memset(n, 0, sizeof(struct x86node));
+	n->mi = mi;
+	n->rdfl = (s->flags & XS_USEFL) != 0;
+	n->wrfl = (s->flags & XS_SETFL) != 0;
+
+	int dk = asmflavor() == AF_ATT ? mi->nops - 1 : 0;
+	bool rmw = (s->flags & XS_RMW) && !(s->lat == XL_IMUL && mi->nops == 3);
+	bool nodst = (s->flags & XS_NODST) != 0;
+	// xor and sub of a register with itself don't depend on it
+	bool idiom = mi->nops == 2 && mi->ops[0] == mi->ops[1] &&
+		(!strcmp(s->mnem, "xor") || !strcmp(s->mnem, "sub") ||
+		 !strcmp(s->mnem, "xorps") || !strcmp(s->mnem, "xorpd"));
+
+	for (int k = 0; k < mi->nops; ++k) {
+		struct asme *e = mi->ops[k];
+		if (e->type == &asme_reg) {
+			regid_t id = ((struct asmreg *)e)->id;
+			// writing part of a register keeps the rest
+			if (!idiom && (k != dk || rmw || nodst || e->size < 4))
+				n->uses |= id;
+			if (k == dk && !nodst)
+				n->defs |= id;
+		} else if (e->type == &asme_x86ea) {
+			struct x86ea *ea = (struct x86ea *)e;
+			if (ea->basereg)
+				n->uses |= ea->basereg->id;
+			if (ea->offset)
+				n->uses |= ea->offset->id;
+			if (!strcmp(s->mnem, "lea"))
+				continue;
+			n->mem = e;
+			n->rdmem = k != dk || rmw || nodst;
+			n->wrmem = k == dk && !nodst;
+		}
+	}
+
+	switch (s->lat) {
+	case XL_ALU:
+		n->lat = lat->alu;
+		break;
+	case XL_IMUL:
+		n->lat = lat->imul;
+		break;
+	case XL_FADD:
+		n->lat = lat->fadd;
+		break;
+	case XL_FMUL:
+		n->lat = lat->fmul;
+		break;
+	case XL_FDIV:
+		n->lat = lat->fdiv;
+		break;
+	}
+	if (n->rdmem)
+		n->lat += lat->load;
+	return true;
+}
+
+/*
+ * Whether two memory operands may overlap. Only slots in the frame are told
+ * apart, the frame pointer doesn't change after the prologue.
+ */
+static bool x86_mayalias(struct asme *a, struct asme *b)
+{
+	struct x86ea *ea = (struct x86ea *)a, *eb = (struct x86ea *)b;
+	const struct asmreg *fp = x86_fp();
+	if (ea->basereg != fp || eb->basereg != fp || ea->offset ||
+	    eb->offset || !ea->displacement || !eb->displacement ||
+	    ea->displacement->label || eb->displacement->label)
+		return true;
+
+	long la = ea->displacement->value, lb = eb->displacement->value;
+	return la < lb + b->size && lb < la + a->size;
+}
+
+// the cycles b waits for a, which comes before it, or -1 if it doesn't
+static int x86_depend(struct x86node *a, struct x86node *b)
+{
+	bool alias = a->mem && b->mem && x86_mayalias(a->mem, b->mem);
+	if ((a->defs & b->uses) || (a->wrfl && b->rdfl) ||
+	    (alias && a->wrmem && b->rdmem))
+		return a->lat;
+
+	if ((a->uses & b->defs) || (a->defs & b->defs) ||
+	    (b->wrfl && (a->rdfl || a->wrfl)) ||
+	    (alias && b->wrmem && (a->rdmem || a->wrmem)))
+		return 0;
+	return -1;
+}
+
+static void x86_schedregion(struct x86node *ns, int n, int issue)
+{
+	int dep[X86_SCHEDWIN][X86_SCHEDWIN];
+	for (int i = 0; i < n; ++i)
+		for (int j = i + 1; j < n; ++j)
+			dep[i][j] = x86_depend(&ns[i], &ns[j]);
+
+	for (int i = n - 1; i >= 0; --i) {
+		ns[i].height = ns[i].lat;
+		for (int j = i + 1; j < n; ++j)
+			if (dep[i][j] >= 0 && dep[i][j] + ns[j].height >
+			    ns[i].height)
+				ns[i].height = dep[i][j] + ns[j].height;
+	}
+
+	struct x86mi *before = ns[0].mi->prev, *after = ns[n - 1].mi->next;
+	struct x86mi *prev = before;
+	int cycle = 0, issued = 0;
+	for (int left = n; left; ) {
+		int best = -1;
+		for (int j = 0; j < n && issued < issue; ++j) {
+			if (ns[j].done || (best >= 0 &&
+			    ns[j].height <= ns[best].height))
+				continue;
+
+			bool ready = true;
+			for (int i = 0; i < j && ready; ++i)
+				if (dep[i][j] >= 0)
+					ready = ns[i].done &&
+						ns[i].cycle + dep[i][j] <= cycle;
+			if (ready)
+				best = j;
+		}
+
+		if (best < 0) {
+			++cycle;
+			issued = 0;
+			continue;
+		}
+
+		ns[best].done = true;
+		ns[best].cycle = cycle;
+		++issued;
+		--left;
+
+		struct x86mi *mi = ns[best].mi;
+		mi->prev = prev;
+		if (prev)
+			prev->next = mi;
+		else
+			x86_mifirst = mi;
+		prev = mi;
+	}
+
+	prev->next = after;
+	if (after)
+		after->prev = prev;
+	else
+		x86_milast = prev;
+}
+
+static void x86_schedule(void)
+{
+	const struct x86lat *lat = &x86lats[getcpu()->offset];
+	if (!lat->issue)
+		return;
+
+	struct x86node ns[X86_SCHEDWIN];
+	for (struct x86mi *mi = x86_mifirst; mi; ) {
+		int n = 0;
+		while (mi && n < X86_SCHEDWIN && x86_schednode(&ns[n], mi, lat)) {
+			++n;
+			mi = mi->next;
+		}
+
+		if (n > 1)
+			x86_schedregion(ns, n, lat->issue);
+		else if (!n)
+			mi = mi->next;
+	}
+}
+
+/*
+ * Instruction encoding
+ *
+ * With '-c' the instructions are encoded here rather than written out for an
+ * assembler. x86_normalize() takes either flavor: it puts the operands in
+ * intel order, destination first, and drops the operand sizes at&t spells
+ * out in some mnemonics.
+ */
+
+// an encoded instruction, of which at most one field refers to a symbol
+struct x86code {
+	unsigned char b[16];
+	int len;
+	int relat;		// the offset of that field, or -1
+	enum objreloc rel;
+	const char *sym;
+	int64_t addend;
+	bool riprel;		// the field is relative to the next instruction
+	bool bad;		// the operands can't be encoded
+};
+
+struct x86op {
+	const char *mnem;
+	int code;
+};
+
+// the reg field of 80/81/83, and 8 times the opcode of the register forms
+static const struct x86op x86alus[] = {
+	{ "add", 0 }, { "or", 1 }, { "adc", 2 }, { "sbb", 3 },
+	{ "and", 4 }, { "sub", 5 }, { "xor", 6 }, { "cmp", 7 }
+};
+
+// the reg field of f6/f7
+static const struct x86op x86unaries[] = {
+	{ "not", 2 }, { "neg", 3 }, { "mul", 4 }, { "imul", 5 },
+	{ "div", 6 }, { "idiv", 7 }
+};
+
+// the reg field of c0/c1/d0-d3
+static const struct x86op x86shifts[] = {
+	{ "rol", 0 }, { "ror", 1 }, { "shl", 4 }, { "sal", 4 },
+	{ "shr", 5 }, { "sar", 7 }
+};
+
+static int x86_findop(const struct x86op *ops, size_t n, const char *mnem)
+{
+	for (int k = 0; k < n; ++k)
+		if (!strcmp(ops[k].mnem, mnem))
+			return ops[k].code;
+	return -1;
+}
+
+#define X86_FINDOP(ops, mnem) \
+	x86_findop(ops, sizeof(ops) / sizeof(*ops), mnem)
+
+struct x86sse {
+	const char *mnem;
+	int pfx;
+	unsigned op, store;	// store is the form writing to memory, if any
+};
+
+static const struct x86sse x86sses[] = {
+	{ "movss", 0xF3, 0x0F10, 0x0F11 },
+	{ "movsd", 0xF2, 0x0F10, 0x0F11 },
+	{ "movaps", 0, 0x0F28, 0x0F29 },
+	{ "movapd", 0x66, 0x0F28, 0x0F29 },
+	{ "addss", 0xF3, 0x0F58, 0 },
+	{ "addsd", 0xF2, 0x0F58, 0 },
+	{ "subss", 0xF3, 0x0F5C, 0 },
+	{ "subsd", 0xF2, 0x0F5C, 0 },
+	{ "mulss", 0xF3, 0x0F59, 0 },
+	{ "mulsd", 0xF2, 0x0F59, 0 },
+	{ "divss", 0xF3, 0x0F5E, 0 },
+	{ "divsd", 0xF2, 0x0F5E, 0 },
+	{ "sqrtss", 0xF3, 0x0F51, 0 },
+	{ "sqrtsd", 0xF2, 0x0F51, 0 },
+	{ "andps", 0, 0x0F54, 0 },
+	{ "andpd", 0x66, 0x0F54, 0 },
+	{ "xorps", 0, 0x0F57, 0 },
+	{ "xorpd", 0x66, 0x0F57, 0 },
+	{ "ucomiss", 0, 0x0F2E, 0 },
+	{ "ucomisd", 0x66, 0x0F2E, 0 },
+	{ "comiss", 0, 0x0F2F, 0 },
+	{ "comisd", 0x66, 0x0F2F, 0 },
+	{ "cvtss2sd", 0xF3, 0x0F5A, 0 },
+	{ "cvtsd2ss", 0xF2, 0x0F5A, 0 },
+	{ "cvtsi2ss", 0xF3, 0x0F2A, 0 },
+	{ "cvtsi2sd", 0xF2, 0x0F2A, 0 },
+	{ "cvttss2si", 0xF3, 0x0F2C, 0 },
+	{ "cvttsd2si", 0xF2, 0x0F2C, 0 }
+};
+
+static const char *const x86ccs[] = {
+	"o", "no", "b", "ae", "e", "ne", "be", "a",
+	"s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+// the condition code of jcc, setcc and cmovcc, or -1
+static int x86_ccnum(const char *cc)
+{
+	for (int k = 0; k < sizeof(x86ccs) / sizeof(*x86ccs); ++k)
+		if (!strcmp(x86ccs[k], cc))
+			return k;
+	return -1;
+}
+
+static void x86_normalize(struct x86mi *mi, char *mnem, struct asme **ops)
+{
+	static const char *const renames[][2] = {
+		{ "cwtd", "cwd" }, { "cltd", "cdq" }, { "cqto", "cqo" },
+		{ "flds", "fld" }, { "fldl", "fld" }, { "movslq", "movsxd" }
+	};
+
+	bool att = asmflavor() == AF_ATT;
+	for (int k = 0; k < mi->nops; ++k)
+		ops[k] = mi->ops[att ? mi->nops - 1 - k : k];
+	strcpy(mnem, mi->mnem);
+	if (!att)
+		return;
+
+	for (int k = 0; k < sizeof(renames) / sizeof(*renames); ++k) {
+		if (!strcmp(mnem, renames[k][0])) {
+			strcpy(mnem, renames[k][1]);
+			return;
+		}
+	}
+
+	size_t len = strlen(mnem);
+	if (len == 6 && (!strncmp(mnem, "movz", 4) ||
+	    !strncmp(mnem, "movs", 4)) &&
+	    strchr("bwlq", mnem[4]) && strchr("bwlq", mnem[5])) {
+		strcpy(mnem + 4, "x");
+		return;
+	}
+
+	// shifts and conversions from integers
+	if (len > 1 && strchr("bwlq", mnem[len - 1])) {
+		char stem[sizeof(mi->mnem)];
+		strcpy(stem, mnem);
+		stem[len - 1] = '\0';
+		if (X86_FINDOP(x86shifts, stem) >= 0 ||
+		    !strcmp(stem, "cvtsi2ss") || !strcmp(stem, "cvtsi2sd"))
+			strcpy(mnem, stem);
+	}
+}
+
+static bool x86_isxmm(struct asme *e)
+{
+	return e->type == &asme_reg && e->size == 16;
+}
+
+static bool x86_fits8(struct asme *e)
+{
+	struct asmimm *imm = (struct asmimm *)e;
+	return !imm->label && imm->value >= -128 && imm->value <= 127;
+}
+
+static int x86_regnum(const struct asmreg *r)
+{
+	static const char *const words[] = {
+		"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"
+	};
+
+	const char *n = r->name;
+	if (!strncmp(n, "xmm", 3))
+		return atoi(n + 3);
+	if (n[0] == 'r' && isdigit(n[1]))
+		return atoi(n + 1);
+	if (strlen(n) == 2 && (n[1] == 'l' || n[1] == 'h'))
+		return strchr("acdb", n[0]) - "acdb" + (n[1] == 'h' ? 4 : 0);
+	if (n[0] == 'e' || n[0] == 'r')
+		++n;
+	for (int k = 0; k < sizeof(words) / sizeof(*words); ++k)
+		if (!strncmp(n, words[k], 2))
+			return k;
+
+	assert(false);
+	return -1;
+}
+
+// al, ax, eax and rax, which have shorter forms with immediates
+static bool x86_isacc(struct asme *e)
+{
+	return e->type == &asme_reg && e->size <= 8 &&
+	       !x86_regnum((struct asmreg *)e);
+}
+
+// spl, bpl, sil and dil need rex, ah, bh, ch and dh can't have it
+static void x86_byterex(const struct asmreg *r, bool *need, bool *deny)
+{
+	if (r->base.size != 1)
+		return;
+	if (r == &spl || r == &bpl || r == &sil || r == &dil)
+		*need = true;
+	if (r == &ah || r == &bh || r == &ch || r == &dh)
+		*deny = true;
+}
+
+static void x86_byte(struct x86code *c, int b)
+{
+	assert(c->len < sizeof(c->b));
+	c->b[c->len++] = b;
+}
+
+static void x86_int(struct x86code *c, uint64_t value, int size)
+{
+	for (int k = 0; k < size; ++k)
+		x86_byte(c, value >> (8 * k));
+}
+
+static void x86_symfield(struct x86code *c, enum objreloc rel,
+	const char *sym, int64_t addend)
+{
+	if (c->relat >= 0)
+		c->bad = true;
+	c->relat = c->len;
+	c->rel = rel;
+	c->sym = sym;
+	c->addend = addend;
+}
+
+static void x86_prefixes(struct x86code *c, int size, int pfx, int rex,
+	bool needrex, bool denyrex)
+{
+	if (size == 2)
+		x86_byte(c, 0x66);
+	if (pfx)
+		x86_byte(c, pfx);
+	if (size == 8)
+		rex |= 8;
+	if (rex || needrex) {
+		c->bad |= denyrex;
+		x86_byte(c, 0x40 | rex);
+	}
+}
+
+static void x86_opcode(struct x86code *c, unsigned op)
+{
+	if (op > 0xFFFF)
+		x86_byte(c, op >> 16);
+	if (op > 0xFF)
+		x86_byte(c, op >> 8);
+	x86_byte(c, op);
+}
+
+/*
+ * Encodes an instruction with a modrm byte: the operand size prefix for size
+ * 2 or rex.w for size 8, mandatory prefix pfx if any, the opcode and then
+ * register reg, or digit if it's NULL, and register or memory operand rm.
+ */
+static void x86_modrm(struct x86code *c, int size, int pfx, unsigned op,
+	struct asme *reg, int digit, struct asme *rm)
+{
+	int rex = 0;
+	bool needrex = false, denyrex = false;
+
+	int r = digit;
+	if (reg) {
+		r = x86_regnum((struct asmreg *)reg);
+		x86_byterex((struct asmreg *)reg, &needrex, &denyrex);
+	}
+	if (r >= 8)
+		rex |= 4;
+
+	if (rm->type == &asme_reg) {
+		int m = x86_regnum((struct asmreg *)rm);
+		x86_byterex((struct asmreg *)rm, &needrex, &denyrex);
+		if (m >= 8)
+			rex |= 1;
+		x86_prefixes(c, size, pfx, rex, needrex, denyrex);
+		x86_opcode(c, op);
+		x86_byte(c, 0xC0 | (r & 7) << 3 | (m & 7));
+		return;
+	}
+
+	assert(rm->type == &asme_x86ea);
+	struct x86ea *ea = (struct x86ea *)rm;
+	struct asmimm *disp = ea->displacement;
+	assert(!disp || !disp->op);
+	const char *sym = disp ? disp->label : NULL;
+	long dv = disp && !sym ? disp->value : 0;
+	bool is64 = getcpu()->bits == 64;
+
+	if (ea->basereg == &rip) {
+		x86_prefixes(c, size, pfx, rex, needrex, denyrex);
+		x86_opcode(c, op);
+		x86_byte(c, (r & 7) << 3 | 5);
+		if (sym) {
+			x86_symfield(c, OR_PC32, sym, dv);
+			c->riprel = true;
+		}
+		x86_int(c, sym ? 0 : dv, 4);
+		return;
+	}
+
+	int b = ea->basereg ? x86_regnum(ea->basereg) : -1;
+	int x = ea->offset ? x86_regnum(ea->offset) : -1;
+	if (b >= 8)
+		rex |= 1;
+	if (x >= 8)
+		rex |= 2;
+	assert(x != 4);
+
+	// 32-bit addresses on x86_64
+	if (is64 && ((ea->basereg && ea->basereg->base.size == 4) ||
+	    (ea->offset && ea->offset->base.size == 4)))
+		x86_byte(c, 0x67);
+	x86_prefixes(c, size, pfx, rex, needrex, denyrex);
+	x86_opcode(c, op);
+
+	int mod = 2;
+	if (b >= 0 && !sym && !dv && (b & 7) != 5)
+		mod = 0;
+	else if (b >= 0 && !sym && dv >= -128 && dv <= 127)
+		mod = 1;
+	else if (b < 0)
+		mod = 0;
+
+	// without base, rm 5 is rip relative on x86_64
+	if (x < 0 && (b < 0 ? !is64 : (b & 7) != 4)) {
+		x86_byte(c, mod << 6 | (r & 7) << 3 | (b < 0 ? 5 : b & 7));
+	} else {
+		int scale = 0;
+		while (ea->mult > 1 << scale)
+			++scale;
+		x86_byte(c, mod << 6 | (r & 7) << 3 | 4);
+		x86_byte(c, scale << 6 | (x < 0 ? 4 : x & 7) << 3 |
+			(b < 0 ? 5 : b & 7));
+	}
+
+	if (mod == 1) {
+		x86_int(c, dv, 1);
+	} else if (mod == 2 || b < 0) {
+		if (sym)
+			x86_symfield(c, is64 ? OR_ABS32S : OR_ABS32, sym, dv);
+		x86_int(c, sym ? 0 : dv, 4);
+	}
+}
+
+// an opcode with the register in its low bits
+static void x86_opreg(struct x86code *c, int size, int op, struct asme *e)
+{
+	const struct asmreg *r = (const struct asmreg *)e;
+	int n = x86_regnum(r);
+	bool needrex = false, denyrex = false;
+	x86_byterex(r, &needrex, &denyrex);
+	x86_prefixes(c, size, 0, n >= 8, needrex, denyrex);
+	x86_byte(c, op + (n & 7));
+}
+
+// an immediate of the given size, for an instruction of size opsize
+static void x86_imm(struct x86code *c, struct asme *e, int size, int opsize)
+{
+	struct asmimm *imm = (struct asmimm *)e;
+	assert(!imm->op);
+	if (imm->label) {
+		enum objreloc rel = size == 8 ? OR_ABS64 :
+			opsize == 8 ? OR_ABS32S : OR_ABS32;
+		x86_symfield(c, rel, imm->label, 0);
+	}
+	x86_int(c, imm->label ? 0 : imm->value, size);
+}
 
-	delete_asm_imm(lbl);
-	free(lbl);
-	list_pop_back(bldict);
-	list_pop_back(bldict);
+// a jump or call to a label, outside the function if target is NULL
+static const char *x86_jumplabel(struct x86mi *mi)
+{
+	if (mi->kind != MI_INSTR || mi->nops != 1 ||
+	    mi->ops[0]->type != &asme_imm ||
+	    (mi->mnem[0] != 'j' && strcmp(mi->mnem, "call")))
+		return NULL;
+	return ((struct asmimm *)mi->ops[0])->label;
+}
+
+// the length of a jump to a label
+static int x86_jumplen(struct x86mi *mi)
+{
+	if (mi->target && !mi->far)
+		return 2;
+	return mi->mnem[0] == 'j' && strcmp(mi->mnem, "jmp") ? 6 : 5;
+}
+
+static void x86_encjump(struct x86mi *mi, struct x86code *c, size_t addr)
+{
+	memset(c, 0, sizeof(struct x86code));
+	c->relat = -1;
+
+	bool call = !strcmp(mi->mnem, "call");
+	int cc = call || !strcmp(mi->mnem, "jmp") ? -1 : x86_ccnum(mi->mnem + 1);
+	assert(call || !strcmp(mi->mnem, "jmp") || cc >= 0);
+
+	if (mi->target && !mi->far) {
+		x86_byte(c, cc < 0 ? 0xEB : 0x70 + cc);
+		x86_int(c, mi->target->addr - (addr + 2), 1);
+		return;
+	}
+
+	if (call)
+		x86_byte(c, 0xE8);
+	else if (cc < 0)
+		x86_byte(c, 0xE9);
+	else
+		x86_opcode(c, 0x0F80 + cc);
+
+	if (mi->target) {
+		x86_int(c, mi->target->addr - (addr + c->len + 4), 4);
+	} else {
+		x86_symfield(c, call ? OR_PLT32 : OR_PC32,
+			((struct asmimm *)mi->ops[0])->label, -4);
+		x86_int(c, 0, 4);
+	}
+}
+
+static void x86_encsse(struct x86code *c, const struct x86sse *sse,
+	const char *mnem, struct asme *d, struct asme *s)
+{
+	if (d->type == &asme_x86ea && sse->store) {
+		x86_modrm(c, 0, sse->pfx, sse->store, s, 0, d);
+		return;
+	}
+
+	// conversions from and to integers take rex.w from the integer
+	int w = 0;
+	if (!strncmp(mnem, "cvtsi2", 6))
+		w = s->size;
+	else if (!strncmp(mnem, "cvtt", 4))
+		w = d->size;
+	x86_modrm(c, w == 8 ? 8 : 0, sse->pfx, sse->op, d, 0, s);
+}
+
+static void x86_encmovdq(struct x86code *c, bool q,
+	struct asme *d, struct asme *s)
+{
+	if (x86_isxmm(d) && (x86_isxmm(s) || (q && s->type == &asme_x86ea)))
+		x86_modrm(c, 0, 0xF3, 0x0F7E, d, 0, s);
+	else if (x86_isxmm(d))
+		x86_modrm(c, q ? 8 : 0, 0x66, 0x0F6E, d, 0, s);
+	else if (q && d->type == &asme_x86ea)
+		x86_modrm(c, 0, 0x66, 0x0FD6, s, 0, d);
+	else
+		x86_modrm(c, q ? 8 : 0, 0x66, 0x0F7E, s, 0, d);
+}
+
+/*
+ * Encodes an instruction other than a jump or call to a label. Returns false
+ * if it isn't known, or can't have the operands it has.
+ */
+static bool x86_encode(struct x86mi *mi, struct x86code *c)
+{
+	char mnem[sizeof(mi->mnem)];
+	struct asme *ops[3];
+	x86_normalize(mi, mnem, ops);
+
+	memset(c, 0, sizeof(struct x86code));
+	c->relat = -1;
+
+	int n = mi->nops;
+	struct asme *d = n > 0 ? ops[0] : NULL;
+	struct asme *s = n > 1 ? ops[1] : NULL;
+	int size = d ? d->size : 0;
+	int isize = size > 4 ? 4 : size;
+	bool byte = size == 1;
+	int k;
+
+	for (k = 0; k < sizeof(x86sses) / sizeof(*x86sses); ++k)
+		if (!strcmp(x86sses[k].mnem, mnem) && n == 2)
+			break;
+
+	if (k < sizeof(x86sses) / sizeof(*x86sses)) {
+		x86_encsse(c, &x86sses[k], mnem, d, s);
+	} else if (!strcmp(mnem, "movd") || !strcmp(mnem, "movq")) {
+		x86_encmovdq(c, mnem[3] == 'q', d, s);
+	} else if ((k = X86_FINDOP(x86alus, mnem)) >= 0 && n == 2) {
+		if (x86_isacc(d) && s->type == &asme_imm &&
+		    (byte || !x86_fits8(s))) {
+			x86_prefixes(c, size, 0, 0, false, false);
+			x86_byte(c, k * 8 + 4 + !byte);
+			x86_imm(c, s, isize, size);
+		} else if (s->type == &asme_imm) {
+			int op = byte ? 0x80 : x86_fits8(s) ? 0x83 : 0x81;
+			x86_modrm(c, size, 0, op, NULL, k, d);
+			x86_imm(c, s, op == 0x81 ? isize : 1, size);
+		} else if (s->type == &asme_reg) {
+			x86_modrm(c, size, 0, k * 8 + !byte, s, 0, d);
+		} else {
+			x86_modrm(c, size, 0, k * 8 + 2 + !byte, d, 0, s);
+		}
+	} else if ((!strcmp(mnem, "mov") || !strcmp(mnem, "movabs")) &&
+	           n == 2) {
+		struct asmimm *imm = (struct asmimm *)s;
+		if (s->type == &asme_imm && d->type == &asme_reg &&
+		    (size != 8 || imm->label || imm->value != (int32_t)imm->value)) {
+			x86_opreg(c, size, byte ? 0xB0 : 0xB8, d);
+			x86_imm(c, s, size, size);
+		} else if (s->type == &asme_imm) {
+			x86_modrm(c, size, 0, byte ? 0xC6 : 0xC7, NULL, 0, d);
+			x86_imm(c, s, isize, size);
+		} else if (s->type == &asme_reg) {
+			x86_modrm(c, size, 0, byte ? 0x88 : 0x89, s, 0, d);
+		} else {
+			x86_modrm(c, size, 0, byte ? 0x8A : 0x8B, d, 0, s);
+		}
+	} else if ((!strcmp(mnem, "test") || !strcmp(mnem, "xchg")) &&
+	           n == 2) {
+		int op = mnem[0] == 't' ? 0x84 : 0x86;
+		if (x86_isacc(d) && s->type == &asme_imm && op == 0x84) {
+			x86_prefixes(c, size, 0, 0, false, false);
+			x86_byte(c, byte ? 0xA8 : 0xA9);
+			x86_imm(c, s, isize, size);
+		} else if (s->type == &asme_imm && op == 0x84) {
+			x86_modrm(c, size, 0, byte ? 0xF6 : 0xF7, NULL, 0, d);
+			x86_imm(c, s, isize, size);
+		} else if (s->type == &asme_reg) {
+			x86_modrm(c, size, 0, op + !byte, s, 0, d);
+		} else {
+			x86_modrm(c, size, 0, op + !byte, d, 0, s);
+		}
+	} else if (!strcmp(mnem, "lea") && n == 2) {
+		x86_modrm(c, size, 0, 0x8D, d, 0, s);
+	} else if ((!strcmp(mnem, "inc") || !strcmp(mnem, "dec")) && n == 1) {
+		// 40+r and 48+r are rex on x86_64
+		if (getcpu()->bits != 64 && d->type == &asme_reg && !byte)
+			x86_opreg(c, size, mnem[0] == 'd' ? 0x48 : 0x40, d);
+		else
+			x86_modrm(c, size, 0, byte ? 0xFE : 0xFF, NULL,
+				mnem[0] == 'd', d);
+	} else if ((k = X86_FINDOP(x86unaries, mnem)) >= 0 && n == 1) {
+		x86_modrm(c, size, 0, byte ? 0xF6 : 0xF7, NULL, k, d);
+	} else if (!strcmp(mnem, "imul") && n == 2 && s->type != &asme_imm) {
+		x86_modrm(c, size, 0, 0x0FAF, d, 0, s);
+	} else if (!strcmp(mnem, "imul") && n >= 2) {
+		struct asme *imm = ops[n - 1];
+		bool short8 = x86_fits8(imm);
+		x86_modrm(c, size, 0, short8 ? 0x6B : 0x69, d, 0,
+			n == 3 ? s : d);
+		x86_imm(c, imm, short8 ? 1 : isize, size);
+	} else if ((k = X86_FINDOP(x86shifts, mnem)) >= 0 && n == 2) {
+		if (s->type == &asme_reg) {
+			x86_modrm(c, size, 0, byte ? 0xD2 : 0xD3, NULL, k, d);
+		} else if (((struct asmimm *)s)->value == 1) {
+			x86_modrm(c, size, 0, byte ? 0xD0 : 0xD1, NULL, k, d);
+		} else {
+			x86_modrm(c, size, 0, byte ? 0xC0 : 0xC1, NULL, k, d);
+			x86_imm(c, s, 1, size);
+		}
+	} else if (!strncmp(mnem, "set", 3) && x86_ccnum(mnem + 3) >= 0 &&
+	           n == 1) {
+		x86_modrm(c, 0, 0, 0x0F90 + x86_ccnum(mnem + 3), NULL, 0, d);
+	} else if (!strncmp(mnem, "cmov", 4) && x86_ccnum(mnem + 4) >= 0 &&
+	           n == 2) {
+		x86_modrm(c, size, 0, 0x0F40 + x86_ccnum(mnem + 4), d, 0, s);
+	} else if ((!strcmp(mnem, "movzx") || !strcmp(mnem, "movsx")) &&
+	           n == 2) {
+		int op = mnem[3] == 'z' ? 0x0FB6 : 0x0FBE;
+		x86_modrm(c, size, 0, op + (s->size == 2), d, 0, s);
+	} else if (!strcmp(mnem, "movsxd") && n == 2) {
+		x86_modrm(c, size, 0, 0x63, d, 0, s);
+	} else if ((!strcmp(mnem, "push") || !strcmp(mnem, "pop")) && n == 1) {
+		bool push = mnem[1] == 'u';
+		// the default operand size is that of the stack
+		int psize = size == 2 ? 2 : 0;
+		if (d->type == &asme_reg)
+			x86_opreg(c, psize, push ? 0x50 : 0x58, d);
+		else if (d->type == &asme_x86ea)
+			x86_modrm(c, psize, 0, push ? 0xFF : 0x8F, NULL,
+				push ? 6 : 0, d);
+		else if (push && x86_fits8(d))
+			x86_byte(c, 0x6A), x86_imm(c, d, 1, 0);
+		else if (push)
+			x86_byte(c, 0x68), x86_imm(c, d, 4, 8);
+		else
+			c->bad = true;
+	} else if (!strcmp(mnem, "fld") && n == 1 && size != 10) {
+		x86_modrm(c, 0, 0, size == 4 ? 0xD9 : 0xDD, NULL, 0, d);
+	} else if (!strcmp(mnem, "fstp") && n == 1 && size != 10) {
+		x86_modrm(c, 0, 0, size == 4 ? 0xD9 : 0xDD, NULL, 3, d);
+	} else if (!strcmp(mnem, "cwd") && !n) {
+		x86_prefixes(c, 2, 0, 0, false, false), x86_byte(c, 0x99);
+	} else if (!strcmp(mnem, "cdq") && !n) {
+		x86_byte(c, 0x99);
+	} else if (!strcmp(mnem, "cqo") && !n) {
+		x86_prefixes(c, 8, 0, 0, false, false), x86_byte(c, 0x99);
+	} else if (!strcmp(mnem, "ret") && !n) {
+		x86_byte(c, 0xC3);
+	} else if (!strcmp(mnem, "leave") && !n) {
+		x86_byte(c, 0xC9);
+	} else if (!strcmp(mnem, "nop") && !n) {
+		x86_byte(c, 0x90);
+	} else {
+		c->bad = true;
+	}
+
+	if (c->riprel)
+		c->addend -= c->len - c->relat;
+	return !c->bad;
+}
+
+// the padding before an alignment at addr, none if it's more than it skips
+static int x86_alignpad(struct x86mi *mi, size_t addr)
+{
+	size_t align = (size_t)1 << mi->p2;
+	int pad = (align - addr % align) % align;
+	return pad > mi->skip ? 0 : pad;
+}
+
+// padding with the fewest nops, multi-byte ones are there from the i686 on
+static void x86_nops(int n)
+{
+	static const unsigned char nops[][10] = {
+		{ 0x90 },
+		{ 0x66, 0x90 },
+		{ 0x0F, 0x1F, 0x00 },
+		{ 0x0F, 0x1F, 0x40, 0x00 },
+		{ 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x2E, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+	};
+
+	int most = getcpu()->offset >= cpui686.offset ? 10 : 1;
+	while (n) {
+		int k = n < most ? n : most;
+		obj_bytes(x86_obj, nops[k - 1], k);
+		n -= k;
+	}
+}
+
+static void x86_objcode(struct x86code *c)
+{
+	size_t at = obj_offset(x86_obj);
+	obj_bytes(x86_obj, c->b, c->len);
+	if (c->relat >= 0)
+		obj_reloc(x86_obj, at + c->relat, c->rel,
+			obj_symbol(x86_obj, c->sym), c->addend);
+}
+
+static void x86_objemit(struct x86mi *mi, size_t addr)
+{
+	struct x86code c;
+	switch (mi->kind) {
+	case MI_LABEL:
+		obj_define(x86_obj, obj_symbol(x86_obj,
+			((struct asmimm *)mi->ops[0])->label));
+		break;
+	case MI_ALIGN:
+		x86_nops(x86_alignpad(mi, addr));
+		break;
+	case MI_INSTR:
+		if (x86_jumplabel(mi))
+			x86_encjump(mi, &c, addr);
+		else if (!x86_encode(mi, &c))
+			report(E_INTERNAL, NULL, "can't encode '%s'", mi->mnem);
+		x86_objcode(&c);
+		break;
+	}
+}
+
+static void x86_objwrite(struct x86mi *mi)
+{
+	x86_objemit(mi, obj_offset(x86_obj));
+}
+
+/*
+ * Assembles the code of a function into the object file. Jumps within it
+ * start out short, and those that don't reach are made near until none
+ * change; alignments only shrink meanwhile, so this ends.
+ */
+static void x86_assemble(void)
+{
+	struct x86code c;
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next) {
+		if (mi->kind != MI_INSTR)
+			continue;
+
+		const char *lbl = x86_jumplabel(mi);
+		if (lbl) {
+			if (strcmp(mi->mnem, "call"))
+				mi->target = x86_milabel(lbl);
+			mi->far = !mi->target;
+			mi->len = x86_jumplen(mi);
+		} else if (x86_encode(mi, &c)) {
+			mi->len = c.len;
+		} else {
+			report(E_INTERNAL, NULL, "can't encode '%s'", mi->mnem);
+		}
+	}
+
+	size_t start = obj_offset(x86_obj);
+	bool grown;
+	do {
+		size_t addr = start;
+		for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next) {
+			mi->addr = addr;
+			if (mi->kind == MI_ALIGN)
+				addr += x86_alignpad(mi, addr);
+			else if (mi->kind == MI_INSTR)
+				addr += mi->len;
+		}
+
+		grown = false;
+		for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next) {
+			if (!mi->target || mi->far)
+				continue;
+			long disp = (long)mi->target->addr - (long)(mi->addr + 2);
+			if (disp < -128 || disp > 127) {
+				mi->far = grown = true;
+				mi->len = x86_jumplen(mi);
+			}
+		}
+	} while (grown);
+
+	for (struct x86mi *mi = x86_mifirst; mi; mi = mi->next) {
+		assert(obj_offset(x86_obj) == mi->addr);
+		x86_objemit(mi, mi->addr);
+	}
+}
+
+static struct asme *x86_getloce(struct x86opnd *o, struct location *loc,
+	int size)
+{
+	struct loc_reg *lreg;
+	struct loc_mem *lmem;
+
+	switch (loc->type) {
+	case LT_REG:
+		lreg = loc->extended;
+		return (struct asme *)&x86_getreg(lreg->rid, size)->base;
+	case LT_LMEM:
+		assert(o != NULL);
+		lmem = loc->extended;
+		new_asm_imm(&o->disp, getcpu()->bits / 8, lmem->offset);
+		new_x86_ea(&o->ea, size, x86_fp(), &o->disp, NULL, 1);
+		return &o->ea.base;
+	}
+
+	assert(false);
+	return NULL;
+}
+
+static struct asme *x86_getasme(struct x86opnd *o, struct itm_expr *e)
+{
+	if (e->etype != ITME_INSTRUCTION) {
+		if (!o)
+			return NULL;
+
+		struct itm_literal *lit = (struct itm_literal *)e;
+		new_asm_imm(&o->imm, e->type->size, lit->value.i);
+		return &o->imm.base;
+	}
+
+	if (x86_isfolded(e)) {
+		struct itm_instr *load = (struct itm_instr *)e;
+		assert(load->id == ITM_ID(itm_load));
+		return x86_getmem(o, list_head(load->operands), e->type->size);
+	}
+
+	struct itm_tag *restag = itm_get_tag(e, tt_loc);
+	assert(restag != NULL);
+	struct location *loc = itm_tag_get_user_ptr(restag);
+	assert(loc != NULL);
+	return x86_getloce(o, loc, e->type->size);
+}
+
+/*
+ * Addresses are of the form base + index * scale + disp, the base being a
+ * register or the frame pointer. Folded getptrs and deepptrs are matched into
+ * the address of their user, each adding its index to it.
+ */
+struct x86addr {
+	struct itm_expr *base;
+	bool frame;		// relative to the frame pointer instead of base
+	struct itm_expr *index;
+	int scale;
+	int64_t disp;
+};
+
+static regid_t x86_rid(struct itm_expr *e)
+{
+	struct location *loc = x86_getloc(e);
+	assert(loc != NULL && loc->type == LT_REG);
+	return ((struct loc_reg *)loc->extended)->rid;
+}
+
+static bool x86_inreg(struct itm_expr *e)
+{
+	struct location *loc = x86_getloc(e);
+	return loc && loc->type == LT_REG;
+}
+
+static int x86_fieldoffset(struct cstruct *s, int j)
+{
+	if (s->base.type == UNION)
+		return 0;
+
+	struct field *fl = get_list_item(s->fields, j);
+	if (s->field_offset)
+		return s->field_offset(fl);
+
+	int offs = 0;
+	for (int k = 0; ; ++k) {
+		fl = get_list_item(s->fields, k);
+		int align = getfalign(fl->type);
+		if (align > 1)
+			offs = (offs + align - 1) / align * align;
+		if (k == j)
+			return offs;
+		offs += fl->type->size;
+	}
+}
+
+static bool x86_addreg(struct x86addr *a, struct itm_expr *e)
+{
+	if (!x86_inreg(e))
+		return false;
+
+	if (!a->base && !a->frame) {
+		a->base = e;
+		return true;
+	}
+	if (!a->index) {
+		a->index = e;
+		a->scale = 1;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Matches e into the address a, expanding e itself as well if it's a getptr
+ * or deepptr and expand is set.
+ */
+static bool x86_matchaddr(struct x86addr *a, struct itm_expr *e, bool expand)
+{
+	if (e->etype != ITME_INSTRUCTION)
+		return false;
+
+	struct itm_instr *i = (struct itm_instr *)e;
+	if (i->id == ITM_ID(itm_alloca)) {
+		if (a->frame || (a->base && a->index))
+			return false;
+		if (a->base) {
+			a->index = a->base;
+			a->scale = 1;
+			a->base = NULL;
+		}
+		a->frame = true;
+		a->disp += ((struct loc_mem *)x86_getloc(e)->extended)->offset;
+		return true;
+	}
+
+	if (!x86_isaddr(i) || !(expand || x86_isfolded(e)))
+		return x86_addreg(a, e);
+
+	struct itm_expr *p = list_head(i->operands);
+	struct itm_expr *idx = list_last(i->operands);
+	if (x86_isfield(i)) {
+		struct ctype *ty = ((struct cpointer *)p->type)->pointsto;
+		a->disp += x86_fieldoffset((struct cstruct *)ty,
+			((struct itm_literal *)idx)->value.i);
+	} else if (idx->etype == ITME_LITERAL) {
+		a->disp += itm_getsi((struct itm_literal *)idx) *
+			x86_elemsize(i);
+	} else {
+		if (a->index || !x86_isscale(x86_elemsize(i)) ||
+		    !x86_inreg(idx))
+			return false;
+		a->index = idx;
+		a->scale = x86_elemsize(i);
+	}
+	return x86_matchaddr(a, p, false);
+}
+
+static bool x86_getaddr(struct x86addr *a, struct itm_expr *e, bool expand)
+{
+	a->base = NULL;
+	a->frame = false;
+	a->index = NULL;
+	a->scale = 1;
+	a->disp = 0;
+	return x86_matchaddr(a, e, expand) &&
+	       a->disp >= INT32_MIN && a->disp <= INT32_MAX;
+}
+
+// the registers an address is made of
+static regid_t x86_addrregs(struct x86addr *a)
+{
+	regid_t res = 0;
+	if (a->base)
+		res |= x86_rid(a->base);
+	if (a->index)
+		res |= x86_rid(a->index);
+	return res;
+}
+
+static struct asme *x86_getea(struct x86opnd *o, struct itm_expr *ptr,
+	int size, bool expand)
+{
+	assert(o != NULL);
+
+	struct x86addr a;
+	bool matched = x86_getaddr(&a, ptr, expand);
+	assert(matched);
+
+	int psize = getcpu()->bits / 8;
+	const struct asmreg *base = NULL, *index = NULL;
+	struct asmimm *disp = NULL;
+	if (a.frame)
+		base = x86_fp();
+	else if (a.base)
+		base = x86_getreg(x86_rid(a.base), psize);
+	if (a.index)
+		index = x86_getreg(x86_rid(a.index), psize);
+	if (a.disp || (!base && !index)) {
+		new_asm_imm(&o->disp, psize, a.disp);
+		disp = &o->disp;
+	}
+
+	new_x86_ea(&o->ea, size, base, disp, index, a.scale);
+	return &o->ea.base;
+}
+
+/*
+ * Gets the memory operand of size bytes pointed to by ptr
+ */
+static struct asme *x86_getmem(struct x86opnd *o, struct itm_expr *ptr,
+	int size)
+{
+	return x86_getea(o, ptr, size, false);
+}
+
+static void x86_putasme(struct x86opnd *o, struct asme *e)
+{
+	if (e == &o->imm.base) {
+		delete_asm_imm(&o->imm);
+	} else if (e == &o->ea.base) {
+		if (o->ea.displacement)
+			delete_asm_imm(o->ea.displacement);
+		delete_x86_ea(&o->ea);
+	}
+}
+
+static bool x86_isreg(struct asme *e)
+{
+	return e->type == &asme_reg;
+}
+
+/*
+ * Tests whether the flags set before i are still used after it, in which
+ * case i shouldn't be emitted as an instruction that changes them.
+ */
+static bool x86_flagslive(struct itm_instr *i)
+{
+	for (i = i->next; i; i = i->next) {
+		if (i->id == ITM_ID(itm_split) || i->id == ITM_ID(itm_select))
+			return true;
+		if (x86_isarith(i) || i->id == ITM_ID(itm_cmpeq) ||
+		    i->id == ITM_ID(itm_cmpneq) || i->id == ITM_ID(itm_cmpgt) ||
+		    i->id == ITM_ID(itm_cmpgte) || i->id == ITM_ID(itm_cmplt) ||
+		    i->id == ITM_ID(itm_cmplte))
+			return false;
+	}
+	return false;
+}
+
+static const char *x86_fmov(struct ctype *ty)
+{
+	return ty->size == 4 ? "movss" : "movsd";
+}
+
+static const char *x86_fsuffix(struct ctype *ty)
+{
+	return ty->size == 4 ? "ss" : "sd";
+}
+
+static char x86_sizesuffix(int size)
+{
+	switch (size) {
+	case 1:
+		return 'b';
+	case 2:
+		return 'w';
+	case 4:
+		return 'l';
+	default:
+		return 'q';
+	}
+}
+
+// copies a float or double, the whole register is copied if possible
+static void x86_fcopy(FILE *f, struct ctype *ty, struct asme *dest,
+	struct asme *src)
+{
+	if (x86_isreg(dest) && x86_isreg(src))
+		emit_sdfi(f, "movaps", dest, src);
+	else
+		emit_sdfi(f, x86_fmov(ty), dest, src);
+}
+
+/*
+ * Loads a value that isn't read from another location, which is a literal or
+ * the address of a frame slot.
+ */
+static void x86_emit_value(FILE *f, struct asme *result, struct itm_expr *val,
+	bool flagslive)
+{
+	struct x86opnd o;
+
+	if (val->etype == ITME_UNDEF)
+		return;
+
+	if (val->etype == ITME_INSTRUCTION) {
+		struct asme *addr = x86_getmem(&o, val, result->size);
+		emit_sdi(f, "lea", result, addr);
+		x86_putasme(&o, addr);
+		return;
+	}
+
+	if (!hastc(val->type, TC_FLOATING)) {
+		// 64-bit immediates only go into registers, by movabs
+		bool abs = x86_isimm64(val);
+		assert(!abs || x86_isreg(result));
+		if (itm_hasvalue(val, 0) && x86_isreg(result) && !flagslive) {
+			emit_sdi(f, "xor", result, result);
+		} else {
+			struct asme *imm = x86_getasme(&o, val);
+			emit_sdi(f, abs ? "movabs" : "mov", result, imm);
+			x86_putasme(&o, imm);
+		}
+		return;
+	}
+
+	// xorps doesn't touch the flags
+	struct itm_literal *lit = (struct itm_literal *)val;
+	assert(x86_isreg(result));
+	uint64_t bits = lit->value.i;
+	if (val->type->size == 4)
+		bits &= 0xfffffffful;
+	if (!bits) {
+		emit_sdfi(f, "xorps", result, result);
+	} else {
+		const struct asmreg *base =
+			getcpu()->offset >= cpux86_64.offset ? &rip : NULL;
+		new_x86_ea(&o.ea, val->type->size, base, x86_getconst(lit),
+			NULL, 1);
+		emit_sdfi(f, x86_fmov(val->type), result, &o.ea.base);
+		delete_x86_ea(&o.ea);
+	}
+}
+
+// the mnemonic of a pattern, sse instructions get the suffix of their type
+static const char *x86_mnem(const struct x86pat *p, struct ctype *ty,
+	char *buf)
+{
+	if (!hastc(ty, TC_FLOATING))
+		return p->mnem;
+	sprintf(buf, "%s%s", p->mnem, x86_fsuffix(ty));
+	return buf;
+}
+
+static void x86_emit_mov(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd ro, o;
+	struct asme *result = x86_getasme(&ro, &i->base);
+	struct asme *src = x86_getasme(&o, list_head(i->operands));
+
+	// a comparison's boolean is taken out of the flags by setcc
+	regid_t rid = x86_isreg(src) ? ((struct asmreg *)src)->id : 0;
+	if (src == result) {
+		// nothing to do
+	} else if (rid >= eflag.id && rid <= beflag.id) {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "set%s", ((struct asmreg *)src)->name);
+		emit_fi(f, buf, 1, result);
+	} else {
+		emit_sdi(f, p->mnem, result, src);
+	}
+	x86_putasme(&o, src);
+	x86_putasme(&ro, result);
+}
+
+static void x86_emit_fmov(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd ro, o;
+	struct asme *result = x86_getasme(&ro, &i->base);
+	struct asme *src = x86_getasme(&o, list_head(i->operands));
+	if (src != result)
+		x86_fcopy(f, i->base.type, result, src);
+	x86_putasme(&o, src);
+	x86_putasme(&ro, result);
+}
+
+static void x86_emit_const(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd ro;
+	struct asme *result = x86_getasme(&ro, &i->base);
+	x86_emit_value(f, result, list_head(i->operands), x86_flagslive(i));
+	x86_putasme(&ro, result);
+}
+
+/*
+ * Conversions between integers of different sizes, and between integers and
+ * floating point values. Literal operands have been moved to registers by
+ * x86_restrictfp(). Extensions may read their operand from memory.
+ */
+static void x86_emit_cast(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct itm_expr *l = list_head(i->operands);
+	struct x86opnd ro, lo;
+	struct asme *result = x86_getasme(&ro, &i->base);
+	struct asme *le = x86_getasme(&lo, l);
+	assert(x86_isreg(result));
+	regid_t resid = ((struct asmreg *)result)->id;
+	int ressize = i->base.type->size;
+	int lsize = l->type->size;
+	bool att = asmflavor() == AF_ATT;
+	char instr[16];
+
+	if (i->id == ITM_ID(itm_itof)) {
+		sprintf(instr, "cvtsi2%s", x86_fsuffix(i->base.type));
+		emit_sdfi(f, instr, result, le);
+	} else if (i->id == ITM_ID(itm_ftoi)) {
+		/*
+		 * There is no conversion to small integers, and unsigned ints
+		 * are converted to 64-bit signed integers where possible
+		 */
+		int size = ressize < 4 ? 4 : ressize;
+		if (hastc(i->base.type, TC_UNSIGNED) && size == 4 &&
+		    getcpu()->offset >= cpux86_64.offset)
+			size = 8;
+		sprintf(instr, "cvtt%s2si", x86_fsuffix(l->type));
+		emit_sdfi(f, instr,
+			(struct asme *)&x86_getreg(resid, size)->base, le);
+	} else if (i->id == ITM_ID(itm_fext)) {
+		emit_sdfi(f, "cvtss2sd", result, le);
+	} else if (i->id == ITM_ID(itm_ftrunc)) {
+		emit_sdfi(f, "cvtsd2ss", result, le);
+	} else if (i->id == ITM_ID(itm_bitcast) &&
+	           x86_isfloat(&i->base) != x86_isfloat(l)) {
+		emit_sdfi(f, ressize == 4 ? "movd" : "movq", result, le);
+	} else if (i->id == ITM_ID(itm_trunc) || i->id == ITM_ID(itm_bitcast) ||
+	           lsize == ressize) {
+		assert(x86_isreg(le));
+		regid_t lid = ((struct asmreg *)le)->id;
+		struct asme *src = (struct asme *)&x86_getreg(lid, ressize)->base;
+		if (src != result)
+			emit_sdi(f, "mov", result, src);
+	} else if (i->id == ITM_ID(itm_zext) && lsize == 4) {
+		// writing a 32-bit register clears the upper half
+		struct asme *dest = (struct asme *)&x86_getreg(resid, 4)->base;
+		emit_sdi(f, "mov", dest, le);
+	} else {
+		bool sext = i->id == ITM_ID(itm_sext);
+		if (att)
+			sprintf(instr, "mov%c%c%c", sext ? 's' : 'z',
+				x86_sizesuffix(lsize), x86_sizesuffix(ressize));
+		else
+			strcpy(instr, !sext ? "movzx" : lsize == 4 ? "movsxd" : "movsx");
+		emit_sdfi(f, instr, result, le);
+	}
+
+	x86_putasme(&lo, le);
+	x86_putasme(&ro, result);
+}
+
+static void x86_emit_load(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd ro, o;
+	char buf[16];
+	struct asme *result = x86_getasme(&ro, &i->base);
+	struct asme *src = x86_getmem(&o, list_head(i->operands),
+		i->base.type->size);
+	if (x86_isfloat(&i->base))
+		emit_sdfi(f, x86_mnem(p, i->base.type, buf), result, src);
+	else
+		emit_sdi(f, p->mnem, result, src);
+	x86_putasme(&o, src);
+	x86_putasme(&ro, result);
+}
+
+static void x86_emit_store(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd vo, o;
+	char buf[16];
+	struct itm_expr *val = list_head(i->operands);
+	struct asme *vale = x86_getasme(&vo, val);
+	struct asme *dest = x86_getmem(&o, list_last(i->operands),
+		val->type->size);
+	if (x86_isfloat(val))
+		emit_sdfi(f, x86_mnem(p, val->type, buf), dest, vale);
+	else
+		emit_sdi(f, p->mnem, dest, vale);
+	x86_putasme(&o, dest);
+	x86_putasme(&vo, vale);
+}
+
+static void x86_emit_lea(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd ro, o;
+	struct asme *result = x86_getasme(&ro, &i->base);
+	struct asme *src = x86_getea(&o, &i->base, result->size, true);
+	emit_sdi(f, p->mnem, result, src);
+	x86_putasme(&o, src);
+	x86_putasme(&ro, result);
+}
+
+/*
+ * Frame setup. The frame pointer is only set up if the function has a frame,
+ * callee-saved registers are pushed below it.
+ */
+static regid_t x86_usedsaved(struct itm_block *b)
+{
+	struct archdes des;
+	x86_archdes(&des);
+
+	while (b->lexprev)
+		b = b->lexprev;
+
+	regid_t used = 0;
+	for (; b; b = b->lexnext) {
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			struct itm_tag *loct = itm_get_tag(&i->base, tt_loc);
+			if (!loct)
+				continue;
+			struct location *loc = itm_tag_get_user_ptr(loct);
+			if (loc->type == LT_REG)
+				used |= ((struct loc_reg *)loc->extended)->rid;
+		}
+	}
+	return used & des.saved_iregs;
 }
 
-static struct asme *x86_getloce(struct location *loc, int size);
-static struct asme *x86_getasme(struct asmimm *imm, struct itm_expr *e);
+static void x86_emit_prologue(FILE *f, struct itm_block *b)
+{
+	struct asme *fpe = (struct asme *)&x86_fp()->base;
+	struct asme *spe = (struct asme *)&x86_sp()->base;
+	int frame = framesize(b);
+	int wsize = getcpu()->bits / 8;
+	if (frame) {
+		// keep the stack aligned to twice the word size
+		frame = (frame + 2 * wsize - 1) / (2 * wsize) * (2 * wsize);
+
+		struct asmimm imm;
+		new_asm_imm(&imm, wsize, frame);
+		emit_i(f, "push", 1, fpe);
+		emit_sdi(f, "mov", fpe, spe);
+		emit_sdi(f, "sub", spe, &imm.base);
+		delete_asm_imm(&imm);
+	}
 
-static struct itm_instr *x86_emit_cmp(FILE *f, struct itm_instr *i,
-	struct list *bldict);
-static struct itm_instr *x86_emit_split(FILE *f, struct itm_instr *i,
-	struct list *bldict);
-static struct itm_instr *x86_emit_jmp(FILE *f, struct itm_instr *i,
-	struct list *bldict);
-static struct itm_instr *x86_emiti_arith(FILE *f, struct itm_instr *i,
-	struct list *bldict);
-static struct itm_instr *x86_emiti_ret(FILE *f, struct itm_instr *i,
-	struct list *bldict);
-static struct itm_instr *x86_emit_jmp(FILE *f, struct itm_instr *i,
-	struct list *bldict);
+	regid_t saved = x86_usedsaved(b);
+	for (int r = 0; r < sizeof(regid_t) * 8; ++r)
+		if (saved & (1ul << r))
+			emit_i(f, "push", 1, &x86_getreg(1ul << r, wsize)->base);
+}
 
-static struct asme *x86_getloce(struct location *loc, int size)
+static void x86_emit_epilogue(FILE *f, struct itm_block *b)
 {
-	struct loc_reg *lreg;
+	struct asme *fpe = (struct asme *)&x86_fp()->base;
+	struct asme *spe = (struct asme *)&x86_sp()->base;
+	int wsize = getcpu()->bits / 8;
 
-	switch (loc->type) {
-	case LT_REG:
-		lreg = loc->extended;
+	regid_t saved = x86_usedsaved(b);
+	for (int r = sizeof(regid_t) * 8 - 1; r >= 0; --r)
+		if (saved & (1ul << r))
+			emit_i(f, "pop", 1, &x86_getreg(1ul << r, wsize)->base);
 
-		const struct asmreg **av = regav[getcpu()->offset];
-		for (int i = 0; av[i]; ++i) {
-			const struct asmreg *reg = av[i];
-			// !reg->base.size is for flags
-			if (reg->id == lreg->rid &&
-			    (reg->base.size == size || !reg->base.size))
-				return (struct asme *)&reg->base;
-		}
+	if (!framesize(b))
+		return;
 
-		assert(false);
-		break;
+	if (getcpu()->offset >= cpui386.offset) {
+		emit_i(f, "leave", 0);
+	} else {
+		emit_sdi(f, "mov", spe, fpe);
+		emit_i(f, "pop", 1, fpe);
 	}
-
-	assert(false);
 }
 
-static struct asme *x86_getasme(struct asmimm *imm, struct itm_expr *e)
+static void x86_emit_ret(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
 {
-	if (e->etype != ITME_INSTRUCTION) {
-		if (!imm)
-			return NULL;
-
-		struct itm_literal *lit = (struct itm_literal *)e;
-		new_asm_imm(imm, e->type->size, lit->value.i);
-		return &imm->base;
+	// 32-bit calling conventions return floating point values in st0
+	if (i->id == ITM_ID(itm_ret) && x86_isfloat(list_head(i->operands)) &&
+	    getcpu()->offset < cpux86_64.offset) {
+		struct itm_expr *val = list_head(i->operands);
+		int size = val->type->size;
+		struct asme *spe = (struct asme *)&x86_sp()->base;
+		struct asmimm imm;
+		struct x86ea ea;
+		new_asm_imm(&imm, 4, 8);
+		new_x86_ea(&ea, size, x86_sp(), NULL, NULL, 1);
+		emit_sdi(f, "sub", spe, &imm.base);
+		emit_sdfi(f, x86_fmov(val->type), &ea.base,
+			x86_getasme(NULL, val));
+		if (asmflavor() == AF_ATT)
+			emit_fi(f, size == 4 ? "flds" : "fldl", 1, &ea.base);
+		else
+			emit_fi(f, "fld", 1, &ea.base);
+		emit_sdi(f, "add", spe, &imm.base);
+		delete_x86_ea(&ea);
+		delete_asm_imm(&imm);
 	}
 
-	struct itm_tag *restag = itm_get_tag(e, tt_loc);
-	assert(restag != NULL);
-	struct location *loc = itm_tag_get_user_ptr(restag);
-	assert(loc != NULL);
-	return x86_getloce(loc, e->type->size);
+	x86_emit_epilogue(f, i->block);
+	emit_i(f, p->mnem, 0);
+}
+
+/*
+ * Tests whether the flags before i are those left by the arithmetic computing
+ * e. and, or and xor set them like a test of the result would, add and sub
+ * only the zero flag, which is all zf asks for.
+ */
+static bool x86_flagsof(struct itm_instr *i, struct itm_expr *e, bool zf)
+{
+	static const char *const all[] = { "and", "or", "xor" };
+	static const char *const zero[] = { "add", "sub", "inc", "dec" };
+
+	if (e->etype != ITME_INSTRUCTION || x86_isfolded(e))
+		return false;
+
+	// moves, other than those of zero, and leas keep the flags
+	struct itm_instr *def = (struct itm_instr *)e;
+	struct itm_instr *j;
+	for (j = i->previous; j && j != def; j = j->previous) {
+		struct itm_expr *src = list_head(j->operands);
+		const char *mnem = x86_getpat(j)->mnem;
+		if (x86_isfolded(&j->base) || !mnem || !strcmp(mnem, "lea"))
+			continue;
+		if (j->id != ITM_ID(itm_mov) || src->etype == ITME_LITERAL)
+			return false;
+	}
+	if (!j)
+		return false;
+
+	const char *mnem = x86_getpat(def)->mnem;
+	if (!mnem)
+		return false;
+	for (int k = 0; k < sizeof(all) / sizeof(*all); ++k)
+		if (!strcmp(mnem, all[k]))
+			return true;
+	for (int k = 0; zf && k < sizeof(zero) / sizeof(*zero); ++k)
+		if (!strcmp(mnem, zero[k]))
+			return true;
+	return false;
 }
 
-static struct itm_instr *x86_emiti(FILE *f, struct itm_instr *i,
+static void x86_emit_test(FILE *f, struct itm_instr *i, const struct x86pat *p,
 	struct list *bldict)
 {
-	assert(i != NULL);
+	bool zf = i->id == ITM_ID(itm_cmpeq) || i->id == ITM_ID(itm_cmpneq);
+	if (x86_flagsof(i, list_head(i->operands), zf))
+		return;
 
-	struct itm_instr *nxt;
+	struct asme *le = x86_getasme(NULL, list_head(i->operands));
+	emit_sdi(f, p->mnem, le, le);
+}
 
-	if ((nxt = x86_emiti_arith(f, i, bldict)) != i)
-		return nxt;
-	if ((nxt = x86_emiti_ret(f, i, bldict)) != i)
-		return nxt;
-	if ((nxt = x86_emit_cmp(f, i, bldict)) != i)
-		return nxt;
-	if ((nxt = x86_emit_split(f, i, bldict)) != i)
-		return nxt;
-	if ((nxt = x86_emit_jmp(f, i, bldict)) != i)
-		return nxt;
+static void x86_emit_cmp(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd l, r;
+	struct asme *le = x86_getasme(&l, list_head(i->operands));
+	struct asme *re = x86_getasme(&r, list_last(i->operands));
+	emit_sdi(f, p->mnem, le, re);
+	x86_putasme(&r, re);
+	x86_putasme(&l, le);
+}
 
-	if (i->id == ITM_ID(itm_mov)) {
-		struct asme *result = x86_getasme(NULL, &i->base);
-		struct asmimm imm;
-		struct itm_expr *firstop = list_head(i->operands);
-		if (itm_hasvalue(firstop, 0)) {
-			emit_sdi(f, "xor", result, result);
-			return i->next;
-		}
-		struct asme *firstope;
-		if ((firstope = x86_getasme(&imm, firstop)) == result)
-			return i->next;
+// numbers the labels x86_emit_fcmp() jumps to
+static THREAD_LOCAL int x86_nparity;
 
-		emit_sdi(f, "mov", result, firstope);
-		if (firstope == &imm.base)
-			delete_asm_imm(&imm);
+static void x86_emit_fcmp(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	struct x86opnd l, r;
+	char buf[16];
+	struct itm_expr *lop = list_head(i->operands);
+	struct itm_expr *rop = list_last(i->operands);
+
+	// see x86_restrictcmp()
+	if (i->id == ITM_ID(itm_cmplt) || i->id == ITM_ID(itm_cmplte)) {
+		struct itm_expr *tmp = lop;
+		lop = rop;
+		rop = tmp;
 	}
 
-	return i->next;
+	struct asme *le = x86_getasme(&l, lop);
+	struct asme *re = x86_getasme(&r, rop);
+	emit_sdfi(f, x86_mnem(p, lop->type, buf), le, re);
+	x86_putasme(&r, re);
+	x86_putasme(&l, le);
+
+	/*
+	 * An unordered result sets the parity flag, and the zero flag as well,
+	 * which testing the stack pointer clears, so that NaN is equal to
+	 * nothing.
+	 */
+	if (i->id != ITM_ID(itm_cmpeq) && i->id != ITM_ID(itm_cmpneq))
+		return;
+
+	const char *fn = i->block->container->id;
+	char *lblid = malloc(5 + sizeof(int) * 3 + strlen(fn));
+	sprintf(lblid, ".L%dp_%s", x86_nparity++, fn);
+	struct asmimm lbl;
+	new_asm_label(&lbl, lblid);
+	free(lblid);
+
+	const struct asmreg *sp = x86_sp();
+	emit_i(f, "jnp", 1, &lbl.base);
+	emit_i(f, "test", 2, &sp->base, &sp->base);
+	emit_label(f, &lbl);
+	delete_asm_imm(&lbl);
 }
 
-static struct itm_instr *x86_emiti_ret(FILE *f, struct itm_instr *i,
-	struct list *bldict)
+/*
+ * Comparisons leave the condition in the flags, see x86_keepflags(). Other
+ * conditions are tested against zero, unless the instruction computing them
+ * just did. Returns the flag to test before i.
+ */
+static regid_t x86_testcond(FILE *f, struct itm_instr *i, struct itm_expr *cond)
 {
-	if (i->id == ITM_ID(itm_leave) || i->id == ITM_ID(itm_ret)) {
-		emit_i(f, "ret", 0);
-		return i->next;
+	struct location *locg = x86_getloc(cond);
+	regid_t rid = 0;
+	if (locg->type == LT_REG)
+		rid = ((struct loc_reg *)locg->extended)->rid;
+
+	if (rid >= eflag.id && rid <= beflag.id)
+		return rid;
+	if (x86_flagsof(i, cond, true))
+		return neflag.id;
+
+	struct x86opnd o;
+	struct asmimm zero;
+	struct asme *conde = x86_getasme(&o, cond);
+	if (locg->type == LT_REG) {
+		emit_sdi(f, "test", conde, conde);
+	} else {
+		new_asm_imm(&zero, cond->type->size, 0);
+		emit_sdi(f, "cmp", conde, &zero.base);
+		delete_asm_imm(&zero);
 	}
+	x86_putasme(&o, conde);
+	return neflag.id;
+}
 
-	return i;
+static bool x86_samereg(struct asme *a, struct asme *b)
+{
+	return x86_isreg(a) && x86_isreg(b) &&
+	       ((struct asmreg *)a)->id == ((struct asmreg *)b)->id;
 }
 
-static struct itm_instr *x86_emit_cmp(FILE *f, struct itm_instr *i,
-	struct list *bldict)
+// the flag that is set when rid isn't
+static regid_t x86_invflag(regid_t rid)
 {
-	if (i->id != ITM_ID(itm_cmpeq) &&
-	    i->id != ITM_ID(itm_cmpneq) &&
-	    i->id != ITM_ID(itm_cmpgt) &&
-	    i->id != ITM_ID(itm_cmplt) &&
-	    i->id != ITM_ID(itm_cmpgte) &&
-	    i->id != ITM_ID(itm_cmplte))
-		return i;
+	const struct asmreg *pairs[][2] = {
+		{ &eflag, &neflag }, { &gflag, &leflag }, { &geflag, &lflag },
+		{ &aflag, &beflag }, { &aeflag, &bflag }
+	};
+	for (int k = 0; k < sizeof(pairs) / sizeof(pairs[0]); ++k) {
+		if (pairs[k][0]->id == rid)
+			return pairs[k][1]->id;
+		if (pairs[k][1]->id == rid)
+			return pairs[k][0]->id;
+	}
+	assert(false);
+	return 0;
+}
 
-	struct asmimm l, r;
-	struct asme *le = x86_getasme(&l, list_head(i->operands));
-	struct asme *re = x86_getasme(&r, list_last(i->operands));
+/*
+ * c ? t : f is a setcc if t and f are 1 and 0, and a cmov otherwise, see
+ * x86_ifconvert()
+ */
+static void x86_emit_select(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct list *bldict)
+{
+	char buf[16];
+	struct itm_expr *te = get_list_item(i->operands, 1);
+	struct itm_expr *fe = list_last(i->operands);
+	regid_t rid = x86_testcond(f, i, list_head(i->operands));
+	struct asme *result = x86_getasme(NULL, &i->base);
 
-	if (itm_hasvalue(list_last(i->operands), 0))
-		emit_sdi(f, "test", le, le);
-	else
-		emit_sdi(f, "cmp", le, re);
+	if (te->etype == ITME_LITERAL) {
+		if (itm_hasvalue(te, 0))
+			rid = x86_invflag(rid);
+		sprintf(buf, "set%s", x86_getreg(rid, 0)->name);
+		emit_fi(f, buf, 1, result);
+		return;
+	}
 
-	if (re == &r.base)
-		delete_asm_imm(&r);
-	if (le == &l.base)
-		delete_asm_imm(&l);
+	// the result may already hold one of the operands
+	struct x86opnd to, fo;
+	struct asme *ta = x86_getasme(&to, te);
+	struct asme *fa = x86_getasme(&fo, fe);
+	struct asme *src = ta, *other = fa;
+	if (x86_samereg(ta, result)) {
+		src = fa;
+		other = ta;
+		rid = x86_invflag(rid);
+	}
+	if (!x86_samereg(other, result))
+		emit_sdi(f, "mov", result, other);
 
-	return i->next;
+	sprintf(buf, "cmov%s", x86_getreg(rid, 0)->name);
+	emit_sdfi(f, buf, result, src);
+	x86_putasme(&fo, fa);
+	x86_putasme(&to, ta);
 }
 
-static struct itm_instr *x86_emit_split(FILE *f, struct itm_instr *i,
+static void x86_emit_split(FILE *f, struct itm_instr *i, const struct x86pat *p,
 	struct list *bldict)
 {
 	/*
@@ -930,27 +5578,17 @@ static struct itm_instr *x86_emit_split(FILE *f, struct itm_instr *i,
 		JG,
 		JLE,
 		JGE,
-		JL
+		JL,
+		JA,
+		JBE,
+		JAE,
+		JB
 	} jtype;
 
-	if (i->id != ITM_ID(itm_split))
-		return i;
-
 	struct itm_block *trblk = get_list_item(i->operands, 1);
 	struct itm_block *fablk = list_last(i->operands);
 
-	struct itm_expr *cond = list_head(i->operands);
-	/*
-	 * TODO: the condition won't always be in a flags register...
-	 * Think of functions returning boolean values...
-	 */
-	struct asme *conde = x86_getasme(NULL, cond);
-	struct itm_tag *loct = itm_get_tag(cond, tt_loc);
-	struct location *locg = itm_tag_get_user_ptr(loct);
-	assert(locg->type == LT_REG);
-	struct loc_reg *locr = locg->extended;
-	regid_t rid = locr->rid;
-
+	regid_t rid = x86_testcond(f, i, list_head(i->operands));
 	if (rid == eflag.id)
 		jtype = JE;
 	else if (rid == neflag.id)
@@ -963,6 +5601,14 @@ static struct itm_instr *x86_emit_split(FILE *f, struct itm_instr *i,
 		jtype = JL;
 	else if (rid == leflag.id)
 		jtype = JLE;
+	else if (rid == aflag.id)
+		jtype = JA;
+	else if (rid == aeflag.id)
+		jtype = JAE;
+	else if (rid == bflag.id)
+		jtype = JB;
+	else if (rid == beflag.id)
+		jtype = JBE;
 
 	// shortcut to trblk if that comes after the current block
 	if (trblk == i->block->lexnext) {
@@ -999,66 +5645,149 @@ static struct itm_instr *x86_emit_split(FILE *f, struct itm_instr *i,
 	case JLE:
 		instr = "jle";
 		break;
+	case JA:
+		instr = "ja";
+		break;
+	case JAE:
+		instr = "jae";
+		break;
+	case JB:
+		instr = "jb";
+		break;
+	case JBE:
+		instr = "jbe";
+		break;
 	}
 
 	emit_i(f, instr, 1, &trimm->base);
 	if (fablk != i->block->lexnext)
 		emit_i(f, "jmp", 1, &faimm->base);
+}
+
+/*
+ * Emits the copies into the phis of succ at the end of pred. The flags aren't
+ * live here, since pred ends in an unconditional jump.
+ */
+static void x86_emit_phicopies(FILE *f, struct itm_block *pred,
+	struct itm_block *succ)
+{
+	struct list *copies = phicopies(pred, succ);
+
+	struct pcopy *c;
+	it_t it = list_iterator(copies);
+	while (iterator_next(&it, (void **)&c)) {
+		struct x86opnd dop, sop;
+		int size = c->type->size;
+		bool isfloat = hastc(c->type, TC_FLOATING);
+
+		/*
+		 * A swap leaves the old value of dst in src, where others may
+		 * read it wider than c's type. Registers are swapped whole.
+		 */
+		if (c->swap && !isfloat) {
+			size = c->width;
+			if (c->dst->type == LT_REG && c->src->type == LT_REG)
+				size = getcpu()->bits / 8;
+		}
+		struct asme *dst = x86_getloce(&dop, c->dst, size);
+
+		if (c->swap) {
+			struct asme *src = x86_getloce(&sop, c->src, size);
+			if (isfloat) {
+				struct asme *scratch =
+					(struct asme *)&x86_fscratch()->base;
+				x86_fcopy(f, c->type, scratch, src);
+				x86_fcopy(f, c->type, src, dst);
+				x86_fcopy(f, c->type, dst, scratch);
+			} else {
+				emit_sdi(f, "xchg", dst, src);
+			}
+			x86_putasme(&sop, src);
+		} else if (c->src) {
+			struct asme *src = x86_getloce(&sop, c->src, size);
+			if (isfloat)
+				x86_fcopy(f, c->type, dst, src);
+			else
+				emit_sdi(f, "mov", dst, src);
+			x86_putasme(&sop, src);
+		} else {
+			x86_emit_value(f, dst, c->val, false);
+		}
+
+		x86_putasme(&dop, dst);
+	}
 
-	return i->next;
+	delete_phicopies(copies);
 }
 
-static struct itm_instr *x86_emit_jmp(FILE *f, struct itm_instr *i,
+static void x86_emit_jmp(FILE *f, struct itm_instr *i, const struct x86pat *p,
 	struct list *bldict)
 {
-	if (i->id != ITM_ID(itm_jmp))
-		return i;
-
 	struct itm_block *bl = list_head(i->operands);
+	x86_emit_phicopies(f, i->block, bl);
 	if (bl == i->block->lexnext)
-		return i->next;
+		return;
 
 	struct asmimm *lbl = x86_getblocklbl(bl, bldict);
-	emit_i(f, "jmp", 1, &lbl->base);
-	return i->next;
+	emit_i(f, p->mnem, 1, &lbl->base);
 }
 
-static struct itm_instr *x86_emiti_arith(FILE *f, struct itm_instr *i,
-	struct list *bldict)
+static void x86_farith(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct itm_expr *lop, struct itm_expr *rop)
 {
-	const char *instrstr;
-
-	instr_id_t id = i->id;
-	if (id == ITM_ID(itm_add))
-		instrstr = "add";
-	else if (id == ITM_ID(itm_sub))
-		instrstr = "sub";
-	else if (id == ITM_ID(itm_mul))
-		instrstr = "imul";
-	else if (id == ITM_ID(itm_div))
-		instrstr = "idiv";
-	else if (id == ITM_ID(itm_and))
-		instrstr = "and";
-	else if (id == ITM_ID(itm_xor))
-		instrstr = "xor";
-	else if (id == ITM_ID(itm_or))
-		instrstr = "or";
-	else
-		return i;
+	char instr[16];
+	struct x86opnd lo, ro;
+	struct asme *result = x86_getasme(NULL, &i->base);
+	struct asme *le = x86_getasme(&lo, lop);
+	struct asme *re = x86_getasme(&ro, rop);
+	assert(x86_isreg(result));
+
+	if (re == result && x86_issymm(i)) {
+		struct asme *tmpe = le;
+		le = re;
+		re = tmpe;
+	} else if (re == result) {
+		// result = le - result, the right operand is saved in scratch
+		struct asme *scratch = (struct asme *)&x86_fscratch()->base;
+		x86_fcopy(f, i->base.type, scratch, re);
+		re = scratch;
+	}
+
+	if (le != result)
+		x86_fcopy(f, i->base.type, result, le);
+	emit_sdfi(f, x86_mnem(p, i->base.type, instr), result, re);
+
+	x86_putasme(&ro, re);
+	x86_putasme(&lo, le);
+}
+
+static void x86_emiti_farith(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	x86_farith(f, i, p, list_head(i->operands), list_last(i->operands));
+}
 
-	struct itm_expr *firstop = list_head(i->operands);
-	struct itm_expr *secop = list_last(i->operands);
+// commutative operations with the foldable operand on the left
+static void x86_emiti_farithc(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	x86_farith(f, i, p, list_last(i->operands), list_head(i->operands));
+}
 
-	struct asmimm limm, rimm;
+static void x86_arith(FILE *f, struct itm_instr *i, const struct x86pat *p,
+	struct itm_expr *firstop, struct itm_expr *secop)
+{
+	struct x86opnd lo, ro;
 	struct asme *result = x86_getasme(NULL, &i->base);
-	struct asme *le = x86_getasme(&limm, firstop);
-	struct asme *re = x86_getasme(&rimm, secop);
+	struct asme *le = x86_getasme(&lo, firstop);
+	struct asme *re = x86_getasme(&ro, secop);
 
 	// all the stuff that checks for this variable is basically dirty
 	// it introduces a set of xchg instructions, which... isn't ideal...
 	bool xchg = false;
 
-	if (re == result) {
+	// an operation of result with itself needs no swapping
+	if (re == result && le != re) {
 		if (x86_issymm(i)) {
 			struct asme *tmpe = le;
 			le = re;
@@ -1068,27 +5797,713 @@ static struct itm_instr *x86_emiti_arith(FILE *f, struct itm_instr *i,
 		}
 	}
 
-	if (xchg) {
+	if (xchg && i->id == ITM_ID(itm_sub)) {
+		// result = le - result
+		emit_i(f, "neg", 1, result);
+		emit_sdi(f, "add", result, le);
+	} else if (xchg) {
 		// re == result here, just keep that in mind
 		emit_sdi(f, "xchg", le, re);
-		emit_sdi(f, instrstr, le, re);
+		emit_sdi(f, p->mnem, le, re);
 		emit_sdi(f, "xchg", le, re);
 	} else {
 		if (le != result)
 			emit_sdi(f, "mov", result, le);
+		emit_sdi(f, p->mnem, result, re);
+	}
 
-		if (id == ITM_ID(itm_add) && itm_hasvalue(secop, 1))
-			emit_i(f, "inc", 1, result);
-		else if (id == ITM_ID(itm_sub) && itm_hasvalue(secop, 1))
-			emit_i(f, "dec", 1, result);
-		else
-			emit_sdi(f, instrstr, result, re);
+	x86_putasme(&ro, re);
+	x86_putasme(&lo, le);
+}
+
+static void x86_emiti_arith(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	x86_arith(f, i, p, list_head(i->operands), list_last(i->operands));
+}
+
+static void x86_emiti_arithc(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	x86_arith(f, i, p, list_last(i->operands), list_head(i->operands));
+}
+
+/*
+ * The three operand imul takes its left operand from anywhere, so it doesn't
+ * need to be copied into the result first.
+ */
+static void x86_emiti_mulimm(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	struct x86opnd lo, ro;
+	struct asme *result = x86_getasme(NULL, &i->base);
+	struct asme *le = x86_getasme(&lo, list_head(i->operands));
+	struct asme *re = x86_getasme(&ro, list_last(i->operands));
+	if (asmflavor() == AF_ATT)
+		emit_i(f, p->mnem, 3, re, le, result);
+	else
+		emit_i(f, p->mnem, 3, result, le, re);
+	x86_putasme(&ro, re);
+	x86_putasme(&lo, le);
+}
+
+// additions of a shift folded by x86_canscale()
+static void x86_emit_addlea(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	struct itm_expr *l = list_head(i->operands);
+	struct itm_instr *sh = (struct itm_instr *)list_last(i->operands);
+	if (x86_isfolded(l)) {
+		sh = (struct itm_instr *)l;
+		l = list_last(i->operands);
+	}
+
+	int psize = getcpu()->bits / 8;
+	struct itm_literal *k = list_last(sh->operands);
+	struct x86ea ea;
+	new_x86_ea(&ea, i->base.type->size, x86_getreg(x86_rid(l), psize), NULL,
+		x86_getreg(x86_rid(list_head(sh->operands)), psize),
+		1 << k->value.i);
+
+	struct asme *result = x86_getasme(NULL, &i->base);
+	emit_sdi(f, p->mnem, result, &ea.base);
+	delete_x86_ea(&ea);
+}
+
+// the size extension of rax into rdx:rax for signed division
+static const char *x86_cwd(int size)
+{
+	bool att = asmflavor() == AF_ATT;
+	switch (size) {
+	case 2:
+		return att ? "cwtd" : "cwd";
+	case 4:
+		return att ? "cltd" : "cdq";
+	default:
+		return att ? "cqto" : "cqo";
+	}
+}
+
+// div, rem and mulh, see x86_restrictdiv()
+static void x86_emiti_wide(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	struct x86opnd o;
+	char mnem[8];
+	int size = i->base.type->size;
+	bool sign = hastc(i->base.type, TC_SIGNED);
+
+	if (i->id != ITM_ID(itm_mulh) && sign) {
+		emit_fi(f, x86_cwd(size), 0);
+	} else if (i->id != ITM_ID(itm_mulh)) {
+		struct asme *dx = (struct asme *)&x86_getreg(rdx.id,
+			size == 8 ? 4 : size)->base;
+		emit_sdi(f, "xor", dx, dx);
+	}
+
+	sprintf(mnem, "%s%s", sign ? "i" : "", p->mnem);
+	struct asme *re = x86_getasme(&o, list_last(i->operands));
+	emit_i(f, mnem, 1, re);
+	x86_putasme(&o, re);
+}
+
+// inc and dec
+static void x86_emiti_unary(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	struct x86opnd lo;
+	struct asme *result = x86_getasme(NULL, &i->base);
+	struct asme *le = x86_getasme(&lo, list_head(i->operands));
+	if (le != result)
+		emit_sdi(f, "mov", result, le);
+	emit_i(f, p->mnem, 1, result);
+	x86_putasme(&lo, le);
+}
+
+/*
+ * Shifts by a variable amount take it in cl, see x86_restrictshift(). The
+ * result is never allocated to rcx. Constant amounts are a byte immediate.
+ */
+static void x86_emiti_shift(FILE *f, struct itm_instr *i,
+	const struct x86pat *p, struct list *bldict)
+{
+	struct x86opnd lo;
+	struct asmimm imm;
+	char instr[8];
+	struct asme *result = x86_getasme(NULL, &i->base);
+	struct asme *le = x86_getasme(&lo, list_head(i->operands));
+	struct itm_expr *r = list_last(i->operands);
+	struct asme *cnt = (struct asme *)&cl.base;
+	if (r->etype == ITME_LITERAL) {
+		new_asm_imm(&imm, 1, ((struct itm_literal *)r)->value.i);
+		cnt = &imm.base;
+	}
+
+	if (le != result)
+		emit_sdi(f, "mov", result, le);
+
+	// the size is that of the shifted operand, not of the amount
+	strcpy(instr, p->mnem);
+	if (asmflavor() == AF_ATT)
+		sprintf(instr, "%s%c", p->mnem, x86_sizesuffix(result->size));
+	emit_sdfi(f, instr, result, cnt);
+
+	if (cnt == &imm.base)
+		delete_asm_imm(&imm);
+	x86_putasme(&lo, le);
+}
+
+/*
+ * The patterns. Where more than one pattern matches an instruction, the one
+ * with the lowest cost is chosen, the first one listed if those are equal.
+ */
+static const struct x86pat x86pats[] = {
+	// instructions without code of their own
+	{ ITM_ID(itm_phi), PT_ANY, OC_ANY, OC_ANY, 0, NULL, NULL },
+	{ ITM_ID(itm_alloca), PT_ANY, OC_ANY, OC_ANY, 0, NULL, NULL },
+	{ ITM_ID(itm_clobb), PT_ANY, OC_ANY, OC_ANY, 0, NULL, NULL },
+
+	// moves
+	{ ITM_ID(itm_mov), PT_INT, OC_REG | OC_SLOT | OC_MEM | OC_FLAG, OC_NONE,
+	  1, "mov", &x86_emit_mov },
+	{ ITM_ID(itm_mov), PT_FLOAT, OC_XMM | OC_SLOT | OC_MEM, OC_NONE,
+	  1, "mov", &x86_emit_fmov },
+	{ ITM_ID(itm_mov), PT_INT | PT_FLOAT,
+	  OC_IMM | OC_IMM64 | OC_FLIT | OC_FRAME | OC_UNDEF, OC_NONE,
+	  1, "mov", &x86_emit_const },
+
+	// memory
+	{ ITM_ID(itm_load), PT_INT, OC_REG | OC_FRAME | OC_ADDR, OC_NONE,
+	  1, "mov", &x86_emit_load },
+	{ ITM_ID(itm_load), PT_FLOAT, OC_REG | OC_FRAME | OC_ADDR, OC_NONE,
+	  1, "mov", &x86_emit_load },
+	{ ITM_ID(itm_store), PT_VOID, OC_REG | OC_IMM,
+	  OC_REG | OC_FRAME | OC_ADDR, 1, "mov", &x86_emit_store },
+	{ ITM_ID(itm_store), PT_VOID, OC_XMM, OC_REG | OC_FRAME | OC_ADDR,
+	  1, "mov", &x86_emit_store },
+
+	// address arithmetic
+	{ ITM_ID(itm_getptr), PT_INT, OC_REG | OC_FRAME | OC_ADDR,
+	  OC_REG | OC_IMM, 1, "lea", &x86_emit_lea },
+	{ ITM_ID(itm_deepptr), PT_INT, OC_REG | OC_FRAME | OC_ADDR,
+	  OC_REG | OC_IMM, 1, "lea", &x86_emit_lea },
+
+	// integer arithmetic
+	{ ITM_ID(itm_add), PT_INT, OC_REG | OC_SLOT, OC_ONE,
+	  1, "inc", &x86_emiti_unary },
+	{ ITM_ID(itm_add), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "add", &x86_emiti_arith },
+	{ ITM_ID(itm_add), PT_INT, OC_REG, OC_MEM, 1, "add", &x86_emiti_arith },
+	{ ITM_ID(itm_add), PT_INT, OC_IMM | OC_MEM, OC_REG,
+	  1, "add", &x86_emiti_arithc },
+	{ ITM_ID(itm_add), PT_INT, OC_REG, OC_SCALE, 1, "lea", &x86_emit_addlea },
+	{ ITM_ID(itm_add), PT_INT, OC_SCALE, OC_REG, 1, "lea", &x86_emit_addlea },
+	{ ITM_ID(itm_sub), PT_INT, OC_REG | OC_SLOT, OC_ONE,
+	  1, "dec", &x86_emiti_unary },
+	{ ITM_ID(itm_sub), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "sub", &x86_emiti_arith },
+	{ ITM_ID(itm_sub), PT_INT, OC_REG, OC_MEM, 1, "sub", &x86_emiti_arith },
+	{ ITM_ID(itm_mul), PT_INT, OC_REG | OC_SLOT | OC_MEM, OC_IMM,
+	  3, "imul", &x86_emiti_mulimm },
+	{ ITM_ID(itm_mul), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT,
+	  3, "imul", &x86_emiti_arith },
+	{ ITM_ID(itm_mul), PT_INT, OC_REG, OC_MEM, 3, "imul", &x86_emiti_arith },
+	{ ITM_ID(itm_mul), PT_INT, OC_IMM | OC_MEM, OC_REG,
+	  3, "imul", &x86_emiti_arithc },
+	{ ITM_ID(itm_div), PT_INT, OC_REG, OC_REG | OC_SLOT | OC_MEM,
+	  20, "div", &x86_emiti_wide },
+	{ ITM_ID(itm_rem), PT_INT, OC_REG, OC_REG | OC_SLOT | OC_MEM,
+	  20, "div", &x86_emiti_wide },
+	{ ITM_ID(itm_mulh), PT_INT, OC_REG, OC_REG | OC_SLOT | OC_MEM,
+	  3, "mul", &x86_emiti_wide },
+	{ ITM_ID(itm_and), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "and", &x86_emiti_arith },
+	{ ITM_ID(itm_and), PT_INT, OC_REG, OC_MEM, 1, "and", &x86_emiti_arith },
+	{ ITM_ID(itm_and), PT_INT, OC_IMM | OC_MEM, OC_REG,
+	  1, "and", &x86_emiti_arithc },
+	{ ITM_ID(itm_or), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "or", &x86_emiti_arith },
+	{ ITM_ID(itm_or), PT_INT, OC_REG, OC_MEM, 1, "or", &x86_emiti_arith },
+	{ ITM_ID(itm_or), PT_INT, OC_IMM | OC_MEM, OC_REG,
+	  1, "or", &x86_emiti_arithc },
+	{ ITM_ID(itm_xor), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "xor", &x86_emiti_arith },
+	{ ITM_ID(itm_xor), PT_INT, OC_REG, OC_MEM, 1, "xor", &x86_emiti_arith },
+	{ ITM_ID(itm_xor), PT_INT, OC_IMM | OC_MEM, OC_REG,
+	  1, "xor", &x86_emiti_arithc },
+	{ ITM_ID(itm_shl), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_IMM,
+	  1, "shl", &x86_emiti_shift },
+	{ ITM_ID(itm_sal), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_IMM,
+	  1, "sal", &x86_emiti_shift },
+	{ ITM_ID(itm_shr), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_IMM,
+	  1, "shr", &x86_emiti_shift },
+	{ ITM_ID(itm_sar), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_IMM,
+	  1, "sar", &x86_emiti_shift },
+
+	// floating point arithmetic
+	{ ITM_ID(itm_add), PT_FLOAT, OC_XMM, OC_XMM | OC_MEM,
+	  3, "add", &x86_emiti_farith },
+	{ ITM_ID(itm_add), PT_FLOAT, OC_MEM, OC_XMM,
+	  3, "add", &x86_emiti_farithc },
+	{ ITM_ID(itm_sub), PT_FLOAT, OC_XMM, OC_XMM | OC_MEM,
+	  3, "sub", &x86_emiti_farith },
+	{ ITM_ID(itm_mul), PT_FLOAT, OC_XMM, OC_XMM | OC_MEM,
+	  5, "mul", &x86_emiti_farith },
+	{ ITM_ID(itm_mul), PT_FLOAT, OC_MEM, OC_XMM,
+	  5, "mul", &x86_emiti_farithc },
+	{ ITM_ID(itm_div), PT_FLOAT, OC_XMM, OC_XMM | OC_MEM,
+	  20, "div", &x86_emiti_farith },
+
+	// comparisons, the result is a condition flag
+	{ ITM_ID(itm_cmpeq), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmpeq), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpeq), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpeq), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpeq), PT_INT, OC_XMM, OC_XMM | OC_MEM,
+	  1, "ucomi", &x86_emit_fcmp },
+	{ ITM_ID(itm_cmpneq), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmpneq), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpneq), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpneq), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpneq), PT_INT, OC_XMM, OC_XMM | OC_MEM,
+	  1, "ucomi", &x86_emit_fcmp },
+	{ ITM_ID(itm_cmpgt), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmpgt), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgt), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgt), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgt), PT_INT, OC_XMM, OC_XMM | OC_MEM,
+	  1, "ucomi", &x86_emit_fcmp },
+	{ ITM_ID(itm_cmpgte), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmpgte), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgte), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgte), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmpgte), PT_INT, OC_XMM, OC_XMM | OC_MEM,
+	  1, "ucomi", &x86_emit_fcmp },
+	// ucomis operands are swapped for lt and lte
+	{ ITM_ID(itm_cmplt), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmplt), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplt), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplt), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplt), PT_INT, OC_XMM | OC_MEM, OC_XMM,
+	  1, "ucomi", &x86_emit_fcmp },
+	{ ITM_ID(itm_cmplte), PT_INT, OC_REG, OC_ZERO, 1, "test", &x86_emit_test },
+	{ ITM_ID(itm_cmplte), PT_INT, OC_REG | OC_SLOT, OC_REG | OC_SLOT | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplte), PT_INT, OC_REG, OC_MEM, 1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplte), PT_INT, OC_MEM, OC_REG | OC_IMM,
+	  1, "cmp", &x86_emit_cmp },
+	{ ITM_ID(itm_cmplte), PT_INT, OC_XMM | OC_MEM, OC_XMM,
+	  1, "ucomi", &x86_emit_fcmp },
+
+	// conversions
+	{ ITM_ID(itm_sext), PT_INT, OC_REG | OC_MEM, OC_NONE,
+	  1, "movs", &x86_emit_cast },
+	{ ITM_ID(itm_zext), PT_INT, OC_REG | OC_MEM, OC_NONE,
+	  1, "movz", &x86_emit_cast },
+	{ ITM_ID(itm_trunc), PT_INT, OC_REG, OC_NONE, 1, "mov", &x86_emit_cast },
+	{ ITM_ID(itm_bitcast), PT_INT | PT_FLOAT, OC_REG | OC_XMM, OC_NONE,
+	  1, "mov", &x86_emit_cast },
+	{ ITM_ID(itm_itof), PT_FLOAT, OC_REG, OC_NONE,
+	  4, "cvtsi2", &x86_emit_cast },
+	{ ITM_ID(itm_ftoi), PT_INT, OC_XMM, OC_NONE,
+	  4, "cvtt", &x86_emit_cast },
+	{ ITM_ID(itm_fext), PT_FLOAT, OC_XMM | OC_MEM, OC_NONE,
+	  4, "cvtss2sd", &x86_emit_cast },
+	{ ITM_ID(itm_ftrunc), PT_FLOAT, OC_XMM | OC_MEM, OC_NONE,
+	  4, "cvtsd2ss", &x86_emit_cast },
+
+	// selects
+	{ ITM_ID(itm_select), PT_INT, OC_FLAG | OC_REG | OC_SLOT, OC_IMM,
+	  1, "set", &x86_emit_select },
+	{ ITM_ID(itm_select), PT_INT, OC_FLAG | OC_REG | OC_SLOT,
+	  OC_REG | OC_SLOT, 2, "cmov", &x86_emit_select },
+
+	// control flow
+	{ ITM_ID(itm_jmp), PT_VOID, OC_BLOCK, OC_NONE, 1, "jmp", &x86_emit_jmp },
+	{ ITM_ID(itm_split), PT_VOID, OC_FLAG, OC_BLOCK,
+	  1, "j", &x86_emit_split },
+	{ ITM_ID(itm_split), PT_VOID, OC_REG | OC_SLOT, OC_BLOCK,
+	  2, "j", &x86_emit_split },
+	{ ITM_ID(itm_ret), PT_VOID, OC_ANY, OC_NONE, 1, "ret", &x86_emit_ret },
+	{ ITM_ID(itm_leave), PT_VOID, OC_NONE, OC_NONE, 1, "ret", &x86_emit_ret }
+};
+
+static enum x86pty x86_pty(struct ctype *ty)
+{
+	if (hastc(ty, TC_FLOATING))
+		return PT_FLOAT;
+	return ty == &cvoid ? PT_VOID : PT_INT;
+}
+
+static int x86_classlit(struct itm_literal *lit)
+{
+	if (hastc(lit->base.type, TC_FLOATING))
+		return OC_FLIT;
+
+	int res = OC_IMM;
+	int64_t v = itm_getsi(lit);
+	// immediates are sign extended to 64 bits
+	if (lit->base.type->size == 8 && (v < INT32_MIN || v > INT32_MAX))
+		res = OC_IMM64;
+	if (lit->value.i == 0)
+		res |= OC_ZERO;
+	else if (lit->value.i == 1)
+		res |= OC_ONE;
+	return res;
+}
+
+/*
+ * A load can be folded into its user if nothing comes between them, and the
+ * user is the only one to read it. x86 takes only one memory operand, so the
+ * user's result has to be in a register. The user may overwrite that before
+ * reading its memory operand, so it mustn't be part of the address.
+ */
+static bool x86_canfold(struct itm_instr *load, struct itm_instr *user)
+{
+	if (load->id != ITM_ID(itm_load) || load->next != user)
+		return false;
+
+	struct itm_tag *usest = itm_get_tag(&load->base, tt_uses);
+	if (!usest || itm_tag_geti(usest) != 1)
+		return false;
+
+	struct x86addr a;
+	if (!x86_getaddr(&a, list_head(load->operands), false))
+		return false;
+
+	struct location *rloc = x86_getloc(&user->base);
+	if (!rloc)
+		return true;
+	return rloc->type == LT_REG &&
+	       !(((struct loc_reg *)rloc->extended)->rid & x86_addrregs(&a));
+}
+
+/*
+ * A left shift by one to three bits can be folded into the addition that
+ * immediately follows it as its only user, which is then emitted as a lea
+ * with the shifted operand as its scaled index.
+ */
+static bool x86_canscale(struct itm_instr *sh, struct itm_instr *user)
+{
+	if (sh->id != ITM_ID(itm_shl) || user->id != ITM_ID(itm_add) ||
+	    sh->next != user || getcpu()->bits < 32)
+		return false;
+
+	int size = user->base.type->size;
+	struct itm_expr *k = list_last(sh->operands);
+	if ((size != 4 && size != 8) || k->etype != ITME_LITERAL ||
+	    ((struct itm_literal *)k)->value.i - 1 > 2)
+		return false;
+
+	struct itm_tag *usest = itm_get_tag(&sh->base, tt_uses);
+	return usest && itm_tag_geti(usest) == 1 &&
+	       x86_inreg(list_head(sh->operands)) && x86_inreg(&user->base);
+}
+
+static bool x86_isaddrpos(struct itm_instr *i, int k)
+{
+	return (i->id == ITM_ID(itm_load) && k == 0) ||
+	       (i->id == ITM_ID(itm_store) && k == 1) ||
+	       (x86_isaddr(i) && k == 0);
+}
+
+static bool x86_writes(struct itm_instr *i, regid_t rids)
+{
+	struct location *loc = x86_getloc(&i->base);
+	return loc && loc->type == LT_REG &&
+	       (((struct loc_reg *)loc->extended)->rid & rids);
+}
+
+/*
+ * A getptr or deepptr is folded into its users if they all follow it in its
+ * block, and take it as an address which can still be encoded after folding.
+ * None of the registers the address is made of may be overwritten before the
+ * last of them.
+ */
+static void x86_foldaddr(struct itm_instr *i)
+{
+	struct x86addr a;
+	struct itm_tag *usest = itm_get_tag(&i->base, tt_uses);
+	if (!usest || !x86_getaddr(&a, &i->base, true))
+		return;
+
+	regid_t rids = x86_addrregs(&a);
+	int uses = itm_tag_geti(usest), seen = 0;
+	bool res = true;
+
+	// users that are getptrs themselves are matched as if i were folded
+	itm_tag_expr(&i->base, new_itm_tag(tt_folded, TO_NONE));
+	for (struct itm_instr *u = i->next; u && res && seen < uses;
+	     u = u->next) {
+		bool used = false;
+		struct itm_expr *e;
+		int k = 0;
+		it_t it = list_iterator(u->operands);
+		while (iterator_next(&it, (void **)&e)) {
+			if (e == &i->base) {
+				used = true;
+				++seen;
+				res = res && x86_isaddrpos(u, k);
+			}
+			++k;
+		}
+
+		struct x86addr ua;
+		if (res && used && x86_isaddr(u))
+			res = x86_getaddr(&ua, &u->base, true);
+		if (res && seen < uses && x86_writes(u, rids))
+			res = false;
+	}
+
+	if (!res || seen < uses)
+		itm_untag_expr(&i->base, tt_folded);
+}
+
+// the classes operand k of i falls in, OC_NONE if there isn't one
+static int x86_classify(struct itm_instr *i, int k)
+{
+	if (list_length(i->operands) <= k)
+		return OC_NONE;
+
+	struct itm_expr *e = get_list_item(i->operands, k);
+	switch (e->etype) {
+	case ITME_LITERAL:
+		return x86_classlit((struct itm_literal *)e);
+	case ITME_UNDEF:
+		return OC_UNDEF;
+	case ITME_BLOCK:
+		return OC_BLOCK;
+	case ITME_INSTRUCTION:
+		break;
+	default:
+		return 0;
+	}
+
+	struct itm_instr *ei = (struct itm_instr *)e;
+	if (ei->id == ITM_ID(itm_alloca))
+		return OC_FRAME;
+	if (x86_isaddr(ei) && x86_isfolded(e))
+		return OC_ADDR;
+
+	int res = x86_canfold(ei, i) ? OC_MEM : 0;
+	if (x86_canscale(ei, i))
+		res |= OC_SCALE;
+	struct location *loc = x86_getloc(e);
+	if (!loc)
+		return res;
+	if (loc->type != LT_REG)
+		return res | OC_SLOT;
+
+	regid_t rid = ((struct loc_reg *)loc->extended)->rid;
+	if (rid >= eflag.id && rid <= beflag.id)
+		return res | OC_FLAG;
+	if (rid >= xmm0.id && rid <= xmm15.id)
+		return res | OC_XMM;
+	return res | OC_REG;
+}
+
+/*
+ * The classes operand k of i may fall in once it's allocated, with values
+ * either in a register or in a slot. The operands in the mask inreg are taken
+ * to have been moved into a register.
+ */
+static int x86_allocclass(struct itm_instr *i, int k, bool slot, int inreg)
+{
+	if (list_length(i->operands) <= k)
+		return OC_NONE;
+
+	struct itm_expr *e = get_list_item(i->operands, k);
+	if (inreg & (1 << k))
+		return OC_REG;
+	switch (e->etype) {
+	case ITME_LITERAL:
+		return x86_classlit((struct itm_literal *)e);
+	case ITME_UNDEF:
+		return OC_UNDEF;
+	case ITME_BLOCK:
+		return OC_BLOCK;
+	case ITME_INSTRUCTION:
+		break;
+	default:
+		return 0;
+	}
+
+	if (((struct itm_instr *)e)->id == ITM_ID(itm_alloca))
+		return OC_FRAME;
+
+	struct location *loc = x86_getloc(e);
+	if (loc && loc->type == LT_REG) {
+		regid_t rid = ((struct loc_reg *)loc->extended)->rid;
+		if (rid >= eflag.id && rid <= beflag.id)
+			return OC_FLAG;
+	}
+	if (slot)
+		return OC_SLOT;
+	return x86_isfloat(e) ? OC_XMM : OC_REG;
+}
+
+static bool x86_haspat(struct itm_instr *i, bool slot, int inreg)
+{
+	int lc = x86_allocclass(i, 0, slot, inreg);
+	int rc = x86_allocclass(i, 1, slot, inreg);
+	enum x86pty ty = x86_pty(i->base.type);
+
+	for (int k = 0; k < sizeof(x86pats) / sizeof(*x86pats); ++k) {
+		const struct x86pat *p = &x86pats[k];
+		if (p->id == i->id && (p->ty & ty) && (p->l & lc) &&
+		    (p->r & rc))
+			return true;
+	}
+	return false;
+}
+
+// the integer literals among the first two operands of i, as a mask
+static int x86_intlits(struct itm_instr *i)
+{
+	int res = 0;
+	for (int k = 0; k < 2 && k < list_length(i->operands); ++k) {
+		struct itm_expr *e = get_list_item(i->operands, k);
+		if (e->etype == ITME_LITERAL && !x86_isfloat(e))
+			res |= 1 << k;
+	}
+	return res;
+}
+
+/*
+ * Integer literals no pattern takes where they are, like the left operand of
+ * a comparison, both operands of an addition or a 64-bit immediate, are moved
+ * into a register of their own first, if a pattern takes them there. Done
+ * last, so that only the literals the other restrictions left are considered.
+ */
+static void x86_restrictimm(struct itm_instr *i)
+{
+	if (i->id == ITM_ID(itm_mov) || i->id == ITM_ID(itm_phi))
+		return;
+
+	for (int k = 0; k < 2; ++k) {
+		int lits = x86_intlits(i);
+		if (!(lits & (1 << k)))
+			continue;
+
+		bool move = false;
+		for (int slot = 0; slot < 2; ++slot)
+			move |= !x86_haspat(i, slot, 0) &&
+				x86_haspat(i, slot, lits);
+		if (!move)
+			continue;
+
+		struct itm_instr *mov = itm_mov(i->block,
+			get_list_item(i->operands, k));
+		itm_inserti(mov, i);
+		set_list_item(i->operands, k, mov);
+	}
+}
+
+static void x86_pattostr(FILE *f, void *p)
+{
+	const char *mnem = ((const struct x86pat *)p)->mnem;
+	fprintf(f, "%s", mnem ? mnem : "-");
+}
+
+// loads and shifts matched as a register have to be emitted after all
+static int x86_loadcost(struct itm_instr *i, int k, int c, int pc)
+{
+	if (!(c & (OC_MEM | OC_SCALE) & ~pc))
+		return 0;
+	return x86_getpat(get_list_item(i->operands, k))->cost;
+}
+
+static void x86_fold(struct itm_instr *i, int k)
+{
+	struct itm_expr *load = get_list_item(i->operands, k);
+	itm_tag_expr(load, new_itm_tag(tt_folded, TO_NONE));
+}
+
+static void x86_selecti(struct itm_instr *i)
+{
+	int lc = x86_classify(i, 0);
+	int rc = x86_classify(i, 1);
+	enum x86pty ty = x86_pty(i->base.type);
+
+	const struct x86pat *best = NULL;
+	int bestcost = 0;
+	for (int k = 0; k < sizeof(x86pats) / sizeof(*x86pats); ++k) {
+		const struct x86pat *p = &x86pats[k];
+		if (p->id != i->id || !(p->ty & ty) ||
+		    !(p->l & lc) || !(p->r & rc))
+			continue;
+
+		int cost = p->cost + x86_loadcost(i, 0, lc, p->l) +
+			x86_loadcost(i, 1, rc, p->r);
+		if (!best || cost < bestcost) {
+			best = p;
+			bestcost = cost;
+		}
+	}
+
+	if (!best) {
+		report(E_INTERNAL, NULL,
+			"no x86 instruction pattern matches '%s'", i->operation);
+		return;
+	}
+
+	struct itm_tag *tag = new_itm_tag(tt_pattern, TO_USER_PTR);
+	itm_tag_set_user_ptr(tag, (void *)best, &x86_pattostr);
+	itm_tag_expr(&i->base, tag);
+
+	if ((lc & OC_MEM) && (best->l & OC_MEM))
+		x86_fold(i, 0);
+	if ((rc & OC_MEM) && (best->r & OC_MEM))
+		x86_fold(i, 1);
+	if ((lc & OC_SCALE) && (best->l & OC_SCALE))
+		x86_fold(i, 0);
+	if ((rc & OC_SCALE) && (best->r & OC_SCALE))
+		x86_fold(i, 1);
+	if (x86_isaddr(i))
+		x86_foldaddr(i);
+}
+
+static void x86_select(struct itm_block *b)
+{
+	// count the uses of every instruction first, loads are folded by them
+	for (struct itm_block *bl = b; bl; bl = bl->lexnext) {
+		for (struct itm_instr *i = bl->first; i; i = i->next) {
+			struct itm_expr *e;
+			it_t it = list_iterator(i->operands);
+			while (iterator_next(&it, (void **)&e)) {
+				if (e->etype != ITME_INSTRUCTION)
+					continue;
+				struct itm_tag *tag = itm_get_tag(e, tt_uses);
+				if (!tag) {
+					tag = new_itm_tag(tt_uses, TO_INT);
+					itm_tag_expr(e, tag);
+				}
+				itm_tag_seti(tag, itm_tag_geti(tag) + 1);
+			}
+		}
 	}
 
-	if (re == &rimm.base)
-		delete_asm_imm(&rimm);
-	if (le == &limm.base)
-		delete_asm_imm(&limm);
+	for (; b; b = b->lexnext)
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			x86_selecti(i);
+}
+
+static void x86_emiti(FILE *f, struct itm_instr *i, struct list *bldict)
+{
+	if (x86_isfolded(&i->base))
+		return;
 
-	return i->next;
+	const struct x86pat *p = x86_getpat(i);
+	if (p->emit)
+		p->emit(f, i, p, bldict);
 }
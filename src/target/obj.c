@@ -0,0 +1,570 @@
+/*
+ * Relocatable object files
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <acc/target/obj.h>
+#include <acc/target/cpu.h>
+#include <acc/error.h>
+#include <acc/list.h>
+
+struct objbuf {
+	unsigned char *data;
+	size_t len, cap;
+};
+
+struct objsect {
+	struct objbuf buf;
+	size_t size;	// of .bss, which has no data
+	size_t align;
+	struct list *relocs;
+};
+
+struct objsym {
+	char *name;
+	enum section sec;	// SECTION_INVALID if undefined
+	size_t value;
+	bool global;
+	int index;		// in the symbol table
+};
+
+struct objrel {
+	size_t offset;
+	enum objreloc type;
+	struct objsym *sym;
+	int64_t addend;
+};
+
+// in the order of enum section
+#define OBJ_NSECTS 5
+
+struct objfile {
+	struct objsect sects[OBJ_NSECTS];
+	enum section cur;
+	struct list *syms;
+};
+
+static void buf_grow(struct objbuf *b, size_t size)
+{
+	if (b->len + size <= b->cap)
+		return;
+
+	while (b->len + size > b->cap)
+		b->cap = b->cap ? b->cap * 2 : 256;
+	b->data = realloc(b->data, b->cap);
+}
+
+static void buf_put(struct objbuf *b, const void *data, size_t size)
+{
+	buf_grow(b, size);
+	if (data)
+		memcpy(b->data + b->len, data, size);
+	else
+		memset(b->data + b->len, 0, size);
+	b->len += size;
+}
+
+// little endian, like every cpu acc targets
+static void buf_int(struct objbuf *b, uint64_t value, int size)
+{
+	buf_grow(b, size);
+	for (int i = 0; i < size; ++i)
+		b->data[b->len++] = (value >> (i * 8)) & 0xff;
+}
+
+static void buf_align(struct objbuf *b, size_t align)
+{
+	while (b->len % align)
+		buf_int(b, 0, 1);
+}
+
+// strings in a string table, which start with an empty one
+static size_t buf_str(struct objbuf *b, const char *str)
+{
+	size_t at = b->len;
+	buf_put(b, str, strlen(str) + 1);
+	return at;
+}
+
+struct objfile *new_objfile(void)
+{
+	struct objfile *o = calloc(1, sizeof(struct objfile));
+	for (int i = 0; i < OBJ_NSECTS; ++i) {
+		o->sects[i].align = 1;
+		o->sects[i].relocs = new_list(NULL, 0);
+	}
+	o->sects[SECTION_TEXT].align = 16;
+	o->cur = SECTION_TEXT;
+	o->syms = new_list(NULL, 0);
+	return o;
+}
+
+static void delete_objsym(void *p)
+{
+	struct objsym *sym = p;
+	free(sym->name);
+	free(sym);
+}
+
+void delete_objfile(struct objfile *o)
+{
+	for (int i = 0; i < OBJ_NSECTS; ++i) {
+		free(o->sects[i].buf.data);
+		delete_list(o->sects[i].relocs, &free);
+	}
+	delete_list(o->syms, &delete_objsym);
+	free(o);
+}
+
+void obj_section(struct objfile *o, enum section sec)
+{
+	assert(sec != SECTION_INVALID);
+	o->cur = sec;
+}
+
+size_t obj_offset(struct objfile *o)
+{
+	struct objsect *s = &o->sects[o->cur];
+	return o->cur == SECTION_BSS ? s->size : s->buf.len;
+}
+
+void obj_bytes(struct objfile *o, const void *data, size_t size)
+{
+	assert(o->cur != SECTION_BSS);
+	buf_put(&o->sects[o->cur].buf, data, size);
+}
+
+void obj_int(struct objfile *o, uint64_t value, int size)
+{
+	assert(o->cur != SECTION_BSS);
+	buf_int(&o->sects[o->cur].buf, value, size);
+}
+
+void obj_zeroes(struct objfile *o, size_t size)
+{
+	if (o->cur == SECTION_BSS)
+		o->sects[o->cur].size += size;
+	else
+		buf_put(&o->sects[o->cur].buf, NULL, size);
+}
+
+void obj_align(struct objfile *o, size_t align)
+{
+	struct objsect *s = &o->sects[o->cur];
+	if (align > s->align)
+		s->align = align;
+
+	size_t off = obj_offset(o);
+	if (off % align)
+		obj_zeroes(o, align - off % align);
+}
+
+struct objsym *obj_symbol(struct objfile *o, const char *name)
+{
+	struct objsym *sym;
+	it_t it = list_iterator(o->syms);
+	while (iterator_next(&it, (void **)&sym))
+		if (!strcmp(sym->name, name))
+			return sym;
+
+	sym = calloc(1, sizeof(struct objsym));
+	sym->name = malloc(strlen(name) + 1);
+	strcpy(sym->name, name);
+	sym->sec = SECTION_INVALID;
+	list_push_back(o->syms, sym);
+	return sym;
+}
+
+void obj_define(struct objfile *o, struct objsym *sym)
+{
+	if (sym->sec != SECTION_INVALID)
+		report(E_INTERNAL, NULL, "symbol '%s' is already defined",
+			sym->name);
+
+	sym->sec = o->cur;
+	sym->value = obj_offset(o);
+}
+
+void obj_global(struct objfile *o, struct objsym *sym)
+{
+	sym->global = true;
+}
+
+bool obj_defined(struct objsym *sym, enum section *sec, size_t *offset)
+{
+	if (sym->sec == SECTION_INVALID)
+		return false;
+
+	*sec = sym->sec;
+	*offset = sym->value;
+	return true;
+}
+
+void obj_reloc(struct objfile *o, size_t offset, enum objreloc type,
+	struct objsym *sym, int64_t addend)
+{
+	struct objrel *r = malloc(sizeof(struct objrel));
+	r->offset = offset;
+	r->type = type;
+	r->sym = sym;
+	r->addend = addend;
+	list_push_back(o->sects[o->cur].relocs, r);
+}
+
+/*
+ * ELF
+ */
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHT_NOBITS 8
+#define SHT_REL 9
+
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+
+#define EM_386 3
+#define EM_X86_64 62
+
+struct elfshdr {
+	size_t name;
+	int type;
+	uint64_t flags;
+	size_t offset, size;
+	int link, info;
+	size_t align, entsize;
+};
+
+static const struct {
+	const char *name;
+	int type;
+	uint64_t flags;
+} elfsects[OBJ_NSECTS] = {
+	{ NULL, 0, 0 },
+	{ ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR },
+	{ ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE },
+	{ ".rodata", SHT_PROGBITS, SHF_ALLOC },
+	{ ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE }
+};
+
+static int elf_reltype(enum objreloc type, bool is64)
+{
+	switch (type) {
+	case OR_ABS32:
+		return is64 ? 10 : 1;	// R_X86_64_32, R_386_32
+	case OR_ABS32S:
+		return is64 ? 11 : 1;	// R_X86_64_32S
+	case OR_ABS64:
+		assert(is64);
+		return 1;		// R_X86_64_64
+	case OR_PC32:
+		return 2;		// R_X86_64_PC32, R_386_PC32
+	case OR_PLT32:
+		return 4;		// R_X86_64_PLT32, R_386_PLT32
+	}
+
+	assert(false);
+	return 0;
+}
+
+static void elf_sym(struct objbuf *b, bool is64, size_t name, int bind,
+	int type, int shndx, uint64_t value)
+{
+	int info = (bind << 4) | type;
+	if (is64) {
+		buf_int(b, name, 4);
+		buf_int(b, info, 1);
+		buf_int(b, 0, 1);
+		buf_int(b, shndx, 2);
+		buf_int(b, value, 8);
+		buf_int(b, 0, 8);
+	} else {
+		buf_int(b, name, 4);
+		buf_int(b, value, 4);
+		buf_int(b, 0, 4);
+		buf_int(b, info, 1);
+		buf_int(b, 0, 1);
+		buf_int(b, shndx, 2);
+	}
+}
+
+/*
+ * The symbol table lists the sections first, then the named local symbols
+ * and then the global ones. Symbols local to the assembler aren't listed.
+ */
+static int elf_symtab(struct objfile *o, bool is64, struct objbuf *symtab,
+	struct objbuf *strtab, int *nlocal)
+{
+	int index = 0;
+	elf_sym(symtab, is64, 0, STB_LOCAL, STT_NOTYPE, 0, 0);
+	++index;
+	for (int s = 1; s < OBJ_NSECTS; ++s, ++index)
+		elf_sym(symtab, is64, 0, STB_LOCAL, STT_SECTION, s, 0);
+
+	for (int global = 0; global < 2; ++global) {
+		if (global)
+			*nlocal = index;
+
+		struct objsym *sym;
+		it_t it = list_iterator(o->syms);
+		while (iterator_next(&it, (void **)&sym)) {
+			if (sym->global != global || !strncmp(sym->name, ".L", 2))
+				continue;
+			// referring to an undefined symbol makes it global
+			if (!global && sym->sec == SECTION_INVALID)
+				continue;
+
+			int type = STT_NOTYPE;
+			if (sym->sec == SECTION_TEXT)
+				type = STT_FUNC;
+			else if (sym->sec != SECTION_INVALID)
+				type = STT_OBJECT;
+			sym->index = index++;
+			elf_sym(symtab, is64, buf_str(strtab, sym->name),
+				global ? STB_GLOBAL : STB_LOCAL, type,
+				sym->sec, sym->value);
+		}
+	}
+
+	struct objsym *sym;
+	it_t it = list_iterator(o->syms);
+	while (iterator_next(&it, (void **)&sym)) {
+		if (sym->global || sym->sec != SECTION_INVALID ||
+		    !strncmp(sym->name, ".L", 2))
+			continue;
+		sym->index = index++;
+		elf_sym(symtab, is64, buf_str(strtab, sym->name),
+			STB_GLOBAL, STT_NOTYPE, 0, 0);
+	}
+	return index;
+}
+
+/*
+ * 64 bit objects keep the addends in the relocations, 32 bit ones in the
+ * fields relocated.
+ */
+static void elf_relocs(struct objfile *o, enum section s, bool is64,
+	struct objbuf *out)
+{
+	struct objrel *r;
+	it_t it = list_iterator(o->sects[s].relocs);
+	while (iterator_next(&it, (void **)&r)) {
+		struct objsym *sym = r->sym;
+		int64_t addend = r->addend;
+		int index = sym->index;
+		if (!strncmp(sym->name, ".L", 2)) {
+			if (sym->sec == SECTION_INVALID)
+				report(E_INTERNAL, NULL,
+					"undefined local symbol '%s'",
+					sym->name);
+			// the section symbols come first
+			index = sym->sec;
+			addend += sym->value;
+		}
+
+		int type = elf_reltype(r->type, is64);
+		if (is64) {
+			buf_int(out, r->offset, 8);
+			buf_int(out, ((uint64_t)index << 32) | type, 8);
+			buf_int(out, addend, 8);
+		} else {
+			unsigned char *field = o->sects[s].buf.data + r->offset;
+			uint32_t v = field[0] | (field[1] << 8) |
+				(field[2] << 16) | ((uint32_t)field[3] << 24);
+			v += addend;
+			for (int i = 0; i < 4; ++i)
+				field[i] = (v >> (i * 8)) & 0xff;
+			buf_int(out, r->offset, 4);
+			buf_int(out, ((uint32_t)index << 8) | type, 4);
+		}
+	}
+}
+
+static void elf_shdr(struct objbuf *b, bool is64, struct elfshdr *h)
+{
+	int word = is64 ? 8 : 4;
+	buf_int(b, h->name, 4);
+	buf_int(b, h->type, 4);
+	buf_int(b, h->flags, word);
+	buf_int(b, 0, word);
+	buf_int(b, h->offset, word);
+	buf_int(b, h->size, word);
+	buf_int(b, h->link, 4);
+	buf_int(b, h->info, 4);
+	buf_int(b, h->align, word);
+	buf_int(b, h->entsize, word);
+}
+
+void obj_write_elf(struct objfile *o, FILE *f)
+{
+	bool is64 = getcpu()->bits == 64;
+	int word = is64 ? 8 : 4;
+	struct objbuf file = { 0 }, shstrtab = { 0 }, symtab = { 0 },
+		strtab = { 0 }, rel = { 0 };
+	// null, sections, relocations, .note.GNU-stack, .symtab, .strtab,
+	// .shstrtab
+	struct elfshdr shdrs[OBJ_NSECTS * 2 + 4];
+	int nshdrs = OBJ_NSECTS;
+	memset(shdrs, 0, sizeof(shdrs));
+
+	buf_str(&shstrtab, "");
+	buf_str(&strtab, "");
+	int nlocal;
+#ifndef NDEBUG
+	int nsyms =
+#endif
+	elf_symtab(o, is64, &symtab, &strtab, &nlocal);
+
+	// the header is written last, when the offsets are known
+	buf_put(&file, NULL, is64 ? 64 : 52);
+
+	for (int s = 1; s < OBJ_NSECTS; ++s) {
+		struct objsect *sect = &o->sects[s];
+		struct elfshdr *h = &shdrs[s];
+		h->name = buf_str(&shstrtab, elfsects[s].name);
+		h->type = elfsects[s].type;
+		h->flags = elfsects[s].flags;
+		h->align = sect->align;
+		h->size = s == SECTION_BSS ? sect->size : sect->buf.len;
+	}
+
+	// relocations patch the sections on 32 bit, so they go first
+	for (int s = 1; s < OBJ_NSECTS; ++s) {
+		if (!list_length(o->sects[s].relocs))
+			continue;
+
+		struct elfshdr *h = &shdrs[nshdrs++];
+		char name[16];
+		sprintf(name, ".rel%s%s", is64 ? "a" : "", elfsects[s].name);
+		h->name = buf_str(&shstrtab, name);
+		h->type = is64 ? SHT_RELA : SHT_REL;
+		h->flags = SHF_INFO_LINK;
+		h->info = s;
+		h->align = word;
+		h->entsize = is64 ? 24 : 8;
+		h->offset = rel.len;
+		elf_relocs(o, s, is64, &rel);
+		h->size = rel.len - h->offset;
+	}
+
+	for (int s = 1; s < OBJ_NSECTS; ++s) {
+		if (s == SECTION_BSS)
+			continue;
+		buf_align(&file, o->sects[s].align);
+		shdrs[s].offset = file.len;
+		buf_put(&file, o->sects[s].buf.data, o->sects[s].buf.len);
+	}
+	shdrs[SECTION_BSS].offset = file.len;
+
+	buf_align(&file, word);
+	size_t reloff = file.len;
+	buf_put(&file, rel.data, rel.len);
+	for (int i = OBJ_NSECTS; i < nshdrs; ++i)
+		shdrs[i].offset += reloff;
+
+	// no executable stack
+	struct elfshdr *note = &shdrs[nshdrs++];
+	note->name = buf_str(&shstrtab, ".note.GNU-stack");
+	note->type = SHT_PROGBITS;
+	note->align = 1;
+	note->offset = file.len;
+
+	int symtabidx = nshdrs;
+	struct elfshdr *sh = &shdrs[nshdrs++];
+	sh->name = buf_str(&shstrtab, ".symtab");
+	sh->type = SHT_SYMTAB;
+	sh->link = symtabidx + 1;
+	sh->info = nlocal;
+	sh->align = word;
+	sh->entsize = is64 ? 24 : 16;
+	buf_align(&file, word);
+	sh->offset = file.len;
+	sh->size = symtab.len;
+	buf_put(&file, symtab.data, symtab.len);
+#ifndef NDEBUG
+	assert(symtab.len == nsyms * sh->entsize);
+#endif
+
+	sh = &shdrs[nshdrs++];
+	sh->name = buf_str(&shstrtab, ".strtab");
+	sh->type = SHT_STRTAB;
+	sh->align = 1;
+	sh->offset = file.len;
+	sh->size = strtab.len;
+	buf_put(&file, strtab.data, strtab.len);
+
+	sh = &shdrs[nshdrs++];
+	sh->name = buf_str(&shstrtab, ".shstrtab");
+	sh->type = SHT_STRTAB;
+	sh->align = 1;
+	sh->offset = file.len;
+	sh->size = shstrtab.len;
+	buf_put(&file, shstrtab.data, shstrtab.len);
+
+	for (int i = OBJ_NSECTS; i < nshdrs; ++i)
+		if (shdrs[i].type == SHT_RELA || shdrs[i].type == SHT_REL)
+			shdrs[i].link = symtabidx;
+
+	buf_align(&file, word);
+	size_t shoff = file.len;
+	for (int i = 0; i < nshdrs; ++i)
+		elf_shdr(&file, is64, &shdrs[i]);
+
+	struct objbuf hdr = { 0 };
+	buf_put(&hdr, "\177ELF", 4);
+	buf_int(&hdr, is64 ? 2 : 1, 1);		// class
+	buf_int(&hdr, 1, 1);			// little endian
+	buf_int(&hdr, 1, 1);			// version
+	buf_put(&hdr, NULL, 9);
+	buf_int(&hdr, 1, 2);			// relocatable
+	buf_int(&hdr, is64 ? EM_X86_64 : EM_386, 2);
+	buf_int(&hdr, 1, 4);
+	buf_int(&hdr, 0, word);			// entry
+	buf_int(&hdr, 0, word);			// program headers
+	buf_int(&hdr, shoff, word);
+	buf_int(&hdr, 0, 4);			// flags
+	buf_int(&hdr, is64 ? 64 : 52, 2);
+	buf_int(&hdr, 0, 2);
+	buf_int(&hdr, 0, 2);
+	buf_int(&hdr, is64 ? 64 : 40, 2);
+	buf_int(&hdr, nshdrs, 2);
+	buf_int(&hdr, nshdrs - 1, 2);		// .shstrtab
+	memcpy(file.data, hdr.data, hdr.len);
+
+	fwrite(file.data, 1, file.len, f);
+
+	free(hdr.data);
+	free(file.data);
+	free(shstrtab.data);
+	free(symtab.data);
+	free(strtab.data);
+	free(rel.data);
+}
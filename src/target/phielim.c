@@ -0,0 +1,232 @@
+/*
+ * Phi elimination
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ *
+ * Phis are eliminated after register allocation, by copying each phi operand
+ * into the location of its phi at the end of the corresponding predecessor.
+ * All phis of a block take their values at the same time, so the copies of a
+ * single edge form a parallel copy, which is sequenced here such that no
+ * location is overwritten before it is read. Cycles are broken by swapping two
+ * locations, so no temporaries are needed.
+ *
+ * The copies have to go on the edge itself, so edges leaving a block with
+ * more than one successor are given a block of their own first.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include <acc/target/asm.h>
+#include <acc/itm/ast.h>
+
+static bool hasphis(struct itm_block *b)
+{
+	return b->first && b->first->id == ITM_ID(itm_phi);
+}
+
+static void repblock(struct list *l, struct itm_block *from,
+	struct itm_block *to)
+{
+	for (int i = 0; i < list_length(l); ++i)
+		if (get_list_item(l, i) == from)
+			set_list_item(l, i, to);
+}
+
+static void splitedge(struct itm_block *pred, struct itm_block *succ)
+{
+	struct itm_block *mid = new_itm_block(pred->container);
+	itm_jmp(mid, succ);
+
+	// keep it close to pred, so that the branch may fall through to it
+	mid->lexnext = pred->lexnext;
+	if (mid->lexnext)
+		mid->lexnext->lexprev = mid;
+	itm_lex_progress(pred, mid);
+
+	repblock(pred->next, succ, mid);
+	repblock(succ->previous, pred, mid);
+	list_push_back(mid->previous, pred);
+	list_push_back(mid->next, succ);
+
+	repblock(pred->last->operands, succ, mid);
+	for (struct itm_instr *i = succ->first;
+	     i && i->id == ITM_ID(itm_phi); i = i->next)
+		repblock(i->operands, pred, mid);
+}
+
+void splitcrit(struct itm_block *b)
+{
+	for (; b; b = b->lexnext) {
+		if (list_length(b->next) < 2)
+			continue;
+
+		struct itm_block *succ;
+		for (int i = 0; i < list_length(b->next); ++i) {
+			succ = get_list_item(b->next, i);
+			if (hasphis(succ))
+				splitedge(b, succ);
+		}
+	}
+}
+
+
+static struct location *getloc(struct itm_expr *e)
+{
+	struct itm_tag *tag = itm_get_tag(e, tt_loc);
+	return tag ? itm_tag_get_user_ptr(tag) : NULL;
+}
+
+static bool loceq(struct location *a, struct location *b)
+{
+	if (!a || !b || a->type != b->type)
+		return false;
+
+	switch (a->type) {
+	case LT_REG:
+		return ((struct loc_reg *)a->extended)->rid ==
+		       ((struct loc_reg *)b->extended)->rid;
+	case LT_LMEM:
+	case LT_PMEM:
+		return ((struct loc_mem *)a->extended)->offset ==
+		       ((struct loc_mem *)b->extended)->offset;
+	default:
+		return a == b;
+	}
+}
+
+static struct pcopy *new_pcopy(struct ctype *ty, struct location *dst,
+	struct location *src, struct itm_expr *val)
+{
+	struct pcopy *c = malloc(sizeof(struct pcopy));
+	c->swap = false;
+	c->width = ty->size;
+	c->type = ty;
+	c->dst = dst;
+	c->src = src;
+	c->val = val;
+	return c;
+}
+
+// tests whether dst is still to be read by any of the pending copies
+static bool isread(struct list *pending, struct location *dst)
+{
+	struct pcopy *c;
+	it_t it = list_iterator(pending);
+	while (iterator_next(&it, (void **)&c))
+		if (loceq(c->src, dst))
+			return true;
+	return false;
+}
+
+static void dropnops(struct list *pending)
+{
+	for (int i = 0; i < list_length(pending); ++i) {
+		struct pcopy *c = get_list_item(pending, i);
+		if (loceq(c->src, c->dst)) {
+			list_remove(pending, c);
+			free(c);
+			--i;
+		}
+	}
+}
+
+struct list *phicopies(struct itm_block *pred, struct itm_block *succ)
+{
+	struct list *res = new_list(NULL, 0);
+	struct list *pending = new_list(NULL, 0);
+	struct list *consts = new_list(NULL, 0);
+
+	for (struct itm_instr *i = succ->first;
+	     i && i->id == ITM_ID(itm_phi); i = i->next) {
+		struct location *dst = getloc(&i->base);
+		if (!dst)
+			continue;
+
+		struct itm_block *from;
+		struct itm_expr *e;
+		it_t it = list_iterator(i->operands);
+		while (iterator_next(&it, (void **)&from)) {
+			iterator_next(&it, (void **)&e);
+			if (from != pred || e->etype == ITME_UNDEF)
+				continue;
+
+			/*
+			 * Frame addresses are locations, but are copied by
+			 * computing their address instead of reading them.
+			 */
+			struct location *src = NULL;
+			if (e->etype == ITME_INSTRUCTION &&
+			    ((struct itm_instr *)e)->id != ITM_ID(itm_alloca))
+				src = getloc(e);
+
+			struct pcopy *c = new_pcopy(i->base.type, dst, src, e);
+			list_push_back(src ? pending : consts, c);
+		}
+	}
+
+	dropnops(pending);
+	while (list_length(pending)) {
+		struct pcopy *c;
+		bool found = false;
+		it_t it = list_iterator(pending);
+		while (iterator_next(&it, (void **)&c)) {
+			if (!isread(pending, c->dst)) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			/*
+			 * Only cycles remain. Swapping breaks one up: afterwards
+			 * dst holds its final value, and the old value of dst,
+			 * which others still have to read, lives in src. Those
+			 * may read it wider than c does, so as much is swapped.
+			 */
+			c = list_head(pending);
+			c->swap = true;
+			struct pcopy *o;
+			it = list_iterator(pending);
+			while (iterator_next(&it, (void **)&o)) {
+				if (o != c && loceq(o->src, c->dst)) {
+					o->src = c->src;
+					if (o->type->size > c->width)
+						c->width = o->type->size;
+				}
+			}
+		}
+
+		list_remove(pending, c);
+		list_push_back(res, c);
+		dropnops(pending);
+	}
+
+	// constants don't read any location, so they are copied last
+	while (list_length(consts))
+		list_push_back(res, list_pop_front(consts));
+
+	delete_list(consts, NULL);
+	delete_list(pending, NULL);
+	return res;
+}
+
+void delete_phicopies(struct list *l)
+{
+	delete_list(l, &free);
+}
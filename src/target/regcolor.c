@@ -0,0 +1,1195 @@
+/*
+ * Graph coloring register allocation
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ *
+ *
+ * This is an iterated register coalescing allocator, as described by George
+ * and Appel, with Briggs' and George's conservative coalescing tests. It is
+ * used instead of the hint-based allocator in asm.c from -O2 upwards.
+ *
+ * The first NPHYS nodes of the interference graph represent the machine
+ * registers, one for each bit of regid_t. Every other node is an SSA-value.
+ * Values that were given a location before allocation (like the itm_movs
+ * inserted by the target to satisfy its constraints) are merged into the node
+ * of their register before coloring starts, so that coalescing with them
+ * removes the move altogether.
+ *
+ * Values that can't be colored are spilled to the stack: a store is inserted
+ * after their definition and a reload before each use, after which the graph
+ * is rebuilt and colored again. Spill slots are shared between values that
+ * don't interfere, and values that are cheap to recompute (literals and frame
+ * addresses) are rematerialized at each use instead. Phis read spilled values
+ * from their slot directly. The reloads themselves are never spilled, so every
+ * round spills values that weren't spilled before, and the loop ends.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <assert.h>
+
+#include <acc/target/asm.h>
+#include <acc/itm/analyze.h>
+#include <acc/itm/ast.h>
+#include <acc/itm/tag.h>
+#include <acc/list.h>
+#include <acc/error.h>
+#include <acc/timer.h>
+#include <acc/stats.h>
+
+enum {
+	NPHYS = sizeof(regid_t) * 8,
+	PHYSDEGREE = INT_MAX / 2
+};
+
+enum nstate {
+	NS_PRECOLORED,
+	NS_INITIAL,
+	NS_SIMPLIFY,
+	NS_FREEZE,
+	NS_SPILL,
+	NS_SPILLED,
+	NS_COALESCED,
+	NS_COLORED,
+	NS_SELECT,
+	NS_COUNT
+};
+
+enum mstate {
+	MS_WORKLIST,
+	MS_ACTIVE,
+	MS_COALESCED,
+	MS_CONSTRAINED,
+	MS_FROZEN,
+	MS_COUNT
+};
+
+struct intvec {
+	int *v;
+	int len;
+	int cap;
+};
+
+struct rnode {
+	struct itm_instr *instr;
+	enum nstate state;
+	int prev, next;
+
+	regid_t ok;	// the registers it may be given
+	int k;
+	int degree;
+	int alias;
+	int color;
+	double cost;
+	struct intvec adj;
+	struct intvec moves;
+};
+
+struct rmove {
+	int dst, src;
+	enum mstate state;
+	int prev, next;
+};
+
+struct rgraph {
+	struct archdes ades;
+
+	int nnodes;
+	struct rnode *nodes;
+	unsigned char *matrix;
+	int nwl[NS_COUNT];
+
+	int nmoves, capmoves;
+	struct rmove *moves;
+	int mwl[MS_COUNT];
+
+	int *stack;
+	int sp;
+};
+
+struct rslot {
+	int offset;
+	size_t size;
+	struct intvec members;
+};
+
+static const char *const rnodestr = "rnode";
+static const tagtype_t tt_rnode = &rnodestr;
+// temporaries introduced by spilling, which mustn't be spilled themselves
+static const char *const spilltmpstr = "spilltmp";
+static const tagtype_t tt_spilltmp = &spilltmpstr;
+
+static void vec_push(struct intvec *v, int i)
+{
+	if (v->len == v->cap) {
+		v->cap = v->cap ? v->cap * 2 : 8;
+		v->v = realloc(v->v, v->cap * sizeof(int));
+	}
+	v->v[v->len++] = i;
+}
+
+static int popcount(regid_t r)
+{
+	int c = 0;
+	for (; r; r &= r - 1)
+		++c;
+	return c;
+}
+
+static struct location *getloc(struct itm_instr *i)
+{
+	struct itm_tag *loct = itm_get_tag(&i->base, tt_loc);
+	return loct ? itm_tag_get_user_ptr(loct) : NULL;
+}
+
+// values already living in memory (like spill slots) don't get a node
+static bool isvalue(struct itm_instr *i)
+{
+	if (i->base.type == &cvoid || i->id == ITM_ID(itm_alloca))
+		return false;
+
+	struct location *loc = getloc(i);
+	return !loc || loc->type == LT_REG;
+}
+
+// returns -1 if e isn't an SSA-value with a node
+static int nodeof(struct itm_expr *e)
+{
+	if (e->etype != ITME_INSTRUCTION)
+		return -1;
+
+	struct itm_tag *tag = itm_get_tag(e, tt_rnode);
+	return tag ? itm_tag_geti(tag) : -1;
+}
+
+/*
+ * Node worklists
+ *
+ * Every node is in exactly one doubly linked list, identified by its state.
+ * The NS_COUNT and MS_COUNT states mean the node or move isn't in a list yet.
+ */
+static void setstate(struct rgraph *g, int n, enum nstate s)
+{
+	struct rnode *nd = &g->nodes[n];
+	if (nd->prev >= 0)
+		g->nodes[nd->prev].next = nd->next;
+	else if (nd->state != NS_COUNT && g->nwl[nd->state] == n)
+		g->nwl[nd->state] = nd->next;
+	if (nd->next >= 0)
+		g->nodes[nd->next].prev = nd->prev;
+
+	nd->state = s;
+	nd->prev = -1;
+	nd->next = g->nwl[s];
+	if (nd->next >= 0)
+		g->nodes[nd->next].prev = n;
+	g->nwl[s] = n;
+}
+
+static void setmstate(struct rgraph *g, int m, enum mstate s)
+{
+	struct rmove *mv = &g->moves[m];
+	if (mv->prev >= 0)
+		g->moves[mv->prev].next = mv->next;
+	else if (mv->state != MS_COUNT && g->mwl[mv->state] == m)
+		g->mwl[mv->state] = mv->next;
+	if (mv->next >= 0)
+		g->moves[mv->next].prev = mv->prev;
+
+	mv->state = s;
+	mv->prev = -1;
+	mv->next = g->mwl[s];
+	if (mv->next >= 0)
+		g->moves[mv->next].prev = m;
+	g->mwl[s] = m;
+}
+
+static bool adjset(struct rgraph *g, int u, int v)
+{
+	size_t bit = (size_t)u * g->nnodes + v;
+	return (g->matrix[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void setadj(struct rgraph *g, int u, int v)
+{
+	size_t bit = (size_t)u * g->nnodes + v;
+	g->matrix[bit / 8] |= 1 << (bit % 8);
+}
+
+static bool isprecolored(struct rgraph *g, int n)
+{
+	return g->nodes[n].state == NS_PRECOLORED;
+}
+
+static int getalias(struct rgraph *g, int n)
+{
+	while (g->nodes[n].state == NS_COALESCED)
+		n = g->nodes[n].alias;
+	return n;
+}
+
+static void addedge(struct rgraph *g, int u, int v)
+{
+	u = getalias(g, u);
+	v = getalias(g, v);
+	if (u == v || adjset(g, u, v))
+		return;
+	// different register classes never interfere
+	if (!(g->nodes[u].ok & g->nodes[v].ok))
+		return;
+
+	setadj(g, u, v);
+	setadj(g, v, u);
+	if (!isprecolored(g, u)) {
+		vec_push(&g->nodes[u].adj, v);
+		++g->nodes[u].degree;
+	}
+	if (!isprecolored(g, v)) {
+		vec_push(&g->nodes[v].adj, u);
+		++g->nodes[v].degree;
+	}
+}
+
+static void addmove(struct rgraph *g, int dst, int src)
+{
+	if (g->nmoves == g->capmoves) {
+		g->capmoves = g->capmoves ? g->capmoves * 2 : 16;
+		g->moves = realloc(g->moves, g->capmoves * sizeof(struct rmove));
+	}
+
+	int m = g->nmoves++;
+	struct rmove *mv = &g->moves[m];
+	mv->dst = dst;
+	mv->src = src;
+	mv->state = MS_COUNT;
+	mv->prev = mv->next = -1;
+	setmstate(g, m, MS_WORKLIST);
+
+	vec_push(&g->nodes[getalias(g, dst)].moves, m);
+	vec_push(&g->nodes[getalias(g, src)].moves, m);
+}
+
+
+/*
+ * Liveness
+ *
+ * Live sets are bit sets over all nodes. Phi operands are live at the end of
+ * the predecessor they're associated with, not at the start of the phi's block.
+ */
+struct liveset {
+	unsigned char *in;
+	unsigned char *out;
+};
+
+static int setbytes(struct rgraph *g)
+{
+	return (g->nnodes + 7) / 8;
+}
+
+static void bset(unsigned char *s, int i)
+{
+	s[i / 8] |= 1 << (i % 8);
+}
+
+static void bclr(unsigned char *s, int i)
+{
+	s[i / 8] &= ~(1 << (i % 8));
+}
+
+static bool btst(unsigned char *s, int i)
+{
+	return (s[i / 8] >> (i % 8)) & 1;
+}
+
+static int blockindex(struct itm_block *b)
+{
+	int i = 0;
+	while (b->lexprev) {
+		b = b->lexprev;
+		++i;
+	}
+	return i;
+}
+
+static void phiuses(struct rgraph *g, struct itm_block *pred,
+	struct itm_block *succ, unsigned char *s)
+{
+	for (struct itm_instr *i = succ->first;
+	     i && i->id == ITM_ID(itm_phi); i = i->next) {
+		struct itm_expr *e;
+		struct itm_block *from;
+		it_t it = list_iterator(i->operands);
+		while (iterator_next(&it, (void **)&from)) {
+			iterator_next(&it, (void **)&e);
+			int n = nodeof(e);
+			if (from == pred && n >= 0)
+				bset(s, n);
+		}
+	}
+}
+
+// transfers live-out into live-in for a single block
+static void transfer(struct rgraph *g, struct itm_block *b,
+	unsigned char *live)
+{
+	for (struct itm_instr *i = b->last; i; i = i->previous) {
+		int d = nodeof(&i->base);
+		if (d >= 0)
+			bclr(live, d);
+		if (i->id == ITM_ID(itm_phi))
+			continue;
+
+		struct itm_expr *e;
+		it_t it = list_iterator(i->operands);
+		while (iterator_next(&it, (void **)&e)) {
+			int n = nodeof(e);
+			if (n >= 0)
+				bset(live, n);
+		}
+	}
+}
+
+static struct liveset *liveness(struct rgraph *g, struct itm_block *strt,
+	int nblocks)
+{
+	int nb = setbytes(g);
+	struct liveset *ls = calloc(nblocks, sizeof(struct liveset));
+	for (int j = 0; j < nblocks; ++j) {
+		ls[j].in = calloc(nb, 1);
+		ls[j].out = calloc(nb, 1);
+	}
+
+	struct itm_block *last = strt;
+	while (last->lexnext)
+		last = last->lexnext;
+
+	unsigned char *tmp = malloc(nb);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		int j = nblocks - 1;
+		for (struct itm_block *b = last; b; b = b->lexprev, --j) {
+			struct liveset *l = &ls[j];
+
+			struct itm_block *s;
+			it_t it = list_iterator(b->next);
+			while (iterator_next(&it, (void **)&s)) {
+				unsigned char *sin = ls[blockindex(s)].in;
+				for (int k = 0; k < nb; ++k)
+					l->out[k] |= sin[k];
+				phiuses(g, b, s, l->out);
+			}
+
+			memcpy(tmp, l->out, nb);
+			transfer(g, b, tmp);
+			if (memcmp(tmp, l->in, nb)) {
+				memcpy(l->in, tmp, nb);
+				changed = true;
+			}
+		}
+	}
+
+	free(tmp);
+	return ls;
+}
+
+
+/*
+ * Graph construction
+ */
+static double loopweight(struct itm_block *b)
+{
+	struct itm_tag *tag = itm_get_tag(&b->base, tt_loopdepth);
+	int depth = tag ? itm_tag_geti(tag) : 0;
+	double w = 1.0;
+	// deeper nesting than this doesn't make the estimate any better
+	for (int i = 0; i < depth && i < 8; ++i)
+		w *= 10.0;
+	return w;
+}
+
+static void buildblock(struct rgraph *g, struct itm_block *b,
+	unsigned char *live)
+{
+	for (struct itm_instr *i = b->last; i; i = i->previous) {
+		if (i->id == ITM_ID(itm_phi))
+			break;
+
+		if (i->id == ITM_ID(itm_clobb)) {
+			struct itm_tag *loct = itm_get_tag(&i->base, tt_loc);
+			struct location *loc = loct ? itm_tag_get_user_ptr(loct) : NULL;
+			if (loc && loc->type == LT_REG) {
+				regid_t rid = ((struct loc_reg *)loc->extended)->rid;
+				for (int r = 0; r < NPHYS; ++r) {
+					if (!(rid & (1ul << r)))
+						continue;
+					for (int l = NPHYS; l < g->nnodes; ++l)
+						if (btst(live, l))
+							addedge(g, r, l);
+				}
+			}
+		}
+
+		int d = nodeof(&i->base);
+		if (d >= 0) {
+			int src = -1;
+			if (i->id == ITM_ID(itm_mov)) {
+				src = nodeof(list_head(i->operands));
+				if (src >= 0)
+					addmove(g, d, src);
+			}
+
+			for (int l = NPHYS; l < g->nnodes; ++l)
+				if (l != src && btst(live, l))
+					addedge(g, d, l);
+			bclr(live, d);
+		}
+
+		struct itm_expr *e;
+		it_t it = list_iterator(i->operands);
+		while (iterator_next(&it, (void **)&e)) {
+			int n = nodeof(e);
+			if (n >= 0)
+				bset(live, n);
+		}
+	}
+
+	// phis are defined simultaneously at the start of the block
+	for (struct itm_instr *i = b->first;
+	     i && i->id == ITM_ID(itm_phi); i = i->next) {
+		int d = nodeof(&i->base);
+		if (d >= 0)
+			bset(live, d);
+	}
+	for (struct itm_instr *i = b->first;
+	     i && i->id == ITM_ID(itm_phi); i = i->next) {
+		int d = nodeof(&i->base);
+		if (d < 0)
+			continue;
+		for (int l = NPHYS; l < g->nnodes; ++l)
+			if (btst(live, l))
+				addedge(g, d, l);
+
+		// each operand becomes a copy into the phi, see phielim.c
+		struct itm_expr *e;
+		it_t it = list_iterator(i->operands);
+		while (iterator_next(&it, (void **)&e)) {
+			iterator_next(&it, (void **)&e);
+			int n = nodeof(e);
+			if (n >= 0 && n != d)
+				addmove(g, d, n);
+		}
+	}
+}
+
+static void build(struct rgraph *g, struct itm_block *strt)
+{
+	int nblocks = 0;
+	for (struct itm_block *b = strt; b; b = b->lexnext)
+		++nblocks;
+
+	struct liveset *ls = liveness(g, strt, nblocks);
+
+	int j = 0;
+	for (struct itm_block *b = strt; b; b = b->lexnext, ++j) {
+		buildblock(g, b, ls[j].out);
+		free(ls[j].in);
+		free(ls[j].out);
+	}
+	free(ls);
+}
+
+static void numbernodes(struct rgraph *g, struct itm_block *strt)
+{
+	int n = NPHYS;
+	for (struct itm_block *b = strt; b; b = b->lexnext)
+		for (struct itm_instr *i = b->first; i; i = i->next)
+			if (isvalue(i))
+				++n;
+
+	g->nnodes = n;
+	g->nodes = calloc(n, sizeof(struct rnode));
+	g->matrix = calloc(((size_t)n * n + 7) / 8, 1);
+
+	for (int s = 0; s < NS_COUNT; ++s)
+		g->nwl[s] = -1;
+	for (int s = 0; s < MS_COUNT; ++s)
+		g->mwl[s] = -1;
+
+	for (int r = 0; r < NPHYS; ++r) {
+		struct rnode *nd = &g->nodes[r];
+		nd->state = NS_COUNT;
+		nd->prev = nd->next = -1;
+		nd->color = r;
+		nd->ok = 1ul << r;
+		nd->degree = PHYSDEGREE;
+		setstate(g, r, NS_PRECOLORED);
+	}
+
+	n = NPHYS;
+	for (struct itm_block *b = strt; b; b = b->lexnext) {
+		double w = loopweight(b);
+		for (struct itm_instr *i = b->first; i; i = i->next) {
+			if (!isvalue(i))
+				continue;
+
+			struct itm_tag *tag = new_itm_tag(tt_rnode, TO_INT);
+			itm_tag_seti(tag, n);
+			itm_tag_expr(&i->base, tag);
+
+			struct rnode *nd = &g->nodes[n];
+			nd->instr = i;
+			nd->state = NS_COUNT;
+			nd->prev = nd->next = -1;
+			nd->color = -1;
+			nd->alias = -1;
+			nd->ok = hastc(i->base.type, TC_FLOATING) ?
+				g->ades.all_fregs : g->ades.all_iregs;
+			if (i->base.type->size == 1)
+				nd->ok &= g->ades.byte_iregs;
+			nd->k = popcount(nd->ok);
+
+			struct itm_tag *usedt = itm_get_tag(&i->base, tt_used);
+			int used = usedt ? itm_tag_geti(usedt) : 0;
+			nd->cost = (1 + used) * w;
+			if (itm_get_tag(&i->base, tt_spilltmp))
+				nd->cost = INFINITY;
+
+			struct location *loc = getloc(i);
+			if (loc) {
+				regid_t rid = ((struct loc_reg *)loc->extended)->rid;
+				int r = 0;
+				while (!(rid & (1ul << r)))
+					++r;
+				nd->alias = r;
+				setstate(g, n, NS_COALESCED);
+			} else {
+				setstate(g, n, NS_INITIAL);
+			}
+			++n;
+		}
+	}
+}
+
+
+/*
+ * The iterated coalescing loop itself
+ */
+static bool moverelated(struct rgraph *g, int n)
+{
+	struct intvec *mv = &g->nodes[n].moves;
+	for (int j = 0; j < mv->len; ++j) {
+		enum mstate s = g->moves[mv->v[j]].state;
+		if (s == MS_ACTIVE || s == MS_WORKLIST)
+			return true;
+	}
+	return false;
+}
+
+static bool isadjacent(struct rgraph *g, int n)
+{
+	enum nstate s = g->nodes[n].state;
+	return s != NS_SELECT && s != NS_COALESCED;
+}
+
+static void mkworklist(struct rgraph *g)
+{
+	int n;
+	while ((n = g->nwl[NS_INITIAL]) >= 0) {
+		if (g->nodes[n].degree >= g->nodes[n].k)
+			setstate(g, n, NS_SPILL);
+		else if (moverelated(g, n))
+			setstate(g, n, NS_FREEZE);
+		else
+			setstate(g, n, NS_SIMPLIFY);
+	}
+}
+
+static void enablemoves(struct rgraph *g, int n)
+{
+	struct intvec *mv = &g->nodes[n].moves;
+	for (int j = 0; j < mv->len; ++j)
+		if (g->moves[mv->v[j]].state == MS_ACTIVE)
+			setmstate(g, mv->v[j], MS_WORKLIST);
+}
+
+static void decdegree(struct rgraph *g, int m)
+{
+	if (isprecolored(g, m))
+		return;
+
+	int d = g->nodes[m].degree--;
+	if (d != g->nodes[m].k)
+		return;
+
+	enablemoves(g, m);
+	struct intvec *adj = &g->nodes[m].adj;
+	for (int j = 0; j < adj->len; ++j)
+		if (isadjacent(g, adj->v[j]))
+			enablemoves(g, adj->v[j]);
+
+	if (g->nodes[m].state != NS_SPILL)
+		return;
+	if (moverelated(g, m))
+		setstate(g, m, NS_FREEZE);
+	else
+		setstate(g, m, NS_SIMPLIFY);
+}
+
+static void simplify(struct rgraph *g)
+{
+	int n = g->nwl[NS_SIMPLIFY];
+	setstate(g, n, NS_SELECT);
+	g->stack[g->sp++] = n;
+
+	struct intvec *adj = &g->nodes[n].adj;
+	for (int j = 0; j < adj->len; ++j)
+		if (isadjacent(g, adj->v[j]))
+			decdegree(g, adj->v[j]);
+}
+
+static void addworklist(struct rgraph *g, int u)
+{
+	if (!isprecolored(g, u) && !moverelated(g, u) &&
+	    g->nodes[u].degree < g->nodes[u].k)
+		setstate(g, u, NS_SIMPLIFY);
+}
+
+// George's test, for coalescing with a precolored node
+static bool georgeok(struct rgraph *g, int t, int r)
+{
+	return g->nodes[t].degree < g->nodes[t].k || isprecolored(g, t) ||
+	       adjset(g, t, r);
+}
+
+// Briggs' test
+static bool conservative(struct rgraph *g, int u, int v)
+{
+	int k = 0;
+	unsigned char *seen = calloc(setbytes(g), 1);
+
+	for (int w = 0; w < 2; ++w) {
+		struct intvec *adj = &g->nodes[w ? v : u].adj;
+		for (int j = 0; j < adj->len; ++j) {
+			int n = adj->v[j];
+			if (!isadjacent(g, n) || btst(seen, n))
+				continue;
+			bset(seen, n);
+			if (g->nodes[n].degree >= g->nodes[n].k)
+				++k;
+		}
+	}
+
+	free(seen);
+	return k < g->nodes[u].k;
+}
+
+static void combine(struct rgraph *g, int u, int v)
+{
+	setstate(g, v, NS_COALESCED);
+	g->nodes[v].alias = u;
+	if (!isprecolored(g, u)) {
+		g->nodes[u].ok &= g->nodes[v].ok;
+		g->nodes[u].k = popcount(g->nodes[u].ok);
+	}
+
+	struct intvec *mv = &g->nodes[v].moves;
+	for (int j = 0; j < mv->len; ++j)
+		vec_push(&g->nodes[u].moves, mv->v[j]);
+	enablemoves(g, v);
+
+	struct intvec *adj = &g->nodes[v].adj;
+	for (int j = 0; j < adj->len; ++j) {
+		int t = adj->v[j];
+		if (!isadjacent(g, t))
+			continue;
+		addedge(g, t, u);
+		decdegree(g, t);
+	}
+
+	if (g->nodes[u].degree >= g->nodes[u].k &&
+	    g->nodes[u].state == NS_FREEZE)
+		setstate(g, u, NS_SPILL);
+}
+
+static void coalesce(struct rgraph *g)
+{
+	int m = g->mwl[MS_WORKLIST];
+	int x = getalias(g, g->moves[m].dst);
+	int y = getalias(g, g->moves[m].src);
+	int u, v;
+	if (isprecolored(g, y)) {
+		u = y;
+		v = x;
+	} else {
+		u = x;
+		v = y;
+	}
+
+	if (u == v) {
+		setmstate(g, m, MS_COALESCED);
+		addworklist(g, u);
+		return;
+	}
+
+	// nor may v end up in a register it can't be given
+	regid_t alloc = g->ades.all_iregs | g->ades.all_fregs;
+	if (isprecolored(g, v) || adjset(g, u, v) || (isprecolored(g, u) &&
+	    (g->nodes[u].ok & alloc & ~g->nodes[v].ok))) {
+		setmstate(g, m, MS_CONSTRAINED);
+		addworklist(g, u);
+		addworklist(g, v);
+		return;
+	}
+
+	bool ok;
+	if (isprecolored(g, u)) {
+		ok = true;
+		struct intvec *adj = &g->nodes[v].adj;
+		for (int j = 0; ok && j < adj->len; ++j)
+			if (isadjacent(g, adj->v[j]))
+				ok = georgeok(g, adj->v[j], u);
+	} else {
+		ok = conservative(g, u, v);
+	}
+
+	if (!ok) {
+		setmstate(g, m, MS_ACTIVE);
+		return;
+	}
+
+	setmstate(g, m, MS_COALESCED);
+	combine(g, u, v);
+	addworklist(g, u);
+}
+
+static void freezemoves(struct rgraph *g, int u)
+{
+	struct intvec *mv = &g->nodes[u].moves;
+	for (int j = 0; j < mv->len; ++j) {
+		int m = mv->v[j];
+		enum mstate s = g->moves[m].state;
+		if (s != MS_ACTIVE && s != MS_WORKLIST)
+			continue;
+
+		int x = getalias(g, g->moves[m].dst);
+		int y = getalias(g, g->moves[m].src);
+		int v = (y == getalias(g, u)) ? x : y;
+
+		setmstate(g, m, MS_FROZEN);
+		if (g->nodes[v].state == NS_FREEZE && !moverelated(g, v) &&
+		    g->nodes[v].degree < g->nodes[v].k)
+			setstate(g, v, NS_SIMPLIFY);
+	}
+}
+
+static void freeze(struct rgraph *g)
+{
+	int u = g->nwl[NS_FREEZE];
+	setstate(g, u, NS_SIMPLIFY);
+	freezemoves(g, u);
+}
+
+static void selspill(struct rgraph *g)
+{
+	int best = -1;
+	double bestp = 0.0;
+	for (int n = g->nwl[NS_SPILL]; n >= 0; n = g->nodes[n].next) {
+		double p = g->nodes[n].cost / (g->nodes[n].degree + 1);
+		if (best < 0 || p < bestp) {
+			best = n;
+			bestp = p;
+		}
+	}
+
+	setstate(g, best, NS_SIMPLIFY);
+	freezemoves(g, best);
+}
+
+static int pickcolor(struct rgraph *g, regid_t ok)
+{
+	regid_t pref = ok & ~(g->ades.saved_iregs | g->ades.saved_fregs);
+	if (!pref)
+		pref = ok;
+	for (int r = 0; r < NPHYS; ++r)
+		if (pref & (1ul << r))
+			return r;
+	return -1;
+}
+
+/*
+ * Spill temporaries only live from their reload to their user, so spilling
+ * them again wouldn't help. If one isn't given a register, the neighbours
+ * holding the cheapest register it may have are spilled instead. Returns false
+ * if every such register is held by a machine register or another temporary.
+ */
+static bool evict(struct rgraph *g, int n)
+{
+	struct intvec *adj = &g->nodes[n].adj;
+	int best = -1;
+	double bestc = INFINITY;
+	for (int r = 0; r < NPHYS; ++r) {
+		if (!(g->nodes[n].ok & (1ul << r)))
+			continue;
+
+		double c = 0.0;
+		for (int j = 0; j < adj->len; ++j) {
+			int w = getalias(g, adj->v[j]);
+			if (g->nodes[w].state == NS_PRECOLORED && w == r)
+				c = INFINITY;
+			else if (g->nodes[w].state == NS_COLORED &&
+			         g->nodes[w].color == r)
+				c += g->nodes[w].cost;
+		}
+		if (c < bestc) {
+			best = r;
+			bestc = c;
+		}
+	}
+	if (best < 0)
+		return false;
+
+	for (int j = 0; j < adj->len; ++j) {
+		int w = getalias(g, adj->v[j]);
+		if (g->nodes[w].state == NS_COLORED &&
+		    g->nodes[w].color == best)
+			setstate(g, w, NS_SPILLED);
+	}
+	g->nodes[n].color = best;
+	setstate(g, n, NS_COLORED);
+	return true;
+}
+
+static void asncolors(struct rgraph *g)
+{
+	while (g->sp > 0) {
+		int n = g->stack[--g->sp];
+		regid_t ok = g->nodes[n].ok;
+
+		struct intvec *adj = &g->nodes[n].adj;
+		for (int j = 0; j < adj->len; ++j) {
+			int w = getalias(g, adj->v[j]);
+			enum nstate s = g->nodes[w].state;
+			if (s == NS_COLORED || s == NS_PRECOLORED)
+				ok &= ~(1ul << g->nodes[w].color);
+		}
+
+		if (!ok) {
+			if (g->nodes[n].cost < INFINITY || !evict(g, n))
+				setstate(g, n, NS_SPILLED);
+			continue;
+		}
+
+		g->nodes[n].color = pickcolor(g, ok);
+		setstate(g, n, NS_COLORED);
+	}
+}
+
+static void setloc(struct itm_instr *i, struct location *loc)
+{
+	struct itm_tag *loct = new_itm_tag(tt_loc, TO_USER_PTR);
+	itm_tag_set_user_ptr(loct, loc,
+		(void (*)(FILE *, void *))&loc_to_string);
+	itm_tag_expr(&i->base, loct);
+}
+
+// writes the results back as tt_loc tags
+static void writelocs(struct rgraph *g)
+{
+	for (int n = NPHYS; n < g->nnodes; ++n) {
+		struct itm_instr *i = g->nodes[n].instr;
+		if (getloc(i))
+			continue;
+
+		int a = getalias(g, n);
+		assert(g->nodes[a].color >= 0);
+		setloc(i, new_loc_reg(i->base.type->size, 1ul << g->nodes[a].color));
+	}
+}
+
+
+/*
+ * Spilling
+ */
+static bool isremat(struct itm_instr *i)
+{
+	if (i->id != ITM_ID(itm_mov))
+		return false;
+
+	struct itm_expr *op = list_head(i->operands);
+	return op->etype != ITME_INSTRUCTION ||
+	       ((struct itm_instr *)op)->id == ITM_ID(itm_alloca);
+}
+
+static bool isspilled(struct rgraph *g, int n)
+{
+	return g->nodes[getalias(g, n)].state == NS_SPILLED;
+}
+
+/*
+ * Stack slot coloring: a spilled value may share a slot with others of the
+ * same size, as long as it interferes with none of them.
+ */
+static int getslot(struct rgraph *g, struct itm_block *strt, int n,
+	struct rslot **slots, int *nslots)
+{
+	size_t size = g->nodes[n].instr->base.type->size;
+
+	for (int j = 0; j < *nslots; ++j) {
+		struct rslot *sl = &(*slots)[j];
+		if (sl->size != size)
+			continue;
+
+		bool ok = true;
+		for (int k = 0; ok && k < sl->members.len; ++k)
+			ok = !adjset(g, n, sl->members.v[k]);
+		if (!ok)
+			continue;
+
+		vec_push(&sl->members, n);
+		return sl->offset;
+	}
+
+	*slots = realloc(*slots, (*nslots + 1) * sizeof(struct rslot));
+	struct rslot *sl = &(*slots)[(*nslots)++];
+	memset(sl, 0, sizeof(struct rslot));
+	sl->offset = framealloc(strt, size);
+	sl->size = size;
+	vec_push(&sl->members, n);
+	return sl->offset;
+}
+
+static struct itm_instr *newtmp(struct itm_instr *before, struct itm_expr *e)
+{
+	/*
+	 * Clobbers right before an instruction belong to it, so the reload goes
+	 * in front of them, lest it be given a clobbered register.
+	 */
+	while (before->previous && before->previous->id == ITM_ID(itm_clobb))
+		before = before->previous;
+
+	struct itm_instr *t = itm_mov(before->block, e);
+	itm_inserti(t, before);
+	itm_tag_expr(&t->base, new_itm_tag(tt_spilltmp, TO_NONE));
+	return t;
+}
+
+/*
+ * Replaces each use of i by a fresh copy of e, inserted right before the
+ * user. Phis use e itself, which is a literal, a frame address or a value in
+ * memory, as the phi copies can read any of those.
+ */
+static void repluses(struct itm_block *strt, struct itm_instr *i,
+	struct itm_expr *e)
+{
+	for (struct itm_block *b = strt; b; b = b->lexnext) {
+		for (struct itm_instr *u = b->first; u; u = u->next) {
+			// e and the copies of it made so far are no uses of i
+			if (&u->base == e || (u->id == ITM_ID(itm_mov) &&
+			    itm_get_tag(&u->base, tt_spilltmp) &&
+			    list_head(u->operands) == e))
+				continue;
+
+			struct itm_instr *tmp = NULL;
+			struct itm_expr *op;
+			int k = 0;
+			it_t it = list_iterator(u->operands);
+			while (iterator_next(&it, (void **)&op)) {
+				if (op == &i->base && u->id == ITM_ID(itm_phi)) {
+					set_list_item(u->operands, k, e);
+				} else if (op == &i->base) {
+					if (!tmp)
+						tmp = newtmp(u, e);
+					set_list_item(u->operands, k, tmp);
+				}
+				++k;
+			}
+		}
+	}
+}
+
+/*
+ * A spilled phi lives in its slot from the start. Its operands are stored
+ * there at the end of each predecessor, so that the phi and its operands share
+ * one location.
+ */
+static void spillphi(struct itm_block *strt, struct itm_instr *i, int offset)
+{
+	size_t size = i->base.type->size;
+	setloc(i, new_loc_lmem(size, offset));
+	repluses(strt, i, &i->base);
+
+	for (int k = 0; k + 1 < list_length(i->operands); k += 2) {
+		struct itm_block *pred = get_list_item(i->operands, k);
+		struct itm_expr *e = get_list_item(i->operands, k + 1);
+		if (e->etype == ITME_UNDEF || e == &i->base)
+			continue;
+
+		/*
+		 * Constants, frame addresses and values in memory can't always
+		 * be stored directly.
+		 */
+		struct itm_instr *jmp = pred->last;
+		if (e->etype != ITME_INSTRUCTION ||
+		    !isvalue((struct itm_instr *)e))
+			e = &newtmp(jmp, e)->base;
+
+		struct itm_instr *st = itm_mov(pred, e);
+		itm_inserti(st, jmp);
+		setloc(st, new_loc_lmem(size, offset));
+		set_list_item(i->operands, k + 1, st);
+	}
+}
+
+static void spill(struct itm_block *strt, struct itm_instr *i, int offset)
+{
+	if (isremat(i)) {
+		repluses(strt, i, list_head(i->operands));
+		itm_remi(i);
+		return;
+	}
+
+	if (i->id == ITM_ID(itm_phi)) {
+		spillphi(strt, i, offset);
+		return;
+	}
+
+	struct itm_instr *st = itm_mov(i->block, &i->base);
+	itm_inserti(st, i->next);
+	setloc(st, new_loc_lmem(i->base.type->size, offset));
+	itm_tag_expr(&i->base, new_itm_tag(tt_spilltmp, TO_NONE));
+
+	repluses(strt, i, &st->base);
+}
+
+static void rewrite(struct rgraph *g, struct itm_block *strt)
+{
+	int nslots = 0;
+	struct rslot *slots = NULL;
+	int nspills = 0;
+	struct itm_instr **spills = malloc(g->nnodes * sizeof(struct itm_instr *));
+	int *offsets = malloc(g->nnodes * sizeof(int));
+
+	for (int n = NPHYS; n < g->nnodes; ++n) {
+		if (!isspilled(g, n))
+			continue;
+
+		struct itm_instr *i = g->nodes[n].instr;
+		spills[nspills] = i;
+		// phi slots are written early, at the end of the predecessors
+		if (isremat(i))
+			offsets[nspills] = 0;
+		else if (i->id == ITM_ID(itm_phi))
+			offsets[nspills] = framealloc(strt, i->base.type->size);
+		else
+			offsets[nspills] = getslot(g, strt, n, &slots, &nslots);
+		++nspills;
+	}
+
+	for (int n = NPHYS; n < g->nnodes; ++n)
+		itm_untag_expr(&g->nodes[n].instr->base, tt_rnode);
+	for (int j = 0; j < nspills; ++j)
+		spill(strt, spills[j], offsets[j]);
+	stats_add(strt->container->id, ST_SPILLED, nspills);
+
+	for (int j = 0; j < nslots; ++j)
+		free(slots[j].members.v);
+	free(slots);
+	free(spills);
+	free(offsets);
+}
+
+static void freegraph(struct rgraph *g)
+{
+	for (int n = 0; n < g->nnodes; ++n) {
+		free(g->nodes[n].adj.v);
+		free(g->nodes[n].moves.v);
+	}
+	free(g->nodes);
+	free(g->matrix);
+	free(g->moves);
+	free(g->stack);
+}
+
+// returns false if values were spilled, and the function should be recolored
+static bool colorgraph(struct itm_block *b, struct archdes ades)
+{
+	struct rgraph g;
+	memset(&g, 0, sizeof(struct rgraph));
+	g.ades = ades;
+
+	timer_start("overlap", NULL);
+	numbernodes(&g, b);
+	build(&g, b);
+	timer_stop();
+	g.stack = malloc(g.nnodes * sizeof(int));
+
+	timer_start("assign", NULL);
+	mkworklist(&g);
+	while (true) {
+		if (g.nwl[NS_SIMPLIFY] >= 0)
+			simplify(&g);
+		else if (g.mwl[MS_WORKLIST] >= 0)
+			coalesce(&g);
+		else if (g.nwl[NS_FREEZE] >= 0)
+			freeze(&g);
+		else if (g.nwl[NS_SPILL] >= 0)
+			selspill(&g);
+		else
+			break;
+	}
+	asncolors(&g);
+	timer_stop();
+
+	for (int n = g.nwl[NS_SPILLED]; n >= 0; n = g.nodes[n].next) {
+		if (g.nodes[n].cost == INFINITY) {
+			report(E_INTERNAL, NULL,
+				"can't allocate registers for '%s'",
+				b->container->id);
+		}
+	}
+
+	bool spilled = g.nwl[NS_SPILLED] >= 0;
+	if (spilled) {
+		timer_start("spill", NULL);
+		rewrite(&g, b);
+		timer_stop();
+	} else {
+		writelocs(&g);
+		for (int n = NPHYS; n < g.nnodes; ++n)
+			itm_untag_expr(&g.nodes[n].instr->base, tt_rnode);
+	}
+
+	freegraph(&g);
+	return !spilled;
+}
+
+void regcolor(struct itm_block *b, struct archdes ades)
+{
+	assert(b != NULL);
+
+	analyze(b, A_USED | A_LOOPDEPTH);
+	while (!colorgraph(b, ades))
+		;
+
+	for (struct itm_block *bl = b; bl; bl = bl->lexnext)
+		for (struct itm_instr *i = bl->first; i; i = i->next)
+			if (itm_get_tag(&i->base, tt_spilltmp))
+				itm_untag_expr(&i->base, tt_spilltmp);
+}
@@ -36,6 +36,8 @@ void archoption(const char *opt)
 	}
 
 	const char *scpu = opt + 3;
+	if (*scpu == '=')
+		++scpu;
 
 	for (int i = 0; cpus[i]; ++i) {
 		if (!strcmp(cpus[i]->name, scpu)) {
@@ -46,3 +48,9 @@ void archoption(const char *opt)
 
 	report(E_OPTIONS | E_FATAL, NULL, "no such CPU: '%s'", scpu);
 }
+
+void archhash(struct hash *h)
+{
+	hash_str(h, cpu->name);
+	xarchhash(h);
+}
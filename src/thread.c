@@ -0,0 +1,299 @@
+/*
+ * Threads
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <acc/thread.h>
+#include <acc/error.h>
+#include <acc/tu.h>
+
+#ifdef ACC_THREADS
+#include <pthread.h>
+#endif
+
+static THREAD_LOCAL jmp_buf *catcher;
+
+jmp_buf *thread_catch(jmp_buf *env)
+{
+	jmp_buf *prev = catcher;
+	catcher = env;
+	return prev;
+}
+
+jmp_buf *thread_catcher(void)
+{
+	return catcher;
+}
+
+#ifdef ACC_THREADS
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+struct mutex *new_mutex(void)
+{
+	struct mutex *m = malloc(sizeof(struct mutex));
+	pthread_mutex_init(&m->m, NULL);
+	return m;
+}
+
+void delete_mutex(struct mutex *m)
+{
+	pthread_mutex_destroy(&m->m);
+	free(m);
+}
+
+void mutex_lock(struct mutex *m)
+{
+	pthread_mutex_lock(&m->m);
+}
+
+void mutex_unlock(struct mutex *m)
+{
+	pthread_mutex_unlock(&m->m);
+}
+
+// the tasks a thread has left, taken from the front, stolen from the back
+struct range {
+	pthread_mutex_t lock;
+	int lo, hi;
+};
+
+struct worker {
+	struct pool *p;
+	int self;
+	pthread_t thread;
+};
+
+struct pool {
+	int nthreads;
+	struct worker *workers;
+	struct range *ranges;	// the caller's comes last
+
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned run;		// counts calls to pool_run()
+	int busy;
+	bool quit;
+
+	// the current run
+	void (*fn)(void *arg, int k);
+	void *arg;
+	struct tu *tu;
+	bool failed;
+};
+
+static bool pool_take(struct pool *p, int self, int *k)
+{
+	struct range *r = &p->ranges[self];
+	pthread_mutex_lock(&r->lock);
+	bool res = r->lo < r->hi;
+	if (res)
+		*k = r->lo++;
+	pthread_mutex_unlock(&r->lock);
+	if (res)
+		return true;
+
+	for (int i = 1; i <= p->nthreads; ++i) {
+		r = &p->ranges[(self + i) % (p->nthreads + 1)];
+		pthread_mutex_lock(&r->lock);
+		res = r->lo < r->hi;
+		if (res)
+			*k = --r->hi;
+		pthread_mutex_unlock(&r->lock);
+		if (res)
+			return true;
+	}
+	return false;
+}
+
+static bool pool_failed(struct pool *p, bool fail)
+{
+	pthread_mutex_lock(&p->lock);
+	if (fail)
+		p->failed = true;
+	bool res = p->failed;
+	pthread_mutex_unlock(&p->lock);
+	return res;
+}
+
+static void pool_work(struct pool *p, int self)
+{
+	jmp_buf env;
+	jmp_buf *prev = thread_catch(&env);
+
+	if (setjmp(env)) {
+		pool_failed(p, true);
+	} else {
+		int k;
+		while (!pool_failed(p, false) && pool_take(p, self, &k))
+			p->fn(p->arg, k);
+	}
+
+	thread_catch(prev);
+}
+
+static void *pool_thread(void *arg)
+{
+	struct worker *w = arg;
+	struct pool *p = w->p;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (p->run == seen && !p->quit)
+			pthread_cond_wait(&p->start, &p->lock);
+		if (p->quit)
+			break;
+		seen = p->run;
+		pthread_mutex_unlock(&p->lock);
+
+		tu_enter(p->tu);
+		pool_work(p, w->self);
+		tu_enter(NULL);
+
+		pthread_mutex_lock(&p->lock);
+		if (!--p->busy)
+			pthread_cond_signal(&p->done);
+	}
+
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+struct pool *new_pool(int nthreads)
+{
+	if (nthreads < 1)
+		return NULL;
+
+	struct pool *p = calloc(1, sizeof(struct pool));
+	p->workers = malloc(nthreads * sizeof(struct worker));
+	p->ranges = malloc((nthreads + 1) * sizeof(struct range));
+	for (int i = 0; i <= nthreads; ++i)
+		pthread_mutex_init(&p->ranges[i].lock, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	for (; p->nthreads < nthreads; ++p->nthreads) {
+		struct worker *w = &p->workers[p->nthreads];
+		w->p = p;
+		w->self = p->nthreads;
+		if (pthread_create(&w->thread, NULL, &pool_thread, w))
+			break;
+	}
+
+	return p;
+}
+
+void delete_pool(struct pool *p)
+{
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = true;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for (int i = 0; i < p->nthreads; ++i)
+		pthread_join(p->workers[i].thread, NULL);
+
+	for (int i = 0; i <= p->nthreads; ++i)
+		pthread_mutex_destroy(&p->ranges[i].lock);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->start);
+	pthread_cond_destroy(&p->done);
+	free(p->ranges);
+	free(p->workers);
+	free(p);
+}
+
+void pool_run(struct pool *p, int n, void (*fn)(void *arg, int k), void *arg)
+{
+	if (!p || !p->nthreads || n < 2) {
+		for (int k = 0; k < n; ++k)
+			fn(arg, k);
+		return;
+	}
+
+	int parts = p->nthreads + 1;
+	for (int i = 0; i < parts; ++i) {
+		p->ranges[i].lo = n * i / parts;
+		p->ranges[i].hi = n * (i + 1) / parts;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->tu = curtu();
+	p->failed = false;
+	p->busy = p->nthreads;
+	++p->run;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	pool_work(p, p->nthreads);
+
+	pthread_mutex_lock(&p->lock);
+	while (p->busy)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->failed)
+		fatal();
+}
+
+#else
+
+struct mutex *new_mutex(void)
+{
+	return NULL;
+}
+
+void delete_mutex(struct mutex *m)
+{
+}
+
+void mutex_lock(struct mutex *m)
+{
+}
+
+void mutex_unlock(struct mutex *m)
+{
+}
+
+struct pool *new_pool(int nthreads)
+{
+	return NULL;
+}
+
+void delete_pool(struct pool *p)
+{
+}
+
+void pool_run(struct pool *p, int n, void (*fn)(void *arg, int k), void *arg)
+{
+	for (int k = 0; k < n; ++k)
+		fn(arg, k);
+}
+
+#endif
@@ -0,0 +1,464 @@
+/*
+ * Phase timing
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// for clock_gettime(), where there is such a thing
+#ifdef __unix__
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <acc/timer.h>
+#include <acc/mem.h>
+#include <acc/options.h>
+#include <acc/thread.h>
+#include <acc/error.h>
+
+/*
+ * The phases of a unit form a tree, those done on a function being kept
+ * under a node for the function, below the phase they were started in
+ */
+struct tnode {
+	char *name;
+	bool fn;
+	double total;		// in microseconds
+	long count;
+	struct memmark mem;	// added up, but for the greatest peak
+	struct tnode *parent;
+	struct tnode *child, *lastchild, *sibling;	// in the order started
+};
+
+struct timetree {
+	char *name;
+	struct tnode root;
+	struct mutex *lock;
+	unsigned serial;
+};
+
+// the phases open on a thread
+#define MAXDEPTH 32
+
+struct timing {
+	struct tnode *node;	// NULL if it's not timed
+	unsigned serial;	// of the tree node is in
+	double start;
+	struct memmark mark;
+};
+
+static THREAD_LOCAL struct timing stack[MAXDEPTH];
+static THREAD_LOCAL int depth;
+
+static bool enabled = false;
+static struct mutex *lock;	// for what follows
+static unsigned serials;
+static double epoch;
+
+// the events of the trace, written out as they come
+static char *trace;
+static size_t tracelen, tracecap;
+static int ntids;
+static THREAD_LOCAL int tid;
+
+static double now(void)
+{
+#ifdef __unix__
+	struct timespec ts;
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+	return (double)clock() / CLOCKS_PER_SEC * 1e6;
+}
+
+static char *copystr(const char *str)
+{
+	char *copy = malloc(strlen(str) + 1);
+	strcpy(copy, str);
+	return copy;
+}
+
+static struct tnode *getchild(struct tnode *n, const char *name, bool fn)
+{
+	struct tnode *c;
+	for (c = n->child; c; c = c->sibling)
+		if (c->fn == fn && !strcmp(c->name, name))
+			return c;
+
+	c = calloc(1, sizeof(struct tnode));
+	c->name = copystr(name);
+	c->fn = fn;
+	c->parent = n;
+	if (n->lastchild)
+		n->lastchild->sibling = c;
+	else
+		n->child = c;
+	n->lastchild = c;
+	return c;
+}
+
+static void deletechildren(struct tnode *n)
+{
+	struct tnode *c = n->child, *next;
+	for (; c; c = next) {
+		next = c->sibling;
+		deletechildren(c);
+		free(c->name);
+		free(c);
+	}
+	n->child = n->lastchild = NULL;
+}
+
+void timer_init(void)
+{
+	enabled = option_time_report() || option_time_trace() ||
+	          option_mem_report();
+	if (!enabled)
+		return;
+
+	lock = new_mutex();
+	epoch = now();
+	tracelen = 0;
+}
+
+void timer_finish(void)
+{
+	if (!enabled)
+		return;
+
+	const char *name = option_time_trace();
+	FILE *f = name ? fopen(name, "wb") : NULL;
+	if (f) {
+		fprintf(f, "{\"traceEvents\":[\n");
+		// without the comma after the last event
+		if (tracelen)
+			fwrite(trace, 1, tracelen - 2, f);
+		fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		fclose(f);
+	} else if (name) {
+		report(E_OPTIONS, NULL, "can't write trace to \"%s\"", name);
+	}
+
+	free(trace);
+	trace = NULL;
+	tracelen = tracecap = 0;
+	delete_mutex(lock);
+	enabled = false;
+}
+
+void timer_open(struct tu *u, const char *name)
+{
+	if (!enabled)
+		return;
+
+	struct timetree *t = calloc(1, sizeof(struct timetree));
+	t->name = copystr(name);
+	t->lock = new_mutex();
+	mutex_lock(lock);
+	t->serial = ++serials;
+	mutex_unlock(lock);
+	u->times = t;
+}
+
+void timer_start(const char *name, const char *fn)
+{
+	if (!enabled)
+		return;
+
+	struct tu *u = curtu();
+	struct timetree *t = u ? u->times : NULL;
+	unsigned serial = t ? t->serial : 0;
+
+	// what's left open by a fatal error in another unit is dropped
+	int top = depth < MAXDEPTH ? depth : MAXDEPTH;
+	if (top && stack[top - 1].serial != serial)
+		depth = 0;
+
+	if (depth++ >= MAXDEPTH)
+		return;
+
+	struct timing *tm = &stack[depth - 1];
+	tm->node = NULL;
+	tm->serial = serial;
+	if (t) {
+		struct tnode *parent = &t->root;
+		if (depth > 1 && stack[depth - 2].node)
+			parent = stack[depth - 2].node;
+
+		mutex_lock(t->lock);
+		if (fn)
+			parent = getchild(parent, fn, true);
+		tm->node = getchild(parent, name, false);
+		mutex_unlock(t->lock);
+	}
+	if (option_mem_report())
+		mem_mark(&tm->mark);
+	tm->start = now();
+}
+
+static void addmem(struct memmark *into, const struct memmark *use)
+{
+	into->allocs += use->allocs;
+	into->bytes += use->bytes;
+	into->live += use->live;
+	if (use->peak > into->peak)
+		into->peak = use->peak;
+}
+
+static void putraw(const char *str)
+{
+	size_t len = strlen(str);
+	if (tracelen + len > tracecap)
+		trace = realloc(trace, tracecap = (tracelen + len) * 2);
+	memcpy(trace + tracelen, str, len);
+	tracelen += len;
+}
+
+static void putjson(const char *str)
+{
+	for (; *str; ++str) {
+		char esc[8];
+		if (*str == '"' || *str == '\\')
+			sprintf(esc, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			sprintf(esc, "\\u%04x", (unsigned char)*str);
+		else
+			sprintf(esc, "%c", *str);
+		putraw(esc);
+	}
+}
+
+// a complete event, in microseconds since timer_init()
+static void putevent(struct timetree *t, struct tnode *n, double start,
+	double end)
+{
+	const char *fn = NULL;
+	for (struct tnode *p = n->parent; p && !fn; p = p->parent)
+		if (p->fn)
+			fn = p->name;
+
+	char num[96];
+	mutex_lock(lock);
+	if (!tid)
+		tid = ++ntids;
+
+	putraw("{\"name\":\"");
+	putjson(n->name);
+	sprintf(num, "\",\"cat\":\"acc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+		"\"pid\":1,\"tid\":%d,\"args\":{\"file\":\"", start - epoch,
+		end - start, tid);
+	putraw(num);
+	putjson(t->name);
+	if (fn) {
+		putraw("\",\"function\":\"");
+		putjson(fn);
+	}
+	putraw("\"}},\n");
+	mutex_unlock(lock);
+}
+
+void timer_stop(void)
+{
+	if (!enabled || !depth)
+		return;
+
+	if (--depth >= MAXDEPTH)
+		return;
+
+	double end = now();
+	struct timing *tm = &stack[depth];
+	struct memmark use;
+	memset(&use, 0, sizeof(struct memmark));
+	if (option_mem_report())
+		mem_since(&tm->mark, &use);
+
+	struct tu *u = curtu();
+	struct timetree *t = u ? u->times : NULL;
+	if (!tm->node || !t || t->serial != tm->serial)
+		return;
+
+	mutex_lock(t->lock);
+	tm->node->total += end - tm->start;
+	++tm->node->count;
+	addmem(&tm->node->mem, &use);
+	mutex_unlock(t->lock);
+
+	if (option_time_trace())
+		putevent(t, tm->node, tm->start, end);
+}
+
+/*
+ * Reporting
+ */
+
+struct out {
+	char *data;
+	size_t len, cap;
+};
+
+static void outf(struct out *o, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char line[256];
+	int len = vsprintf(line, fmt, ap);
+	va_end(ap);
+
+	if (o->len + len > o->cap)
+		o->data = realloc(o->data, o->cap = (o->len + len) * 2);
+	memcpy(o->data + o->len, line, len);
+	o->len += len;
+}
+
+// adds the phases under from to into, those under functions as well
+static void merge(struct tnode *into, struct tnode *from)
+{
+	for (struct tnode *c = from->child; c; c = c->sibling) {
+		if (c->fn) {
+			merge(into, c);
+			continue;
+		}
+
+		struct tnode *to = getchild(into, c->name, false);
+		to->total += c->total;
+		to->count += c->count;
+		addmem(&to->mem, &c->mem);
+		merge(to, c);
+	}
+}
+
+// gathers the functions under n into fns, one node for each
+static void collect(struct tnode *fns, struct tnode *n)
+{
+	for (struct tnode *c = n->child; c; c = c->sibling) {
+		if (!c->fn) {
+			collect(fns, c);
+			continue;
+		}
+
+		struct tnode *f = getchild(fns, c->name, false);
+		merge(f, c);
+	}
+}
+
+static double childtotal(struct tnode *n)
+{
+	double total = 0;
+	for (struct tnode *c = n->child; c; c = c->sibling)
+		total += c->total;
+	return total;
+}
+
+static void putphases(struct out *o, struct tnode *n, int indent,
+	double total)
+{
+	for (struct tnode *c = n->child; c; c = c->sibling) {
+		outf(o, "  %*s%-*s %8ld %11.3f %6.1f%%\n", indent, "",
+			36 - indent, c->name, c->count, c->total / 1e3,
+			total > 0 ? c->total * 100 / total : 0.0);
+		putphases(o, c, indent + 2, total);
+	}
+}
+
+static void puttimes(struct out *o, struct tnode *phases, struct tnode *fns)
+{
+	double total = childtotal(phases);
+	outf(o, "  %-36s %8s %11s %7s\n", "phase", "calls", "ms", "%");
+	putphases(o, phases, 0, total);
+	outf(o, "  %-36s %8s %11.3f\n", "total", "", total / 1e3);
+
+	if (fns->child)
+		outf(o, "  %-36s %20s  %s\n", "function", "ms", "phases (ms)");
+	for (struct tnode *f = fns->child; f; f = f->sibling) {
+		outf(o, "  %-36.200s %20.3f ", f->name, childtotal(f) / 1e3);
+		for (struct tnode *c = f->child; c; c = c->sibling)
+			outf(o, " %s %.3f", c->name, c->total / 1e3);
+		outf(o, "\n");
+	}
+}
+
+static void putmemphases(struct out *o, struct tnode *n, int indent)
+{
+	for (struct tnode *c = n->child; c; c = c->sibling) {
+		outf(o, "  %*s%-*s %8ld %10ld %12.1f %10.1f %10.1f\n", indent,
+			"", 36 - indent, c->name, c->count, c->mem.allocs,
+			c->mem.bytes / 1024.0, c->mem.live / 1024.0,
+			c->mem.peak / 1024.0);
+		putmemphases(o, c, indent + 2);
+	}
+}
+
+// the high-water mark of a function is the greatest of its phases
+static void putmem(struct out *o, struct tnode *phases, struct tnode *fns)
+{
+	outf(o, "  %-36s %8s %10s %12s %10s %10s\n", "phase", "calls", "allocs",
+		"allocated KB", "net KB", "peak KB");
+	putmemphases(o, phases, 0);
+
+	if (fns->child)
+		outf(o, "  %-36s %20s  %s\n", "function", "peak KB",
+			"phases (peak KB)");
+	for (struct tnode *f = fns->child; f; f = f->sibling) {
+		long peak = 0;
+		for (struct tnode *c = f->child; c; c = c->sibling)
+			if (c->mem.peak > peak)
+				peak = c->mem.peak;
+
+		outf(o, "  %-36.200s %20.1f ", f->name, peak / 1024.0);
+		for (struct tnode *c = f->child; c; c = c->sibling)
+			outf(o, " %s %.1f", c->name, c->mem.peak / 1024.0);
+		outf(o, "\n");
+	}
+}
+
+void timer_report(struct tu *u)
+{
+	struct timetree *t = u->times;
+	if (!t)
+		return;
+
+	struct tnode phases, fns;
+	memset(&phases, 0, sizeof(struct tnode));
+	memset(&fns, 0, sizeof(struct tnode));
+	merge(&phases, &t->root);
+	collect(&fns, &t->root);
+
+	struct out o = { 0 };
+	if (option_time_report()) {
+		outf(&o, "time report for %.200s:\n", t->name);
+		puttimes(&o, &phases, &fns);
+	}
+	if (option_mem_report()) {
+		outf(&o, "memory report for %.200s:\n", t->name);
+		putmem(&o, &phases, &fns);
+	}
+	if (o.len)
+		tu_diag(u, o.data, o.len);
+	free(o.data);
+	deletechildren(&phases);
+	deletechildren(&fns);
+
+	deletechildren(&t->root);
+	delete_mutex(t->lock);
+	free(t->name);
+	free(t);
+	u->times = NULL;
+}
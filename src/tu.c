@@ -0,0 +1,85 @@
+/*
+ * Translation units
+ * Copyright (C) 2014  Antonie Blom
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <acc/tu.h>
+
+static THREAD_LOCAL struct tu *current;
+
+void tu_init(struct tu *u, const char *file, bool bufdiag)
+{
+	memset(u, 0, sizeof(struct tu));
+	u->file = file;
+	u->line = 1;
+	u->column = 1;
+	u->bufdiag = bufdiag;
+	u->diaglock = new_mutex();
+}
+
+void tu_destroy(struct tu *u)
+{
+	if (u->linestr)
+		free(u->linestr);
+	if (u->isbuffered)
+		freetok(&u->buffer);
+	if (u->diag)
+		free(u->diag);
+	delete_mutex(u->diaglock);
+}
+
+void tu_enter(struct tu *u)
+{
+	current = u;
+}
+
+struct tu *curtu(void)
+{
+	return current;
+}
+
+void tu_diag(struct tu *u, const char *msg, size_t len)
+{
+	if (!u) {
+		fwrite(msg, 1, len, stderr);
+		return;
+	}
+
+	mutex_lock(u->diaglock);
+	++u->ndiag;
+	if (!u->bufdiag) {
+		fwrite(msg, 1, len, stderr);
+	} else {
+		if (u->diaglen + len > u->diagcap) {
+			u->diagcap = (u->diaglen + len) * 2;
+			u->diag = realloc(u->diag, u->diagcap);
+		}
+		memcpy(u->diag + u->diaglen, msg, len);
+		u->diaglen += len;
+	}
+	mutex_unlock(u->diaglock);
+}
+
+void tu_flushdiag(struct tu *u, FILE *f)
+{
+	if (u->diaglen)
+		fwrite(u->diag, 1, u->diaglen, f);
+	u->diaglen = 0;
+}
@@ -0,0 +1,25 @@
+int main(int argc, char **argv)
+{
+	int a = 12;
+	int b = 100000;
+	int k;
+	int r;
+	double x = 1.5;
+	for (k = 0; k < 100; k = k + 1) {
+		if (a < b) {
+			a = a * 9 + b / 7;
+			b = b - a * 300;
+			a = a / 3 + b % 5;
+			b = b * 1000 + a / 11;
+			a = a - b * 17;
+			b = b / 13 + a % 101;
+			a = a * 7 + b / 21;
+			b = b - a * 23;
+		} else {
+			a = a - 1;
+		}
+		x = x * 0.5 + 2.25;
+	}
+	r = a + b + x;
+	return r + 613473107;
+}
@@ -0,0 +1,18 @@
+int main(int argc, char **argv)
+{
+	int a = 0;
+	int b = 1000;
+	int acc = 0;
+	int k;
+	for (k = 0; k < 300; k = k + 1) {
+		if (k & 4)
+			acc = acc + 3;
+		b = b - k;
+		if (b != 0)
+			acc = acc * 5;
+		a = a + (b < k) + (a == k);
+		if (a < b)
+			acc = acc - a;
+	}
+	return (acc + a) % 256 - 155;
+}
@@ -0,0 +1,18 @@
+int main(int argc, char **argv)
+{
+	int x = -100000;
+	int y = 3;
+	unsigned int u = 2000000000;
+	unsigned int v = 7;
+	int acc = 0;
+	int k;
+	for (k = 0; k < 300; k = k + 1) {
+		acc = acc * 3 + x / 7 + x % 7 + x / -8 + x % 16 + x / y + x % y;
+		acc = acc + u / 10 + u % 10 + u / 64 + u % 64 + u / v + u % v;
+		x = x + 7919;
+		y = y * 5 % 1001 + 1;
+		u = u + 1234567;
+		v = v * 3 + 1;
+	}
+	return acc % 256 + 177;
+}
@@ -0,0 +1,28 @@
+int main(int argc, char **argv)
+{
+	double a = 1.5;
+	float b = 0.5f;
+	int i = 3;
+	double c = a * i - b;
+	double z = 0.0;
+	double *p = &z;
+	double n = *p / z;
+	unsigned long u = 18000000000000000000;
+	unsigned long *q = &u;
+	double d = *q;
+	unsigned long v = d;
+	int r = 0;
+	if (n == n)
+		r = r + 1;
+	if (n != n)
+		r = r + 2;
+	if (n == c)
+		r = r + 4;
+	if (d < 17000000000000000000.0)
+		r = r + 8;
+	if (v != u)
+		r = r + 16;
+	if (c > 3.5)
+		return r - 2;
+	return c;
+}
@@ -0,0 +1,11 @@
+int main(int argc, char **argv)
+{
+	long x = 0;
+	long *p = &x;
+	int a = 3 * 4;
+	if (3 < a)
+		*p = 6000000000;
+	if (x == 6000000000)
+		a = a + 1;
+	return 3 + 4 + a - 20;
+}
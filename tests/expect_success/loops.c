@@ -0,0 +1,16 @@
+int main(int argc, char **argv)
+{
+	int a = 1;
+	int b = 2;
+	int x = 0;
+	int i;
+	int t;
+	for (i = 0; i < 10; i = i + 1) {
+		if (i > 5)
+			x = x + i;
+		t = a;
+		a = b;
+		b = t;
+	}
+	return x - 30 + a - 1;
+}
@@ -0,0 +1,41 @@
+int clamp(void)
+{
+	int x = 17;
+	if (x < 0)
+		x = 0;
+	if (x > 10)
+		x = 10;
+	return x;
+}
+
+int sum(void)
+{
+	int s = 0;
+	int i;
+	for (i = 0; i < 10; i = i + 1)
+		s = s + i;
+	return s;
+}
+
+double halve(void)
+{
+	double x = 100.0;
+	int times = 3;
+	while (times > 0) {
+		x = x * 0.5;
+		times = times - 1;
+	}
+	return x;
+}
+
+int main(int argc, char **argv)
+{
+	int a = 3;
+	int b = 0;
+	while (a > 0) {
+		if (a > 1)
+			b = b + a;
+		a = a - 1;
+	}
+	return b - 5;
+}
@@ -0,0 +1,17 @@
+int main(int argc, char **argv)
+{
+	int x = -100000;
+	unsigned int u = 2000000000;
+	long l = 123456789;
+	int acc = 0;
+	int k;
+	for (k = 0; k < 300; k = k + 1) {
+		acc = acc + x * 3 + x * 10 + x * -9 + x * 15 + x * 40 + x * 641;
+		acc = acc + u * 7 + u * 24 + u * 1000 + u * 0 + u * 1;
+		acc = acc + l * 45 + l * 100000007 + k * 12;
+		x = x + 7919;
+		u = u + 1234567;
+		l = l * 3 + 1;
+	}
+	return acc % 256 + 216;
+}
@@ -0,0 +1,18 @@
+int main(int argc, char **argv)
+{
+	int a = 0;
+	int b = 0;
+	int k;
+	for (k = 0; k < 100; k = k + 1) {
+		if (k % 3 == 0) {
+			if (k % 5 == 0)
+				a = a + 1;
+			else
+				a = a - 1;
+		} else {
+			b = 0;
+		}
+		b = b + a;
+	}
+	return a + b + 59;
+}
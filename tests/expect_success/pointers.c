@@ -0,0 +1,16 @@
+int main(int argc, char **argv)
+{
+	long a = 5;
+	long *p = &a;
+	long *q = p + 1;
+	char c = 7;
+	char *s = &c;
+	int i = 0;
+	int k;
+	for (k = 0; k < 4; k = k + 1) {
+		*(p + i) = *(q - 1 + i) * 2 + *(p + i);
+		*(s + i) = *(s + i) + 1;
+		i = i * k;
+	}
+	return a - 405 + c - 11;
+}
@@ -0,0 +1,19 @@
+int main(int argc, char **argv)
+{
+	int a = 3;
+	int b = 5;
+	int c = 7;
+	int d = 11;
+	int k;
+	for (k = 0; k < 50; k = k + 1) {
+		a = a * b + c;
+		b = b * c - d;
+		c = c * d + a;
+		d = d * a - b;
+		a = a % 1009;
+		b = b % 1013;
+		c = c % 1019;
+		d = d % 1021;
+	}
+	return a + b + c + d - 2157;
+}
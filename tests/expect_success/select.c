@@ -0,0 +1,27 @@
+int main(int argc, char **argv)
+{
+	int x = -1000;
+	unsigned int u = 0;
+	int m = 0;
+	int n = 0;
+	int acc = 0;
+	int k;
+	for (k = 0; k < 300; k = k + 1) {
+		if (x > 50)
+			m = 7;
+		else
+			m = 3;
+		if (u < 1000)
+			n = x;
+		else
+			n = k;
+		if (k % 3 < 1)
+			acc = acc + x;
+		else
+			acc = acc - 1;
+		acc = acc + m + n + (x == k);
+		x = x + 37;
+		u = u + 123457;
+	}
+	return acc % 256 - 236;
+}
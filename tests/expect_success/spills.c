@@ -0,0 +1,30 @@
+int main(int argc, char **argv)
+{
+	int i1 = 2;
+	int i2 = 16;
+	int i3 = 0;
+	int i4 = 68034096;
+	int i5 = 123457;
+	int i6 = 100;
+	int i7 = 7;
+	unsigned u0 = 0;
+	unsigned u1 = 3;
+	unsigned u2 = 37;
+	unsigned u3 = 294502670;
+	int acc = 0;
+	int t = 0;
+	int k;
+	for (k = 0; k < 18; k = k + 1) {
+		if (u2 <= ((u0 ^ u3) / 125)) {
+			if (i5 & 1)
+				i3 = (i7 | (i2 / 10));
+			if (u2 != u1) {
+				u1 = (u1 % (u2 | 1));
+			}
+		}
+		i3 = (((~i1) - 1122811584) != ((~(i6 - i3)) ^ 641));
+		acc = acc + i4;
+		acc = acc ^ t;
+	}
+	return acc - 1224613728;
+}
@@ -0,0 +1,36 @@
+int main(int argc, char **argv)
+{
+	int i0 = 993853330;
+	int i1 = 1098814383;
+	int i2 = 1706728761;
+	unsigned u0 = 16;
+	unsigned u1 = 37;
+	unsigned u3 = 7;
+	unsigned u4 = 5;
+	long l0 = 0;
+	long l1 = 121739162;
+	long l2 = 0;
+	long l3 = 3;
+	long l4 = 7;
+	int acc = 0;
+	int t = 0;
+	int k;
+	int *p = &i1;
+	for (k = 0; k < 29; k = k + 1) {
+		if (u1 >= u0)
+			u4 = (((u3 ^ 16) * (37 << 3)) % 65536);
+		i2 = (((i2 / 100) > (i2 * i0)) >> 12);
+		i0 = i1;
+		*p = *p + i2;
+		u0 = u1;
+		if (l0 < 2147483647)
+			l0 = l0 + 1;
+		acc = acc ^ t;
+		t = l1;
+		t = l2;
+		t = l3;
+		t = l4;
+		acc = acc ^ t;
+	}
+	return acc - 7;
+}